@@ -28,6 +28,12 @@ def subp_kishu_commit(notebook_key, message, cookies, queue):
     queue.put(into_json(commit_result))
 
 
+def subp_kishu_metrics(notebook_key, cookies, queue):
+    with JupyterRuntimeEnv.context(cookies=cookies):
+        metrics_result = KishuCommand.metrics(notebook_key)
+    queue.put(into_json(metrics_result))
+
+
 class InitHandler(APIHandler):
     @tornado.gen.coroutine
     @tornado.web.authenticated
@@ -111,6 +117,31 @@ class CommitHandler(APIHandler):
         self.finish(commit_result)
 
 
+class MetricsHandler(APIHandler):
+    @tornado.gen.coroutine
+    @tornado.web.authenticated
+    def post(self):
+        input_data = self.get_json_body()
+        cookies = {morsel.key: morsel.value for _, morsel in self.cookies.items()}
+        notebook_key = NotebookId.parse_key_from_path_or_key(input_data["notebook_path"])
+
+        # KishuCommand.metrics looks up the kernel through the Jupyter Server API, so it runs in a separate process
+        # to not block the Jupyter Server backend.
+        metrics_queue = multiprocessing.Queue()
+        metrics_process = multiprocessing.Process(
+            target=subp_kishu_metrics,
+            args=(notebook_key, cookies, metrics_queue)
+        )
+        metrics_process.start()
+        while metrics_queue.empty():
+            # Awaiting to unblock.
+            yield asyncio.sleep(0.5)
+        metrics_result = metrics_queue.get()
+        metrics_process.join()
+
+        self.finish(metrics_result)
+
+
 def setup_handlers(web_app):
     host_pattern = ".*$"
     base_url = web_app.settings["base_url"]
@@ -120,5 +151,6 @@ def setup_handlers(web_app):
         (url_path_join(kishu_url, "log_all"), LogAllHandler),
         (url_path_join(kishu_url, "checkout"), CheckoutHandler),
         (url_path_join(kishu_url, "commit"), CommitHandler),
+        (url_path_join(kishu_url, "metrics"), MetricsHandler),
     ]
     web_app.add_handlers(host_pattern, handlers)
@@ -0,0 +1,20 @@
+# Benchmarks the native extensions (tests/benchmarks) built as a variant of setup.py (release, debug or pgo),
+# saving the run under the variant's name and failing if a benchmark's mean time regressed by more than 10%
+# against the previous saved run. For example, `sh benchmark.sh debug && sh benchmark.sh release` compares the
+# optimized build against the debug one.
+# Usage: sh benchmark.sh [variant]
+
+variant="${1:-release}"
+if [ "$variant" = pgo ]; then
+    # Train the profile-guided build on the benchmark workloads, running each once.
+    rm -rf build/pgo
+    KISHU_BUILD=pgo-generate python setup.py build_ext --inplace --force
+    pytest tests/benchmarks --run-benchmark --benchmark-disable
+    KISHU_BUILD=pgo-use python setup.py build_ext --inplace --force
+else
+    KISHU_BUILD="$variant" python setup.py build_ext --inplace --force
+fi
+
+pytest tests/benchmarks --run-benchmark --benchmark-only \
+    --benchmark-save="$variant" --benchmark-compare --benchmark-compare-fail=mean:10% \
+    --benchmark-columns=mean,stddev,ops,rounds --benchmark-group-by=group,param:workload
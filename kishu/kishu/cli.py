@@ -346,6 +346,21 @@ def status(
     print(into_json(KishuCommand.status(notebook_key, commit_id)))
 
 
+@kishu_app.command()
+@print_clean_errors
+def metrics(
+    notebook_path_or_key: str = typer.Argument(
+        ...,
+        help="Path to the target notebook or Kishu notebook key.",
+        show_default=False
+    ),
+) -> None:
+    """
+    Show the time spent by Kishu in each phase of the recent cells, and its native counters.
+    """
+    print(into_json(KishuCommand.metrics(notebook_path_or_key)))
+
+
 @kishu_app.command()
 @print_clean_errors
 def commit(
@@ -24,6 +24,7 @@ from kishu.jupyterint import (
 from kishu.jupyter.namespace import Namespace
 from kishu.jupyter.runtime import JupyterRuntimeEnv
 from kishu.notebook_id import NotebookId
+from kishu.planning.metrics import CellMetrics
 from kishu.storage.config import Config
 from kishu.storage.branch import BranchRow, HeadBranch, KishuBranch
 from kishu.storage.commit import CommitEntry, FormattedCell, KishuCommit
@@ -152,6 +153,14 @@ class CommitResult:
         )
 
 
+@dataclass_json
+@dataclass
+class MetricsResult:
+    status: str
+    message: str
+    cells: List[CellMetrics]  # Oldest first, empty unless status is OK
+
+
 @dataclass
 class CommitSummary:
     commit_id: str
@@ -420,6 +429,34 @@ class KishuCommand:
             reattachment=instrument_result
         )
 
+    @staticmethod
+    def metrics(notebook_path_or_key: str) -> MetricsResult:
+        notebook_path = NotebookId.parse_path_from_path_or_key(notebook_path_or_key)
+        try:
+            kernel_id = JupyterRuntimeEnv.kernel_id_from_notebook(notebook_path)
+        except FileNotFoundError as e:
+            return MetricsResult(
+                status="error",
+                message=f"{type(e).__name__}: {str(e)}",
+                cells=[],
+            )
+
+        # Metrics are only collected by the running instrumentation, so it is not reattached.
+        if not KishuCommand._is_notebook_attached(kernel_id):
+            return MetricsResult(
+                status="error",
+                message="Kishu instrumentation is not attached to the notebook kernel",
+                cells=[],
+            )
+        result = JupyterConnection(kernel_id).execute_one_command("_kishu.metrics()")
+        if result.status != "ok":
+            return MetricsResult(status=result.status, message=result.message, cells=[])
+        return MetricsResult(
+            status="ok",
+            message="",
+            cells=[CellMetrics(**cell) for cell in json.loads(result.message)],
+        )
+
     @staticmethod
     def edit_commit(
         notebook_path_or_key: str,
@@ -1,6 +1,43 @@
 from __future__ import annotations
 
-from typing import Any, Dict, List, Optional, Set, Tuple
+from typing import Any, Callable, Dict, List, Optional, Set, Tuple
+
+
+def _loaded_value(obj: Any) -> Any:
+    return obj
+
+
+class LazyVariable:
+    """
+        Placeholder of a restored variable, loaded from its snapshot on first access through a namespace.
+        The variables of a snapshot share load_snapshot, which must return the same dictionary on every call
+        so that objects shared between them stay shared.
+    """
+    def __init__(self, name: str, load_snapshot: Callable[[], Dict[str, Any]]) -> None:
+        self.name = name
+        self._load_snapshot = load_snapshot
+
+    def load(self) -> Any:
+        return self._load_snapshot()[self.name]
+
+    def shares_snapshot(self, other: LazyVariable) -> bool:
+        return self._load_snapshot is other._load_snapshot
+
+    def __reduce__(self):
+        # Pickle the variable rather than the placeholder.
+        return (_loaded_value, (self.load(), ))
+
+    def __repr__(self) -> str:
+        return f"{self.__class__.__name__}(name={self.name})"
+
+
+def load_lazy_variables(user_ns: Dict[str, Any]) -> None:
+    """
+        Replaces the lazy variables of user_ns with their values, e.g., before running code on it.
+    """
+    for name, obj in list(dict.items(user_ns)):
+        if isinstance(obj, LazyVariable):
+            dict.__setitem__(user_ns, name, obj.load())
 
 
 class TrackedNamespace(dict):
@@ -16,7 +53,38 @@ class TrackedNamespace(dict):
     def __getitem__(self, name: str) -> Any:
         if name in self and self.track_access_assign:
             self._accessed_vars.add(name)
-        return dict.__getitem__(self, name)
+        return self.get_untracked(name)
+
+    def get_untracked(self, name: str) -> Any:
+        """
+            Gets a variable without recording the access, loading it if it is lazy. The other variables of its
+            snapshot are loaded with it, so that they are tracked together from then on.
+        """
+        obj = dict.__getitem__(self, name)
+        if isinstance(obj, LazyVariable):
+            for other_name, other in list(dict.items(self)):
+                if isinstance(other, LazyVariable) and other.shares_snapshot(obj):
+                    dict.__setitem__(self, other_name, other.load())
+            obj = dict.__getitem__(self, name)
+        return obj
+
+    def is_lazy(self, name: str) -> bool:
+        """
+            Whether a variable is a LazyVariable which has not been loaded yet.
+        """
+        return isinstance(dict.get(self, name), LazyVariable)
+
+    def get(self, name: str, default: Any = None) -> Any:
+        return self.get_untracked(name) if dict.__contains__(self, name) else default
+
+    def values(self):
+        # Hand out the variables rather than their placeholders.
+        load_lazy_variables(self)
+        return dict.values(self)
+
+    def items(self):
+        load_lazy_variables(self)
+        return dict.items(self)
 
     def __setitem__(self, name: str, obj: Any) -> None:
         if not self._assigned_vars:
@@ -64,7 +132,7 @@ class Namespace:
         return key in self._tracked_namespace
 
     def __getitem__(self, key) -> Any:
-        return dict(self._tracked_namespace.items())[key]
+        return self._tracked_namespace.get_untracked(key)
 
     def __delitem__(self, key) -> Any:
         del self._tracked_namespace[key]
@@ -79,14 +147,19 @@ class Namespace:
         return self._tracked_namespace
 
     def keyset(self) -> Set[str]:
-        return set(varname for varname, _ in filter(Namespace.no_ipython_var, self._tracked_namespace.items()))
+        # Lazy variables are not loaded by listing them.
+        return set(varname for varname, _ in filter(Namespace.no_ipython_var, dict.items(self._tracked_namespace)))
 
     def to_dict(self) -> Dict[str, Any]:
-        return {k: v for k, v in filter(Namespace.no_ipython_var, self._tracked_namespace.items())}
+        return {k: self._tracked_namespace.get_untracked(k)
+                for k, _ in filter(Namespace.no_ipython_var, dict.items(self._tracked_namespace))}
 
     def update(self, other: Namespace):
-        # Need to filter with other.to_dict() to not replace ipython variables.
-        self._tracked_namespace.update(other.to_dict())
+        # Need to filter with no_ipython_var to not replace ipython variables. Lazy variables stay lazy.
+        self._tracked_namespace.update(filter(Namespace.no_ipython_var, dict.items(other._tracked_namespace)))
+
+    def is_lazy(self, key) -> bool:
+        return self._tracked_namespace.is_lazy(key)
 
     def accessed_vars(self) -> Set[str]:
         return set(name for name in self._tracked_namespace.accessed_vars() if Namespace.no_ipython_var((name, None)))
@@ -53,7 +53,7 @@ import time
 import uuid
 import sys
 
-from dataclasses import dataclass
+from dataclasses import asdict, dataclass
 from IPython.core.interactiveshell import InteractiveShell
 from jupyter_ui_poll import run_ui_poll_loop
 from pathlib import Path
@@ -72,11 +72,12 @@ from kishu.jupyter.namespace import Namespace
 from kishu.jupyter.runtime import JupyterRuntimeEnv
 from kishu.notebook_id import NotebookId
 from kishu.planning.ahg import AHG, VersionedName
+from kishu.planning.metrics import CHECKPOINT_WRITE
 from kishu.planning.plan import RestorePlan
 from kishu.planning.planner import CheckpointRestorePlanner, ChangedVariables
 from kishu.planning.variable_version_tracker import VariableVersionTracker
 from kishu.storage.branch import KishuBranch
-from kishu.storage.checkpoint import KishuCheckpoint
+from kishu.storage.checkpoint import CheckpointWriter, KishuCheckpoint
 from kishu.storage.commit import CommitEntry, CommitEntryKind, FormattedCell, KishuCommit
 from kishu.storage.commit_graph import KishuCommitGraph
 from kishu.storage.config import Config
@@ -561,6 +562,7 @@ class KishuForJupyter:
         self._start_time = None
 
         self._commit_entry(entry, changed_vars)
+        self._cr_planner.get_metrics().end_cell(entry.execution_count)
 
     @staticmethod
     def kishu_sessions() -> List[KishuSession]:
@@ -635,8 +637,15 @@ class KishuForJupyter:
         entry.message = message if message is not None else f"Manual commit after {entry.execution_count} executions."
         self.save_notebook()
         self._commit_entry(entry)
+        self._cr_planner.get_metrics().end_cell()
         return BareReprStr(entry.commit_id)
 
+    def metrics(self) -> BareReprStr:
+        """
+        Returns the per-cell breakdown of the time spent by Kishu (see CellMetrics) as a JSON list, oldest first.
+        """
+        return BareReprStr(json.dumps([asdict(cell) for cell in self._cr_planner.get_metrics().cells()]))
+
     def _commit_entry(self, entry: CommitEntry, changed_vars: Optional[ChangedVariables] = None) -> None:
         # Generate commit ID.
         entry.commit_id = self._commit_id()
@@ -700,8 +709,12 @@ class KishuForJupyter:
 
         # Step 2: checkpoint
         start = time.time()
-        checkpoint_plan.run(self._user_ns)
+        with self._cr_planner.get_metrics().phase(CHECKPOINT_WRITE):
+            checkpoint_plan.run(self._user_ns)
         self._cr_planner.write_row("checkpoint-time", time.time() - start)
+        writer_metrics = CheckpointWriter.metrics()
+        self._cr_planner.write_row("checkpoint-queue-depth", writer_metrics.queue_depth)
+        self._cr_planner.write_row("checkpoint-lag", writer_metrics.lag_s)
         try:
             self._cr_planner.write_row("commit-table-size", self.total_commit_size + sys.getsizeof(self._cr_planner._ahg.serialize()))
         except Exception as e:
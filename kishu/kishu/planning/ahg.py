@@ -209,7 +209,7 @@ class AHG:
         self._active_variable_snapshots = {k: v for k, v in self._active_variable_snapshots.items()
                                            if not k.intersection(modified_variables)}
 
-        output_vss_delete = [VariableSnapshot(frozenset(k), version, False) for k in deleted_variables]
+        output_vss_delete = [VariableSnapshot(frozenset({k}), version, False) for k in deleted_variables]
 
         # Add the newly created CE to the graph.
         self.add_cell_execution(cell, cell_runtime_s, input_vss, output_vss_create + output_vss_modify + output_vss_delete)
@@ -223,6 +223,31 @@ class AHG:
         #REVISION-----
         # self._variable_snapshots += output_vss_create + output_vss_modify + output_vss_delete
 
+    def add_modified_variables(self, version: int, modified_variables: Set[str]) -> None:
+        """
+            Records variables found modified after the last cell execution was added, e.g., by hashing them in full at
+            checkpoint time, as modified by it: the last cell execution accesses their active VSes and outputs new ones.
+
+            @param version: Version number of newly created VSes.
+            @param modified_variables: set of modified variables.
+        """
+        if not self._cell_executions:
+            return
+        ce = self._cell_executions[-1]
+
+        # VSes already output by the last cell execution are up to date.
+        modified_vss = [vs for vs in self._active_variable_snapshots.values()
+                        if vs.name.intersection(modified_variables) and vs.output_ce is not ce]
+        for vs in modified_vss:
+            new_vs = VariableSnapshot(frozenset(vs.name), version, False)
+            if not any(src_vs is vs for src_vs in ce.src_vss):
+                ce.src_vss.append(vs)
+                vs.input_ces.append(ce)
+            ce.dst_vss.append(new_vs)
+            new_vs.output_ce = ce
+            self._active_variable_snapshots[new_vs.name] = new_vs
+            self._variable_snapshots[VersionedName(new_vs.name, new_vs.version)] = new_vs
+
     def get_cell_executions(self) -> List[CellExecution]:
         return self._cell_executions
 
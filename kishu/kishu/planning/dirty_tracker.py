@@ -0,0 +1,57 @@
+"""
+Dirty set of the variables of a namespace, from dict and type watchers (CPython 3.12+).
+"""
+from typing import Any, Dict, Iterable, Set
+
+try:
+    # Native watchers, built with the C extensions in lib/.
+    import c_dirty_tracker
+except ImportError:
+    c_dirty_tracker = None
+
+
+class DirtyTracker:
+    """
+        Tracks which variables of a namespace may have been modified. A variable is tracked if all objects reachable
+        from it are dicts, types or immutable builtins (see lib/dirtytrackermodule.c); it is then only possibly
+        modified after writes to its namespace entry or to one of its dicts or types. Variables that are not tracked,
+        and all variables without watcher support, are always possibly modified.
+    """
+    def __init__(self, user_ns: Dict[str, Any], enabled: bool = True) -> None:
+        """
+            @param user_ns  Namespace dict of the variables.
+            @param enabled  Whether to track variables if watchers are supported.
+        """
+        self._tracker = None
+        if enabled and c_dirty_tracker is not None and c_dirty_tracker.watchers_available():
+            self._tracker = c_dirty_tracker.create(user_ns)
+
+    def is_enabled(self) -> bool:
+        return self._tracker is not None
+
+    def track(self, name: str, obj: Any) -> bool:
+        """
+            Tracks the current value of a variable, e.g., after computing its ID graph.
+            @return  True if the variable is tracked.
+        """
+        if self._tracker is None:
+            return False
+        return c_dirty_tracker.track(self._tracker, name, obj)
+
+    def untrack(self, name: str) -> None:
+        if self._tracker is not None:
+            c_dirty_tracker.untrack(self._tracker, name)
+
+    def possibly_modified(self, names: Iterable[str]) -> Set[str]:
+        """
+            Filters variables by whether they may have been modified since the last call, which resets the dirty set.
+            @param names  Variables to filter.
+            @return  The variables among names which are dirty or not tracked.
+        """
+        names = set(names)
+        if self._tracker is None:
+            return names
+        dirty = c_dirty_tracker.pop_dirty(self._tracker)
+        if dirty is None:
+            return names
+        return {name for name in names if name in dirty or not c_dirty_tracker.is_tracked(self._tracker, name)}
@@ -18,6 +18,8 @@ from matplotlib.contour import QuadContourSet
 from typing import Any, List, Optional, Set
 from types import GeneratorType, FunctionType
 
+from kishu.planning.sampled_hash import ArrayHasher
+
 
 PRIMITIVES = (type(None), int, float, bool, str, bytes)
 
@@ -150,7 +152,13 @@ def value_equals(idGraph1: GraphNode, idGraph2: GraphNode):
     return GraphNode._compare_idgraph(idGraph1, idGraph2, check_id_obj=False)
 
 
-def get_object_state(obj, visited: dict, include_id=True, first_creation=False) -> GraphNode:
+def get_object_state(
+    obj,
+    visited: dict,
+    include_id=True,
+    first_creation=False,
+    array_hasher: Optional[ArrayHasher] = None
+) -> GraphNode:
     if id(obj) in visited.keys():
         return visited[id(obj)]
 
@@ -163,7 +171,7 @@ def get_object_state(obj, visited: dict, include_id=True, first_creation=False)
     elif isinstance(obj, tuple):
         node = GraphNode(obj_type=type(obj))
         for item in obj:
-            child = get_object_state(item, visited, include_id, first_creation)
+            child = get_object_state(item, visited, include_id, first_creation, array_hasher)
             node.children.append(child)
 
         node.children.append("/EOC")
@@ -176,7 +184,7 @@ def get_object_state(obj, visited: dict, include_id=True, first_creation=False)
             node.id_obj = id(obj)
 
         for item in obj:
-            child = get_object_state(item, visited, include_id, first_creation)
+            child = get_object_state(item, visited, include_id, first_creation, array_hasher)
             node.children.append(child)
 
         node.children.append("/EOC")
@@ -188,7 +196,7 @@ def get_object_state(obj, visited: dict, include_id=True, first_creation=False)
         if include_id:
             node.id_obj = id(obj)
         for item in obj:
-            child = get_object_state(item, visited, include_id, first_creation)
+            child = get_object_state(item, visited, include_id, first_creation, array_hasher)
             node.children.append(child)
 
         node.children.append("/EOC")
@@ -201,9 +209,9 @@ def get_object_state(obj, visited: dict, include_id=True, first_creation=False)
             node.id_obj = id(obj)
 
         for key, value in obj.items():
-            child = get_object_state(key, visited, include_id, first_creation)
+            child = get_object_state(key, visited, include_id, first_creation, array_hasher)
             node.children.append(child)
-            child = get_object_state(value, visited, include_id, first_creation)
+            child = get_object_state(value, visited, include_id, first_creation, array_hasher)
             node.children.append(child)
 
         node.children.append("/EOC")
@@ -264,7 +272,7 @@ def get_object_state(obj, visited: dict, include_id=True, first_creation=False)
 
         node.children.append(cloudpickle.dumps(obj))
         if hasattr(obj, 'tree_'):
-            child = get_object_state(obj.tree_, visited, include_id, first_creation)
+            child = get_object_state(obj.tree_, visited, include_id, first_creation, array_hasher)
             node.children.append(child)
         node.children.append("/EOC")
         return node
@@ -279,7 +287,9 @@ def get_object_state(obj, visited: dict, include_id=True, first_creation=False)
 
         node.children.append(cloudpickle.dumps(obj))
         for item in obj.axes:
-            child = get_object_state(item, visited, include_id=False, first_creation=first_creation)
+            child = get_object_state(
+                item, visited, include_id=False, first_creation=first_creation, array_hasher=array_hasher
+            )
             node.children.append(child)
         node.children.append("/EOC")
         return node
@@ -307,9 +317,14 @@ def get_object_state(obj, visited: dict, include_id=True, first_creation=False)
             node.id_obj = id(obj)
             visited[id(obj)] = node
 
-            h = xxhash.xxh3_128()
-            h.update(numpy.ascontiguousarray(obj.data))
-            node.children.append(h.intdigest())
+            if array_hasher is None:
+                h = xxhash.xxh3_128()
+                h.update(numpy.ascontiguousarray(obj.data))
+                node.children.append(h.intdigest())
+            else:
+                # Arrays left unhashed because the hashing budget ran out are considered modified.
+                digest = array_hasher.hash_array(obj)
+                node.children.append(digest if digest is not None else uuid.uuid4().hex)
             node.children.append("/EOC")
             return node
         except:
@@ -323,9 +338,14 @@ def get_object_state(obj, visited: dict, include_id=True, first_creation=False)
             visited[id(obj)] = node
     
             # create hash
-            h = xxhash.xxh3_128()
-            h.update(numpy.ascontiguousarray(obj.data))
-            node.children.append(h.intdigest())
+            if array_hasher is None:
+                h = xxhash.xxh3_128()
+                h.update(numpy.ascontiguousarray(obj.data))
+                node.children.append(h.intdigest())
+            else:
+                # Arrays left unhashed because the hashing budget ran out are considered modified.
+                digest = array_hasher.hash_array(obj.data)
+                node.children.append(digest if digest is not None else uuid.uuid4().hex)
             node.children.append("/EOC")
             return node
         except:
@@ -382,7 +402,9 @@ def get_object_state(obj, visited: dict, include_id=True, first_creation=False)
                     return node
     
                 for item in reduced[1:]:
-                    child = get_object_state(item, visited, include_id=False, first_creation=first_creation)
+                    child = get_object_state(
+                        item, visited, include_id=False, first_creation=first_creation, array_hasher=array_hasher
+                    )
                     node.children.append(child)
                 node.children.append("/EOC")
             except:
@@ -406,7 +428,9 @@ def get_object_state(obj, visited: dict, include_id=True, first_creation=False)
                     return node
     
                 for item in reduced[1:]:
-                    child = get_object_state(item, visited, include_id=False, first_creation=first_creation)
+                    child = get_object_state(
+                        item, visited, include_id=False, first_creation=first_creation, array_hasher=array_hasher
+                    )
                     node.children.append(child)
     
                 node.children.append("/EOC")
@@ -425,7 +449,9 @@ def get_object_state(obj, visited: dict, include_id=True, first_creation=False)
 
         for attr_name, attr_value in obj.__getstate__().items():
             node.children.append(attr_name)
-            child = get_object_state(attr_value, visited, include_id=False, first_creation=first_creation)
+            child = get_object_state(
+                attr_value, visited, include_id=False, first_creation=first_creation, array_hasher=array_hasher
+            )
             node.children.append(child)
 
         node.children.append("/EOC")
@@ -439,7 +465,7 @@ def get_object_state(obj, visited: dict, include_id=True, first_creation=False)
 
         for attr_name, attr_value in obj.__dict__.items():
             node.children.append(attr_name)
-            child = get_object_state(attr_value, visited, first_creation=first_creation)
+            child = get_object_state(attr_value, visited, first_creation=first_creation, array_hasher=array_hasher)
             node.children.append(child)
 
         node.children.append("/EOC")
@@ -0,0 +1,129 @@
+"""
+Per-cell breakdown of the time Kishu adds to cell executions, with the counters of the native extensions.
+"""
+from __future__ import annotations
+
+import time
+
+from collections import deque
+from contextlib import contextmanager
+from dataclasses import dataclass, field
+from typing import Deque, Dict, Iterator, List, Optional
+
+try:
+    # Native instrumentation, built with the C extensions in lib/.
+    import c_idgraph
+except ImportError:
+    c_idgraph = None
+try:
+    import VisitorModule
+except ImportError:
+    VisitorModule = None
+
+
+# Phases of a cell, in the order they run.
+PRE_RUN = "pre_run"
+HASH = "hash"
+COMPARE = "compare"
+LINKED_VAR = "linked_var"
+OPTIMIZER = "optimizer"
+CHECKPOINT_WRITE = "checkpoint_write"
+PHASES = [PRE_RUN, HASH, COMPARE, LINKED_VAR, OPTIMIZER, CHECKPOINT_WRITE]
+
+# Number of cells whose metrics are kept.
+DEFAULT_HISTORY = 100
+
+
+def native_stats() -> Dict[str, int]:
+    """
+        Counters and timers of the native extensions since they were loaded (see lib/stats_c.h), keyed by
+        "<module>.<name>". Extensions which are not built are left out.
+    """
+    stats: Dict[str, int] = {}
+    for module in (VisitorModule, c_idgraph):
+        if module is not None:
+            stats.update({f"{module.__name__}.{name}": value for name, value in module.get_stats().items()})
+    return stats
+
+
+@dataclass
+class CellMetrics:
+    """
+        Time spent by Kishu in each phase of a cell, excluding the time of the phases nested in it, and the native
+        counters accumulated meanwhile.
+    """
+    execution_count: Optional[int]  # None for commits outside of cell executions.
+    phase_ns: Dict[str, int] = field(default_factory=lambda: {phase: 0 for phase in PHASES})
+    native: Dict[str, int] = field(default_factory=dict)
+
+    def total_ns(self) -> int:
+        return sum(self.phase_ns.values())
+
+
+class PlannerMetrics:
+    """
+        Aggregates the phase timers of the planner into per-cell breakdowns. A cell spans from begin_cell (or its
+        first phase) to end_cell, e.g., from the pre-run hook to the end of its checkpoint.
+    """
+    def __init__(self, history: int = DEFAULT_HISTORY) -> None:
+        """
+            @param history  Number of finished cells to keep.
+        """
+        self._cells: Deque[CellMetrics] = deque(maxlen=history)
+        self._current: Optional[CellMetrics] = None
+        self._native_start: Dict[str, int] = {}
+
+        # (phase, start time, time of the nested phases) of the running phases, innermost last.
+        self._running: List[List] = []
+
+    def begin_cell(self) -> None:
+        """
+            Starts the metrics of a new cell, finishing the current one if any.
+        """
+        if self._current is not None:
+            self.end_cell()
+        self._current = CellMetrics(execution_count=None)
+        self._native_start = native_stats()
+
+    @contextmanager
+    def phase(self, name: str) -> Iterator[None]:
+        """
+            Times a phase of the current cell with a monotonic clock. The time of a phase nested in another one only
+            counts for the inner phase, so the phases of a cell add up to its total.
+            @param name  One of PHASES.
+        """
+        if self._current is None:
+            self.begin_cell()
+        cell = self._current
+        running = [name, time.monotonic_ns(), 0]
+        self._running.append(running)
+        try:
+            yield
+        finally:
+            self._running.pop()
+            elapsed = time.monotonic_ns() - running[1]
+            if cell is not None:
+                cell.phase_ns[name] = cell.phase_ns.get(name, 0) + elapsed - running[2]
+            if self._running:
+                self._running[-1][2] += elapsed
+
+    def end_cell(self, execution_count: Optional[int] = None) -> Optional[CellMetrics]:
+        """
+            Finishes the metrics of the current cell.
+            @param execution_count  Execution count of the cell, None for commits outside of cell executions.
+            @return  The metrics of the cell, or None without a current cell.
+        """
+        cell = self._current
+        if cell is None:
+            return None
+        cell.execution_count = execution_count
+        cell.native = {name: value - self._native_start.get(name, 0) for name, value in native_stats().items()}
+        self._cells.append(cell)
+        self._current = None
+        return cell
+
+    def cells(self) -> List[CellMetrics]:
+        """
+            @return  The metrics of the finished cells, oldest first.
+        """
+        return list(self._cells)
@@ -0,0 +1,184 @@
+"""
+Min-cut solver of the optimizer's flow graphs: flow networks in compressed sparse row form, solved per connected
+component, with the cuts of unchanged components reused across commits.
+"""
+from collections import deque
+from typing import Dict, FrozenSet, Hashable, List, Optional, Set, Tuple
+
+
+class FlowNetwork:
+    """
+        Flow network in compressed sparse row (CSR) form. The arcs leaving node u are the indices
+        offsets[u] to offsets[u + 1] of heads (the node an arc points to), residuals (its residual capacity) and
+        reverse (the index of its reverse arc). Each edge adds a forward arc and a zero-capacity reverse arc.
+    """
+    def __init__(self, num_nodes: int, edges: List[Tuple[int, int, float]]) -> None:
+        self.num_nodes = num_nodes
+        self.offsets = [0] * (num_nodes + 1)
+        for u, v, _ in edges:
+            self.offsets[u + 1] += 1
+            self.offsets[v + 1] += 1
+        for u in range(num_nodes):
+            self.offsets[u + 1] += self.offsets[u]
+
+        self.heads = [0] * (2 * len(edges))
+        self.residuals = [0.0] * (2 * len(edges))
+        self.reverse = [0] * (2 * len(edges))
+        position = self.offsets[:-1]
+        for u, v, capacity in edges:
+            i, j = position[u], position[v]
+            position[u] += 1
+            position[v] += 1
+            self.heads[i], self.residuals[i], self.reverse[i] = v, capacity, j
+            self.heads[j], self.residuals[j], self.reverse[j] = u, 0.0, i
+
+    def _levels(self, source: int) -> List[int]:
+        """
+            BFS distances from source over arcs with residual capacity; -1 for unreachable nodes.
+        """
+        level = [-1] * self.num_nodes
+        level[source] = 0
+        queue = deque([source])
+        while queue:
+            u = queue.popleft()
+            for arc in range(self.offsets[u], self.offsets[u + 1]):
+                v = self.heads[arc]
+                if level[v] < 0 and self.residuals[arc] > 0:
+                    level[v] = level[u] + 1
+                    queue.append(v)
+        return level
+
+    def _augment(self, source: int, sink: int, level: List[int], current: List[int]) -> bool:
+        """
+            Pushes flow along one shortest path of the level graph, with an explicit stack of arcs. current
+            holds the next arc to try from each node; exhausted nodes are removed from the level graph.
+            Returns False once no such path is left.
+        """
+        heads, residuals, offsets = self.heads, self.residuals, self.offsets
+        path: List[int] = []
+        u = source
+        while True:
+            if u == sink:
+                flow = min(residuals[arc] for arc in path)
+                for arc in path:
+                    residuals[arc] -= flow
+                    residuals[self.reverse[arc]] += flow
+                return True
+            while current[u] < offsets[u + 1]:
+                arc = current[u]
+                v = heads[arc]
+                if residuals[arc] > 0 and level[v] == level[u] + 1:
+                    break
+                current[u] += 1
+            else:
+                # Dead end: retreat to the previous node and skip the arc leading here.
+                if u == source:
+                    return False
+                level[u] = -1
+                arc = path.pop()
+                u = heads[self.reverse[arc]]
+                current[u] += 1
+                continue
+            path.append(current[u])
+            u = heads[current[u]]
+
+    def min_cut(self, source: int, sink: int) -> List[bool]:
+        """
+            Computes a maximum flow with Dinic's algorithm. Returns whether each node is on the source side of
+            the minimum cut, i.e., reachable from source in the residual network; this is the minimal source side,
+            which is the same for every maximum flow.
+        """
+        while True:
+            level = self._levels(source)
+            if level[sink] < 0:
+                return [distance >= 0 for distance in level]
+            current = self.offsets[:-1]
+            while self._augment(source, sink, level, current):
+                pass
+
+
+# A component of a flow graph: capacities of its source edges by node, capacities of its sink edges by node
+# (None for nodes without one), and its infinite-capacity edges between the two.
+ComponentKey = Tuple[FrozenSet[Tuple[Hashable, float]], FrozenSet[Tuple[Hashable, Optional[float]]],
+                     FrozenSet[Tuple[Hashable, Hashable]]]
+
+
+class MinCutCache:
+    """
+        Source sides of the min-cuts of the components solved in the last call to solve. Commits mostly leave
+        the flow graph untouched except around the newly executed cells, so the other components are reused
+        instead of solved again.
+    """
+    def __init__(self) -> None:
+        self._cuts: Dict[ComponentKey, FrozenSet[Hashable]] = {}
+
+    def solve(
+        self,
+        source_capacities: Dict[Hashable, float],
+        sink_capacities: Dict[Hashable, float],
+        edges: Dict[Hashable, Set[Hashable]]
+    ) -> Set[Hashable]:
+        """
+            Returns the source side (without the source) of the minimum cut of a bipartite flow graph: the
+            source is connected to the nodes of source_capacities, the nodes of sink_capacities to the sink, and
+            edges connects the former to the latter with infinite capacity. Nodes of sink_capacities without
+            incoming edges are left out of the graph (and the result); edge targets without a sink capacity are
+            kept without a sink edge.
+        """
+        # Group the nodes into connected components.
+        parent: Dict[Hashable, Hashable] = {}
+
+        def find(node: Hashable) -> Hashable:
+            root = node
+            while parent.setdefault(root, root) != root:
+                root = parent[root]
+            while parent[node] != root:
+                parent[node], node = root, parent[node]
+            return root
+
+        for node in source_capacities:
+            find(node)
+        for node, targets in edges.items():
+            for target in targets:
+                parent[find(target)] = find(node)
+        components: Dict[Hashable, Tuple[List[Hashable], List[Hashable]]] = {}
+        for node in source_capacities:
+            components.setdefault(find(node), ([], []))[0].append(node)
+        for target in {target for targets in edges.values() for target in targets}:
+            components[find(target)][1].append(target)
+
+        cuts: Dict[ComponentKey, FrozenSet[Hashable]] = {}
+        source_side: Set[Hashable] = set()
+        for left, right in components.values():
+            key: ComponentKey = (
+                frozenset((node, source_capacities[node]) for node in left),
+                frozenset((node, sink_capacities.get(node)) for node in right),
+                frozenset((node, target) for node in left for target in edges.get(node, ())),
+            )
+            cut = cuts.get(key)
+            if cut is None:
+                cut = self._cuts.get(key)
+            if cut is None:
+                cut = self._solve_component(left, right, source_capacities, sink_capacities, edges)
+            cuts[key] = cut
+            source_side.update(cut)
+        self._cuts = cuts
+        return source_side
+
+    @staticmethod
+    def _solve_component(
+        left: List[Hashable],
+        right: List[Hashable],
+        source_capacities: Dict[Hashable, float],
+        sink_capacities: Dict[Hashable, float],
+        edges: Dict[Hashable, Set[Hashable]]
+    ) -> FrozenSet[Hashable]:
+        # Node 0 is the source, node 1 the sink.
+        nodes = left + right
+        index = {node: i + 2 for i, node in enumerate(nodes)}
+        flow_edges = [(0, index[node], source_capacities[node]) for node in left]
+        flow_edges.extend((index[node], index[target], float('inf'))
+                          for node in left for target in edges.get(node, ()))
+        flow_edges.extend((index[node], 1, sink_capacities[node]) for node in right if node in sink_capacities)
+        reachable = FlowNetwork(len(nodes) + 2, flow_edges).min_cut(0, 1)
+        return frozenset(node for node in nodes if reachable[index[node]])
@@ -1,12 +1,9 @@
-import networkx as nx
-import numpy as np
-
 from dataclasses import dataclass
-from networkx.algorithms.flow import shortest_augmenting_path
 from itertools import chain
 from typing import Any, Dict, FrozenSet, List, Optional, Set, Tuple
 
 from kishu.planning.ahg import AHG, CellExecution, VariableSnapshot, VersionedName, VersionedNameContext
+from kishu.planning.mincut import MinCutCache
 from kishu.storage.config import Config
 
 REALLY_FAST_BANDWIDTH_10GBPS = 10_000_000_000
@@ -33,7 +30,8 @@ class Optimizer():
     def __init__(
         self, ahg: AHG,
         active_vss: List[VariableSnapshot],
-        already_stored_vss: Optional[Dict[VersionedName, VersionedNameContext]] = None
+        already_stored_vss: Optional[Dict[VersionedName, VersionedNameContext]] = None,
+        cut_cache: Optional[MinCutCache] = None
     ) -> None:
         """
             Creates an optimizer with a migration speed estimate. The AHG and active VS fields
@@ -43,9 +41,11 @@ class Optimizer():
             @param active_vss: active Variable Snapshots at time of checkpointing.
             @param already_stored_vss: A List of Variable snapshots already stored in previous plans. They can be
                 loaded as part of the restoration plan to save restoration time.
+            @param cut_cache: Min-cuts of the flow graph of the previous commit, reused for its unchanged parts.
         """
         self.ahg = ahg
         self.active_vss = active_vss
+        self.cut_cache = cut_cache if cut_cache else MinCutCache()
 
         # Optimizer context containing flags for optimizer parameters.
         self._optimizer_context = PlannerContext(
@@ -119,40 +119,22 @@ class Optimizer():
         if self._optimizer_context.always_recompute:
             return set(), set(ce.cell_num for ce in self.ahg.get_cell_executions())
 
-        # Construct flow graph for computing mincut.
-        flow_graph = nx.DiGraph()
-
-        # Add source and sink to flow graph.
-        flow_graph.add_node("source")
-        flow_graph.add_node("sink")
-
-        # Add all active VSs as nodes, connect them with the source with edge capacity equal to migration cost.
-        for active_vs in self.active_vss:
-            active_versioned_name = VersionedName(active_vs.name, active_vs.version)
-            flow_graph.add_node(active_versioned_name)
-            flow_graph.add_edge("source", active_versioned_name, capacity=active_vs.size / self._optimizer_context.network_bandwidth)
-
-        # Add all CEs as nodes, connect them with the sink with edge capacity equal to recomputation cost.
-        for ce in self.ahg.get_cell_executions():
-            flow_graph.add_node(ce.cell_num)
-            flow_graph.add_edge(ce.cell_num, "sink", capacity=ce.cell_runtime_s)
-
-        # Connect each CE with its output variables and its prerequisite CEs.
-        for active_vs in self.active_vss:
-            for cell_num in self.req_func_mapping[active_vs.output_ce.cell_num]:
-                flow_graph.add_edge(VersionedName(active_vs.name, active_vs.version), cell_num, capacity=np.inf)
-
-        # Prune CEs which produce no active variables to speedup computation.
-        for ce in self.ahg.get_cell_executions():
-            if flow_graph.in_degree(ce.cell_num) == 0:
-                flow_graph.remove_node(ce.cell_num)
+        # Construct the flow graph for computing the mincut: the source connects to all active VSs with edge
+        # capacity equal to their migration cost, all CEs connect to the sink with edge capacity equal
+        # to their recomputation cost, and each active VS connects to its prerequisite CEs. CEs which produce
+        # no active variables are pruned.
+        migration_costs = {VersionedName(active_vs.name, active_vs.version):
+                           active_vs.size / self._optimizer_context.network_bandwidth for active_vs in self.active_vss}
+        recomputation_costs = {ce.cell_num: ce.cell_runtime_s for ce in self.ahg.get_cell_executions()}
+        prerequisites = {VersionedName(active_vs.name, active_vs.version):
+                         self.req_func_mapping[active_vs.output_ce.cell_num] for active_vs in self.active_vss}
 
-        # Solve min-cut with Ford-Fulkerson.
-        cut_value, partition = nx.minimum_cut(flow_graph, "source", "sink", flow_func=shortest_augmenting_path)
+        # Solve the min-cut of each connected component of the flow graph, if it changed since the last plan.
+        source_side = self.cut_cache.solve(migration_costs, recomputation_costs, prerequisites)
 
         # Determine the replication plan from the partition.
-        vss_to_migrate = set(partition[1]).intersection(self.active_versioned_names)
-        ces_to_recompute = set(partition[0]).intersection(set(ce.cell_num for ce in self.ahg.get_cell_executions()))
+        vss_to_migrate = self.active_versioned_names.difference(source_side)
+        ces_to_recompute = source_side.intersection(recomputation_costs)
 
         return vss_to_migrate, ces_to_recompute
 
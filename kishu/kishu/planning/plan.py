@@ -1,21 +1,26 @@
 from __future__ import annotations
 
 import atexit
-import cloudpickle
 import dill
 import functools
+import os
 import pickle
 
+from collections import deque
+from concurrent.futures import FIRST_COMPLETED, Future, ThreadPoolExecutor, wait
+from contextlib import ExitStack
 from dataclasses import dataclass, field
 from enum import IntEnum
 from IPython.core.interactiveshell import InteractiveShell
+from itertools import chain
 from queue import LifoQueue
-from typing import Any, Callable, Dict, FrozenSet, List, Optional, Set, Tuple, Union
+from typing import Any, Callable, Deque, Dict, FrozenSet, List, Optional, Set, Tuple, Union
 
 from kishu.exceptions import CommitIdNotExistError, DuplicateRestoreActionError
-from kishu.jupyter.namespace import Namespace
+from kishu.jupyter.namespace import LazyVariable, Namespace, load_lazy_variables
 from kishu.planning.ahg import VariableSnapshot, VersionedName, VersionedNameContext
-from kishu.storage.checkpoint import KishuCheckpoint
+from kishu.storage.checkpoint import CheckpointWriter, KishuCheckpoint
+from kishu.storage.config import Config
 
 
 class RestoreActionOrder(IntEnum):
@@ -44,11 +49,30 @@ class StepOrder:
         return self.cell_num < other.cell_num
 
 
+# Threads unpickling variable snapshots during restoration.
+RESTORE_THREADS = min(8, os.cpu_count() or 1)
+
+# Load actions fetched ahead of setting their variables, which are held in memory until then.
+PREFETCHED_ACTIONS = 2
+
+
 @dataclass
 class RestoreActionContext:
     shell: InteractiveShell
     checkpoint_file: str
     exec_id: str
+    lazy_load: bool = False  # Defer loading variable snapshots until their variables are accessed.
+    executor: Optional[ThreadPoolExecutor] = None  # Restore threads, shared by the load actions.
+    load_checkpoint: Optional[Callable[[], Dict[str, Any]]] = None  # Cached loader of the checkpoint of exec_id.
+
+
+def _load_checkpoint(checkpoint_file: str, exec_id: str) -> Dict[str, Any]:
+    return VarNamesToObjects.loads(KishuCheckpoint(checkpoint_file).get_checkpoint(exec_id)).object_dict
+
+
+def _load_snapshot(checkpoint_file: str, versioned_name: Tuple[VersionedName, VersionedNameContext]) -> Dict[str, Any]:
+    kishu_checkpoint = KishuCheckpoint(checkpoint_file)
+    return kishu_checkpoint.loads_variable_snapshot(kishu_checkpoint.get_variable_snapshots([versioned_name])[0])
 
 
 @dataclass
@@ -111,13 +135,22 @@ class IncrementalWriteCheckpointAction(CheckpointAction):
     """
     Stores VarNamesToObjects into database incrementally.
     """
-    def __init__(self, vses_to_store: List[VariableSnapshot], filename: str, exec_id: str) -> None:
+    def __init__(self, vses_to_store: List[VariableSnapshot], filename: str, exec_id: str,
+                 asynchronous: bool = False) -> None:
+        """
+        @param asynchronous  Only pickle the variables here and leave writing them to the CheckpointWriter.
+        """
         self.vses_to_store = vses_to_store
         self.filename = filename
         self.exec_id = exec_id
+        self.asynchronous = asynchronous
 
     def run(self, user_ns: Namespace):
-        KishuCheckpoint(self.filename).store_variable_snapshots(self.exec_id, self.vses_to_store, user_ns)
+        if self.asynchronous:
+            captured = KishuCheckpoint(self.filename).capture_variable_snapshots(self.exec_id, self.vses_to_store, user_ns)
+            CheckpointWriter.submit(self.filename, self.exec_id, captured)
+        else:
+            KishuCheckpoint(self.filename).store_variable_snapshots(self.exec_id, self.vses_to_store, user_ns)
 
 
 class CheckpointPlan:
@@ -194,14 +227,17 @@ class IncrementalCheckpointPlan:
         user_ns: Namespace,
         checkpoint_file: str,
         exec_id: str,
-        vses_to_store: List[VariableSnapshot]
+        vses_to_store: List[VariableSnapshot],
+        asynchronous: bool = False
     ):
         """
         @param user_ns  A dictionary representing a target variable namespace. In Jupyter, this
                 can be optained by `get_ipython().user_ns`.
         @param checkpoint_file  A file where checkpointed data will be stored to.
+        @param asynchronous  Write the checkpointed data in the background.
         """
-        actions = IncrementalCheckpointPlan.set_up_actions(user_ns, checkpoint_file, exec_id, vses_to_store)
+        actions = IncrementalCheckpointPlan.set_up_actions(user_ns, checkpoint_file, exec_id, vses_to_store,
+                                                           asynchronous)
         return IncrementalCheckpointPlan(checkpoint_file, actions)
 
     @classmethod
@@ -210,7 +246,8 @@ class IncrementalCheckpointPlan:
         user_ns: Namespace,
         checkpoint_file: str,
         exec_id: str,
-        vses_to_store: List[VariableSnapshot]
+        vses_to_store: List[VariableSnapshot],
+        asynchronous: bool = False
     ) -> List[CheckpointAction]:
         if user_ns is None or checkpoint_file is None:
             raise ValueError("Fields are not properly initialized.")
@@ -227,6 +264,7 @@ class IncrementalCheckpointPlan:
                 vses_to_store,
                 checkpoint_file,
                 exec_id,
+                asynchronous,
             )
         ]
 
@@ -247,8 +285,38 @@ class RestoreAction:
         """
         raise NotImplementedError("This base class must be extended.")
 
+    def reads(self) -> Optional[Set[str]]:
+        """
+        @return  The variables this action reads, or None if unknown (it may read any variable).
+        """
+        return None
+
+    def writes(self) -> Optional[Set[str]]:
+        """
+        @return  The variables this action sets, or None if unknown (it may set any variable).
+        """
+        return None
+
+
+class LoadRestoreAction(RestoreAction):
+    """
+    A base class for actions loading variables from storage. Loading is split into fetching the variables, which
+    doesn't touch the namespace and can run in the background, and setting them in the namespace.
+    """
+    def fetch(self, ctx: RestoreActionContext) -> Dict[str, Any]:
+        """
+        @return  The loaded variables by name.
+        """
+        raise NotImplementedError("This base class must be extended.")
+
+    def run(self, ctx: RestoreActionContext):
+        ctx.shell.user_ns.update(self.fetch(ctx))
+
+    def reads(self) -> Optional[Set[str]]:
+        return set()
 
-class LoadVariableRestoreAction(RestoreAction):
+
+class LoadVariableRestoreAction(LoadRestoreAction):
     """
     Load variables from a pickled file (using the dill module).
     """
@@ -269,16 +337,19 @@ class LoadVariableRestoreAction(RestoreAction):
         self.variable_names: Set[str] = set(var_names)
         self.fallback_recomputation: List[RerunCellRestoreAction] = fallback_recomputation
 
-    def run(self, ctx: RestoreActionContext):
-        """
-        @param user_ns  A target space where restored variables will be set.
-        """
+    def fetch(self, ctx: RestoreActionContext) -> Dict[str, Any]:
+        if ctx.lazy_load and ctx.load_checkpoint is not None:
+            # The checkpoint is a single pickle: the variables of all load actions share its loader, so that they
+            # are loaded together on first access and keep sharing objects.
+            return {key: LazyVariable(key, ctx.load_checkpoint) for key in self.variable_names}
+
         data: bytes = KishuCheckpoint(ctx.checkpoint_file).get_checkpoint(ctx.exec_id)
         namespace: VarNamesToObjects = VarNamesToObjects.loads(data)
-        for key, obj in namespace.items():
-            # if self.variable_names is set, limit the restoration only to those variables.
-            if key in self.variable_names:
-                ctx.shell.user_ns[key] = obj
+        # if self.variable_names is set, limit the restoration only to those variables.
+        return {key: obj for key, obj in namespace.items() if key in self.variable_names}
+
+    def writes(self) -> Optional[Set[str]]:
+        return set(self.variable_names)
 
     def __repr__(self) -> str:
         return f"{self.__class__.__name__}(step_order={self.step_order}, \
@@ -289,7 +360,7 @@ class LoadVariableRestoreAction(RestoreAction):
         return self.__repr__()
 
 
-class IncrementalLoadRestoreAction(RestoreAction):
+class IncrementalLoadRestoreAction(LoadRestoreAction):
     """
     Load variables from a pickled file (using the dill module).
     """
@@ -310,20 +381,40 @@ class IncrementalLoadRestoreAction(RestoreAction):
         self.versioned_names = versioned_names
         self.fallback_recomputation: List[RerunCellRestoreAction] = fallback_recomputation
 
-    def run(self, ctx: RestoreActionContext):
-        """
-        @param user_ns  A target space where restored variables will be set.
-        """
-        data: List[bytes] = KishuCheckpoint(ctx.checkpoint_file).get_variable_snapshots(self.versioned_names)
-        dictionaries = []
-        for i in data:
-            try:
-                dictionaries.append(cloudpickle.loads(i))
-            except:
-                dictionaries.append(dill.loads(i))
-        for dictionary in dictionaries:
-            for k, v in dictionary.items():
-                ctx.shell.user_ns[k] = v
+    def fetch(self, ctx: RestoreActionContext) -> Dict[str, Any]:
+        variables: Dict[str, Any] = {}
+        if ctx.lazy_load:
+            for vn, vnc in self.versioned_names:
+                # Cached, so that the variables of the snapshot are loaded together and keep sharing objects.
+                load_snapshot = functools.lru_cache(maxsize=None)(
+                    functools.partial(_load_snapshot, ctx.checkpoint_file, (vn, vnc)))
+                for k in vn.name:
+                    variables[k] = LazyVariable(k, load_snapshot)
+            return variables
+
+        # Snapshots are independent: stream them from the checkpoint file while earlier ones are unpickled by the
+        # restore threads. At most RESTORE_THREADS + 1 pickles of this action are held at a time.
+        kishu_checkpoint = KishuCheckpoint(ctx.checkpoint_file)
+        loaded = 0
+        pending: Deque[Future] = deque()
+        with ExitStack() as stack:
+            executor = ctx.executor
+            if executor is None:
+                executor = stack.enter_context(ThreadPoolExecutor(max_workers=RESTORE_THREADS))
+            for _, data in kishu_checkpoint.iter_variable_snapshots(self.versioned_names):
+                pending.append(executor.submit(kishu_checkpoint.loads_variable_snapshot, data))
+                if len(pending) > RESTORE_THREADS:
+                    variables.update(pending.popleft().result())
+                    loaded += 1
+            while pending:
+                variables.update(pending.popleft().result())
+                loaded += 1
+        if loaded != len(self.versioned_names):
+            raise ValueError(f"length of results {loaded} not equal to queries {len(self.versioned_names)}:")
+        return variables
+
+    def writes(self) -> Optional[Set[str]]:
+        return set(chain.from_iterable(vn.name for vn, _ in self.versioned_names))
 
     def __repr__(self) -> str:
         return f"{self.__class__.__name__}(step_order={self.step_order}, \
@@ -357,6 +448,12 @@ class MoveVariableRestoreAction(RestoreAction):
         for k, v in self.vars_to_move.to_dict().items():
             ctx.shell.user_ns[k] = v
 
+    def reads(self) -> Optional[Set[str]]:
+        return set()
+
+    def writes(self) -> Optional[Set[str]]:
+        return set(self.vars_to_move.keyset())
+
     def __repr__(self) -> str:
         return f"{self.__class__.__name__}(step_order={self.step_order}, \
         vars_to_move={list(self.vars_to_move.keyset())}"
@@ -369,24 +466,42 @@ class RerunCellRestoreAction(RestoreAction):
     """
     Load variables from a pickled file (using the dill module).
     """
-    def __init__(self, step_order: StepOrder, cell_code: str = ""):
+    def __init__(
+        self,
+        step_order: StepOrder,
+        cell_code: str = "",
+        accessed_vars: Optional[Set[str]] = None,
+        modified_vars: Optional[Set[str]] = None
+    ):
         """
         cell_num: cell number of the executed cell code.
         cell_code: cell code to rerun.
+        accessed_vars: variables the cell accessed when it was executed (see CellExecution.src_vss), None if unknown.
+        modified_vars: variables the cell created or modified (see CellExecution.dst_vss), None if unknown.
         """
         self.step_order = step_order
         self.cell_code: Optional[str] = cell_code
+        self.accessed_vars = accessed_vars
+        self.modified_vars = modified_vars
 
     def run(self, ctx: RestoreActionContext):
         """
         @param user_ns  A target space where restored variables will be set.
         """
+        # The cell may access any variable, so lazy variables can't stay lazy.
+        load_lazy_variables(ctx.shell.user_ns)
         try:
             ctx.shell.run_cell(self.cell_code)
         except Exception:
             # We don't want to raise exceptions during code rerunning as the code can contain errors.
             pass
 
+    def reads(self) -> Optional[Set[str]]:
+        return self.accessed_vars
+
+    def writes(self) -> Optional[Set[str]]:
+        return self.modified_vars
+
     def __repr__(self) -> str:
         return f"{self.__class__.__name__}(step_order={self.step_order}, cell_code={self.cell_code})"
 
@@ -397,6 +512,51 @@ class RerunCellRestoreAction(RestoreAction):
         return self.step_order == other.step_order and self.cell_code == other.cell_code
 
 
+def restore_dependencies(actions: List[RestoreAction]) -> List[Set[int]]:
+    """
+    Computes the dependencies between restore actions from the variables they read and write (see the AHG).
+
+    @param actions  Restore actions in the order they would run one after another.
+    @return  For each action, the indices of the earlier actions it must run after: the last earlier action writing
+        a variable it reads or writes, and the earlier actions reading a variable it writes. Actions whose variables
+        are unknown run after all earlier actions and before all later ones. Cell reruns share the shell, so they also
+        stay in order.
+    """
+    dependencies: List[Set[int]] = []
+    last_writer: Dict[str, int] = {}
+    readers: Dict[str, List[int]] = {}  # Readers since the last write.
+    last_barrier: Optional[int] = None
+    since_barrier: List[int] = []
+    last_rerun: Optional[int] = None
+    for index, action in enumerate(actions):
+        reads, writes = action.reads(), action.writes()
+        if reads is None or writes is None:
+            deps = set(since_barrier)
+            if last_barrier is not None:
+                deps.add(last_barrier)
+            last_barrier, since_barrier = index, []
+            last_writer.clear()
+            readers.clear()
+        else:
+            deps = {last_barrier} if last_barrier is not None else set()
+            deps.update(last_writer[name] for name in reads | writes if name in last_writer)
+            deps.update(chain.from_iterable(readers.get(name, []) for name in writes))
+            for name in reads:
+                readers.setdefault(name, []).append(index)
+            for name in writes:
+                last_writer[name] = index
+                readers[name] = []
+            since_barrier.append(index)
+
+        if isinstance(action, RerunCellRestoreAction):
+            if last_rerun is not None:
+                deps.add(last_rerun)
+            last_rerun = index
+        deps.discard(index)
+        dependencies.append(deps)
+    return dependencies
+
+
 # Idea from https://stackoverflow.com/questions/57633815/atexit-how-does-one-trigger-it-manually
 class AtExitContext:
 
@@ -433,7 +593,7 @@ class AtExitContext:
 @dataclass
 class RestorePlan:
     """
-    TODO: In the future, we will combine recomputation and data loading.
+    Loading variables overlaps with recomputation where the AHG shows they are independent (see _run_actions).
 
     @param actions  A series of actions for restoring a state.
     """
@@ -442,11 +602,22 @@ class RestorePlan:
     # TODO: add the undeserializable variables which caused fallback computation to config list.
     fallbacked_actions: List[Union[LoadVariableRestoreAction, IncrementalLoadRestoreAction]] = field(default_factory=lambda: [])
 
-    def add_rerun_cell_restore_action(self, cell_num: int, cell_code: str):
+    def add_rerun_cell_restore_action(
+        self,
+        cell_num: int,
+        cell_code: str,
+        accessed_vars: Optional[Set[str]] = None,
+        modified_vars: Optional[Set[str]] = None
+    ):
+        """
+        @param accessed_vars, modified_vars  Variables accessed and modified by the cell, which let the cell rerun
+            concurrently with loading other variables. Without them, the cell reruns after all earlier actions and
+            before all later ones.
+        """
         step_order = StepOrder(cell_num, RestoreActionOrder.RERUN_CELL)
         if step_order in self.actions:
             raise DuplicateRestoreActionError(step_order.cell_num, step_order.restore_action_order)
-        self.actions[step_order] = RerunCellRestoreAction(step_order, cell_code)
+        self.actions[step_order] = RerunCellRestoreAction(step_order, cell_code, accessed_vars, modified_vars)
 
     def add_load_variable_restore_action(
         self,
@@ -490,21 +661,88 @@ class RestorePlan:
 
         self.actions[step_order] = MoveVariableRestoreAction(step_order, vars_to_move)            
 
-    def run(self, checkpoint_file: str, exec_id: str) -> Namespace:
+    def run(self, checkpoint_file: str, exec_id: str, lazy_load: Optional[bool] = None) -> Namespace:
         """
         Performs a series of actions as specified in self.actions.
 
         @param user_ns  A target space where restored variables will be set.
         @param checkpoint_file  The file where information is stored.
+        @param lazy_load  Restore stored variables as LazyVariables, loaded on first access through the returned
+            namespace. Variables failing to load then raise on access instead of being recomputed. Defaults to
+            PLANNER.lazy_load of the config.
         """
+        if lazy_load is None:
+            lazy_load = Config.get('PLANNER', 'lazy_load', False)
         while True:
-            with AtExitContext():  # Intercept and trigger all atexit functions.
-                ctx = RestoreActionContext(InteractiveShell(), checkpoint_file, exec_id)
+            # Intercept and trigger all atexit functions.
+            with AtExitContext(), ThreadPoolExecutor(max_workers=RESTORE_THREADS) as executor:
+                ctx = RestoreActionContext(InteractiveShell(), checkpoint_file, exec_id, lazy_load, executor)
+                if lazy_load:
+                    ctx.load_checkpoint = functools.lru_cache(maxsize=None)(
+                        functools.partial(_load_checkpoint, checkpoint_file, exec_id))
+                failed_action = self._run_actions(ctx)
+                if failed_action is None:
+                    return Namespace(ctx.shell.user_ns.copy())
+
+                # If action is load variable, replace action with fallback recomputation plan
+                self.fallbacked_actions.append(failed_action)
+                del self.actions[failed_action.step_order]
+                for rerun_cell_action in failed_action.fallback_recomputation:
+                    self.actions[rerun_cell_action.step_order] = rerun_cell_action
 
-                # Run restore actions sorted by cell number, then rerun cells before loading variables.
-                for _, action in sorted(self.actions.items(), key=lambda k: k[0]):
+    def _run_actions(
+        self,
+        ctx: RestoreActionContext
+    ) -> Optional[Union[LoadVariableRestoreAction, IncrementalLoadRestoreAction]]:
+        """
+        Runs the restore actions as a DAG (see restore_dependencies) over their order by cell number, with cells
+        rerun before variables are loaded. Variables are fetched in the background from the start, and set in the
+        namespace as soon as they are fetched and their dependencies ran, so that loading them overlaps with
+        rerunning the cells which don't depend on them. Cells rerun on this thread, in the restored shell.
+
+        Load actions are fetched one at a time, in order, at most PREFETCHED_ACTIONS ahead of those whose variables
+        were set; snapshots are unpickled by the restore threads of ctx.
+
+        @return  The first load action which failed, or None if all actions ran.
+        """
+        actions = [action for _, action in sorted(self.actions.items(), key=lambda k: k[0])]
+        dependencies = restore_dependencies(actions)
+        dependents: List[List[int]] = [[] for _ in actions]
+        for index, deps in enumerate(dependencies):
+            for dep in deps:
+                dependents[dep].append(index)
+        num_waiting = [len(deps) for deps in dependencies]
+        ready = [index for index, waiting in enumerate(num_waiting) if waiting == 0]
+
+        to_fetch = deque(index for index, action in enumerate(actions) if isinstance(action, LoadRestoreAction))
+        with ThreadPoolExecutor(max_workers=1) as executor:
+            fetches: Dict[int, Future] = {}
+
+            def fetch_ahead() -> None:
+                while to_fetch and len(fetches) < PREFETCHED_ACTIONS:
+                    index = to_fetch.popleft()
+                    fetches[index] = executor.submit(actions[index].fetch, ctx)
+
+            fetch_ahead()
+            try:
+                while ready:
+                    # Prefer setting fetched variables, then rerunning cells, over waiting for fetches. The earliest
+                    # load action left is always being fetched, and the others only wait for earlier actions.
+                    index = next((i for i in ready if i in fetches and fetches[i].done()), None)
+                    if index is None:
+                        index = next((i for i in ready if not isinstance(actions[i], LoadRestoreAction)), None)
+                    if index is None:
+                        wait([fetches[i] for i in ready if i in fetches], return_when=FIRST_COMPLETED)
+                        continue
+                    ready.remove(index)
+
+                    action = actions[index]
                     try:
-                        action.run(ctx)
+                        if isinstance(action, LoadRestoreAction):
+                            ctx.shell.user_ns.update(fetches.pop(index).result())
+                            fetch_ahead()
+                        else:
+                            action.run(ctx)
                     except CommitIdNotExistError as e:
                         # Problem was caused by Kishu itself (specifically, missing file for commit ID).
                         raise e
@@ -512,11 +750,14 @@ class RestorePlan:
                         if not isinstance(action, LoadVariableRestoreAction) \
                         and not isinstance(action, IncrementalLoadRestoreAction):
                             raise e
-                        # If action is load variable, replace action with fallback recomputation plan
-                        self.fallbacked_actions.append(action)
-                        del self.actions[action.step_order]
-                        for rerun_cell_action in action.fallback_recomputation:
-                            self.actions[rerun_cell_action.step_order] = rerun_cell_action
-                        break
-                else:
-                    return Namespace(ctx.shell.user_ns.copy())
+                        return action
+
+                    for dependent in dependents[index]:
+                        num_waiting[dependent] -= 1
+                        if num_waiting[dependent] == 0:
+                            ready.append(dependent)
+                    ready.sort()
+            finally:
+                for fetch in fetches.values():
+                    fetch.cancel()
+        return None
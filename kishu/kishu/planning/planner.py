@@ -4,16 +4,20 @@ import time
 
 from collections import defaultdict
 from dataclasses import dataclass
-from itertools import chain, combinations
+from itertools import chain
 from typing import Dict, FrozenSet, List, Optional, Set, Tuple
 
 from kishu.jupyter.namespace import Namespace
 
 from kishu.planning.ahg import AHG, VersionedName
+from kishu.planning.dirty_tracker import DirtyTracker
 from kishu.planning.idgraph import GraphNode, get_object_state, value_equals
+from kishu.planning.metrics import COMPARE, HASH, LINKED_VAR, OPTIMIZER, PRE_RUN, PlannerMetrics
+from kishu.planning.mincut import MinCutCache
 from kishu.planning.optimizer import Optimizer
 from kishu.planning.plan import CheckpointPlan, IncrementalCheckpointPlan, RestorePlan
 from kishu.planning.profiler import profile_variable_size
+from kishu.planning.sampled_hash import ArrayHasher
 from kishu.storage.checkpoint import KishuCheckpoint
 from kishu.storage.config import Config
 
@@ -25,6 +29,8 @@ class PlannerContext:
     """
     incremental_store: bool
     incremental_load: bool  # Not used yet
+    async_checkpoint: bool
+    dirty_tracking: bool  # Only re-hash variables which dict and type watchers report as possibly modified.
 
 
 @dataclass
@@ -63,12 +69,31 @@ class CheckpointRestorePlanner:
         # C/R plan configs.
         self._planner_context = PlannerContext(
             incremental_store=Config.get('PLANNER', 'incremental_store', False),
-            incremental_load=Config.get('PLANNER', 'incremental_load', False)  # Not used yet
+            incremental_load=Config.get('PLANNER', 'incremental_load', False),  # Not used yet
+            async_checkpoint=Config.get('PLANNER', 'async_checkpoint', False),
+            dirty_tracking=Config.get('PLANNER', 'dirty_tracking', False)
         )
+        self._dirty_tracker = DirtyTracker(self._user_ns.get_tracked_namespace(), self._planner_context.dirty_tracking)
 
         # Used by instrumentation to compute whether data has changed.
         self._modified_vars_structure: Set[str] = set()
 
+        # Min-cuts of the last checkpoint's flow graph, reused by the optimizer of the next one.
+        self._cut_cache = MinCutCache()
+
+        # Per-cell breakdown of the time spent by Kishu.
+        self._metrics = PlannerMetrics(Config.get('PLANNER', 'metrics_history', 100))
+
+        # Hashes the data of arrays in ID graphs, sampling large ones within a time budget per cell if enabled.
+        self._array_hasher = ArrayHasher.from_config()
+
+        # Variables with arrays left unhashed in their ID graphs, hashed again at checkpoint time.
+        self._unhashed_vars: Set[str] = set()
+
+        # Variables with arrays sampled without the dirty page watcher, hashed in full at checkpoint time, mapped to
+        # their ID graphs hashed in full at the last checkpoint if any.
+        self._unwatched_vars: Dict[str, Optional[GraphNode]] = {}
+
     @staticmethod
     def from_existing(user_ns: Namespace) -> CheckpointRestorePlanner:
         return CheckpointRestorePlanner(user_ns, AHG.from_existing(user_ns))
@@ -77,13 +102,17 @@ class CheckpointRestorePlanner:
         """
             Preprocessing steps performed prior to cell execution.
         """
-        # Record variables in the user name prior to running cell.
-        self._pre_run_cell_vars = self._user_ns.keyset()
-
-        # Populate missing ID graph entries.
-        for var in self._ahg.get_variable_names():
-            if var not in self._id_graph_map and var in self._user_ns:
-                self._id_graph_map[var] = get_object_state(self._user_ns[var], {})
+        self._metrics.begin_cell()
+        self._array_hasher.begin_cell()
+        with self._metrics.phase(PRE_RUN):
+            # Record variables in the user name prior to running cell.
+            self._pre_run_cell_vars = self._user_ns.keyset()
+
+            # Populate missing ID graph entries. Lazy variables get theirs once they are loaded.
+            for var in self._ahg.get_variable_names():
+                if var not in self._id_graph_map and var in self._user_ns and not self._user_ns.is_lazy(var):
+                    self._update_id_graph(var)
+            self._end_hash_pass()
 
     def post_run_cell_update(self, code_block: Optional[str], runtime_s: Optional[float]) -> ChangedVariables:
         """
@@ -102,32 +131,52 @@ class CheckpointRestorePlanner:
         created_vars = self._user_ns.keyset().difference(self._pre_run_cell_vars)
         deleted_vars = self._pre_run_cell_vars.difference(self._user_ns.keyset())
 
-        # Find modified variables.
+        # Find modified variables. Variables which can't have been modified since their ID graph was computed are
+        # skipped.
         modified_vars_structure = set()
         modified_vars_value = set()
-        for k in filter(self._user_ns.__contains__, self._id_graph_map.keys()):
-            new_idgraph = get_object_state(self._user_ns[k], {})
-
-            # Identify objects which have changed by value. For displaying in front end.
-            if not value_equals(self._id_graph_map[k], new_idgraph):
+        possibly_modified_vars = self._dirty_tracker.possibly_modified(self._id_graph_map.keys())
+        for k in filter(self._user_ns.__contains__, possibly_modified_vars):
+            with self._metrics.phase(HASH):
+                new_idgraph = self._get_object_state(k)
+                self._dirty_tracker.track(k, self._user_ns[k])
+
+            with self._metrics.phase(COMPARE):
+                # Identify objects which have changed by value. For displaying in front end.
+                value_modified = not value_equals(self._id_graph_map[k], new_idgraph)
+                structure_modified = not self._id_graph_map[k] == new_idgraph
+            if value_modified:
                 modified_vars_value.add(k)
 
-            if not self._id_graph_map[k] == new_idgraph:
+            if structure_modified:
                 # Non-overwrite modification requires also accessing the variable.
                 if self._id_graph_map[k].is_root_id_and_type_equals(new_idgraph):
                     accessed_vars.add(k)
                 self._id_graph_map[k] = new_idgraph
                 modified_vars_structure.add(k)
 
+        # Lazy variables loaded by the cell have no ID graph to compare against, so they are considered accessed
+        # and modified.
+        loaded_vars = set(var for var in self._pre_run_cell_vars.difference(deleted_vars)
+                          if var not in self._id_graph_map and not self._user_ns.is_lazy(var))
+        for var in loaded_vars:
+            self._update_id_graph(var)
+        accessed_vars.update(loaded_vars)
+        modified_vars_structure.update(loaded_vars)
+        modified_vars_value.update(loaded_vars)
+
         # Update ID graphs for newly created variables.
         for var in created_vars:
-            self._id_graph_map[var] = get_object_state(self._user_ns[var], {})
+            self._update_id_graph(var)
+        for var in deleted_vars:
+            self._dirty_tracker.untrack(var)
+            self._unhashed_vars.discard(var)
+            self._unwatched_vars.pop(var, None)
+        self._end_hash_pass()
 
         # Find pairs of linked variables.
-        linked_var_pairs = []
-        for x, y in combinations(self._user_ns.keyset(), 2):
-            if self._id_graph_map[x].is_overlap(self._id_graph_map[y]):
-                linked_var_pairs.append((x, y))
+        with self._metrics.phase(LINKED_VAR):
+            linked_var_pairs = self._find_linked_var_pairs()
 
         # Update AHG.
         runtime_s = 0.0 if runtime_s is None else runtime_s
@@ -144,12 +193,93 @@ class CheckpointRestorePlanner:
 
         return ChangedVariables(created_vars, modified_vars_value, modified_vars_structure, deleted_vars)
 
+    def _update_id_graph(self, var: str) -> None:
+        """
+            Computes the ID graph of a variable, which is tracked for modifications from then on.
+        """
+        with self._metrics.phase(HASH):
+            self._id_graph_map[var] = self._get_object_state(var)
+            self._dirty_tracker.track(var, self._user_ns[var])
+
+    def _get_object_state(self, var: str) -> GraphNode:
+        """
+            Computes the ID graph of a variable, recording whether arrays were left unhashed in it.
+        """
+        id_graph = get_object_state(self._user_ns[var], {}, array_hasher=self._array_hasher)
+        if self._array_hasher.take_incomplete():
+            self._unhashed_vars.add(var)
+        else:
+            self._unhashed_vars.discard(var)
+        if self._array_hasher.take_unwatched():
+            self._unwatched_vars.setdefault(var, None)
+        else:
+            self._unwatched_vars.pop(var, None)
+        return id_graph
+
+    def _hash_unhashed_vars(self) -> None:
+        """
+            Falls back to hashing the arrays left unhashed when the budget of a cell ran out, without a budget, so that
+            the next cell compares against their hashes.
+        """
+        if self._unhashed_vars:
+            with self._array_hasher.unbounded():
+                for var in list(self._unhashed_vars):
+                    self._update_id_graph(var)
+        self._end_hash_pass()
+
+    def _hash_unwatched_vars_in_full(self) -> None:
+        """
+            Without the dirty page watcher, writes between the sample pages of arrays are missed. Falls back to hashing
+            the variables with sampled arrays in full, and records those which changed since the last checkpoint as
+            modified by the last cell.
+        """
+        if not self._unwatched_vars:
+            return
+        modified_vars = set()
+        with self._metrics.phase(HASH), self._array_hasher.full():
+            for var in list(self._unwatched_vars):
+                if var not in self._user_ns or self._user_ns.is_lazy(var):
+                    del self._unwatched_vars[var]
+                    continue
+                full_id_graph = get_object_state(self._user_ns[var], {}, array_hasher=self._array_hasher)
+                last_full_id_graph = self._unwatched_vars[var]
+                if last_full_id_graph is not None and not last_full_id_graph == full_id_graph:
+                    modified_vars.add(var)
+                self._unwatched_vars[var] = full_id_graph
+        if modified_vars:
+            self._ahg.add_modified_variables(time.monotonic_ns(), modified_vars)
+
+    def _end_hash_pass(self) -> None:
+        with self._metrics.phase(HASH):
+            self._array_hasher.end_pass()
+
+    def _find_linked_var_pairs(self) -> List[Tuple[str, str]]:
+        """
+            Finds pairs of variables sharing objects using an inverted index from object ID to the first
+            variable holding it. Each variable is paired with the owners of the objects it shares, which
+            spans the same connected components in the AHG as checking all pairs for overlaps, in time
+            linear in the size of the ID sets.
+        """
+        owners: Dict[int, str] = {}
+        linked_var_pairs: Dict[Tuple[str, str], None] = {}
+        for var in self._user_ns.keyset():
+            if var not in self._id_graph_map:
+                # Lazy variables are only linked to others once loaded.
+                continue
+            for obj_id in self._id_graph_map[var].id_set():
+                owner = owners.setdefault(obj_id, var)
+                if owner != var:
+                    linked_var_pairs[(owner, var)] = None
+        return list(linked_var_pairs)
+
     def generate_checkpoint_restore_plans(
         self,
         database_path: str,
         commit_id: str,
         parent_commit_ids: Optional[List[str]] = None
     ) -> Tuple[CheckpointPlan, RestorePlan]:
+        self._hash_unwatched_vars_in_full()
+
         # Retrieve active VSs from the graph. Active VSs are correspond to the latest instances/versions of each variable.
         active_vss = self._ahg.get_active_variable_snapshots()
         for vs in active_vss:
@@ -157,18 +287,22 @@ class CheckpointRestorePlanner:
                 """If manual commit made before init, pre-run cell update doesn't happen for new variables
                 so we need to add them to self._id_graph_map"""
                 if varname not in self._id_graph_map:
-                    self._id_graph_map[varname] = get_object_state(self._user_ns[varname], {})
+                    self._update_id_graph(varname)
+        self._hash_unhashed_vars()
 
-        # Profile the size of each variable defined in the current session.
+        # Profile the size of each variable defined in the current session, scaled by how much its last stored
+        # snapshot was compressed to estimate the size to transfer.
+        kishu_checkpoint = KishuCheckpoint(database_path)
         for active_vs in active_vss:
-            active_vs.size = profile_variable_size([self._user_ns[var] for var in active_vs.name])
+            active_vs.size = profile_variable_size([self._user_ns[var] for var in active_vs.name]) * \
+                kishu_checkpoint.compression_ratio(active_vs.name)
 
         # If incremental storage is enabled, retrieve list of currently stored VSes and compute VSes to
         # NOT migrate as they are already stored.
         if self._planner_context.incremental_store:
             if parent_commit_ids is None:
                 parent_commit_ids = []
-            stored_versioned_names = KishuCheckpoint(database_path).get_stored_versioned_names(parent_commit_ids)
+            stored_versioned_names = kishu_checkpoint.get_stored_versioned_names(parent_commit_ids)
             active_vss = [vs for vs in active_vss if
                           VersionedName(vs.name, vs.version) not in stored_versioned_names]
 
@@ -178,11 +312,13 @@ class CheckpointRestorePlanner:
         optimizer = Optimizer(
             self._ahg,
             active_vss,
-            stored_versioned_names if self._planner_context.incremental_store else None
+            stored_versioned_names if self._planner_context.incremental_store else None,
+            self._cut_cache
         )
 
         # Use the optimizer to compute the checkpointing configuration.
-        vss_to_migrate, ces_to_recompute = optimizer.compute_plan()
+        with self._metrics.phase(OPTIMIZER):
+            vss_to_migrate, ces_to_recompute = optimizer.compute_plan()
 
         # Sort variables to migrate based on cells they were created in.
         ce_to_vs_map = defaultdict(list)
@@ -195,7 +331,8 @@ class CheckpointRestorePlanner:
                 self._user_ns,
                 database_path,
                 commit_id,
-                list(self._ahg.get_active_variable_snapshots_dict()[vn.name] for vn in vss_to_migrate)
+                list(self._ahg.get_active_variable_snapshots_dict()[vn.name] for vn in vss_to_migrate),
+                self._planner_context.async_checkpoint
             )
 
         else:
@@ -232,7 +369,12 @@ class CheckpointRestorePlanner:
         for ce in self._ahg.get_cell_executions():
             # Add a rerun cell restore action if the cell needs to be rerun
             if ce.cell_num in ces_to_recompute:
-                restore_plan.add_rerun_cell_restore_action(ce.cell_num, ce.cell)
+                restore_plan.add_rerun_cell_restore_action(
+                    ce.cell_num,
+                    ce.cell,
+                    set(chain.from_iterable(vs.name for vs in ce.src_vss)),
+                    set(chain.from_iterable(vs.name for vs in ce.dst_vss))
+                )
 
             # Add a load variable restore action if there are variables from the cell that needs to be stored
             if len(ce_to_vs_map[ce.cell_num]) > 0:
@@ -249,6 +391,9 @@ class CheckpointRestorePlanner:
     def get_ahg(self) -> AHG:
         return self._ahg
 
+    def get_metrics(self) -> PlannerMetrics:
+        return self._metrics
+
     def get_id_graph_map(self) -> Dict[str, GraphNode]:
         """
             For testing only.
@@ -273,4 +418,7 @@ class CheckpointRestorePlanner:
         # Also clear the old ID graphs and pre-run cell info.
         # TODO: only clear ID graphs of variables which have changed between pre and post-checkout.
         self._id_graph_map = {}
-        self._pre_run_cell_vars = set()
\ No newline at end of file
+        self._pre_run_cell_vars = set()
+        self._unhashed_vars = set()
+        self._unwatched_vars = {}
+        self._dirty_tracker = DirtyTracker(self._user_ns.get_tracked_namespace(), self._planner_context.dirty_tracking)
\ No newline at end of file
@@ -0,0 +1,158 @@
+"""
+Sampled hashing of large numpy arrays for ID graphs, within a time budget per cell.
+"""
+from __future__ import annotations
+
+import numpy
+import time
+import xxhash
+
+from contextlib import contextmanager
+from typing import Iterator, Optional
+
+from kishu.storage.config import Config
+
+try:
+    # Sampled hashing is native, built with the C extensions in lib/.
+    import VisitorModule
+except ImportError:
+    VisitorModule = None
+
+
+# Defaults of the OPTIMIZER config entries, see lib/sampled_hash_c.h.
+DEFAULT_SAMPLED_HASH_BUDGET_MS = 1000
+DEFAULT_SAMPLED_HASH_THRESHOLD = 64 * 1024 * 1024
+DEFAULT_SAMPLED_HASH_PAGE_SIZE = 64 * 1024
+DEFAULT_SAMPLED_HASH_PAGES = 64
+
+
+class ArrayHasher:
+    """
+        Hashes the data of numpy arrays for their ID graph nodes. By default, all of the data is hashed. In sampled
+        mode, arrays of at least threshold bytes are hashed from their metadata, sample_pages evenly strided pages of
+        page_size bytes and the pages written since the last pass, as reported by the dirty page watcher of the
+        kernel where available. This is probabilistic without the watcher: writes between sample pages are missed,
+        so arrays sampled without it are reported (see take_unwatched) to be hashed in full at checkpoint time.
+
+        Large arrays are only sampled until the budget of the current cell runs out; the others are left unhashed, so
+        their variables are considered modified, and are hashed again at checkpoint time without a budget.
+    """
+    def __init__(
+        self,
+        sampled: bool = False,
+        budget_ms: float = DEFAULT_SAMPLED_HASH_BUDGET_MS,
+        threshold: int = DEFAULT_SAMPLED_HASH_THRESHOLD,
+        page_size: int = DEFAULT_SAMPLED_HASH_PAGE_SIZE,
+        sample_pages: int = DEFAULT_SAMPLED_HASH_PAGES,
+    ) -> None:
+        """
+            @param sampled  Whether to sample large arrays. Ignored if the native extensions are not built.
+            @param budget_ms  Time to sample large arrays in each cell, negative for no budget.
+        """
+        self._sampled = sampled and VisitorModule is not None
+        self._budget_ns = int(budget_ms * 1_000_000)
+        self._threshold = threshold
+        self._page_size = page_size
+        self._sample_pages = sample_pages
+
+        # Deadline of the current cell on the monotonic clock, None for no deadline.
+        self._deadline_ns: Optional[int] = None
+
+        # Whether an array was left unhashed since the last take_incomplete.
+        self._incomplete = False
+
+        # Whether an array was sampled without the dirty page watcher since the last take_unwatched.
+        self._unwatched = False
+
+        # Whether to hash all of the data of large arrays meanwhile.
+        self._full = False
+
+    @staticmethod
+    def from_config() -> ArrayHasher:
+        return ArrayHasher(
+            sampled=Config.get('OPTIMIZER', 'sampled_hashing', False),
+            budget_ms=Config.get('OPTIMIZER', 'sampled_hash_budget_ms', DEFAULT_SAMPLED_HASH_BUDGET_MS),
+            threshold=Config.get('OPTIMIZER', 'sampled_hash_threshold', DEFAULT_SAMPLED_HASH_THRESHOLD),
+            page_size=Config.get('OPTIMIZER', 'sampled_hash_page_size', DEFAULT_SAMPLED_HASH_PAGE_SIZE),
+            sample_pages=Config.get('OPTIMIZER', 'sampled_hash_pages', DEFAULT_SAMPLED_HASH_PAGES),
+        )
+
+    def is_sampled(self) -> bool:
+        return self._sampled
+
+    def begin_cell(self) -> None:
+        """
+            Starts the budget of a cell.
+        """
+        self._deadline_ns = time.monotonic_ns() + self._budget_ns if self._budget_ns >= 0 else None
+
+    @contextmanager
+    def unbounded(self) -> Iterator[None]:
+        """
+            Hashes without a budget meanwhile, e.g., at checkpoint time.
+        """
+        deadline_ns = self._deadline_ns
+        self._deadline_ns = None
+        try:
+            yield
+        finally:
+            self._deadline_ns = deadline_ns
+
+    @contextmanager
+    def full(self) -> Iterator[None]:
+        """
+            Hashes all of the data of arrays meanwhile, e.g., at checkpoint time without the dirty page watcher.
+        """
+        full = self._full
+        self._full = True
+        try:
+            yield
+        finally:
+            self._full = full
+
+    def hash_array(self, array: numpy.ndarray) -> Optional[int]:
+        """
+            @return  The digest of the data of the array, or None if the budget ran out.
+        """
+        if not self._sampled or self._full or array.nbytes < self._threshold or array.dtype.hasobject:
+            h = xxhash.xxh3_128()
+            h.update(numpy.ascontiguousarray(array.data))
+            return h.intdigest()
+
+        budget_ns = -1 if self._deadline_ns is None else max(self._deadline_ns - time.monotonic_ns(), 0)
+        digest, complete = VisitorModule.get_object_sampled_hash(
+            array,
+            budget_ns=budget_ns,
+            threshold=self._threshold,
+            page_size=self._page_size,
+            sample_pages=self._sample_pages
+        )
+        if not complete:
+            self._incomplete = True
+            return None
+        if not VisitorModule.page_watcher_available():
+            self._unwatched = True
+        return digest
+
+    def take_incomplete(self) -> bool:
+        """
+            @return  Whether an array was left unhashed since the last call.
+        """
+        incomplete = self._incomplete
+        self._incomplete = False
+        return incomplete
+
+    def take_unwatched(self) -> bool:
+        """
+            @return  Whether an array was sampled without the dirty page watcher since the last call.
+        """
+        unwatched = self._unwatched
+        self._unwatched = False
+        return unwatched
+
+    def end_pass(self) -> None:
+        """
+            Ends a hashing pass, after which the dirty page watcher reports the pages written from then on.
+        """
+        if self._sampled:
+            VisitorModule.end_sampled_pass()
@@ -4,36 +4,251 @@ Sqlite interface for storing checkpoints.
 import ast
 import cloudpickle
 import dill
+import atexit
+import functools
+import logging
+import os
+import pickle
+import queue
+import shutil
 import sqlite3
-import sys
+import tempfile
+import threading
+import time
 
-from typing import Dict, FrozenSet, List, Set, Tuple
+from collections import deque
+from dataclasses import dataclass
+from typing import IO, Any, Deque, Dict, FrozenSet, Iterator, List, Optional, Set, Tuple
 
 from kishu.exceptions import CommitIdNotExistError
 from kishu.jupyter.namespace import Namespace
 from kishu.planning.ahg import VariableSnapshot, VersionedName, VersionedNameContext
+from kishu.planning.optimizer import REALLY_FAST_BANDWIDTH_10GBPS
+from kishu.storage.chunk_store import ChunkStore
 from kishu.storage.config import Config
+from kishu.storage.segment import collect_out_of_band, commit_segment_directory, map_segment, write_segment
 
 
 CHECKPOINT_TABLE = 'checkpoint'
 VARIABLE_SNAPSHOT_TABLE = 'variable_snapshot'
 
+# Pickles up to this size are buffered in memory before being written to the database; larger ones spill to a
+# temporary file, which bounds the memory used for storing a variable snapshot.
+SPOOL_MAX_SIZE = 16 * 1024 * 1024
+
+# Size of the chunks copied into the database with incremental BLOB I/O.
+BLOB_CHUNK_SIZE = 1024 * 1024
+
+# Variable snapshots looked up per query, staying below the default limit of 999 host parameters of old SQLite
+# versions (3 parameters per snapshot).
+SNAPSHOT_QUERY_BATCH = 300
+
+# Commits waiting for the CheckpointWriter before submitting blocks. Each one holds its captured pickles, up to
+# SPOOL_MAX_SIZE per snapshot in memory, so this bounds the memory used when writes fall behind.
+WRITER_QUEUE_SIZE = 4
+
+logger = logging.getLogger(__name__)
+
+
+class ConnectionPool:
+    """
+        Persistent SQLite connections, one per database file and thread, so callers don't reconnect on every
+        access. Connections use WAL journaling: a commit appends to the log instead of rewriting the database,
+        and readers don't block the writer. A connection is reopened if its database file was replaced.
+
+        A caller may fail before committing: the transaction it left open is rolled back when the connection is
+        handed out again, so that its writes don't leak into the next caller. Connections of finished threads are
+        closed when a new connection is opened.
+    """
+    _connections: Dict[Tuple[str, int], Tuple[sqlite3.Connection, Tuple[int, int]]] = {}
+    _lock = threading.Lock()
+
+    @staticmethod
+    def _file_identity(database_path: str) -> Tuple[int, int]:
+        try:
+            stat = os.stat(database_path)
+        except OSError:
+            return (-1, -1)
+        return (stat.st_dev, stat.st_ino)
+
+    @classmethod
+    def get(cls, database_path: str) -> sqlite3.Connection:
+        key = (os.path.abspath(database_path), threading.get_ident())
+        identity = cls._file_identity(database_path)
+        with cls._lock:
+            entry = cls._connections.get(key)
+            if entry is not None and entry[1] == identity:
+                con = entry[0]
+                if con.in_transaction:
+                    con.rollback()
+                return con
+            if entry is not None:
+                entry[0].close()
+            cls._close_finished_threads()
+
+            # Each connection is only used by its own thread, but may be closed by another one.
+            con = sqlite3.connect(database_path, check_same_thread=False)
+            con.execute("pragma journal_mode=wal")
+            # In WAL mode, NORMAL only syncs at checkpoints and still can't corrupt the database.
+            con.execute("pragma synchronous=normal")
+            cls._connections[key] = (con, cls._file_identity(database_path))
+            return con
+
+    @classmethod
+    def _close_finished_threads(cls) -> None:
+        alive = {thread.ident for thread in threading.enumerate()}
+        for key in [key for key in cls._connections if key[1] not in alive]:
+            cls._connections.pop(key)[0].close()
+
+    @classmethod
+    def close_all(cls) -> None:
+        with cls._lock:
+            for con, _ in cls._connections.values():
+                con.close()
+            cls._connections.clear()
+
+
+def _dump_namespace(ns_dict: Dict[str, Any], file: IO[bytes], buffers: Optional[List[pickle.PickleBuffer]]) -> bool:
+    """
+        Streams the pickle of a namespace into file, with cloudpickle or, if it fails, dill.
+        Returns whether pickling succeeded.
+
+        @param buffers  If not None, pickle with protocol 5 and collect the large buffers to store out-of-band.
+    """
+    for pickler in (cloudpickle, dill):
+        file.seek(0)
+        file.truncate()
+        try:
+            if buffers is None:
+                pickler.dump(ns_dict, file)
+            else:
+                buffers.clear()
+                pickler.dump(ns_dict, file, protocol=5, buffer_callback=functools.partial(collect_out_of_band, buffers))
+            return True
+        except Exception:
+            pass
+    return False
+
+
+@functools.lru_cache(maxsize=None)
+def _parse_name(name: str) -> FrozenSet[str]:
+    """
+        Parses the name column of a variable snapshot, the repr of its sorted variable names. Parsed names are
+        interned: most variable sets are stored by many commits, and are only parsed once per process.
+    """
+    return frozenset(ast.literal_eval(name))
+
+
+# A variable snapshot pickled into a (rewound) temporary file, ready to be written, and the segment file holding
+# its out-of-band buffers, if any.
+CapturedSnapshot = Tuple[VariableSnapshot, IO[bytes], Optional[str]]
+
+
+@dataclass
+class CheckpointWriterMetrics:
+    queue_depth: int  # Commits submitted but not written yet, including the one being written.
+    lag_s: float  # Time since the oldest of those commits was submitted.
+    written: int  # Commits written so far.
+    failed: int  # Commits whose transaction failed.
+    last_error: Optional[str]  # Error of the last commit which failed, if any.
+
+
+class CheckpointWriter:
+    """
+        Background writer of captured variable snapshots. A single worker thread stores submitted commits in
+        order, one transaction each, so the program doesn't wait on chunking and SQLite writes. Readers of
+        variable snapshots call flush first, which is the barrier ensuring they see every submitted commit.
+        At most WRITER_QUEUE_SIZE commits wait to be written; submit blocks until there is room.
+    """
+    _queue: queue.Queue = queue.Queue(maxsize=WRITER_QUEUE_SIZE)
+    _submit_times: Deque[float] = deque()
+    _thread: Optional[threading.Thread] = None
+    _lock = threading.Lock()
+    _written = 0
+    _failed = 0
+    _last_error: Optional[Exception] = None
+    _unreported_error: Optional[Exception] = None
+
+    @classmethod
+    def submit(cls, database_path: str, commit_id: str, captured: List[CapturedSnapshot]) -> None:
+        with cls._lock:
+            if cls._thread is None:
+                cls._thread = threading.Thread(target=cls._run, name="kishu-checkpoint-writer", daemon=True)
+                cls._thread.start()
+                # Don't lose pending checkpoints when the kernel exits.
+                atexit.register(cls.flush)
+            cls._submit_times.append(time.monotonic())
+        cls._queue.put((database_path, commit_id, captured))
+
+    @classmethod
+    def flush(cls) -> Optional[Exception]:
+        """
+            Waits until all submitted commits are written. Returns immediately on the worker thread.
+            Returns the error of the last commit which failed since the previous flush, if any.
+        """
+        if threading.current_thread() is cls._thread:
+            return None
+        cls._queue.join()
+        with cls._lock:
+            error, cls._unreported_error = cls._unreported_error, None
+            return error
+
+    @classmethod
+    def metrics(cls) -> CheckpointWriterMetrics:
+        with cls._lock:
+            lag_s = time.monotonic() - cls._submit_times[0] if cls._submit_times else 0.0
+            last_error = None if cls._last_error is None else repr(cls._last_error)
+            return CheckpointWriterMetrics(len(cls._submit_times), lag_s, cls._written, cls._failed, last_error)
+
+    @classmethod
+    def _run(cls) -> None:
+        while True:
+            database_path, commit_id, captured = cls._queue.get()
+            error = None
+            try:
+                KishuCheckpoint(database_path).write_variable_snapshots(commit_id, captured)
+            except Exception as e:
+                logger.exception("Failed to write the variable snapshots of commit %s to %s", commit_id, database_path)
+                error = e
+            with cls._lock:
+                cls._submit_times.popleft()
+                if error is None:
+                    cls._written += 1
+                else:
+                    cls._failed += 1
+                    cls._last_error = cls._unreported_error = error
+            cls._queue.task_done()
+
 
 class KishuCheckpoint:
+    # Stored size over pickled size of the last stored snapshot of each variable set, by database.
+    _compression_ratios: Dict[Tuple[str, FrozenSet[str]], float] = {}
+
     def __init__(self, database_path: str):
         self.database_path = database_path
 
+    def compression_ratio(self, names: FrozenSet[str]) -> float:
+        """
+            Returns how much the last stored snapshot of the variables shrank in storage (1.0 if not stored yet),
+            which estimates the size of storing them again.
+        """
+        return KishuCheckpoint._compression_ratios.get((os.path.abspath(self.database_path), names), 1.0)
+
+    def segment_directory(self) -> str:
+        return self.database_path + '.segments'
+
     def init_database(self):
-        con = sqlite3.connect(self.database_path)
+        con = ConnectionPool.get(self.database_path)
         cur = con.cursor()
         cur.execute(f'create table if not exists {CHECKPOINT_TABLE} (commit_id text primary key, data blob)')
         cur.execute(f'create table if not exists {VARIABLE_SNAPSHOT_TABLE} '
                     f'(version int, name text, commit_id text, size int, data blob)')
+        ChunkStore(con).init_table()
 
         con.commit()
 
     def get_checkpoint(self, commit_id: str) -> bytes:
-        con = sqlite3.connect(self.database_path)
+        con = ConnectionPool.get(self.database_path)
         cur = con.cursor()
         cur.execute(
             f"select data from {CHECKPOINT_TABLE} where commit_id = ?",
@@ -46,7 +261,7 @@ class KishuCheckpoint:
         return result
 
     def store_checkpoint(self, commit_id: str, data: bytes) -> None:
-        con = sqlite3.connect(self.database_path)
+        con = ConnectionPool.get(self.database_path)
         cur = con.cursor()
         cur.execute(
             f"insert into {CHECKPOINT_TABLE} values (?, ?)",
@@ -55,50 +270,222 @@ class KishuCheckpoint:
         con.commit()
 
     def get_variable_snapshots(self, versioned_names: List[Tuple[VersionedName, VersionedNameContext]]) -> List[bytes]:
-        con = sqlite3.connect(self.database_path)
-        cur = con.cursor()
-        param_list = [(vn.version, repr(sorted(vn.name)), vnc.commit_id) for vn, vnc in versioned_names]
-        cur.execute(
-            f"""select data from {VARIABLE_SNAPSHOT_TABLE} where (version, name, commit_id) IN (VALUES {','.join(f'({",".join("?" * len(t))})' for t in param_list)})""", [i for t in param_list for i in t]
-        )
-        res: List = cur.fetchall()
-        res_list = [i[0] for i in res]
+        res_list = [data for _, data in self.iter_variable_snapshots(versioned_names)]
         if len(res_list) != len(versioned_names):
             raise ValueError(f"length of results {len(res_list)} not equal to queries {len(versioned_names)}:") 
         return res_list
 
+    def iter_variable_snapshots(
+        self,
+        versioned_names: List[Tuple[VersionedName, VersionedNameContext]]
+    ) -> Iterator[Tuple[VersionedName, bytes]]:
+        """
+            Streams the pickles of variable snapshots in storage order, so that only one is held in memory at a
+            time. Snapshots that aren't stored are skipped.
+        """
+        CheckpointWriter.flush()
+        con = ConnectionPool.get(self.database_path)
+        chunk_store = ChunkStore(con)
+        param_list = [(vn.version, repr(sorted(vn.name)), vnc.commit_id) for vn, vnc in versioned_names]
+        for i in range(0, len(param_list), SNAPSHOT_QUERY_BATCH):
+            batch = param_list[i:i + SNAPSHOT_QUERY_BATCH]
+            cur = con.execute(
+                f"select version, name, data from {VARIABLE_SNAPSHOT_TABLE} where (version, name, commit_id) in "
+                f"(values {','.join(['(?, ?, ?)'] * len(batch))})",
+                [param for params in batch for param in params]
+            )
+            for version, name, data in cur:
+                # Snapshots stored in the chunk store are reassembled from their manifests.
+                if ChunkStore.is_manifest(data):
+                    data = chunk_store.get(data)
+                yield VersionedName(_parse_name(name), version), data
+
     def get_stored_versioned_names(self, commit_ids: List[str]) -> Dict[VersionedName, VersionedNameContext]:
-        con = sqlite3.connect(self.database_path)
+        CheckpointWriter.flush()
+        con = ConnectionPool.get(self.database_path)
         cur = con.cursor()
 
         # Get all namespaces
         cur.execute(f"select version, name, size, commit_id from {VARIABLE_SNAPSHOT_TABLE} WHERE commit_id IN (%s)" %
                            ','.join('?'*len(commit_ids)), commit_ids)
-        res: List = cur.fetchall()
-        return {VersionedName(frozenset(ast.literal_eval(i[1])), i[0]): VersionedNameContext(i[2], i[3]) for i in res}
+        return {VersionedName(_parse_name(name), version): VersionedNameContext(size, commit_id)
+                for version, name, size, commit_id in cur}
 
     def store_variable_snapshots(self, commit_id: str, vses_to_store: List[VariableSnapshot], user_ns: Namespace) -> None:
-        con = sqlite3.connect(self.database_path)
-        cur = con.cursor()
+        self.write_variable_snapshots(commit_id, self.capture_variable_snapshots(commit_id, vses_to_store, user_ns))
+
+    def capture_variable_snapshots(
+        self,
+        commit_id: str,
+        vses_to_store: List[VariableSnapshot],
+        user_ns: Namespace
+    ) -> List[CapturedSnapshot]:
+        """
+            Pickles the variables of each snapshot into a spooled temporary file. Unpicklable snapshots are skipped;
+            they will be reconstructed upon checkout. Once captured, snapshots don't depend on the namespace
+            anymore and can be written while the program keeps modifying its variables.
 
-        # Store each variable snapshot.
+            Large contiguous buffers (e.g., of numpy arrays) are written out-of-band to a segment file of the
+            commit right away, rather than copied through the pickle, while they still hold the captured state.
+        """
+        out_of_band = Config.get('PLANNER', 'out_of_band_buffers', True)
+        captured = []
         for vs in vses_to_store:
             # Create a namespace containing only variables from the component
             ns_subset = user_ns.subset(set(vs.name))
 
-            try:
-                data_dump = cloudpickle.dumps(ns_subset.to_dict())
-            except:
+            data_dump = tempfile.SpooledTemporaryFile(max_size=SPOOL_MAX_SIZE)
+            buffers: Optional[List[pickle.PickleBuffer]] = [] if out_of_band else None
+            if not _dump_namespace(ns_subset.to_dict(), data_dump, buffers):
+                data_dump.close()
+                continue
+            segment = None
+            if buffers:
                 try:
-                    data_dump = dill.dumps(ns_subset.to_dict())
-                except:
-                    pass
-            try:
-                cur.execute(
-                    f"insert into {VARIABLE_SNAPSHOT_TABLE} values (?, ?, ?, ?, ?)",
-                    (vs.version, repr(sorted(vs.name)), commit_id, sys.getsizeof(data_dump), memoryview(data_dump))
-                )
-                con.commit()
-            except:
-                # If storage fails, don't do anything. The VariableSnapshot will be reconstructed upon checkout.
-                pass
+                    segment, trailer = write_segment(self.segment_directory(), commit_id, buffers)
+                except OSError:
+                    data_dump.close()
+                    continue
+                finally:
+                    for buffer in buffers:
+                        buffer.release()
+                data_dump.write(trailer)
+            data_dump.seek(0)
+            captured.append((vs, data_dump, segment))
+        return captured
+
+    def loads_variable_snapshot(self, data: bytes) -> Dict[str, Any]:
+        """
+            Unpickles a variable snapshot. Its out-of-band buffers are mapped from their segment file, with
+            copy-on-write pages unless PLANNER.mmap_copy_on_write is off (then, restored arrays are read-only).
+        """
+        pickled, buffers = map_segment(self.segment_directory(), data,
+                                       Config.get('PLANNER', 'mmap_copy_on_write', True))
+        try:
+            return cloudpickle.loads(pickled, buffers=buffers)
+        except Exception:
+            return dill.loads(pickled, buffers=buffers)
+
+    def write_variable_snapshots(self, commit_id: str, captured: List[CapturedSnapshot]) -> None:
+        """
+            Writes captured variable snapshots of a commit in a single transaction, closing their files. Each
+            pickle is either split into deduplicated, compressed chunks of the chunk store (the row holding the
+            manifest), or copied uncompressed into its row in chunks with incremental BLOB I/O.
+
+            The size recorded for a snapshot is the size of its stored data, including out-of-band buffers.
+        """
+        chunked_store = Config.get('PLANNER', 'chunked_store', True)
+        codec_name = Config.get('PLANNER', 'compression', 'auto')
+        con = ConnectionPool.get(self.database_path)
+        chunk_store = ChunkStore(
+            con,
+            Config.get('OPTIMIZER', 'network_bandwidth', REALLY_FAST_BANDWIDTH_10GBPS),
+            None if codec_name == 'auto' else codec_name
+        )
+        try:
+            with con:
+                # Opened explicitly, so that the savepoints of chunked snapshots are nested in it rather than
+                # committing each snapshot on its own.
+                con.execute("begin")
+                for vs, data_dump, segment in captured:
+                    size = data_dump.seek(0, os.SEEK_END)
+                    data_dump.seek(0)
+                    segment_size = 0 if segment is None else os.path.getsize(segment)
+                    row_id = None
+                    try:
+                        if chunked_store:
+                            stored_size = KishuCheckpoint._store_chunked(
+                                con, chunk_store, vs, commit_id, data_dump, segment_size)
+                        else:
+                            stored_size = size + segment_size
+                            row_id = con.execute(
+                                f"insert into {VARIABLE_SNAPSHOT_TABLE} values (?, ?, ?, ?, zeroblob(?))",
+                                (vs.version, repr(sorted(vs.name)), commit_id, stored_size, size)
+                            ).lastrowid
+                            KishuCheckpoint._write_blob(con, row_id, data_dump)
+                        KishuCheckpoint._compression_ratios[(os.path.abspath(self.database_path), vs.name)] = \
+                            stored_size / max(size + segment_size, 1)
+                    except Exception:
+                        # If storage fails, don't do anything. The VariableSnapshot will be reconstructed upon checkout.
+                        if row_id is not None:
+                            con.execute(f"delete from {VARIABLE_SNAPSHOT_TABLE} where rowid = ?", (row_id, ))
+                        if segment is not None:
+                            os.remove(segment)
+        except Exception:
+            # The transaction was rolled back, so none of the segment files are referred to.
+            for _, _, segment in captured:
+                if segment is not None and os.path.exists(segment):
+                    os.remove(segment)
+            raise
+        finally:
+            for _, data_dump, _ in captured:
+                data_dump.close()
+
+    def delete_variable_snapshots(self, commit_ids: List[str]) -> None:
+        """
+            Deletes the variable snapshots of commits, releasing their chunks. Chunks no other snapshot
+            refers to are reclaimed by collect_garbage.
+        """
+        CheckpointWriter.flush()
+        con = ConnectionPool.get(self.database_path)
+        placeholders = ','.join('?' * len(commit_ids))
+        with con:
+            chunk_store = ChunkStore(con)
+            rows = con.execute(
+                f"select data from {VARIABLE_SNAPSHOT_TABLE} where commit_id in ({placeholders})", commit_ids
+            ).fetchall()
+            for data, in rows:
+                if ChunkStore.is_manifest(data):
+                    chunk_store.release(data)
+            con.execute(f"delete from {VARIABLE_SNAPSHOT_TABLE} where commit_id in ({placeholders})", commit_ids)
+        # Restored arrays keep their mappings valid after their files are deleted.
+        for commit_id in commit_ids:
+            shutil.rmtree(commit_segment_directory(self.segment_directory(), commit_id), ignore_errors=True)
+
+    def collect_garbage(self) -> int:
+        """
+            Deletes the chunks no longer referred to by any variable snapshot. Returns the number of deleted chunks.
+        """
+        CheckpointWriter.flush()
+        con = ConnectionPool.get(self.database_path)
+        with con:
+            return ChunkStore(con).collect_garbage()
+
+    @staticmethod
+    def _store_chunked(con: sqlite3.Connection, chunk_store: ChunkStore, vs: VariableSnapshot, commit_id: str,
+                       data_dump: IO[bytes], segment_size: int) -> int:
+        """
+            Stores data_dump in the chunk store and a variable snapshot row holding its manifest. On failure,
+            the chunk references taken so far are rolled back with the rest of the row.
+            Returns the stored size of the snapshot.
+        """
+        con.execute("savepoint store_chunked")
+        try:
+            manifest, stored_size = chunk_store.put(data_dump)
+            stored_size += segment_size
+            con.execute(
+                f"insert into {VARIABLE_SNAPSHOT_TABLE} values (?, ?, ?, ?, ?)",
+                (vs.version, repr(sorted(vs.name)), commit_id, stored_size, manifest)
+            )
+            return stored_size
+        except Exception:
+            con.execute("rollback to store_chunked")
+            raise
+        finally:
+            con.execute("release store_chunked")
+
+    @staticmethod
+    def _write_blob(con: sqlite3.Connection, row_id: int, data_dump: IO[bytes]) -> None:
+        """
+            Copies data_dump into the (zero-filled) data blob of a variable snapshot row.
+        """
+        if not hasattr(con, "blobopen"):
+            # Incremental BLOB I/O requires Python 3.11.
+            con.execute(
+                f"update {VARIABLE_SNAPSHOT_TABLE} set data = ? where rowid = ?",
+                (memoryview(data_dump.read()), row_id)
+            )
+            return
+        with con.blobopen(VARIABLE_SNAPSHOT_TABLE, "data", row_id) as blob:
+            while chunk := data_dump.read(BLOB_CHUNK_SIZE):
+                blob.write(chunk)
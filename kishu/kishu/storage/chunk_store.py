@@ -0,0 +1,151 @@
+"""
+Content-addressed, deduplicated store of checkpoint chunks.
+"""
+import sqlite3
+import hashlib
+
+from typing import IO, Dict, Iterator, List, Optional, Tuple
+
+from kishu.storage.codec import CodecChoice, decode, select_codec
+
+try:
+    # Native content-defined chunking, built with the C extensions in lib/.
+    from VisitorModule import content_defined_chunks
+except ImportError:
+    content_defined_chunks = None
+
+
+CHUNK_TABLE = 'chunk'
+
+# Prefix of the chunk manifests stored in place of snapshot payloads. Pickles start with b'\x80', so a manifest
+# can't be mistaken for a pickle stored before the chunk store existed.
+MANIFEST_MAGIC = b'KCHK1'
+
+# Length of the chunk digests (XXH3 128-bit natively, BLAKE2b truncated to 16 bytes otherwise).
+DIGEST_SIZE = 16
+
+# Chunk size without native chunking, and the amount of payload read per chunking call. The window must hold
+# at least one chunk of the largest size (2 MiB).
+FIXED_CHUNK_SIZE = 512 * 1024
+READ_WINDOW = 8 * 1024 * 1024
+
+
+def _digest(chunk: bytes) -> bytes:
+    return hashlib.blake2b(chunk, digest_size=DIGEST_SIZE).digest()
+
+
+def _fixed_size_chunks(data: bytes, final: bool) -> List[Tuple[int, bytes]]:
+    """
+        Fallback of content_defined_chunks, with the same interface.
+    """
+    stop = len(data) if final else len(data) - len(data) % FIXED_CHUNK_SIZE
+    return [(min(start + FIXED_CHUNK_SIZE, stop), _digest(data[start:start + FIXED_CHUNK_SIZE]))
+            for start in range(0, stop, FIXED_CHUNK_SIZE)]
+
+
+def split_chunks(file: IO[bytes]) -> Iterator[Tuple[bytes, memoryview]]:
+    """
+        Splits the remaining contents of file into chunks, yielding (digest, chunk) pairs. Chunks are
+        content-defined, so an edit of the payload only changes the chunks around it, unless the native
+        chunker is unavailable and fixed-size chunks are used.
+    """
+    chunker = content_defined_chunks if content_defined_chunks is not None else _fixed_size_chunks
+    carry = b''
+    while True:
+        block = file.read(READ_WINDOW)
+        final = len(block) < READ_WINDOW
+        data = carry + block
+        view = memoryview(data)
+        start = 0
+        for end, digest in chunker(data, final):
+            yield digest, view[start:end]
+            start = end
+        carry = data[start:]
+        if final:
+            return
+
+
+class ChunkStore:
+    """
+        Stores payloads (e.g., variable snapshot pickles) as chunks addressed by their digests. A chunk
+        shared by several payloads is stored once; each payload is described by a manifest listing the digests
+        of its chunks. Chunks are reference counted by manifest and deleted by collect_garbage once unused.
+        Chunks are stored as codec frames, compressed the way chosen for the payload first storing them.
+        All methods run in the current transaction of the connection.
+    """
+    def __init__(self, con: sqlite3.Connection, bandwidth: float = float('inf'), codec_name: Optional[str] = None):
+        """
+            @param bandwidth  Bytes per second at which stored chunks are transferred, for choosing codecs.
+            @param codec_name  Codec to compress with; chosen among the available ones if None.
+        """
+        self.con = con
+        self.bandwidth = bandwidth
+        self.codec_name = codec_name
+
+    def init_table(self) -> None:
+        self.con.execute(f'create table if not exists {CHUNK_TABLE} '
+                         f'(digest blob primary key, refcount int, data blob)')
+
+    @staticmethod
+    def is_manifest(data: bytes) -> bool:
+        """
+            Checks whether a stored payload is a manifest of this store rather than a plain pickle.
+        """
+        return bytes(data[:len(MANIFEST_MAGIC)]) == MANIFEST_MAGIC
+
+    @staticmethod
+    def _digests(manifest: bytes) -> List[bytes]:
+        return [bytes(manifest[i:i + DIGEST_SIZE]) for i in range(len(MANIFEST_MAGIC), len(manifest), DIGEST_SIZE)]
+
+    def put(self, file: IO[bytes]) -> Tuple[bytes, int]:
+        """
+            Stores the remaining contents of file, writing only the chunks not stored yet. The codec of the new
+            chunks is selected from a sample of the first one.
+            Returns the manifest of the payload and its stored (compressed) size, counting shared chunks.
+        """
+        manifest = [MANIFEST_MAGIC]
+        stored_size = 0
+        codec_choice: Optional[CodecChoice] = None
+        for digest, chunk in split_chunks(file):
+            row = self.con.execute(f"select length(data) from {CHUNK_TABLE} where digest = ?", (digest, )).fetchone()
+            if row is not None:
+                self.con.execute(f"update {CHUNK_TABLE} set refcount = refcount + 1 where digest = ?", (digest, ))
+                stored_size += row[0]
+            else:
+                if codec_choice is None:
+                    codec_choice = select_codec(chunk, self.bandwidth, self.codec_name)
+                frame = codec_choice.encode(chunk)
+                self.con.execute(f"insert into {CHUNK_TABLE} values (?, 1, ?)", (digest, frame))
+                stored_size += len(frame)
+            manifest.append(digest)
+        return b''.join(manifest), stored_size
+
+    def get(self, manifest: bytes) -> bytes:
+        """
+            Reassembles the payload described by a manifest.
+        """
+        digests = self._digests(manifest)
+        unique_digests = list(set(digests))
+        chunks: Dict[bytes, bytes] = {}
+        # Stay below the default limit of 999 host parameters of old SQLite versions.
+        for i in range(0, len(unique_digests), 500):
+            batch = unique_digests[i:i + 500]
+            cur = self.con.execute(
+                f"select digest, data from {CHUNK_TABLE} where digest in ({','.join('?' * len(batch))})", batch)
+            chunks.update((bytes(digest), decode(data)) for digest, data in cur.fetchall())
+        if len(chunks) != len(unique_digests):
+            raise ValueError(f"{len(unique_digests) - len(chunks)} chunks of the payload are missing")
+        return b''.join(chunks[digest] for digest in digests)
+
+    def release(self, manifest: bytes) -> None:
+        """
+            Drops the references of a manifest to its chunks. Unused chunks are kept until collect_garbage.
+        """
+        self.con.executemany(f"update {CHUNK_TABLE} set refcount = refcount - 1 where digest = ?",
+                             [(digest, ) for digest in self._digests(manifest)])
+
+    def collect_garbage(self) -> int:
+        """
+            Deletes the chunks no manifest refers to. Returns the number of deleted chunks.
+        """
+        return self.con.execute(f"delete from {CHUNK_TABLE} where refcount <= 0").rowcount
@@ -0,0 +1,157 @@
+"""
+Compression codecs of stored checkpoint data, selected per payload from a sample.
+"""
+import time
+import zlib
+
+from dataclasses import dataclass
+from typing import Callable, Dict, List, Optional
+
+try:
+    import lz4.frame
+except ImportError:
+    lz4 = None
+
+try:
+    import zstandard
+except ImportError:
+    zstandard = None
+
+
+@dataclass(frozen=True)
+class Codec:
+    """
+        A compression algorithm. Levels only matter when compressing, so frames record the codec id only.
+    """
+    codec_id: int
+    name: str
+    compress: Callable[[bytes, int], bytes]
+    decompress: Callable[[bytes], bytes]
+    levels: List[int]  # Levels tried by the automatic selection.
+
+
+_CODECS: Dict[int, Codec] = {}
+
+
+def register_codec(codec: Codec) -> None:
+    """
+        Makes a codec available for storing and loading data. Ids are persisted in frames and must stay stable.
+    """
+    if codec.codec_id in _CODECS and _CODECS[codec.codec_id].name != codec.name:
+        raise ValueError(f"codec id {codec.codec_id} is already used by {_CODECS[codec.codec_id].name}")
+    _CODECS[codec.codec_id] = codec
+
+
+def codec_by_name(name: str) -> Codec:
+    for codec in _CODECS.values():
+        if codec.name == name:
+            return codec
+    raise ValueError(f"codec {name} is not available")
+
+
+register_codec(Codec(0, 'none', lambda data, level: bytes(data), bytes, [0]))
+register_codec(Codec(1, 'zlib', lambda data, level: zlib.compress(data, level), zlib.decompress, [1]))
+if lz4 is not None:
+    register_codec(Codec(2, 'lz4', lambda data, level: lz4.frame.compress(data, compression_level=level),
+                         lz4.frame.decompress, [0]))
+if zstandard is not None:
+    register_codec(Codec(3, 'zstd', lambda data, level: zstandard.ZstdCompressor(level=level).compress(data),
+                         lambda data: zstandard.ZstdDecompressor().decompress(data), [1, 3]))
+
+
+def shuffle(data: bytes, itemsize: int) -> bytes:
+    """
+        Groups the i-th bytes of all itemsize-byte elements together. In arrays of numbers, the high bytes of
+        neighboring elements are often equal, which the shuffled layout exposes to the codecs.
+    """
+    end = len(data) - len(data) % itemsize
+    view = memoryview(data)
+    return b''.join([bytes(view[i:end:itemsize]) for i in range(itemsize)] + [bytes(view[end:])])
+
+
+def unshuffle(data: bytes, itemsize: int) -> bytes:
+    end = len(data) - len(data) % itemsize
+    count = end // itemsize
+    out = bytearray(len(data))
+    for i in range(itemsize):
+        out[i:end:itemsize] = data[i * count:(i + 1) * count]
+    out[end:] = data[end:]
+    return bytes(out)
+
+
+# Element sizes tried by the automatic selection for the shuffle filter; 1 disables it.
+SHUFFLE_ITEMSIZES = [1, 4, 8]
+
+# Payloads smaller than this are stored uncompressed; sampled bytes of larger ones.
+MIN_COMPRESS_SIZE = 4 * 1024
+SAMPLE_SIZE = 64 * 1024
+
+
+@dataclass(frozen=True)
+class CodecChoice:
+    codec: Codec
+    level: int = 0
+    itemsize: int = 1  # Element size of the shuffle filter applied before compression.
+
+    def encode(self, data: bytes) -> bytes:
+        """
+            Returns a frame of data: the codec id, the shuffle element size, and the compressed data.
+        """
+        if self.itemsize > 1:
+            data = shuffle(data, self.itemsize)
+        return bytes((self.codec.codec_id, self.itemsize)) + self.codec.compress(data, self.level)
+
+
+NO_COMPRESSION = CodecChoice(_CODECS[0])
+
+
+def decode(frame: bytes) -> bytes:
+    codec = _CODECS.get(frame[0])
+    if codec is None:
+        raise ValueError(f"codec id {frame[0]} is not available")
+    data = codec.decompress(memoryview(frame)[2:])
+    return unshuffle(data, frame[1]) if frame[1] > 1 else data
+
+
+def _sample(data: bytes) -> bytes:
+    """
+        Takes about SAMPLE_SIZE bytes from the start, middle and end of data, or all of it if it is smaller.
+    """
+    if len(data) <= SAMPLE_SIZE:
+        return bytes(data)
+    # Parts start at multiples of the largest shuffled element size, so that elements stay aligned.
+    alignment = max(SHUFFLE_ITEMSIZES)
+    part = SAMPLE_SIZE // 3 // alignment * alignment
+    starts = [0, len(data) // 2 // alignment * alignment, (len(data) - part) // alignment * alignment]
+    return b''.join(bytes(data[start:start + part]) for start in starts)
+
+
+def select_codec(data: bytes, bandwidth: float, codec_name: Optional[str] = None) -> CodecChoice:
+    """
+        Chooses how to compress a payload, given a part of it in data, by trying the candidates on a sample.
+        The choice minimizes the estimated time to compress, transfer at bandwidth (bytes/s) and decompress it.
+
+        @param codec_name  Use this codec, only choosing its level and filter, or choose among all available
+            ones if None.
+    """
+    if len(data) < MIN_COMPRESS_SIZE or codec_name == NO_COMPRESSION.codec.name:
+        return NO_COMPRESSION
+    sample = _sample(data)
+    if codec_name is not None:
+        codecs, best_cost = [codec_by_name(codec_name)], float('inf')
+    else:
+        codecs, best_cost = list(_CODECS.values()), len(sample) / bandwidth
+    best = NO_COMPRESSION
+    for codec in codecs:
+        for level in codec.levels:
+            for itemsize in SHUFFLE_ITEMSIZES:
+                if codec.codec_id == NO_COMPRESSION.codec.codec_id:
+                    continue
+                choice = CodecChoice(codec, level, itemsize)
+                start = time.perf_counter()
+                frame = choice.encode(sample)
+                decode(frame)
+                cost = time.perf_counter() - start + len(frame) / bandwidth
+                if cost < best_cost:
+                    best, best_cost = choice, cost
+    return best
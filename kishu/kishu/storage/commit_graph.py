@@ -3,11 +3,13 @@ from __future__ import annotations
 import json
 import os
 import pickle
+import shutil
 
 from dataclasses import dataclass
 from typing import Any, Dict, Iterator, List, Literal, Optional, Set, Tuple, Union
 from typing_extensions import TypeAlias
 
+from kishu.storage.commit_index import NO_NODE, CommitIndex
 from kishu.storage.config import Config
 
 """
@@ -24,6 +26,9 @@ MUL_SIZE times larger than its lower rank block (exponential sizes).
 MAX_BASE_SIZE = Config.get('COMMIT_GRAPH', 'MAX_BASE_SIZE', 128)
 MUL_SIZE = Config.get('COMMIT_GRAPH', 'MUL_SIZE', 2)
 
+# Directory in which the index is built when importing blocks, before it is moved into place.
+IMPORT_DIRECTORY = "commit_index.import"
+
 """
 Node byte format: [ header | serialzied node | padding ] where header contains the serialized node
 size in bytes. Header is an integer encoded in little endian. This assumes each node fits in 200 B.
@@ -290,52 +295,42 @@ class CommitGraphBlockSorted:
 
 
 class CommitGraphWalker(CommitNodeInfoIterator):
-    def __init__(self, store: CommitGraphStore, current_node: Optional[CommitNode]):
-        self._store = store
-        self._current_node = current_node
+    def __init__(self, index: CommitIndex, ancestry: Iterator[int]):
+        self._index = index
+        self._ancestry = ancestry
 
     def __iter__(self) -> CommitGraphWalker:
         return self
 
     def __next__(self) -> CommitNodeInfo:
-        if self._current_node is None:
-            raise StopIteration
-        current_node = self._current_node
-        next_position = self._current_node.parent_position()
-        if next_position == UNSET_POSITION:
-            self._current_node = None
-        else:
-            self._current_node = self._store._read(next_position)
-        return current_node.info()
+        commit_id, parent_id, _ = self._index.node(next(self._ancestry))
+        return CommitNodeInfo(commit_id, parent_id)
 
 
 class CommitGraphStore:
+    """
+    Commit graph on file, stored in a memory-mapped commit index (see CommitIndex). Graphs stored in blocks by
+    earlier versions are imported into the index when first opened.
+    """
 
     def __init__(self, root_path: str):
         self._root_path = root_path
         self._sorted_blocks: List[CommitGraphBlockSorted] = []
         self._tail_block: CommitGraphBlockTail = CommitGraphBlockTail(self._root_path)
+        self._index = CommitIndex(self._root_path)
 
-        try:
-            self._load_meta()
-        except FileNotFoundError:
-            pass
+        if not self._index.exists():
+            self._import_blocks()
 
     def begin_read(self, commit_id: CommitId) -> CommitNodeInfoIterator:
-        return CommitGraphWalker(self, self._find_and_read(commit_id))
+        index = NO_NODE if commit_id == ABSOLUTE_PAST else self._index.find(commit_id)
+        return CommitGraphWalker(self._index, self._index.iter_ancestry(index))
 
     def read_all(self) -> List[CommitNodeInfo]:
-        commit_node_infos = [node.info() for node in self._tail_block.read_all()]
-        for sorted_block in self._sorted_blocks:
-            commit_node_infos.extend([node.info() for node in sorted_block.read_all()])
-        return commit_node_infos
+        return [CommitNodeInfo(commit_id, parent_id) for commit_id, parent_id, _ in self._index.iter_nodes()]
 
     def insert(self, commit_node_info: CommitNodeInfo):
-        node = CommitNode(commit_node_info)
-        parent_node = self._find_and_read(node.parent_id())
-        if parent_node is not None:
-            node.set_parent_position(parent_node.position())
-        self._insert(node)
+        self._index.insert(commit_node_info.commit_id, commit_node_info.parent_id)
 
     def set_head(self, commit_id: CommitId):
         with open(self._head_path(), "w") as f:
@@ -352,75 +347,43 @@ class CommitGraphStore:
             return ABSOLUTE_PAST
 
     """
-    Commit graph chain: management over collection of blocks.
+    Commit graph chain: blocks of earlier versions.
     """
 
-    def _read(self, position: BlockPosition) -> CommitNode:
-        rank, offset = position
-        if rank < -1 or rank >= len(self._sorted_blocks):
-            raise IndexError(
-                f"Rank {position} out of range ({len(self._sorted_blocks)} sorted blocks)."
-            )
-        if offset >= MAX_BLOCK_SIZE(rank):
-            raise IndexError(f"Offset {offset} out of range for rank {rank}.")
-        if rank == -1:
-            return self._tail_block.read(position)
-        return self._sorted_blocks[rank].read(position)
-
-    def _find_and_read(self, commit_id: CommitId) -> Optional[CommitNode]:
-        # Find in tail first, then lower-rank to higher-rank sorted blocks.
-        # Assuming most commit_id is skewed towards newer commits.
-        if commit_id == ABSOLUTE_PAST:
-            return None
-        node = self._tail_block.find_and_read(commit_id)
-        if node is not None:
-            return node
+    def _import_blocks(self) -> None:
+        """
+        Inserts the nodes of the blocks into the index, parents before their children, so that they are linked.
+        The index is built aside and moved into place once complete, so an interrupted import is redone when the
+        graph is opened again.
+        """
+        try:
+            self._load_meta()
+        except FileNotFoundError:
+            return
+        nodes = self._tail_block.read_all()
         for sorted_block in self._sorted_blocks:
-            node = sorted_block.find_and_read(commit_id)
-            if node is not None:
-                return node
-        return None
-
-    def _insert(self, node: CommitNode) -> None:
-        self._tail_block.insert(node)
-        if self._tail_block.size() >= MAX_BLOCK_SIZE(-1):
-            # Tail block is full; merging into the first sorted block.
-            new_sorted_block = self._get_sorted_block(0).merge_tail(self._tail_block)
-
-            # Merge until size is under capacity by rank.
-            rank = 0
-            while new_sorted_block.size() >= MAX_BLOCK_SIZE(rank):
-                rank += 1
-                next_sorted_block = self._get_sorted_block(rank).merge(new_sorted_block)
-                new_sorted_block.clear()
-                new_sorted_block = next_sorted_block
-
-            # Clear tail.
-            self._tail_block.clear()
-
-            # Clear merged blocks.
-            for sorted_block in self._sorted_blocks[:rank + 1]:
-                sorted_block.clear()
-
-            # Assign new sorted block.
-            self._sorted_blocks[rank] = new_sorted_block
-
-        # Update metadata.
-        self._save_meta()
-
-    def _get_sorted_block(self, rank):
-        while rank >= len(self._sorted_blocks):
-            self._sorted_blocks.append(CommitGraphBlockSorted(rank, self._root_path))
-        return self._sorted_blocks[rank]
-
-    def _save_meta(self):
-        with open(self._meta_path(), "w") as f:
-            meta = {}
-            meta["sorted_blocks"] = [
-                sorted_block.to_dict() for sorted_block in self._sorted_blocks
-            ]
-            meta["tail_block"] = self._tail_block.to_dict()
-            json.dump(meta, f)
+            nodes.extend(sorted_block.read_all())
+
+        import_path = os.path.join(self._root_path, IMPORT_DIRECTORY)
+        shutil.rmtree(import_path, ignore_errors=True)
+        os.makedirs(import_path)
+        index = CommitIndex(import_path)
+
+        infos = {node.commit_id(): node.info() for node in nodes}
+        imported: Set[CommitId] = set()
+        for info in infos.values():
+            chain = []
+            while info.commit_id not in imported:
+                chain.append(info)
+                imported.add(info.commit_id)
+                if info.parent_id not in infos:
+                    break
+                info = infos[info.parent_id]
+            for info in reversed(chain):
+                index.insert(info.commit_id, info.parent_id)
+
+        index.move(self._root_path)
+        os.rmdir(import_path)
 
     def _load_meta(self):
         with open(self._meta_path(), "r") as f:
@@ -0,0 +1,317 @@
+"""
+Memory-mapped, append-only index of a commit graph, queried without parsing the stored history.
+"""
+from __future__ import annotations
+
+import mmap
+import os
+import struct
+import zlib
+
+from typing import Iterator, Optional, Tuple
+
+
+# Interned commit IDs, concatenated in UTF-8. Each ID is stored once, however many nodes refer to it.
+IDS_FILE = 'commit_index.ids'
+
+# Fixed-width node records, in insertion order; a node is referred to by its index in this file.
+NODES_FILE = 'commit_index.nodes'
+
+# Open-addressing hash table from commit IDs to the index of their latest node.
+TABLE_FILE = 'commit_index.table'
+
+# Offset and length of the commit ID and of the parent ID in the ID file, index of the parent node or NO_NODE.
+_NODE = struct.Struct('<QQIIi4x')
+NO_NODE = -1
+
+# Number of slots and of indexed nodes, followed by the slots: 0 if empty, or the index of a node + 1.
+_TABLE_HEADER = struct.Struct('<QQ')
+_SLOT = struct.Struct('<I')
+
+# Slots of a new table. Tables are doubled when half full, which keeps probe sequences short.
+INITIAL_TABLE_CAPACITY = 1024
+
+
+def _hash(commit_id: bytes) -> int:
+    return zlib.crc32(commit_id)
+
+
+class _MappedFile:
+    """
+        A file read through a memory map, which is remapped when reads go past its end, e.g., after appends
+        from this or another process, or when the file was replaced.
+    """
+    def __init__(self, path: str, writable: bool = False) -> None:
+        self._path = path
+        self._writable = writable
+        self._map: Optional[mmap.mmap] = None
+        self._identity: Tuple[int, int] = (-1, -1)
+
+    def view(self, end: int = 0) -> Optional[mmap.mmap]:
+        """
+            Returns the mapping of the file, remapped if it is shorter than end bytes. None if the file is empty.
+        """
+        if self._map is None or len(self._map) < end:
+            self.remap()
+        return self._map
+
+    def remap(self) -> None:
+        self.close()
+        try:
+            with open(self._path, 'r+b' if self._writable else 'rb') as f:
+                stat = os.fstat(f.fileno())
+                if stat.st_size > 0:
+                    # The mapping stays valid after the file is closed.
+                    access = mmap.ACCESS_WRITE if self._writable else mmap.ACCESS_READ
+                    self._map = mmap.mmap(f.fileno(), 0, access=access)
+                self._identity = (stat.st_ino, stat.st_size)
+        except FileNotFoundError:
+            self._identity = (-1, -1)
+
+    def is_stale(self) -> bool:
+        """
+            Whether the file was replaced or resized since it was mapped.
+        """
+        try:
+            stat = os.stat(self._path)
+        except FileNotFoundError:
+            return self._identity != (-1, -1)
+        return (stat.st_ino, stat.st_size) != self._identity
+
+    def append(self, data: bytes) -> int:
+        """
+            Appends data to the file, returning its offset.
+        """
+        with open(self._path, 'ab') as f:
+            offset = f.tell()
+            f.write(data)
+        return offset
+
+    def close(self) -> None:
+        if self._map is not None:
+            self._map.close()
+            self._map = None
+
+
+class CommitIndex:
+    """
+        Commit graph stored as fixed-width node records referring to their parent node by index, so walking the
+        history reads one record per commit from a memory map. Commit IDs are interned in an ID file and found
+        through an on-disk hash table; opening the index maps the files without reading them.
+
+        Files are only appended to, except the table, which is updated in place and replaced by a larger copy
+        when it fills up. Nodes are appended before their table slot, so the table may lag behind the nodes of
+        a writer which has been interrupted: lookups scan the nodes past the table, and the next insert indexes
+        them. There must be one writer at a time; readers in other processes see its appends once they remap.
+    """
+    def __init__(self, root_path: str) -> None:
+        self._root_path = root_path
+        self._ids = _MappedFile(os.path.join(root_path, IDS_FILE))
+        self._nodes = _MappedFile(os.path.join(root_path, NODES_FILE))
+        self._table = _MappedFile(os.path.join(root_path, TABLE_FILE), writable=True)
+
+    def exists(self) -> bool:
+        return os.path.exists(self._nodes._path)
+
+    def size(self) -> int:
+        """
+            Returns the number of nodes, including those appended by other processes since the last remap.
+        """
+        try:
+            return os.path.getsize(self._nodes._path) // _NODE.size
+        except FileNotFoundError:
+            return 0
+
+    def commit_id(self, index: int) -> str:
+        id_offset, _, id_length, _, _ = self._read_node(index)
+        return self._read_id(id_offset, id_length)
+
+    def node(self, index: int) -> Tuple[str, str, int]:
+        """
+            Returns the commit ID, parent ID and parent node index of a node.
+        """
+        id_offset, parent_offset, id_length, parent_length, parent = self._read_node(index)
+        return self._read_id(id_offset, id_length), self._read_id(parent_offset, parent_length), parent
+
+    def iter_nodes(self) -> Iterator[Tuple[str, str, int]]:
+        for index in range(self.size()):
+            yield self.node(index)
+
+    def iter_ancestry(self, index: int) -> Iterator[int]:
+        """
+            Yields the node and its ancestors, from newest to oldest.
+        """
+        while index != NO_NODE:
+            yield index
+            index = self._read_node(index)[4]
+
+    def find(self, commit_id: str) -> int:
+        """
+            Returns the index of the latest node of the commit, or NO_NODE.
+        """
+        encoded = commit_id.encode()
+        index = self._find(encoded)
+        if index == NO_NODE and (self._nodes.is_stale() or self._table.is_stale()):
+            # Another process may have inserted it since we mapped the files.
+            self._nodes.remap()
+            self._table.remap()
+            index = self._find(encoded)
+        return index
+
+    def insert(self, commit_id: str, parent_id: str) -> int:
+        """
+            Appends a node of the commit, linked to the latest node of its parent if there is one. Returns its
+            index.
+        """
+        self._index_pending()
+        encoded = commit_id.encode()
+        encoded_parent = parent_id.encode()
+
+        existing = self._find(encoded)
+        id_offset, id_length = self._intern(encoded, existing)
+        parent = self._find(encoded_parent) if encoded_parent else NO_NODE
+        parent_offset, parent_length = self._intern(encoded_parent, parent)
+
+        index = self.size()
+        self._nodes.append(_NODE.pack(id_offset, parent_offset, id_length, parent_length, parent))
+        self._index(index, encoded)
+        return index
+
+    def move(self, root_path: str) -> None:
+        """
+            Moves the files of the index into another directory, replacing the index there. The nodes file is
+            moved last, so the index only exists in root_path once all of its files are in place.
+        """
+        self.close()
+        for mapped in [self._ids, self._table, self._nodes]:
+            if os.path.exists(mapped._path):
+                os.replace(mapped._path, os.path.join(root_path, os.path.basename(mapped._path)))
+
+    def close(self) -> None:
+        self._ids.close()
+        self._nodes.close()
+        self._table.close()
+
+    """
+    Records and interned IDs.
+    """
+
+    def _read_node(self, index: int) -> Tuple[int, int, int, int, int]:
+        end = (index + 1) * _NODE.size
+        nodes = self._nodes.view(end)
+        if index < 0 or nodes is None or len(nodes) < end:
+            raise IndexError(f"Node {index} out of range.")
+        return _NODE.unpack_from(nodes, index * _NODE.size)
+
+    def _read_id(self, offset: int, length: int) -> str:
+        if length == 0:
+            return ""
+        ids = self._ids.view(offset + length)
+        assert ids is not None
+        return ids[offset:offset + length].decode()
+
+    def _id_equals(self, index: int, encoded: bytes) -> bool:
+        id_offset, _, id_length, _, _ = self._read_node(index)
+        if id_length != len(encoded):
+            return False
+        ids = self._ids.view(id_offset + id_length)
+        assert ids is not None
+        return ids[id_offset:id_offset + id_length] == encoded
+
+    def _intern(self, encoded: bytes, index: int) -> Tuple[int, int]:
+        """
+            Returns the offset and length of the ID, reusing that of the node at index if there is one.
+        """
+        if not encoded:
+            return 0, 0
+        if index != NO_NODE:
+            id_offset, _, id_length, _, _ = self._read_node(index)
+            return id_offset, id_length
+        return self._ids.append(encoded), len(encoded)
+
+    """
+    Hash table.
+    """
+
+    def _table_header(self) -> Tuple[Optional[mmap.mmap], int, int]:
+        table = self._table.view(_TABLE_HEADER.size)
+        if table is None:
+            return None, 0, 0
+        capacity, count = _TABLE_HEADER.unpack_from(table, 0)
+        return table, capacity, count
+
+    def _find(self, encoded: bytes) -> int:
+        table, capacity, count = self._table_header()
+        if table is not None:
+            slot = _hash(encoded) & (capacity - 1)
+            while True:
+                value, = _SLOT.unpack_from(table, _TABLE_HEADER.size + slot * _SLOT.size)
+                if value == 0:
+                    break
+                if self._id_equals(value - 1, encoded):
+                    # A later node of the commit may not be indexed yet.
+                    return self._scan(encoded, count, value - 1)
+                slot = (slot + 1) & (capacity - 1)
+        return self._scan(encoded, count, NO_NODE)
+
+    def _scan(self, encoded: bytes, start: int, found: int) -> int:
+        """
+            Searches the nodes which are not in the table yet, from start, for a later node of the commit.
+        """
+        for index in range(start, self.size()):
+            if self._id_equals(index, encoded):
+                found = index
+        return found
+
+    def _index(self, index: int, encoded: bytes) -> None:
+        table, capacity, count = self._table_header()
+        if table is None or 2 * (count + 1) > capacity:
+            self._rebuild(max(INITIAL_TABLE_CAPACITY, 2 * capacity))
+            table, capacity, count = self._table_header()
+            assert table is not None
+            if count > index:
+                # The rebuilt table already holds the node.
+                return
+
+        slot = _hash(encoded) & (capacity - 1)
+        while True:
+            position = _TABLE_HEADER.size + slot * _SLOT.size
+            value, = _SLOT.unpack_from(table, position)
+            if value == 0 or self._id_equals(value - 1, encoded):
+                _SLOT.pack_into(table, position, index + 1)
+                break
+            slot = (slot + 1) & (capacity - 1)
+        _TABLE_HEADER.pack_into(table, 0, capacity, count + 1)
+
+    def _index_pending(self) -> None:
+        """
+            Indexes the nodes past the table, e.g., if a writer was interrupted between a node and its slot.
+        """
+        _, _, count = self._table_header()
+        for index in range(count, self.size()):
+            self._index(index, self.commit_id(index).encode())
+
+    def _rebuild(self, capacity: int) -> None:
+        """
+            Replaces the table with one of the given capacity holding all nodes, written aside first so that
+            readers never see a partial table.
+        """
+        size = self.size()
+        slots = bytearray(capacity * _SLOT.size)
+        for index in range(size):
+            encoded = self.commit_id(index).encode()
+            slot = _hash(encoded) & (capacity - 1)
+            while True:
+                value, = _SLOT.unpack_from(slots, slot * _SLOT.size)
+                if value == 0 or self._id_equals(value - 1, encoded):
+                    _SLOT.pack_into(slots, slot * _SLOT.size, index + 1)
+                    break
+                slot = (slot + 1) & (capacity - 1)
+
+        temp_path = self._table._path + '.tmp'
+        with open(temp_path, 'wb') as f:
+            f.write(_TABLE_HEADER.pack(capacity, size))
+            f.write(slots)
+        self._table.close()
+        os.replace(temp_path, self._table._path)
+        self._table.remap()
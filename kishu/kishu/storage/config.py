@@ -79,6 +79,10 @@ class Config:
         if isinstance(default, list) and config_entry in Config.config[config_category]:
             return ast.literal_eval(Config.config[config_category][config_entry])
 
+        # bool("False") is True, so booleans are parsed by the config parser instead.
+        if isinstance(default, bool) and config_entry in Config.config[config_category]:
+            return Config.config[config_category].getboolean(config_entry)
+
         return type(default)(Config.config[config_category].get(config_entry, default))
 
     @staticmethod
@@ -0,0 +1,130 @@
+"""
+Side-car segment files holding the large buffers of pickles out-of-band.
+"""
+import mmap
+import os
+import pickle
+import struct
+import uuid
+
+from typing import List, Optional, Tuple
+
+
+# Suffix of the payloads whose buffers are stored in a segment file. Pickles end with the STOP opcode b'.', so
+# a payload with a segment can't be mistaken for a plain pickle.
+SEGMENT_MAGIC = b'KSEG1'
+
+# Contiguous buffers (e.g., of numpy arrays) at least this large are stored out-of-band; smaller ones stay in the
+# pickle, where they are cheaper than a separate mapping.
+OUT_OF_BAND_MIN_SIZE = 1024 * 1024
+
+# Buffers start at multiples of this offset in segment files, which keeps mapped arrays aligned for any dtype.
+SEGMENT_ALIGNMENT = 64
+
+_HEADER = struct.Struct('<HI')  # Length of the segment name, number of buffers.
+_BUFFER = struct.Struct('<QQ')  # Offset and length of a buffer.
+_TRAILER_SIZE = struct.Struct('<I')
+
+# Buffers passed to a single writev call (the Linux limit).
+_IOV_MAX = 1024
+
+
+def collect_out_of_band(buffers: List[pickle.PickleBuffer], buffer: pickle.PickleBuffer) -> bool:
+    """
+        buffer_callback of pickle protocol 5. Collects the buffers to store out-of-band into buffers; returns
+        True for the buffers to keep in the pickle.
+    """
+    try:
+        raw = buffer.raw()
+    except BufferError:
+        # Non-contiguous buffers can't be mapped back.
+        return True
+    if raw.nbytes < OUT_OF_BAND_MIN_SIZE:
+        return True
+    buffers.append(buffer)
+    return False
+
+
+def commit_segment_directory(segment_dir: str, commit_id: str) -> str:
+    """
+        Returns the directory holding the segment files of a commit, which are deleted together.
+    """
+    return os.path.join(segment_dir, commit_id)
+
+
+def write_segment(segment_dir: str, commit_id: str, buffers: List[pickle.PickleBuffer]) -> Tuple[str, bytes]:
+    """
+        Writes buffers into a new segment file of the commit, with a single gathering write where available.
+        Returns the path of the file, and the trailer to append to the pickle referring to the buffers.
+    """
+    os.makedirs(commit_segment_directory(segment_dir, commit_id), exist_ok=True)
+    name = os.path.join(commit_id, uuid.uuid4().hex + '.seg')
+    path = os.path.join(segment_dir, name)
+
+    views: List[memoryview] = []
+    entries = []
+    offset = 0
+    for buffer in buffers:
+        raw = buffer.raw()
+        padding = -offset % SEGMENT_ALIGNMENT
+        if padding:
+            views.append(memoryview(bytes(padding)))
+            offset += padding
+        views.append(raw)
+        entries.append((offset, raw.nbytes))
+        offset += raw.nbytes
+
+    with open(path, 'wb') as f:
+        if hasattr(os, 'writev'):
+            fd = f.fileno()
+            first = 0
+            while first < len(views):
+                written = os.writev(fd, views[first:first + _IOV_MAX])
+                # Skip the views written completely, and the written prefix of the next one.
+                while first < len(views) and written >= views[first].nbytes:
+                    written -= views[first].nbytes
+                    first += 1
+                if written:
+                    views[first] = views[first][written:]
+        else:
+            for view in views:
+                f.write(view)
+
+    encoded_name = name.encode()
+    trailer = _HEADER.pack(len(encoded_name), len(entries)) + encoded_name + \
+        b''.join(_BUFFER.pack(*entry) for entry in entries)
+    return path, trailer + _TRAILER_SIZE.pack(len(trailer)) + SEGMENT_MAGIC
+
+
+def has_segment(data: bytes) -> bool:
+    return bytes(data[-len(SEGMENT_MAGIC):]) == SEGMENT_MAGIC
+
+
+def _parse_trailer(data: bytes) -> Tuple[int, str, List[Tuple[int, int]]]:
+    """
+        Returns the length of the pickle preceding the trailer, the segment name and its buffers.
+    """
+    end = len(data) - len(SEGMENT_MAGIC) - _TRAILER_SIZE.size
+    trailer_size, = _TRAILER_SIZE.unpack_from(data, end)
+    start = end - trailer_size
+    name_size, count = _HEADER.unpack_from(data, start)
+    name_start = start + _HEADER.size
+    name = bytes(data[name_start:name_start + name_size]).decode()
+    entries = [_BUFFER.unpack_from(data, name_start + name_size + i * _BUFFER.size) for i in range(count)]
+    return start, name, entries
+
+
+def map_segment(segment_dir: str, data: bytes, copy_on_write: bool) -> Tuple[memoryview, Optional[List[memoryview]]]:
+    """
+        Splits a payload into its pickle and the out-of-band buffers to unpickle it with, which are views of the
+        memory-mapped segment file: read-only, or private copy-on-write pages. Objects unpickled from them, like
+        numpy arrays, reference the mapping instead of copying it.
+    """
+    if not has_segment(data):
+        return memoryview(data), None
+    pickle_size, name, entries = _parse_trailer(data)
+    with open(os.path.join(segment_dir, name), 'rb') as f:
+        # The mapping stays valid after the file is closed, as long as views of it exist.
+        mapped = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_COPY if copy_on_write else mmap.ACCESS_READ)
+    view = memoryview(mapped)
+    return memoryview(data)[:pickle_size], [view[offset:offset + length] for offset, length in entries]
@@ -1,7 +1,6 @@
-import sqlite3
-
 from typing import Dict, List, Set
 
+from kishu.storage.checkpoint import ConnectionPool
 from kishu.storage.path import KishuPath
 
 
@@ -14,7 +13,7 @@ class VariableVersion:
         self.database_path = KishuPath.database_path(notebook_id)
 
     def init_database(self):
-        con = sqlite3.connect(self.database_path)
+        con = ConnectionPool.get(self.database_path)
         cur = con.cursor()
 
         cur.execute(
@@ -33,7 +32,7 @@ class VariableVersion:
         con.commit()
 
     def store_variable_version_table(self, var_names: Set[str], commit_id: str):
-        con = sqlite3.connect(self.database_path)
+        con = ConnectionPool.get(self.database_path)
         cur = con.cursor()
         for var_name in var_names:
             cur.execute(
@@ -43,7 +42,7 @@ class VariableVersion:
         con.commit()
 
     def store_commit_variable_version_table(self, commit_id: str, commit_variable_version_map: Dict[str, str]):
-        con = sqlite3.connect(self.database_path)
+        con = ConnectionPool.get(self.database_path)
         cur = con.cursor()
         values_to_insert = [(commit_id, key, value) for key, value in commit_variable_version_map.items()]
         cur.executemany(
@@ -53,7 +52,7 @@ class VariableVersion:
         con.commit()
 
     def get_variable_version_by_commit_id(self, commit_id: str) -> Dict[str, str]:
-        con = sqlite3.connect(self.database_path)
+        con = ConnectionPool.get(self.database_path)
         cur = con.cursor()
         cur.execute(
             f"select var_name, var_commit_id from {COMMIT_VARIABLE_VERSION_TABLE} where commit_id = ?",
@@ -64,7 +63,7 @@ class VariableVersion:
         return result
 
     def get_commit_ids_by_variable_name(self, variable_name: str) -> List[str]:
-        con = sqlite3.connect(self.database_path)
+        con = ConnectionPool.get(self.database_path)
         cur = con.cursor()
         cur.execute(
             f"select var_commit_id from {VARIABLE_VERSION_TABLE} where var_name = ?",
@@ -0,0 +1,87 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "arena_c.h"
+#include "stats_c.h"
+
+// All allocations are aligned to this boundary
+#define ARENA_ALIGNMENT 16
+
+static size_t align_up(size_t size) {
+    return (size + (ARENA_ALIGNMENT - 1)) & ~((size_t)ARENA_ALIGNMENT - 1);
+}
+
+static size_t header_size() {
+    return align_up(sizeof(ArenaBlock));
+}
+
+static ArenaBlock* new_block(size_t capacity) {
+    ArenaBlock *block = (ArenaBlock*) malloc(header_size() + capacity);
+    if (!block)
+        return NULL;
+    STATS_INC(allocations);
+    block->next = NULL;
+    block->used = 0;
+    block->capacity = capacity;
+    return block;
+}
+
+void arena_init(Arena *arena) {
+    arena->head = NULL;
+}
+
+/*
+* Returns size bytes from the current block, chaining a new block if the current
+* one is exhausted. Returns NULL if the system is out of memory.
+*/
+void* arena_alloc(Arena *arena, size_t size) {
+    size = align_up(size ? size : 1);
+    ArenaBlock *block = arena->head;
+
+    if (block == NULL || block->capacity - block->used < size) {
+        if (size > ARENA_BLOCK_SIZE / 4) {
+            /* Large request: give it a dedicated block behind the current one so the
+               remaining space of the current block is not wasted */
+            ArenaBlock *large = new_block(size);
+            if (!large)
+                return NULL;
+            large->used = size;
+            if (block == NULL) {
+                arena->head = large;
+            } else {
+                large->next = block->next;
+                block->next = large;
+            }
+            return (char*)large + header_size();
+        }
+        block = new_block(ARENA_BLOCK_SIZE);
+        if (!block)
+            return NULL;
+        block->next = arena->head;
+        arena->head = block;
+    }
+
+    void *ptr = (char*)block + header_size() + block->used;
+    block->used += size;
+    return ptr;
+}
+
+void* arena_calloc(Arena *arena, size_t count, size_t size) {
+    if (size && count > SIZE_MAX / size)
+        return NULL;
+    void *ptr = arena_alloc(arena, count * size);
+    if (ptr)
+        memset(ptr, 0, count * size);
+    return ptr;
+}
+
+void arena_free(Arena *arena) {
+    ArenaBlock *block = arena->head;
+    ArenaBlock *temp;
+    while (block != NULL) {
+        temp = block->next;
+        free(block);
+        block = temp;
+    }
+    arena->head = NULL;
+}
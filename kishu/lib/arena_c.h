@@ -0,0 +1,33 @@
+#ifndef _ARENA_C_H
+#define _ARENA_C_H
+
+#include <stddef.h>
+
+// Default size of a single arena block. Requests larger than this get a dedicated block.
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+/*
+* A block of memory owned by an arena. Blocks are chained so the whole arena
+* can be released in one pass.
+*/
+typedef struct ArenaBlock {
+    struct ArenaBlock *next;
+    size_t used;
+    size_t capacity;
+    // Payload follows the header
+} ArenaBlock;
+
+/*
+* Bump allocator. Individual allocations are never freed; everything handed out
+* by the arena is released at once with arena_free.
+*/
+typedef struct Arena {
+    ArenaBlock *head;
+} Arena;
+
+void arena_init(Arena *arena);
+void* arena_alloc(Arena *arena, size_t size);
+void* arena_calloc(Arena *arena, size_t count, size_t size);
+void arena_free(Arena *arena);
+
+#endif /* _ARENA_C_H */
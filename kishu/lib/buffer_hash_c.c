@@ -0,0 +1,155 @@
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "buffer_hash_c.h"
+
+/*
+* Feeds the items of an N-dimensional strided buffer to state in logical
+* (C, row-major) order without materializing the items as Python objects.
+* Since XXH3 streaming does not depend on how the input is split, the result
+* equals hashing a C-contiguous copy of the buffer.
+* A contiguous buffer is hashed with a single update. Otherwise the trailing
+* dimensions which are contiguous are hashed as runs, and runs shorter than the
+* gather buffer are batched together first.
+* shape and strides may be NULL when ndim is 0; strides may be NULL for a
+* C-contiguous buffer.
+* Return: 0 on success, -1 if ndim is larger than BUFFER_HASH_MAX_NDIM
+*/
+int hash_strided_buffer(XXH3_state_t *state, const char *data, int ndim,
+                        const Py_ssize_t *shape, const Py_ssize_t *strides, Py_ssize_t itemsize) {
+    if (ndim > BUFFER_HASH_MAX_NDIM)
+        return -1;
+
+    for (int d = 0; d < ndim; d++) {
+        if (shape[d] == 0)
+            return 0;  // Empty buffer, nothing to hash
+    }
+
+    // Find the trailing dimensions that form one contiguous run of memory
+    Py_ssize_t run = itemsize;
+    int outer = ndim;
+    while (outer > 0 && (strides == NULL || shape[outer - 1] == 1 || strides[outer - 1] == run)) {
+        run *= shape[outer - 1];
+        outer--;
+    }
+
+    if (outer == 0) {
+        XXH3_64bits_update(state, data, (size_t)run);
+        return 0;
+    }
+
+    char gather[BUFFER_HASH_GATHER_SIZE];
+    size_t gathered = 0;
+    bool use_gather = run < BUFFER_HASH_GATHER_SIZE / 4;
+
+    // Odometer over the outer (non-contiguous) dimensions
+    Py_ssize_t index[BUFFER_HASH_MAX_NDIM] = {0};
+    const char *ptr = data;
+    while (true) {
+        if (use_gather) {
+            if (gathered + (size_t)run > sizeof(gather)) {
+                XXH3_64bits_update(state, gather, gathered);
+                gathered = 0;
+            }
+            memcpy(gather + gathered, ptr, (size_t)run);
+            gathered += (size_t)run;
+        } else {
+            XXH3_64bits_update(state, ptr, (size_t)run);
+        }
+
+        int d = outer - 1;
+        while (d >= 0) {
+            index[d]++;
+            ptr += strides[d];
+            if (index[d] < shape[d])
+                break;
+            ptr -= strides[d] * shape[d];
+            index[d] = 0;
+            d--;
+        }
+        if (d < 0)
+            break;
+    }
+
+    if (gathered > 0)
+        XXH3_64bits_update(state, gather, gathered);
+    return 0;
+}
+
+// Work shared by the threads hashing the chunks of one buffer
+typedef struct ChunkJob {
+    const char *data;
+    size_t length;
+    size_t chunk_size;
+    size_t num_chunks;
+    size_t next_chunk;  // Next chunk to hash, taken atomically
+    XXH64_hash_t *digests;
+} ChunkJob;
+
+static void* hash_chunks_worker(void *arg) {
+    ChunkJob *job = (ChunkJob*) arg;
+    while (true) {
+        size_t chunk = __atomic_fetch_add(&(job->next_chunk), 1, __ATOMIC_RELAXED);
+        if (chunk >= job->num_chunks)
+            break;
+        size_t offset = chunk * job->chunk_size;
+        size_t size = job->length - offset < job->chunk_size ? job->length - offset : job->chunk_size;
+        job->digests[chunk] = XXH3_64bits(job->data + offset, size);
+    }
+    return NULL;
+}
+
+/*
+* Tree hashing of a contiguous buffer: the buffer is split into chunks of
+* chunk_size bytes, each chunk is hashed on its own, and the length of the
+* buffer followed by the chunk digests is fed to state.
+* The chunks are hashed by num_threads threads (the caller included). The
+* result only depends on chunk_size, not on the number of threads, and differs
+* from hashing the buffer with a single update.
+* Touches no Python objects, so it may run with the GIL released.
+* Return: 0 on success, -1 if out of memory
+*/
+int hash_buffer_chunked(XXH3_state_t *state, const char *data, size_t length,
+                        size_t chunk_size, int num_threads) {
+    ChunkJob job;
+    job.data = data;
+    job.length = length;
+    job.chunk_size = chunk_size;
+    job.num_chunks = (length + chunk_size - 1) / chunk_size;
+    job.next_chunk = 0;
+    job.digests = (XXH64_hash_t*) malloc((job.num_chunks ? job.num_chunks : 1) * sizeof(XXH64_hash_t));
+    if (!job.digests)
+        return -1;
+
+    if (num_threads > BUFFER_HASH_MAX_THREADS)
+        num_threads = BUFFER_HASH_MAX_THREADS;
+    if ((size_t)num_threads > job.num_chunks)
+        num_threads = (int)job.num_chunks;
+
+    // Threads that fail to start are not an error: the remaining threads take their chunks
+    pthread_t threads[BUFFER_HASH_MAX_THREADS];
+    int started = 0;
+    for (int i = 1; i < num_threads; i++) {
+        if (pthread_create(&threads[started], NULL, hash_chunks_worker, &job) != 0)
+            break;
+        started++;
+    }
+    hash_chunks_worker(&job);
+    for (int i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+
+    XXH3_64bits_update(state, &length, sizeof(length));
+    XXH3_64bits_update(state, job.digests, job.num_chunks * sizeof(XXH64_hash_t));
+    free(job.digests);
+    return 0;
+}
+
+/*
+* Return: the number of online CPUs, used when no thread count is given
+*/
+int buffer_hash_default_threads() {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return cpus > 0 ? (int)cpus : 1;
+}
@@ -0,0 +1,25 @@
+#ifndef _BUFFER_HASH_C_H
+#define _BUFFER_HASH_C_H
+
+#include <Python.h>
+#include "xxh_x86dispatch.h"
+
+// Largest number of dimensions supported by hash_strided_buffer (numpy allows at most 64)
+#define BUFFER_HASH_MAX_NDIM 64
+
+// Size of the scratch buffer used to gather small strided items before hashing them
+#define BUFFER_HASH_GATHER_SIZE (16 * 1024)
+
+// Buffers of at least this many bytes are hashed with the GIL released
+#define BUFFER_HASH_NOGIL_THRESHOLD (64 * 1024)
+
+// Largest number of worker threads used by hash_buffer_chunked
+#define BUFFER_HASH_MAX_THREADS 256
+
+int hash_strided_buffer(XXH3_state_t *state, const char *data, int ndim,
+                        const Py_ssize_t *shape, const Py_ssize_t *strides, Py_ssize_t itemsize);
+int hash_buffer_chunked(XXH3_state_t *state, const char *data, size_t length,
+                        size_t chunk_size, int num_threads);
+int buffer_hash_default_threads();
+
+#endif /* _BUFFER_HASH_C_H */
@@ -0,0 +1,91 @@
+#include <stdint.h>
+#include "chunker_c.h"
+
+/*
+* Content-defined chunking with a gear rolling hash: the hash is shifted left by
+* one bit per byte and the gear value of the byte is added, so it depends on the
+* last 64 bytes only. A chunk ends where the top bits of the hash are zero, so
+* boundaries move with the content and an insertion only changes the chunks
+* around it.
+*/
+
+// Random value of every byte, generated deterministically so chunks are stable across runs
+static uint64_t gear[256];
+
+/*
+* Fills the gear table. Must be called before find_chunk_ends, e.g. at module
+* initialization.
+*/
+void chunker_init() {
+    uint64_t state = 0x9e3779b97f4a7c15ULL;
+    for (int i = 0; i < 256; i++) {
+        // splitmix64
+        uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        gear[i] = z ^ (z >> 31);
+    }
+}
+
+/*
+* Return: mask of the top bits of the hash that must be zero at a boundary, so
+* that chunks are about avg_size long on average
+*/
+static uint64_t boundary_mask(size_t min_size, size_t avg_size) {
+    size_t span = avg_size > min_size ? avg_size - min_size : 1;
+    int bits = 0;
+    while (bits < 63 && ((size_t)1 << bits) < span)
+        bits++;
+    return bits == 0 ? 0 : ~(uint64_t)0 << (64 - bits);
+}
+
+/*
+* Splits data into chunks of min_size to max_size bytes, except the last chunk,
+* which can be shorter. Without final, the data continues in a later call and
+* the trailing bytes after the last boundary are not returned as a chunk; the
+* caller passes them again with the continuation, which yields the same chunks as
+* a single call.
+* ends: receives the end offset of every chunk, must hold length / min_size + 1 entries
+* Return: the number of chunks
+*/
+size_t find_chunk_ends(const unsigned char *data, size_t length, size_t min_size, size_t avg_size,
+                       size_t max_size, bool final, size_t *ends) {
+    uint64_t mask = boundary_mask(min_size, avg_size);
+    size_t count = 0;
+    size_t start = 0;
+    while (start < length) {
+        size_t remaining = length - start;
+        if (remaining <= min_size) {
+            if (final)
+                ends[count++] = length;
+            break;
+        }
+
+        // Warm up the hash on the window preceding the first possible boundary
+        size_t limit = remaining < max_size ? remaining : max_size;
+        size_t i = min_size > 64 ? min_size - 64 : 0;
+        uint64_t hash = 0;
+        for (; i < min_size; i++)
+            hash = (hash << 1) + gear[data[start + i]];
+
+        size_t boundary = 0;
+        for (; i < limit; i++) {
+            hash = (hash << 1) + gear[data[start + i]];
+            if ((hash & mask) == 0) {
+                boundary = i + 1;
+                break;
+            }
+        }
+        if (boundary == 0) {
+            if (limit == max_size)
+                boundary = max_size;
+            else if (final)
+                boundary = remaining;
+            else
+                break;
+        }
+        ends[count++] = start + boundary;
+        start += boundary;
+    }
+    return count;
+}
@@ -0,0 +1,16 @@
+#ifndef _CHUNKER_C_H
+#define _CHUNKER_C_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Default chunk sizes of content-defined chunking (see find_chunk_ends)
+#define CHUNKER_MIN_SIZE (128 * 1024)
+#define CHUNKER_AVG_SIZE (512 * 1024)
+#define CHUNKER_MAX_SIZE (2 * 1024 * 1024)
+
+void chunker_init();
+size_t find_chunk_ends(const unsigned char *data, size_t length, size_t min_size, size_t avg_size,
+                       size_t max_size, bool final, size_t *ends);
+
+#endif /* _CHUNKER_C_H */
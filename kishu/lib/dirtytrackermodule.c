@@ -0,0 +1,599 @@
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "idmap_c.h"
+
+// Dict and type watchers were added in CPython 3.12.
+#if PY_VERSION_HEX >= 0x030C0000
+#define HAVE_WATCHERS 1
+#endif
+
+// Maximum number of objects reachable from a variable for it to be tracked
+#define TRACK_MAX_OBJECTS (1 << 20)
+
+/**
+ * Dirty set of the variables of a namespace.
+ *
+ * A tracked variable is one whose reachable objects are all watchable: exact
+ *dicts and types are watched, and the other objects are immutable (exact
+ *tuples and frozensets of watchable objects, builtin scalars, strings and
+ *bytes). Functions are not tracked, as their closure cells, defaults and
+ *attributes can change without any watched write. Writes to the namespace entry of a variable, or to one of the
+ *dicts or types reachable from it, make the variable dirty.
+ *
+ * @member "namespace" The watched namespace (owned).
+ * @member "owners" Address of a watched object -> set of the names of the
+ *variables it is reachable from (owned).
+ * @member "watched" Name of a tracked variable -> list of its watched
+ *objects, which are kept alive so that their addresses are not reused
+ *(owned).
+ * @member "dirty" Names written to since the last pop_dirty (owned).
+ * @member "all_dirty" Whether the whole namespace may have been modified,
+ *e.g. if it was cleared or an event could not be recorded.
+ * @member "prev" Previous live tracker.
+ * @member "next" Next live tracker.
+ **/
+typedef struct dirtyTracker {
+  PyObject *namespace;
+  PyObject *owners;
+  PyObject *watched;
+  PyObject *dirty;
+  bool all_dirty;
+  struct dirtyTracker *prev;
+  struct dirtyTracker *next;
+} dirtyTracker;
+
+// Live trackers, to which the watchers dispatch events
+static dirtyTracker *trackers = NULL;
+
+#ifdef HAVE_WATCHERS
+static int dict_watcher_id = -1;
+static int type_watcher_id = -1;
+#endif
+
+/**
+ * Adds the names of the variables an object is reachable from to the dirty
+ *set of a tracker.
+ *
+ * @return Returns 0 on success, -1 with an exception set on failure.
+ **/
+int mark_owners_dirty(dirtyTracker *tracker, PyObject *obj) {
+  PyObject *address = PyLong_FromVoidPtr(obj);
+  if (address == NULL) {
+    return -1;
+  }
+  PyObject *names = PyDict_GetItemWithError(tracker->owners, address);
+  Py_DECREF(address);
+  if (names == NULL) {
+    return PyErr_Occurred() ? -1 : 0;
+  }
+
+  PyObject *iterator = PyObject_GetIter(names);
+  if (iterator == NULL) {
+    return -1;
+  }
+  PyObject *name;
+  while ((name = PyIter_Next(iterator)) != NULL) {
+    int ret = PySet_Add(tracker->dirty, name);
+    Py_DECREF(name);
+    if (ret == -1) {
+      Py_DECREF(iterator);
+      return -1;
+    }
+  }
+  Py_DECREF(iterator);
+  return PyErr_Occurred() ? -1 : 0;
+}
+
+#ifdef HAVE_WATCHERS
+/**
+ * Records a modification of a watched dict in every live tracker.
+ *
+ * Watchers must not raise, so a tracker that fails to record the event
+ *considers its whole namespace dirty.
+ *
+ * @return Returns 0.
+ **/
+static int on_dict_event(PyDict_WatchEvent event, PyObject *dict,
+                         PyObject *key, PyObject *new_value) {
+  PyObject *raised = PyErr_GetRaisedException();
+  for (dirtyTracker *tracker = trackers; tracker != NULL;
+       tracker = tracker->next) {
+    int ret = 0;
+    if (dict == tracker->namespace) {
+      if (key != NULL && (event == PyDict_EVENT_ADDED ||
+                          event == PyDict_EVENT_MODIFIED ||
+                          event == PyDict_EVENT_DELETED)) {
+        ret = PySet_Add(tracker->dirty, key);
+      } else {
+        tracker->all_dirty = true;
+      }
+    }
+    if (ret == 0) {
+      ret = mark_owners_dirty(tracker, dict);
+    }
+    if (ret == -1) {
+      PyErr_Clear();
+      tracker->all_dirty = true;
+    }
+  }
+  PyErr_SetRaisedException(raised);
+  return 0;
+}
+
+/**
+ * Records a modification of a watched type in every live tracker.
+ *
+ * @return Returns 0.
+ **/
+static int on_type_event(PyTypeObject *modified) {
+  PyObject *raised = PyErr_GetRaisedException();
+  for (dirtyTracker *tracker = trackers; tracker != NULL;
+       tracker = tracker->next) {
+    if (mark_owners_dirty(tracker, (PyObject *)modified) == -1) {
+      PyErr_Clear();
+      tracker->all_dirty = true;
+    }
+  }
+  PyErr_SetRaisedException(raised);
+  return 0;
+}
+#endif
+
+/**
+ * Collects the objects to watch for a variable.
+ *
+ * The objects reachable from obj are walked iteratively, until one that is
+ *neither watchable nor immutable is found.
+ *
+ * @param obj The value of the variable.
+ * @param watched List the dicts and types reachable from obj are appended
+ *to.
+ *
+ * @return Returns 1 if the variable can be tracked, 0 if not, or -1 with an
+ *exception set on failure.
+ **/
+int collect_watched(PyObject *obj, PyObject *watched) {
+  IdMap visited = {0};
+  Py_ssize_t capacity = 64;
+  Py_ssize_t count = 0;
+  PyObject **stack = (PyObject **)malloc(capacity * sizeof(PyObject *));
+  if (stack == NULL || idmap_init(&visited, 0) == -1) {
+    free(stack);
+    PyErr_NoMemory();
+    return -1;
+  }
+
+  // The walk runs no Python code, so the borrowed references stay valid
+  int ret = 1;
+  Py_ssize_t num_objects = 0;
+  stack[count++] = obj;
+  while (count > 0 && ret == 1) {
+    PyObject *current = stack[--count];
+    int64_t previous;
+    if (idmap_put(&visited, (uint64_t)(uintptr_t)current, 0, &previous) ==
+        -1) {
+      PyErr_NoMemory();
+      ret = -1;
+      break;
+    }
+    if (previous != IDMAP_MISSING) {
+      continue;
+    }
+    if (++num_objects > TRACK_MAX_OBJECTS) {
+      ret = 0;
+      break;
+    }
+
+    // Immutable leaves
+    if (current == Py_None || current == Py_Ellipsis ||
+        current == Py_NotImplemented || PyBool_Check(current) ||
+        PyLong_CheckExact(current) || PyFloat_CheckExact(current) ||
+        PyComplex_CheckExact(current) || PyUnicode_CheckExact(current) ||
+        PyBytes_CheckExact(current)) {
+      continue;
+    }
+
+    // Children of containers
+    Py_ssize_t num_children;
+    if (PyDict_CheckExact(current)) {
+      num_children = 2 * PyDict_GET_SIZE(current);
+    } else if (PyTuple_CheckExact(current)) {
+      num_children = PyTuple_GET_SIZE(current);
+    } else if (PyFrozenSet_CheckExact(current)) {
+      num_children = PySet_GET_SIZE(current);
+    } else if (PyType_Check(current)) {
+      num_children = 0;
+    } else {
+      ret = 0;
+      break;
+    }
+    if (count + num_children > capacity) {
+      while (count + num_children > capacity) {
+        capacity *= 2;
+      }
+      PyObject **grown =
+          (PyObject **)realloc(stack, capacity * sizeof(PyObject *));
+      if (grown == NULL) {
+        PyErr_NoMemory();
+        ret = -1;
+        break;
+      }
+      stack = grown;
+    }
+
+    if (PyDict_CheckExact(current) || PyType_Check(current)) {
+      if (PyList_Append(watched, current) == -1) {
+        ret = -1;
+        break;
+      }
+    }
+    if (PyDict_CheckExact(current)) {
+      Py_ssize_t pos = 0;
+      PyObject *key, *value;
+      while (PyDict_Next(current, &pos, &key, &value)) {
+        stack[count++] = key;
+        stack[count++] = value;
+      }
+    } else if (PyTuple_CheckExact(current)) {
+      for (Py_ssize_t i = 0; i < num_children; i++) {
+        stack[count++] = PyTuple_GET_ITEM(current, i);
+      }
+    } else if (PyFrozenSet_CheckExact(current)) {
+      // Items of a frozenset are only reachable through an iterator
+      PyObject *iterator = PyObject_GetIter(current);
+      if (iterator == NULL) {
+        ret = -1;
+        break;
+      }
+      PyObject *item;
+      while ((item = PyIter_Next(iterator)) != NULL) {
+        stack[count++] = item;
+        Py_DECREF(item);
+      }
+      Py_DECREF(iterator);
+      if (PyErr_Occurred()) {
+        ret = -1;
+        break;
+      }
+    }
+  }
+
+  free(stack);
+  idmap_free(&visited);
+  return ret;
+}
+
+/**
+ * Stops tracking a variable, which is then always possibly modified.
+ *
+ * The watched objects are released but not unwatched, as other trackers may
+ *watch them: events of objects without owners are ignored.
+ *
+ * @return Returns 0 on success, -1 with an exception set on failure.
+ **/
+int untrack_variable(dirtyTracker *tracker, PyObject *name) {
+  PyObject *objects = PyDict_GetItemWithError(tracker->watched, name);
+  if (objects == NULL) {
+    return PyErr_Occurred() ? -1 : 0;
+  }
+  Py_ssize_t num_objects = PyList_GET_SIZE(objects);
+  for (Py_ssize_t i = 0; i < num_objects; i++) {
+    PyObject *address = PyLong_FromVoidPtr(PyList_GET_ITEM(objects, i));
+    if (address == NULL) {
+      return -1;
+    }
+    int ret = 0;
+    PyObject *names = PyDict_GetItemWithError(tracker->owners, address);
+    if (names == NULL) {
+      ret = PyErr_Occurred() ? -1 : 0;
+    } else if (PySet_Discard(names, name) == -1) {
+      ret = -1;
+    } else if (PySet_GET_SIZE(names) == 0) {
+      ret = PyDict_DelItem(tracker->owners, address);
+    }
+    Py_DECREF(address);
+    if (ret == -1) {
+      return -1;
+    }
+  }
+  return PyDict_DelItem(tracker->watched, name);
+}
+
+/**
+ * Tracks a variable, replacing its previous tracking.
+ *
+ * @return Returns 1 if the variable is tracked, 0 if it can't be, or -1 with
+ *an exception set on failure.
+ **/
+int track_variable(dirtyTracker *tracker, PyObject *name, PyObject *obj) {
+  if (untrack_variable(tracker, name) == -1) {
+    return -1;
+  }
+#ifdef HAVE_WATCHERS
+  PyObject *objects = PyList_New(0);
+  if (objects == NULL) {
+    return -1;
+  }
+  int ret = collect_watched(obj, objects);
+  if (ret != 1) {
+    Py_DECREF(objects);
+    return ret;
+  }
+
+  Py_ssize_t num_objects = PyList_GET_SIZE(objects);
+  for (Py_ssize_t i = 0; i < num_objects && ret == 1; i++) {
+    PyObject *watched = PyList_GET_ITEM(objects, i);
+    if ((PyType_Check(watched) ? PyType_Watch(type_watcher_id, watched)
+                               : PyDict_Watch(dict_watcher_id, watched)) ==
+        -1) {
+      ret = -1;
+      break;
+    }
+
+    PyObject *address = PyLong_FromVoidPtr(watched);
+    if (address == NULL) {
+      ret = -1;
+      break;
+    }
+    PyObject *names = PyDict_GetItemWithError(tracker->owners, address);
+    if (names == NULL && !PyErr_Occurred()) {
+      names = PySet_New(NULL);
+      if (names != NULL &&
+          PyDict_SetItem(tracker->owners, address, names) == -1) {
+        Py_CLEAR(names);
+      }
+      Py_XDECREF(names);  // Referenced by owners
+    }
+    if (names == NULL || PySet_Add(names, name) == -1) {
+      ret = -1;
+    }
+    Py_DECREF(address);
+  }
+  // The owners added so far are removed with the variable
+  if (PyDict_SetItem(tracker->watched, name, objects) == -1) {
+    ret = -1;
+  }
+  Py_DECREF(objects);
+  if (ret == -1) {
+    PyObject *raised = PyErr_GetRaisedException();
+    if (untrack_variable(tracker, name) == -1) {
+      PyErr_Clear();
+    }
+    PyErr_SetRaisedException(raised);
+  }
+  return ret;
+#else
+  return 0;
+#endif
+}
+
+/**
+ * Frees a tracker once its capsule is released, removing it from the live
+ *trackers.
+ **/
+void free_tracker(PyObject *capsule) {
+  dirtyTracker *tracker =
+      (dirtyTracker *)PyCapsule_GetPointer(capsule, "dirtyTracker");
+  if (tracker == NULL) {
+    PyErr_Clear();
+    return;
+  }
+  if (tracker->prev != NULL) {
+    tracker->prev->next = tracker->next;
+  } else {
+    trackers = tracker->next;
+  }
+  if (tracker->next != NULL) {
+    tracker->next->prev = tracker->prev;
+  }
+  Py_XDECREF(tracker->namespace);
+  Py_XDECREF(tracker->owners);
+  Py_XDECREF(tracker->watched);
+  Py_XDECREF(tracker->dirty);
+  free(tracker);
+}
+
+/**
+ * Gets the tracker of a capsule.
+ *
+ * @return Returns the tracker, or NULL with an exception set.
+ **/
+dirtyTracker *get_tracker(PyObject *capsule) {
+  return (dirtyTracker *)PyCapsule_GetPointer(capsule, "dirtyTracker");
+}
+
+/**
+ * Python interface: whether dict and type watchers are supported, i.e. on
+ *CPython 3.12+.
+ **/
+static PyObject *watchers_available(PyObject *self, PyObject *args) {
+#ifdef HAVE_WATCHERS
+  Py_RETURN_TRUE;
+#else
+  Py_RETURN_FALSE;
+#endif
+}
+
+/**
+ * Python interface: creates a tracker watching a namespace dict.
+ *
+ * @return Returns a capsule of the tracker, or NULL with NotImplementedError
+ *set without watcher support.
+ **/
+static PyObject *create_tracker(PyObject *self, PyObject *args) {
+  PyObject *namespace;
+  if (!PyArg_ParseTuple(args, "O!", &PyDict_Type, &namespace)) {
+    return NULL;
+  }
+#ifdef HAVE_WATCHERS
+  if (dict_watcher_id == -1 &&
+      (dict_watcher_id = PyDict_AddWatcher(on_dict_event)) == -1) {
+    return NULL;
+  }
+  if (type_watcher_id == -1 &&
+      (type_watcher_id = PyType_AddWatcher(on_type_event)) == -1) {
+    return NULL;
+  }
+  if (PyDict_Watch(dict_watcher_id, namespace) == -1) {
+    return NULL;
+  }
+
+  dirtyTracker *tracker = (dirtyTracker *)calloc(1, sizeof(dirtyTracker));
+  if (tracker == NULL) {
+    return PyErr_NoMemory();
+  }
+  tracker->owners = PyDict_New();
+  tracker->watched = PyDict_New();
+  tracker->dirty = PySet_New(NULL);
+  if (tracker->owners == NULL || tracker->watched == NULL ||
+      tracker->dirty == NULL) {
+    Py_XDECREF(tracker->owners);
+    Py_XDECREF(tracker->watched);
+    Py_XDECREF(tracker->dirty);
+    free(tracker);
+    return NULL;
+  }
+  Py_INCREF(namespace);
+  tracker->namespace = namespace;
+
+  PyObject *capsule = PyCapsule_New(tracker, "dirtyTracker", free_tracker);
+  if (capsule == NULL) {
+    Py_DECREF(tracker->namespace);
+    Py_DECREF(tracker->owners);
+    Py_DECREF(tracker->watched);
+    Py_DECREF(tracker->dirty);
+    free(tracker);
+    return NULL;
+  }
+  tracker->next = trackers;
+  if (trackers != NULL) {
+    trackers->prev = tracker;
+  }
+  trackers = tracker;
+  return capsule;
+#else
+  PyErr_SetString(PyExc_NotImplementedError,
+                  "Dict watchers require Python 3.12 or later.");
+  return NULL;
+#endif
+}
+
+/**
+ * Python interface: tracks a variable (see track_variable).
+ *
+ * @return Returns True if the variable is tracked, False if it is always
+ *possibly modified.
+ **/
+static PyObject *track(PyObject *self, PyObject *args) {
+  PyObject *capsule, *name, *obj;
+  if (!PyArg_ParseTuple(args, "OUO", &capsule, &name, &obj)) {
+    return NULL;
+  }
+  dirtyTracker *tracker = get_tracker(capsule);
+  if (tracker == NULL) {
+    return NULL;
+  }
+  int ret = track_variable(tracker, name, obj);
+  if (ret == -1) {
+    return NULL;
+  }
+  return PyBool_FromLong(ret);
+}
+
+/**
+ * Python interface: stops tracking a variable.
+ **/
+static PyObject *untrack(PyObject *self, PyObject *args) {
+  PyObject *capsule, *name;
+  if (!PyArg_ParseTuple(args, "OU", &capsule, &name)) {
+    return NULL;
+  }
+  dirtyTracker *tracker = get_tracker(capsule);
+  if (tracker == NULL || untrack_variable(tracker, name) == -1) {
+    return NULL;
+  }
+  Py_RETURN_NONE;
+}
+
+/**
+ * Python interface: whether a variable is tracked.
+ **/
+static PyObject *is_tracked(PyObject *self, PyObject *args) {
+  PyObject *capsule, *name;
+  if (!PyArg_ParseTuple(args, "OU", &capsule, &name)) {
+    return NULL;
+  }
+  dirtyTracker *tracker = get_tracker(capsule);
+  if (tracker == NULL) {
+    return NULL;
+  }
+  int contains = PyDict_Contains(tracker->watched, name);
+  if (contains == -1) {
+    return NULL;
+  }
+  return PyBool_FromLong(contains);
+}
+
+/**
+ * Python interface: takes the dirty set of a tracker, which is then emptied.
+ *
+ * @return Returns the set of names written to since the last call, or None if
+ *the whole namespace may have been modified.
+ **/
+static PyObject *pop_dirty(PyObject *self, PyObject *args) {
+  PyObject *capsule;
+  if (!PyArg_ParseTuple(args, "O", &capsule)) {
+    return NULL;
+  }
+  dirtyTracker *tracker = get_tracker(capsule);
+  if (tracker == NULL) {
+    return NULL;
+  }
+  PyObject *empty = PySet_New(NULL);
+  if (empty == NULL) {
+    return NULL;
+  }
+  PyObject *dirty = tracker->dirty;
+  tracker->dirty = empty;
+  if (tracker->all_dirty) {
+    tracker->all_dirty = false;
+    Py_DECREF(dirty);
+    Py_RETURN_NONE;
+  }
+  return dirty;
+}
+
+static PyMethodDef DirtyTrackerMethods[] = {
+    {"watchers_available", watchers_available, METH_NOARGS,
+     "Return True if dict and type watchers are supported."},
+    {"create", create_tracker, METH_VARARGS,
+     "Create a tracker of the variables of a namespace dict."},
+    {"track", track, METH_VARARGS,
+     "Track a variable and return True if it is tracked."},
+    {"untrack", untrack, METH_VARARGS, "Stop tracking a variable."},
+    {"is_tracked", is_tracked, METH_VARARGS,
+     "Return True if a variable is tracked."},
+    {"pop_dirty", pop_dirty, METH_VARARGS,
+     "Return and clear the set of dirty variables, or None if all may be "
+     "dirty."},
+    {NULL, NULL, 0, NULL}};
+
+/**
+ * A PyModuleDef structure that defines the dirty tracker module.
+ **/
+static struct PyModuleDef dirtytrackermodule = {
+    PyModuleDef_HEAD_INIT, "c_dirty_tracker",
+    "Dirty sets of namespace variables from dict and type watchers", -1,
+    DirtyTrackerMethods};
+
+/**
+ * Initializes the dirty tracker module.
+ *
+ * @return The Python module object.
+ **/
+PyMODINIT_FUNC PyInit_c_dirty_tracker(void) {
+  return PyModule_Create(&dirtytrackermodule);
+}
@@ -0,0 +1,81 @@
+#include "hash_cache_c.h"
+
+// Number of entries allocated when the first entry is added
+#define HASH_CACHE_INITIAL_CAPACITY 64
+
+/*
+* Return: the entry of obj, or NULL if obj is not cached
+*/
+HashCacheEntry* hash_cache_get(HashCache *cache, PyObject *obj) {
+    if (cache->count == 0)
+        return NULL;
+    int64_t i = idmap_get(&(cache->index), (uint64_t)(uintptr_t)obj);
+    return i == IDMAP_MISSING ? NULL : &(cache->entries[i]);
+}
+
+/*
+* Adds an entry for obj, which must not be cached yet
+* Return: 0 on success, -1 if out of memory
+*/
+int hash_cache_put(HashCache *cache, PyObject *obj, XXH64_hash_t digest, size_t chunk_size, bool immutable) {
+    if (!cache->entries) {
+        if (idmap_init(&(cache->index), HASH_CACHE_INITIAL_CAPACITY) == -1)
+            return -1;
+        cache->entries = (HashCacheEntry*) malloc(HASH_CACHE_INITIAL_CAPACITY * sizeof(HashCacheEntry));
+        if (!cache->entries) {
+            idmap_free(&(cache->index));
+            return -1;
+        }
+        cache->capacity = HASH_CACHE_INITIAL_CAPACITY;
+    }
+    if (cache->count == cache->capacity) {
+        HashCacheEntry *entries = (HashCacheEntry*) realloc(cache->entries, 2 * cache->capacity * sizeof(HashCacheEntry));
+        if (!entries)
+            return -1;
+        cache->entries = entries;
+        cache->capacity *= 2;
+    }
+
+    if (idmap_put(&(cache->index), (uint64_t)(uintptr_t)obj, (int64_t)cache->count, NULL) == -1)
+        return -1;
+    HashCacheEntry *entry = &(cache->entries[cache->count++]);
+    Py_INCREF(obj);
+    entry->obj = obj;
+    entry->digest = digest;
+    entry->chunk_size = chunk_size;
+    entry->immutable = immutable;
+    return 0;
+}
+
+/*
+* Drops the entries of objects that are only referenced by the cache, i.e. that
+* were deleted by the program since they were cached.
+*/
+void hash_cache_prune(HashCache *cache) {
+    size_t i = 0;
+    while (i < cache->count) {
+        PyObject *obj = cache->entries[i].obj;
+        if (Py_REFCNT(obj) > 1) {
+            i++;
+            continue;
+        }
+        // Move the last entry into the freed position
+        idmap_remove(&(cache->index), (uint64_t)(uintptr_t)obj);
+        cache->count--;
+        if (i != cache->count) {
+            cache->entries[i] = cache->entries[cache->count];
+            idmap_put(&(cache->index), (uint64_t)(uintptr_t)(cache->entries[i].obj), (int64_t)i, NULL);
+        }
+        Py_DECREF(obj);
+    }
+}
+
+void hash_cache_clear(HashCache *cache) {
+    for (size_t i = 0; i < cache->count; i++)
+        Py_DECREF(cache->entries[i].obj);
+    free(cache->entries);
+    idmap_free(&(cache->index));
+    cache->entries = NULL;
+    cache->count = 0;
+    cache->capacity = 0;
+}
@@ -0,0 +1,36 @@
+#ifndef _HASH_CACHE_C_H
+#define _HASH_CACHE_C_H
+
+#include <Python.h>
+#include <stdbool.h>
+#include "idmap_c.h"
+#include "xxh_x86dispatch.h"
+
+/*
+* A cached subtree. The cache holds a reference to obj, so its address can't be
+* reused by another object while the entry exists.
+*/
+typedef struct HashCacheEntry {
+    PyObject *obj;
+    XXH64_hash_t digest;
+    size_t chunk_size;  // hash_chunk_size the digest was computed with
+    bool immutable;  // false: the subtree holds mutable objects and is not cached
+} HashCacheEntry;
+
+/*
+* Persistent cache of subtree digests across hashing passes, keyed by object
+* address. Entries are stored densely; index maps addresses to entry positions.
+*/
+typedef struct HashCache {
+    IdMap index;
+    HashCacheEntry *entries;
+    size_t count;
+    size_t capacity;
+} HashCache;
+
+HashCacheEntry* hash_cache_get(HashCache *cache, PyObject *obj);
+int hash_cache_put(HashCache *cache, PyObject *obj, XXH64_hash_t digest, size_t chunk_size, bool immutable);
+void hash_cache_prune(HashCache *cache);
+void hash_cache_clear(HashCache *cache);
+
+#endif /* _HASH_CACHE_C_H */
@@ -1,7 +1,11 @@
 #include <Python.h>
 #include <stdbool.h>
+#include "buffer_hash_c.h"
+#include "hash_cache_c.h"
 #include "hash_visitor_c.h"
-#include "xxhash.h"
+#include "sampled_hash_c.h"
+#include "stats_c.h"
+#include "xxh_x86dispatch.h"
 
 
 /*
@@ -10,13 +14,8 @@
 */
 VisitorReturnType* hash_has_visited(PyObject *obj, Visited *visited, const bool include_id, VisitorReturnType* state) {
     // Implementation specific to HashVisitor
-
-    Visited* current = visited;
-    while(current != NULL) {
-        if (current->pyObject == obj)
-            return state;
-        current = current->next;
-    }
+    if (visited_contains(visited, obj))
+        return state;
     return NULL;
 }
 
@@ -65,10 +64,10 @@ VisitorReturnType* hash_visit_primitive(PyObject *obj, VisitorReturnType* state,
         const char* data = PyUnicode_AsUTF8AndSize(obj, &length);
         XXH3_64bits_update(state->hashed_state, &TYPE_STR, sizeof(TYPE_STR));
         XXH3_64bits_update(state->hashed_state, data, (size_t)length); 
+        STATS_ADD(bytes_hashed, length);
     }  else {
         // Set TypeError for unknown primitive type
         PyErr_SetString(PyExc_TypeError, "Unsupported object type for hashing");
-        XXH3_freeState(state->hashed_state);
         return NULL;
     }
 
@@ -84,10 +83,8 @@ VisitorReturnType* hash_visit_tuple(PyObject *obj, Visited **visited, const bool
 }
 
 VisitorReturnType* hash_visit_list(PyObject *obj, Visited **visited, const bool include_id, VisitorReturnType* state, PyObject* list_included, const bool include_trav) {
-    Visited *new_node = (Visited*) (malloc(sizeof(Visited)));
-    new_node->next = *visited;
-    new_node->pyObject = obj;
-    *visited = new_node;
+    if (visited_add(*visited, obj) == -1)
+        return NULL;
 
     if (include_id) {
         /* Hash id */
@@ -101,10 +98,8 @@ VisitorReturnType* hash_visit_list(PyObject *obj, Visited **visited, const bool
 }
 
 VisitorReturnType* hash_visit_set(PyObject *obj, Visited **visited, const bool include_id, VisitorReturnType* state, PyObject* list_included, const bool include_trav) {
-    Visited *new_node = (Visited*) (malloc(sizeof(Visited)));
-    new_node->next = *visited;
-    new_node->pyObject = obj;
-    *visited = new_node;
+    if (visited_add(*visited, obj) == -1)
+        return NULL;
 
     if (include_id) {
         size_t obj_id = (size_t)obj;
@@ -117,10 +112,8 @@ VisitorReturnType* hash_visit_set(PyObject *obj, Visited **visited, const bool i
 }
 
 VisitorReturnType* hash_visit_dict(PyObject *obj, Visited **visited, const bool include_id, VisitorReturnType* state, PyObject* list_included, const bool include_trav) {
-    Visited *new_node = (Visited*) (malloc(sizeof(Visited)));
-    new_node->next = *visited;
-    new_node->pyObject = obj;
-    *visited = new_node;
+    if (visited_add(*visited, obj) == -1)
+        return NULL;
 
     if (include_id) {
         size_t obj_id = (size_t)obj;
@@ -132,6 +125,44 @@ VisitorReturnType* hash_visit_dict(PyObject *obj, Visited **visited, const bool
     return state;
 }
 
+/*
+* Hashes the contiguous memory of obj, in chunked mode if it is enabled in state
+* and the memory is larger than one chunk. Large memory is hashed with the GIL
+* released; obj stays exported meanwhile so e.g. a bytearray can't be resized.
+* In sampled mode, the memory of large mutable objects is sampled instead
+* (bytes can't change, and their digests are cached).
+* Return: 0 on success, -1 on error
+*/
+int hash_data(PyObject *obj, const char* data, size_t length, VisitorReturnType* state) {
+    if (state->sample && length >= state->sample->threshold && !PyBytes_Check(obj)) {
+        sample_hash_buffer(state->hashed_state, data, length, state->sample);
+        return 0;
+    }
+
+    STATS_ADD(bytes_hashed, length);
+    if (length < BUFFER_HASH_NOGIL_THRESHOLD) {
+        XXH3_64bits_update(state->hashed_state, data, length);
+        return 0;
+    }
+
+    Py_buffer view;
+    if (PyObject_GetBuffer(obj, &view, PyBUF_SIMPLE) == -1)
+        return -1;
+
+    int ret = 0;
+    Py_BEGIN_ALLOW_THREADS
+    if (state->hash_chunk_size == 0 || length <= state->hash_chunk_size)
+        XXH3_64bits_update(state->hashed_state, data, length);
+    else
+        ret = hash_buffer_chunked(state->hashed_state, data, length, state->hash_chunk_size, state->hash_num_threads);
+    Py_END_ALLOW_THREADS
+
+    PyBuffer_Release(&view);
+    if (ret == -1)
+        PyErr_NoMemory();
+    return ret;
+}
+
 VisitorReturnType* hash_visit_byte(PyObject *obj, Visited **visited, const bool include_id, VisitorReturnType* state, PyObject* list_included, const bool include_trav) {
     /* Python - bytes or bytearray */
     char *data;
@@ -158,7 +189,8 @@ VisitorReturnType* hash_visit_byte(PyObject *obj, Visited **visited, const bool
     }
 
     /* Hash value */
-    XXH3_64bits_update(state->hashed_state, data, (size_t)length);
+    if (hash_data(obj, data, (size_t)length, state) == -1)
+        return NULL;
 
     if (include_trav)
         PyList_Append(list_included, obj);
@@ -179,15 +211,59 @@ VisitorReturnType* hash_visit_type(PyObject *obj, Visited **visited, const bool
     return state;
 }
 
+/*
+* Hashes an object exposing the buffer protocol (e.g. numpy arrays) from its raw
+* memory: item format, item size, shape, strides and the items in logical order.
+* This replaces hashing the __reduce_ex__ output, which copies the data to bytes.
+* As for other custom objects, the id of the object is hashed as well.
+*/
+VisitorReturnType* hash_visit_buffer(PyObject *obj, Py_buffer *view, Visited **visited, const bool include_id, VisitorReturnType* state, PyObject* list_included, const bool include_trav) {
+    if (visited_add(*visited, obj) == -1)
+        return NULL;
+
+    hash_update_state_id(obj, state, list_included, include_trav);
+
+    /* Hash type */
+    XXH3_64bits_update(state->hashed_state, &TYPE_BUFFER, sizeof(TYPE_BUFFER));
+
+    /* Hash layout */
+    const char* format = view->format ? view->format : "B";
+    XXH3_64bits_update(state->hashed_state, format, strlen(format));
+    XXH3_64bits_update(state->hashed_state, &(view->itemsize), sizeof(view->itemsize));
+    XXH3_64bits_update(state->hashed_state, &(view->ndim), sizeof(view->ndim));
+    if (view->ndim > 0) {
+        XXH3_64bits_update(state->hashed_state, view->shape, view->ndim * sizeof(Py_ssize_t));
+        XXH3_64bits_update(state->hashed_state, view->strides, view->ndim * sizeof(Py_ssize_t));
+    }
+
+    /* Hash value */
+    if (PyBuffer_IsContiguous(view, 'C'))
+        return hash_data(obj, (const char*) view->buf, (size_t)view->len, state) == -1 ? NULL : state;
+    // Strided buffers can't be sampled, but are skipped past the deadline all the same
+    if (state->sample && (size_t)view->len >= state->sample->threshold && sample_deadline_passed(state->sample))
+        return state;
+    // view keeps the memory exported while the GIL is released
+    STATS_ADD(bytes_hashed, view->len);
+    int ret;
+    bool release_gil = view->len >= BUFFER_HASH_NOGIL_THRESHOLD;
+    PyThreadState *thread_state = release_gil ? PyEval_SaveThread() : NULL;
+    ret = hash_strided_buffer(state->hashed_state, (const char*) view->buf, view->ndim, view->shape, view->strides, view->itemsize);
+    if (release_gil)
+        PyEval_RestoreThread(thread_state);
+    if (ret == -1) {
+        PyErr_SetString(PyExc_ValueError, "Too many dimensions for hashing buffer");
+        return NULL;
+    }
+    return state;
+}
+
 VisitorReturnType* hash_visit_callable(PyObject *obj, Visited **visited, const bool include_id, VisitorReturnType* state, PyObject* list_included, const bool include_trav) {
 
 
     if (include_id) {
-        Visited *new_node = (Visited*) (malloc(sizeof(Visited)));
-        new_node->next = *visited;
-        new_node->pyObject = obj;
-        *visited = new_node;
-        
+        if (visited_add(*visited, obj) == -1)
+            return NULL;
+
         size_t obj_id = (size_t)obj;
         XXH3_64bits_update(state->hashed_state, &obj_id, sizeof(obj_id));
 
@@ -199,25 +275,295 @@ VisitorReturnType* hash_visit_callable(PyObject *obj, Visited **visited, const b
 }
 
 VisitorReturnType* hash_visit_custom_obj(PyObject *obj, Visited **visited, const bool include_id, VisitorReturnType* state, PyObject* list_included, const bool include_trav) {
-    Visited *new_node = (Visited*) (malloc(sizeof(Visited)));
-    new_node->next = *visited;
-    new_node->pyObject = obj;
-    *visited = new_node;
+    if (visited_add(*visited, obj) == -1)
+        return NULL;
 
     return state;
 }
 
-void hash_free_contents(Visited *visited, VisitorReturnType* state) {
-    Visited* head = visited;
-    Visited* temp;
+// Digests of immutable subtrees, kept across hashing passes
+static HashCache hash_cache = {0};
+
+/*
+* Checks whether the hash of obj may be cached: large str and bytes, and large
+* tuples (whose contents have yet to be checked with is_immutable_subtree)
+*/
+static bool is_cacheable(PyObject *obj) {
+    if (PyUnicode_Check(obj))
+        return PyUnicode_GET_LENGTH(obj) >= HASH_CACHE_MIN_SIZE;
+    if (PyBytes_Check(obj))
+        return PyBytes_GET_SIZE(obj) >= HASH_CACHE_MIN_SIZE;
+    if (PyTuple_Check(obj))
+        return PyTuple_GET_SIZE(obj) >= HASH_CACHE_MIN_ITEMS;
+    return false;
+}
+
+// Result of check_immutable for tuples whose items remain to be checked
+#define IMMUTABLE_UNKNOWN 2
+
+/*
+* Checks obj without looking at its items, see is_immutable_subtree
+* Return: 1 if obj is immutable, 0 if not, IMMUTABLE_UNKNOWN for tuples not in the cache
+*/
+static int check_immutable(PyObject *obj) {
+    if (is_primitive(obj) || PyBytes_Check(obj))
+        return 1;
+    if (!PyTuple_Check(obj))
+        return 0;
+
+    HashCacheEntry *entry = hash_cache_get(&hash_cache, obj);
+    if (entry)
+        return entry->immutable;
+    return IMMUTABLE_UNKNOWN;
+}
+
+/*
+* Caches the digest of obj, or replaces its entry
+* Return: 0 on success, -1 on memory error
+*/
+static int cache_subtree(PyObject *obj, XXH64_hash_t digest, size_t chunk_size, bool immutable) {
+    HashCacheEntry *entry = hash_cache_get(&hash_cache, obj);
+    if (entry) {
+        entry->digest = digest;
+        entry->chunk_size = chunk_size;
+        entry->immutable = immutable;
+        return 0;
+    }
+    if (hash_cache_put(&hash_cache, obj, digest, chunk_size, immutable) == -1) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    return 0;
+}
+
+/*
+* Checks whether obj only consists of primitives, bytes and tuples. Such a
+* subtree never changes and its objects are never added to the visited set, so
+* its hash is the same in every pass and in every position of the traversal.
+* Nested tuples are walked from the traversal stack of the visitor. The large
+* tuples on the path to a mutable object are remembered as mutable, so they are
+* not walked again when the traversal reaches them.
+* Return: 1 if obj is immutable, 0 if not, -1 on memory error
+*/
+static int is_immutable_subtree(PyObject *obj, TraversalStack *stack) {
+    size_t base = stack->count;
+    int immutable = check_immutable(obj);
+    while (immutable) {
+        if (immutable == IMMUTABLE_UNKNOWN) {
+            Py_INCREF(obj);
+            if (traversal_push(stack, FRAME_TUPLE, obj, NULL, 0, PyTuple_GET_SIZE(obj), false, NULL) == -1) {
+                immutable = -1;
+                break;
+            }
+        }
+        // Next item of the innermost tuple with unchecked items
+        while (stack->count > base && stack->frames[stack->count - 1].index == stack->frames[stack->count - 1].size)
+            traversal_pop(stack);
+        if (stack->count == base) {
+            immutable = 1;
+            break;
+        }
+        TraversalFrame *frame = &(stack->frames[stack->count - 1]);
+        obj = PyTuple_GET_ITEM(frame->items, frame->index++);
+        immutable = check_immutable(obj);
+    }
+    for (size_t i = base; immutable == 0 && i < stack->count; i++) {
+        PyObject *tuple = stack->frames[i].items;
+        if (is_cacheable(tuple) && cache_subtree(tuple, 0, 0, false) == -1)
+            immutable = -1;
+    }
+    while (stack->count > base)
+        traversal_pop(stack);
+    return immutable;
+}
+
+/*
+* Return: a copy of state hashing into a fresh XXH3 state, or NULL on memory error
+*/
+static VisitorReturnType* create_subtree_state(const VisitorReturnType* state) {
+    VisitorReturnType* subtree_state = (VisitorReturnType*) malloc(sizeof(VisitorReturnType));
+    XXH3_state_t* hashed_state = XXH3_createState();
+    if (!subtree_state || !hashed_state) {
+        free(subtree_state);
+        XXH3_freeState(hashed_state);
+        PyErr_NoMemory();
+        return NULL;
+    }
+    STATS_ADD(allocations, 2);
+    *subtree_state = *state;
+    subtree_state->hashed_state = hashed_state;
+    XXH3_64bits_reset(hashed_state);
+    return subtree_state;
+}
+
+static void free_subtree_state(VisitorReturnType* subtree_state) {
+    XXH3_freeState(subtree_state->hashed_state);
+    free(subtree_state);
+}
+
+/*
+* Pops the top frame of a subtree pushed at base (see hash_subtree), and frees
+* its state if it is its own
+*/
+static void pop_subtree_frame(TraversalStack *stack, size_t base) {
+    VisitorReturnType* frame_state = stack->frames[stack->count - 1].state;
+    bool own_state = stack->count - 1 == base || frame_state != stack->frames[stack->count - 2].state;
+    traversal_pop(stack);
+    if (own_state)
+        free_subtree_state(frame_state);
+}
+
+/*
+* Hashes the immutable subtree obj into a fresh state, as get_object_state with
+* hash_visit_immutable would, but bottom-up from the traversal stack: large
+* nested tuples hash into states of their own, and their digests are cached and
+* added to the enclosing tuple when they are popped. Each tuple of the subtree
+* is thus hashed once, without recursing.
+* Return: 0 and the digest in digest on success, -1 on error
+*/
+static int hash_subtree(PyObject *obj, Visitor *visitor, const bool include_id, VisitorReturnType* state, const bool include_trav, XXH64_hash_t *digest) {
+    VisitorReturnType* subtree_state = create_subtree_state(state);
+    if (!subtree_state)
+        return -1;
+
+    if (!PyTuple_Check(obj)) {
+        VisitorReturnType* ret;
+        if (PyBytes_Check(obj))
+            ret = visitor->visit_byte(obj, &(visitor->visited), include_id, subtree_state, visitor->list_included, include_trav);
+        else
+            ret = visitor->visit_primitive(obj, subtree_state, visitor->list_included, include_trav);
+        *digest = XXH3_64bits_digest(subtree_state->hashed_state);
+        free_subtree_state(subtree_state);
+        return ret ? 0 : -1;
+    }
+
+    TraversalStack *stack = &(visitor->stack);
+    size_t base = stack->count;
+    if (!visitor->visit_tuple(obj, &(visitor->visited), include_id, subtree_state, visitor->list_included, include_trav)) {
+        free_subtree_state(subtree_state);
+        return -1;
+    }
+    Py_INCREF(obj);
+    if (traversal_push(stack, FRAME_TUPLE, obj, NULL, 0, PyTuple_GET_SIZE(obj), include_id, subtree_state) == -1) {
+        free_subtree_state(subtree_state);
+        return -1;
+    }
 
-    while (head != NULL) {
-        temp = head->next;
-        free(head);
-        head = temp;
+    while (stack->count > base) {
+        TraversalFrame *frame = &(stack->frames[stack->count - 1]);
+        if (frame->index == frame->size) {
+            VisitorReturnType* outer_state = stack->count - 1 > base ? stack->frames[stack->count - 2].state : NULL;
+            if (frame->state != outer_state) {
+                *digest = XXH3_64bits_digest(frame->state->hashed_state);
+                if (outer_state) {
+                    if (cache_subtree(frame->items, *digest, state->hash_chunk_size, true) == -1)
+                        goto error;
+                    XXH3_64bits_update(outer_state->hashed_state, &TYPE_SUBTREE, sizeof(TYPE_SUBTREE));
+                    XXH3_64bits_update(outer_state->hashed_state, digest, sizeof(*digest));
+                }
+            }
+            pop_subtree_frame(stack, base);
+            continue;
+        }
+
+        PyObject *item = PyTuple_GET_ITEM(frame->items, frame->index++);
+        const bool item_include_id = frame->include_id;
+        VisitorReturnType* item_state = frame->state;
+        if (!PyTuple_Check(item)) {
+            if (!get_object_state(item, visitor, item_include_id, item_state, include_trav))
+                goto error;
+            continue;
+        }
+
+        STATS_INC(objects_visited);
+        bool cacheable = is_cacheable(item);
+        if (cacheable) {
+            HashCacheEntry *entry = include_trav ? NULL : hash_cache_get(&hash_cache, item);
+            if (entry && entry->chunk_size == state->hash_chunk_size) {
+                XXH3_64bits_update(item_state->hashed_state, &TYPE_SUBTREE, sizeof(TYPE_SUBTREE));
+                XXH3_64bits_update(item_state->hashed_state, &(entry->digest), sizeof(entry->digest));
+                continue;
+            }
+            item_state = create_subtree_state(state);
+            if (!item_state)
+                goto error;
+        }
+        if (!visitor->visit_tuple(item, &(visitor->visited), item_include_id, item_state, visitor->list_included, include_trav)) {
+            if (cacheable)
+                free_subtree_state(item_state);
+            goto error;
+        }
+        Py_INCREF(item);
+        if (traversal_push(stack, FRAME_TUPLE, item, NULL, 0, PyTuple_GET_SIZE(item), item_include_id, item_state) == -1) {
+            if (cacheable)
+                free_subtree_state(item_state);
+            goto error;
+        }
     }
+    return 0;
 
+error:
+    while (stack->count > base)
+        pop_subtree_frame(stack, base);
+    return -1;
+}
+
+/*
+* Hashes large immutable subtrees (see is_cacheable and is_immutable_subtree) as
+* the digest of their own hash. The digest is cached, so a subtree seen in an
+* earlier pass is not traversed again. Chunked buffers hash differently, so a
+* digest computed with another hash_chunk_size is recomputed and replaced. With
+* include_trav, the subtree is always traversed to record its items, which
+* yields the same digest.
+* Return: 1 if obj was hashed, 0 if obj should be hashed as usual, -1 on error
+*/
+int hash_visit_immutable(PyObject *obj, Visitor *visitor, const bool include_id, VisitorReturnType* state, const bool include_trav) {
+    if (!is_cacheable(obj))
+        return 0;
+
+    XXH64_hash_t digest;
+    HashCacheEntry *entry = include_trav ? NULL : hash_cache_get(&hash_cache, obj);
+    if (entry && !entry->immutable)
+        return 0;
+    if (entry && entry->chunk_size == state->hash_chunk_size) {
+        digest = entry->digest;
+    } else {
+        // Large tuples holding mutable objects are remembered by is_immutable_subtree
+        int immutable = entry ? 1 : is_immutable_subtree(obj, &(visitor->stack));
+        if (immutable == -1)
+            return -1;
+        if (!immutable)
+            return 0;
+        if (hash_subtree(obj, visitor, include_id, state, include_trav, &digest) == -1)
+            return -1;
+        if (cache_subtree(obj, digest, state->hash_chunk_size, true) == -1)
+            return -1;
+    }
+
+    XXH3_64bits_update(state->hashed_state, &TYPE_SUBTREE, sizeof(TYPE_SUBTREE));
+    XXH3_64bits_update(state->hashed_state, &digest, sizeof(digest));
+    return 1;
+}
+
+/*
+* Called before each hashing pass: drops the cached subtrees deleted since
+* the last pass, or the whole cache once it holds HASH_CACHE_MAX_ENTRIES
+*/
+void hash_cache_begin_pass() {
+    if (hash_cache.count >= HASH_CACHE_MAX_ENTRIES)
+        hash_cache_clear(&hash_cache);
+    else
+        hash_cache_prune(&hash_cache);
+}
+
+void hash_cache_reset() {
+    hash_cache_clear(&hash_cache);
+}
+
+void hash_free_contents(Visited *visited, VisitorReturnType* state) {
+    visited_free(visited);
     XXH3_freeState(state->hashed_state);
+    free(state);
 }
 
 void hash_update_state_id(PyObject *obj, VisitorReturnType* state, PyObject* list_included, const bool include_trav) {
@@ -229,10 +575,30 @@ void hash_update_state_id(PyObject *obj, VisitorReturnType* state, PyObject* lis
 }
 
 
+/*
+* Return: a new hash visitor, or NULL with an exception set on memory error
+*/
 Visitor* create_hash_visitor() {
     int seed = 0;
     /* Initialze hash visitor */
     Visitor* visitor = (Visitor*) (malloc(sizeof(Visitor)));
+    Visited* visited = visited_create();
+    XXH3_state_t* xxhash_state = XXH3_createState();
+    VisitorReturnType* state = (VisitorReturnType*) (malloc(sizeof(VisitorReturnType)));
+    PyObject* list_included = PyList_New(0);
+    PyObject* keep_alive = PyList_New(0);
+    if (!visitor || !visited || !xxhash_state || !state || !list_included || !keep_alive) {
+        free(visitor);
+        visited_free(visited);
+        XXH3_freeState(xxhash_state);
+        free(state);
+        Py_XDECREF(list_included);
+        Py_XDECREF(keep_alive);
+        PyErr_NoMemory();
+        return NULL;
+    }
+    STATS_ADD(allocations, 3);
+
     /* Initialize hash visitor functions */
     visitor->has_visited = hash_has_visited;
     visitor->handle_visited = hash_handle_visited;
@@ -244,24 +610,29 @@ Visitor* create_hash_visitor() {
     visitor->visit_dict = hash_visit_dict;
     visitor->visit_byte = hash_visit_byte;
     visitor->visit_type = hash_visit_type;
+    visitor->visit_buffer = hash_visit_buffer;
     visitor->visit_callable = hash_visit_callable;
     visitor->visit_custom_obj = hash_visit_custom_obj;
 
+    visitor->visit_immutable = hash_visit_immutable;
     visitor->update_state_id = hash_update_state_id;
     visitor->free_contents = hash_free_contents;
 
-    visitor->visited = NULL;
+    visitor->visited = visited;
+    visitor->stack = (TraversalStack){NULL, 0, 0};
 
-    XXH3_state_t* xxhash_state = XXH3_createState();
     XXH3_64bits_reset_withSeed(xxhash_state, seed);
-
-    VisitorReturnType* state = (VisitorReturnType*) (malloc(sizeof(VisitorReturnType*)));
     state->hashed_state = xxhash_state;
+    state->hash_chunk_size = 0;
+    state->hash_num_threads = 1;
+    state->size = NULL;
+    state->sample = NULL;
 
     /* Initialize hash visitor state */
     visitor->state = state;
 
-    visitor->list_included = PyList_New(0);
+    visitor->list_included = list_included;
+    visitor->keep_alive = keep_alive;
     
     return visitor;
 }
@@ -3,6 +3,15 @@
 
 #include "visitor_c.h"
 
+// Smallest str (in code points) or bytes (in bytes) whose digest is cached across calls
+#define HASH_CACHE_MIN_SIZE 4096
+
+// Smallest tuple whose digest is cached across calls, if it only holds immutable objects
+#define HASH_CACHE_MIN_ITEMS 64
+
+// Number of cached digests at which the cache is emptied
+#define HASH_CACHE_MAX_ENTRIES (1 << 20)
+
 // typedef struct HashVisitor {
 //     Visitor base; // First member is Visitor
 //     // Additional members specific to HashVisitor
@@ -17,10 +26,16 @@ VisitorReturnType* hash_visit_tuple(PyObject *obj, Visited **visited, const bool
 VisitorReturnType* hash_visit_list(PyObject *obj, Visited **visited, const bool include_id, VisitorReturnType* state, PyObject* list_included, const bool include_trav);
 VisitorReturnType* hash_visit_set(PyObject *obj, Visited **visited, const bool include_id, VisitorReturnType* state, PyObject* list_included, const bool include_trav);
 VisitorReturnType* hash_visit_dict(PyObject *obj, Visited **visited, const bool include_id, VisitorReturnType* state, PyObject* list_included, const bool include_trav);
+int hash_data(PyObject *obj, const char* data, size_t length, VisitorReturnType* state);
 VisitorReturnType* hash_visit_byte(PyObject *obj, Visited **visited, const bool include_id, VisitorReturnType* state, PyObject* list_included, const bool include_trav);
 VisitorReturnType* hash_visit_type(PyObject *obj, Visited **visited, const bool include_id, VisitorReturnType* state, PyObject* list_included, const bool include_trav);
+VisitorReturnType* hash_visit_buffer(PyObject *obj, Py_buffer *view, Visited **visited, const bool include_id, VisitorReturnType* state, PyObject* list_included, const bool include_trav);
 VisitorReturnType* hash_visit_callable(PyObject *obj, Visited **visited, const bool include_id, VisitorReturnType* state, PyObject* list_included, const bool include_trav);
 VisitorReturnType* hash_visit_custom_obj(PyObject *obj, Visited **visited, const bool include_id, VisitorReturnType* state, PyObject* list_included, const bool include_trav);
+void hash_update_state_id(PyObject *obj, VisitorReturnType* state, PyObject* list_included, const bool include_trav);
+int hash_visit_immutable(PyObject *obj, Visitor *visitor, const bool include_id, VisitorReturnType* state, const bool include_trav);
+void hash_cache_begin_pass();
+void hash_cache_reset();
 void hash_free_contents(Visited *visited, VisitorReturnType* state);
 // PyObject* get_obj_id(PyObject *v);
 
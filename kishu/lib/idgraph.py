@@ -1,5 +1,5 @@
 import c_idgraph
-from typing import Any
+from typing import Any, Iterable, List, Tuple
 
 
 class IDGraph:
@@ -24,6 +24,70 @@ class IDGraph:
         """
         return c_idgraph.compare_graph(self.__cObject, graph.__cObject)
 
+    def compare_object(self, obj: Any) -> bool:
+        """
+            Compares the IdGraph with the current state of an object, without building the IdGraph of the object:
+            the object is traversed alongside the IdGraph until the first difference.
+
+            :param obj: The object to compare self with, e.g., the referenced object after it may have changed
+            :type obj: Any
+
+            :return: This method returns True if the IdGraph of obj would be the same as self, False otherwise
+            :rtype: boolean
+        """
+        return c_idgraph.compare_graph_object(self.__cObject, obj)
+
+    def update(self, obj: Any) -> bool:
+        """
+            Makes the IdGraph a snapshot of the current state of an object. The snapshot is reused if the object
+            is unchanged, in which case nothing is allocated.
+
+            :param obj: The object to snapshot
+            :type obj: Any
+
+            :return: This method returns True if the IdGraph changed, False otherwise
+            :rtype: boolean
+        """
+        self.obj = obj
+        graph = c_idgraph.update_idgraph(self.__cObject, obj)
+        changed = graph is not self.__cObject
+        self.__cObject = graph
+        return changed
+
+    @staticmethod
+    def compare_many(pairs: Iterable[Tuple["IDGraph", "IDGraph"]]) -> List[bool]:
+        """
+            Compares many pairs of IdGraphs in one native call.
+
+            :param pairs: (IDGraph, IDGraph) pairs to compare
+            :type pairs: Iterable[Tuple[IDGraph, IDGraph]]
+
+            :return: This method returns, for each pair, True if the 2 IDGraphs are the same
+            :rtype: List[boolean]
+        """
+        return c_idgraph.compare_graphs([(graph1.__cObject, graph2.__cObject) for graph1, graph2 in pairs])
+
+    @classmethod
+    def from_bytes(cls, data: bytes) -> "IDGraph":
+        """
+            Rebuilds an IdGraph from its binary encoding (see to_bytes). The rebuilt IdGraph can be
+            compared with other IdGraphs, but has no referenced object.
+
+            :param data: The binary encoding of an IdGraph
+            :type data: bytes
+
+            :return: This method returns the rebuilt IdGraph
+            :rtype: IDGraph
+        """
+        graph = cls.__new__(cls)
+        graph.obj = None
+        graph.__cObject = c_idgraph.idgraph_from_bytes(data)
+        return graph
+
+    def to_bytes(self) -> bytes:
+        """Get the compact binary encoding of the Id Graph, for persisting it across sessions."""
+        return c_idgraph.idgraph_bytes(self.__cObject)
+
     def get_obj_id(self) -> int:
         return c_idgraph.idgraph_obj_id(self.__cObject)
 
@@ -3,19 +3,31 @@
 #include <stdbool.h>
 #include <string.h>
 
-#include "cJSON.h"
+#include "arena_c.h"
+#include "buffer_hash_c.h"
+#include "idmap_c.h"
 #include "numpy/arrayobject.h"
-#include "xxhash.h"
+#include "stats_c.h"
+#include "type_dispatch_c.h"
+#include "xxh_x86dispatch.h"
+
+// Initial number of node slots in an ID graph.
+#define INITIAL_GRAPH_CAPACITY 64
+
+// Index used for a missing node, e.g. the parent of the root.
+#define NO_NODE (-1)
 
 // Forward declaration
-typedef struct idGraphNode idGraphNode;
-idGraphNode *create_id_graph();
+typedef struct idGraph idGraph;
+Py_ssize_t add_object_node(PyObject *obj, Py_ssize_t parent, idGraph *graph);
 
 /**
  * A union to represent obj_value idGraphPrimitiveValue.
  *
- * @member "next" Pointer to the next node.
- * @member "child" Pointer to the idGraphNode represented by the node.
+ * @member "obj_int" Value for integer types and digest for buffer types.
+ * @member "obj_float" Value for float types.
+ * @member "obj_bool" Value for bool types.
+ * @member "obj_str" Value for string types.
  **/
 typedef union {
   long long obj_int;    // Value for integer types
@@ -24,25 +36,6 @@ typedef union {
   const char *obj_str;  // Value for string types
 } idGraphPrimitiveValue;
 
-/**
- * A struct to represent a linkedlist node holding an idGraphNode.
- *
- * @member "next" Pointer to the next node.
- * @member "child" Pointer to the idGraphNode represented by the node.
- **/
-typedef struct idGraphNodeList {
-  struct idGraphNodeList *next;
-  idGraphNode *child;
-} idGraphNodeList;
-
-/**
- * A struct to represent an ID Graph node.
- * @member "obj_id" Unique object id (memory address).
- * @member "obj_type" Type of object.
- * @member "is_primitive" If node represents a primitive type.
- * @member "primitive" Union that holds primitive value.
- * @member "children" Head of a linklist representing children of the object.
- **/
 enum IdGraphObjectType {
   OBJ_TYPE_INT,
   OBJ_TYPE_FLOAT,
@@ -53,6 +46,7 @@ enum IdGraphObjectType {
   OBJ_TYPE_DICT,
   OBJ_TYPE_SET,
   OBJ_TYPE_CLASS,
+  OBJ_TYPE_BUFFER,
 };
 
 char *getobjectTypeName(enum IdGraphObjectType graphObjectType) {
@@ -75,157 +69,922 @@ char *getobjectTypeName(enum IdGraphObjectType graphObjectType) {
       return "set";
     case OBJ_TYPE_CLASS:
       return "class";
+    case OBJ_TYPE_BUFFER:
+      return "buffer";
     default:
       return "unknown";
   }
 }
 
-struct idGraphNode {
-  long obj_id;                      // Pointer to memory address
-  enum IdGraphObjectType obj_type;  // Type of object
-  bool is_primitive;
-  idGraphPrimitiveValue primitive;  // Union to the primitive value
-  idGraphNodeList *children;
+enum IdGraphFrameKind {
+  FRAME_SEQUENCE,  // List or tuple
+  FRAME_DICT,
+  FRAME_SET,
+  FRAME_CLASS,    // Class instance: its attributes
+  FRAME_NDARRAY,  // Numpy array: its attributes, then its shape and data
+  FRAME_PANDAS,   // Pandas object: the axes and blocks of its BlockManager
+};
+
+enum IdGraphFrameStep {
+  FRAME_STEP_ITEMS,  // Items or attributes
+  FRAME_STEP_SHAPE,  // Dimensions of a numpy array
+  FRAME_STEP_DATA,   // Elements of a numpy array of Python objects
+};
+
+/**
+ * A container node whose children remain to be added to the ID graph.
+ *
+ * @member "kind" Kind of the container.
+ * @member "step" What the next children are; only numpy arrays go past
+ *FRAME_STEP_ITEMS.
+ * @member "obj" The container (owned).
+ * @member "items" Keys of a dict, iterator over a set or attribute names of a
+ *class instance (owned, or NULL).
+ * @member "values" Values of a dict (owned, or NULL).
+ * @member "pending" Attribute value to add below the node of its name, which
+ *is the last child (owned, or NULL).
+ * @member "node" Index of the container node.
+ * @member "previous" Path entry shadowed by node (see mark_visited).
+ * @member "index" Next item of the current step.
+ * @member "size" Number of items of the current step.
+ * @member "last_child" Index of the most recently added child, or NO_NODE.
+ **/
+typedef struct {
+  enum IdGraphFrameKind kind;
+  enum IdGraphFrameStep step;
+  PyObject *obj;
+  PyObject *items;
+  PyObject *values;
+  PyObject *pending;
+  Py_ssize_t node;
+  int64_t previous;
+  Py_ssize_t index;
+  Py_ssize_t size;
+  Py_ssize_t last_child;
+} idGraphFrame;
+
+/**
+ * A struct that holds an ID graph as flat (struct-of-arrays) node columns.
+ *
+ * Nodes are numbered in preorder: a node is appended when it is visited,
+ * before its children, so the root is node 0 and the children of a node
+ * appear in increasing index order. Node i is described by obj_id[i],
+ * obj_type[i], is_primitive[i] and primitive[i].
+ *
+ * The children of node i are child_index[child_offset[i]] up to (excluding)
+ * child_index[child_offset[i + 1]] in insertion order (CSR layout). The CSR
+ * arrays are built from parent once construction finishes.
+ *
+ * While the graph is being built, visited maps the obj_id of each container
+ * on the current traversal path to its node index, to cut cyclic references,
+ * and frames holds the same containers as an explicit stack, innermost last,
+ * so that the depth of an object is only bounded by memory.
+ *
+ * @member "arena" Arena holding the copied strings of the graph.
+ * @member "num_nodes" Number of nodes.
+ * @member "capacity" Allocated length of the node columns.
+ * @member "obj_id" Unique object id (memory address) per node.
+ * @member "obj_type" Type of object per node.
+ * @member "is_primitive" If the node represents a primitive type.
+ * @member "primitive" Union that holds the primitive value per node.
+ * @member "parent" Index of the parent of each node (NO_NODE for the root).
+ * @member "child_offset" CSR offsets into child_index (num_nodes + 1).
+ * @member "child_index" CSR child node indices.
+ * @member "visited" obj_id to node index map of the current traversal path.
+ * @member "frames" Stack of the containers on the current traversal path.
+ * @member "num_frames" Number of frames on the stack.
+ * @member "frame_capacity" Allocated length of frames.
+ * @member "out_of_memory" Set if an allocation failed during construction.
+ * @member "reference" Graph the nodes are compared against instead of being
+ *stored, or NULL (see add_node).
+ * @member "diverged" Set once a node differs from reference; construction
+ *then stops as if out of memory.
+ **/
+struct idGraph {
+  Arena arena;
+  Py_ssize_t num_nodes;
+  Py_ssize_t capacity;
+  long *obj_id;                       // Pointer to memory address
+  enum IdGraphObjectType *obj_type;  // Type of object
+  bool *is_primitive;
+  idGraphPrimitiveValue *primitive;  // Union to the primitive value
+  Py_ssize_t *parent;
+  Py_ssize_t *child_offset;
+  Py_ssize_t *child_index;
+  IdMap visited;
+  idGraphFrame *frames;
+  Py_ssize_t num_frames;
+  Py_ssize_t frame_capacity;
+  bool out_of_memory;
+  const idGraph *reference;
+  bool diverged;
 };
 
 /**
- * Constructs a cJSON object representation of the ID Graph (idGraphNode *).
+ * Allocates an empty ID graph.
+ *
+ * @return Returns the graph, or NULL if out of memory.
+ **/
+idGraph *create_idGraph() {
+  idGraph *graph = (idGraph *)calloc(1, sizeof(idGraph));
+  if (graph == NULL) {
+    return NULL;
+  }
+  arena_init(&graph->arena);
+  if (idmap_init(&graph->visited, 0) == -1) {
+    free(graph);
+    return NULL;
+  }
+  STATS_ADD(allocations, 2);
+  return graph;
+}
+
+/**
+ * Releases an ID graph and every node in it.
+ *
+ * @param graph The graph to free.
+ **/
+void free_idGraph(idGraph *graph) {
+  if (graph == NULL) {
+    return;
+  }
+  free(graph->obj_id);
+  free(graph->obj_type);
+  free(graph->is_primitive);
+  free(graph->primitive);
+  free(graph->parent);
+  free(graph->child_offset);
+  free(graph->child_index);
+  idmap_free(&graph->visited);
+  free(graph->frames);
+  arena_free(&graph->arena);
+  free(graph);
+}
+
+/**
+ * Grows the node columns of a graph to hold at least capacity nodes.
+ *
+ * @param graph The graph to grow.
+ * @param capacity The number of nodes to make room for.
+ *
+ * @return Returns 0 on success, -1 if out of memory.
+ **/
+int reserve_nodes(idGraph *graph, Py_ssize_t capacity) {
+  if (capacity <= graph->capacity) {
+    return 0;
+  }
+  void *obj_id = realloc(graph->obj_id, capacity * sizeof(long));
+  if (obj_id != NULL) graph->obj_id = obj_id;
+  void *obj_type =
+      realloc(graph->obj_type, capacity * sizeof(enum IdGraphObjectType));
+  if (obj_type != NULL) graph->obj_type = obj_type;
+  void *is_primitive = realloc(graph->is_primitive, capacity * sizeof(bool));
+  if (is_primitive != NULL) graph->is_primitive = is_primitive;
+  void *primitive =
+      realloc(graph->primitive, capacity * sizeof(idGraphPrimitiveValue));
+  if (primitive != NULL) graph->primitive = primitive;
+  void *parent = realloc(graph->parent, capacity * sizeof(Py_ssize_t));
+  if (parent != NULL) graph->parent = parent;
+
+  if (obj_id == NULL || obj_type == NULL || is_primitive == NULL ||
+      primitive == NULL || parent == NULL) {
+    PyErr_NoMemory();
+    return -1;
+  }
+  STATS_ADD(allocations, 5);
+  graph->capacity = capacity;
+  return 0;
+}
+
+/**
+ * Appends a node to an ID graph.
  *
- * Recursively iterates over the ID graph and creates a JSON object.
+ * In comparison mode, i.e. when the graph has a reference, the node is not
+ *stored but checked against the node of the reference at the same preorder
+ *index. Nodes are in preorder, so equal parents at every index mean equal
+ *trees. The first differing node marks the graph as diverged.
  *
- * @param node Head node of the ID graph.
+ * @param graph The graph the node is added to.
+ * @param parent Index of the parent node, or NO_NODE for the root.
+ * @param obj_id The object id to be used as initial value.
+ * @param obj_type The object type to be used as initial value.
+ * @param primitive If the node represents a primitive type.
+ *
+ * @return Returns the index of the new node, or NO_NODE if out of memory.
+ **/
+Py_ssize_t add_node(idGraph *graph, Py_ssize_t parent, long obj_id,
+                    enum IdGraphObjectType obj_type, bool primitive) {
+  const idGraph *reference = graph->reference;
+  if (reference != NULL) {
+    Py_ssize_t node = graph->num_nodes;
+    if (node >= reference->num_nodes || reference->parent[node] != parent ||
+        reference->obj_type[node] != obj_type ||
+        reference->is_primitive[node] != primitive ||
+        (!primitive && reference->obj_id[node] != obj_id)) {
+      graph->diverged = true;
+      return NO_NODE;
+    }
+    return graph->num_nodes++;
+  }
+
+  if (graph->num_nodes == graph->capacity) {
+    Py_ssize_t capacity = graph->capacity == 0 ? INITIAL_GRAPH_CAPACITY
+                                               : graph->capacity * 2;
+    if (reserve_nodes(graph, capacity) == -1) {
+      return NO_NODE;
+    }
+  }
+  Py_ssize_t node = graph->num_nodes++;
+  graph->obj_id[node] = obj_id;
+  graph->obj_type[node] = obj_type;
+  graph->is_primitive[node] = primitive;
+  graph->primitive[node].obj_int = 0;
+  graph->parent[node] = parent;
+  return node;
+}
+
+/**
+ * Copies a string into the arena of the graph.
+ *
+ * Primitive strings are copied so that the graph stays valid after the
+ * source Python object is released.
+ *
+ * @param graph Graph owning the copy.
+ * @param str The NUL-terminated string to copy.
  *
- * @return Returns the computed cJSON object.
+ * @return Returns the copy, or NULL if out of memory.
+ **/
+const char *copy_str(idGraph *graph, const char *str) {
+  size_t len = strlen(str) + 1;
+  char *copy = (char *)arena_alloc(&graph->arena, len);
+  if (copy != NULL) {
+    memcpy(copy, str, len);
+  }
+  return copy;
+}
+
+/**
+ * Checks if two primitive values of the given type are equal.
  **/
-cJSON *get_json_rep(idGraphNode *node) {
-  cJSON *node_json = cJSON_CreateObject();
+static inline bool primitive_equals(enum IdGraphObjectType obj_type,
+                                    const idGraphPrimitiveValue *primitive1,
+                                    const idGraphPrimitiveValue *primitive2) {
+  switch (obj_type) {
+    case OBJ_TYPE_INT:
+    case OBJ_TYPE_BUFFER:
+      return primitive1->obj_int == primitive2->obj_int;
+    case OBJ_TYPE_FLOAT:
+      return primitive1->obj_float == primitive2->obj_float;
+    case OBJ_TYPE_BOOL:
+      return primitive1->obj_bool == primitive2->obj_bool;
+    case OBJ_TYPE_STRING:
+      return strcmp(primitive1->obj_str, primitive2->obj_str) == 0;
+    default:
+      return true;
+  }
+}
+
+/**
+ * Appends a primitive node holding a value to an ID graph.
+ *
+ * @param graph The graph the node is added to.
+ * @param parent Index of the parent node, or NO_NODE for the root.
+ * @param obj_id The object id of the value.
+ * @param obj_type The type of the value.
+ * @param value The value. Strings are copied into the graph, except in
+ *comparison mode where they are only compared.
+ *
+ * @return Returns the index of the new node, or NO_NODE if out of memory or
+ *diverged.
+ **/
+Py_ssize_t add_primitive_node(idGraph *graph, Py_ssize_t parent, long obj_id,
+                              enum IdGraphObjectType obj_type,
+                              idGraphPrimitiveValue value) {
+  Py_ssize_t node = add_node(graph, parent, obj_id, obj_type, true);
+  if (node == NO_NODE) {
+    return NO_NODE;
+  }
+  if (graph->reference != NULL) {
+    if (!primitive_equals(obj_type, &graph->reference->primitive[node],
+                          &value)) {
+      graph->diverged = true;
+      return NO_NODE;
+    }
+    return node;
+  }
+  if (obj_type == OBJ_TYPE_STRING) {
+    value.obj_str = copy_str(graph, value.obj_str);
+    if (value.obj_str == NULL) {
+      graph->num_nodes--;
+      return NO_NODE;
+    }
+  }
+  graph->primitive[node] = value;
+  return node;
+}
+
+/**
+ * Returns the object id of a node under construction, which is held by the
+ *reference in comparison mode.
+ **/
+static inline long node_obj_id(const idGraph *graph, Py_ssize_t node) {
+  return (graph->reference != NULL ? graph->reference : graph)->obj_id[node];
+}
+
+/**
+ * Returns the type of a node under construction, which is held by the
+ *reference in comparison mode.
+ **/
+static inline enum IdGraphObjectType node_obj_type(const idGraph *graph,
+                                                   Py_ssize_t node) {
+  return (graph->reference != NULL ? graph->reference : graph)->obj_type[node];
+}
 
-  // Add the object id and type as JSON string values
-  // Allocate memory for the string representation of obj_id
-  if (node->is_primitive == false) {
-    // char obj_id[64];
-    // snprintf(obj_id, sizeof(obj_id), "%ld", node->obj_id);
-    cJSON_AddNumberToObject(node_json, "obj_id", node->obj_id);
+/**
+ * Builds the CSR children arrays of a fully constructed graph and releases
+ * the construction-only state.
+ *
+ * Nodes are in preorder, so filling child_index in node order keeps the
+ * children of each node in insertion order.
+ *
+ * @param graph The graph to finalize.
+ *
+ * @return Returns 0 on success, -1 if out of memory.
+ **/
+int finalize_idGraph(idGraph *graph) {
+  Py_ssize_t n = graph->num_nodes;
+  graph->child_offset = (Py_ssize_t *)calloc(n + 1, sizeof(Py_ssize_t));
+  graph->child_index =
+      (Py_ssize_t *)malloc((n > 1 ? n - 1 : 1) * sizeof(Py_ssize_t));
+  Py_ssize_t *fill = (Py_ssize_t *)malloc((n + 1) * sizeof(Py_ssize_t));
+  if (graph->child_offset == NULL || graph->child_index == NULL ||
+      fill == NULL) {
+    free(fill);
+    PyErr_NoMemory();
+    return -1;
+  }
+  STATS_ADD(allocations, 3);
+
+  // Count children, then prefix sum into offsets
+  for (Py_ssize_t i = 1; i < n; i++) {
+    graph->child_offset[graph->parent[i] + 1]++;
+  }
+  for (Py_ssize_t i = 0; i < n; i++) {
+    graph->child_offset[i + 1] += graph->child_offset[i];
+  }
+  memcpy(fill, graph->child_offset, (n + 1) * sizeof(Py_ssize_t));
+  for (Py_ssize_t i = 1; i < n; i++) {
+    graph->child_index[fill[graph->parent[i]]++] = i;
+  }
+  free(fill);
+
+  idmap_free(&graph->visited);
+  free(graph->frames);
+  graph->frames = NULL;
+  graph->frame_capacity = 0;
+  return 0;
+}
+
+/**
+ * Returns the number of children of a node.
+ **/
+static inline Py_ssize_t num_children(const idGraph *graph, Py_ssize_t node) {
+  return graph->child_offset[node + 1] - graph->child_offset[node];
+}
+
+// Leading bytes and version of the binary encoding of ID graphs.
+#define IDGRAPH_BINARY_MAGIC "KIDG"
+#define IDGRAPH_BINARY_MAGIC_LEN 4
+#define IDGRAPH_BINARY_VERSION 1
+
+// Flag of the tag byte set for primitive nodes; the other bits hold the type.
+#define IDGRAPH_BINARY_PRIMITIVE 0x80
+
+/**
+ * A growable byte buffer for the binary encoding.
+ *
+ * @member "data" The bytes written so far.
+ * @member "len" Number of bytes written.
+ * @member "capacity" Allocated length of data.
+ * @member "out_of_memory" Set if an allocation failed; later writes are no-ops.
+ **/
+typedef struct {
+  unsigned char *data;
+  size_t len;
+  size_t capacity;
+  bool out_of_memory;
+} idGraphWriter;
+
+static void writer_put(idGraphWriter *writer, const void *data, size_t len) {
+  if (writer->out_of_memory) {
+    return;
+  }
+  if (writer->len + len > writer->capacity) {
+    size_t capacity = writer->capacity == 0 ? 256 : writer->capacity;
+    while (capacity < writer->len + len) {
+      capacity *= 2;
+    }
+    unsigned char *grown = (unsigned char *)realloc(writer->data, capacity);
+    if (grown == NULL) {
+      writer->out_of_memory = true;
+      return;
+    }
+    writer->data = grown;
+    writer->capacity = capacity;
+  }
+  memcpy(writer->data + writer->len, data, len);
+  writer->len += len;
+}
+
+/**
+ * Writes an unsigned LEB128 varint.
+ **/
+static void writer_put_varint(idGraphWriter *writer, unsigned long long value) {
+  unsigned char bytes[10];
+  size_t len = 0;
+  do {
+    bytes[len] = value & 0x7f;
+    value >>= 7;
+    if (value != 0) {
+      bytes[len] |= 0x80;
+    }
+    len++;
+  } while (value != 0);
+  writer_put(writer, bytes, len);
+}
+
+/**
+ * Writes a signed value as a zigzag varint, so small negative values stay
+ *short.
+ **/
+static void writer_put_signed(idGraphWriter *writer, long long value) {
+  writer_put_varint(writer, ((unsigned long long)value << 1) ^
+                                (unsigned long long)(value >> 63));
+}
+
+/**
+ * Writes 8 bytes in little-endian order.
+ **/
+static void writer_put_fixed64(idGraphWriter *writer, unsigned long long value) {
+  unsigned char bytes[8];
+  for (int i = 0; i < 8; i++) {
+    bytes[i] = (unsigned char)(value >> (8 * i));
+  }
+  writer_put(writer, bytes, 8);
+}
+
+/**
+ * Writes a string as a quoted JSON string, escaping quotes, backslashes and
+ *control characters.
+ **/
+static void writer_put_json_string(idGraphWriter *writer, const char *str) {
+  writer_put(writer, "\"", 1);
+  const char *run = str;
+  for (const char *c = str; *c != '\0'; c++) {
+    unsigned char ch = (unsigned char)*c;
+    if (ch > 31 && ch != '"' && ch != '\\') {
+      continue;
+    }
+    writer_put(writer, run, c - run);
+    run = c + 1;
+
+    char escape[7];
+    switch (ch) {
+      case '"':
+        writer_put(writer, "\\\"", 2);
+        break;
+      case '\\':
+        writer_put(writer, "\\\\", 2);
+        break;
+      case '\b':
+        writer_put(writer, "\\b", 2);
+        break;
+      case '\f':
+        writer_put(writer, "\\f", 2);
+        break;
+      case '\n':
+        writer_put(writer, "\\n", 2);
+        break;
+      case '\r':
+        writer_put(writer, "\\r", 2);
+        break;
+      case '\t':
+        writer_put(writer, "\\t", 2);
+        break;
+      default:
+        snprintf(escape, sizeof(escape), "\\u%04x", ch);
+        writer_put(writer, escape, 6);
+        break;
+    }
+  }
+  writer_put(writer, run, strlen(run));
+  writer_put(writer, "\"", 1);
+}
+
+/**
+ * Writes the JSON members of a node up to the opening bracket of its
+ *children.
+ **/
+static void writer_put_json_node(idGraphWriter *writer, const idGraph *graph,
+                                 Py_ssize_t node) {
+  enum IdGraphObjectType obj_type = graph->obj_type[node];
+  const idGraphPrimitiveValue *primitive = &graph->primitive[node];
+  char value[32];
+
+  if (graph->is_primitive[node] == false) {
+    int len = snprintf(value, sizeof(value), "%ld", graph->obj_id[node]);
+    writer_put(writer, "{\"obj_id\":", 10);
+    writer_put(writer, value, len);
   } else {
-    char *obj_val;
-    if (node->obj_type == OBJ_TYPE_INT) {
-      size_t id_size = snprintf(NULL, 0, "%lld", node->primitive.obj_int);
-      int len = id_size + 1;
-      obj_val = malloc(len * sizeof(char));  // Memory freed later
-      snprintf(obj_val, len, "%lld", node->primitive.obj_int);
-    } else if (node->obj_type == OBJ_TYPE_FLOAT) {
-      size_t id_size = snprintf(NULL, 0, "%lf", node->primitive.obj_float);
-      int len = id_size + 1;
-      obj_val = malloc(len * sizeof(char));  // Memory freed later
-      snprintf(obj_val, len, "%lf", node->primitive.obj_float);
-    } else if (node->obj_type == OBJ_TYPE_BOOL) {
-      size_t id_size = snprintf(NULL, 0, "%d", node->primitive.obj_bool);
-      int len = id_size + 1;
-      obj_val = malloc(len * sizeof(char));  // Memory freed later
-      snprintf(obj_val, len, "%d", node->primitive.obj_bool);
-    } else if (node->obj_type == OBJ_TYPE_STRING) {
-      size_t id_size = snprintf(NULL, 0, "%s", node->primitive.obj_str);
-      int len = id_size + 1;
-      obj_val = malloc(len * sizeof(char));  // Memory freed later
-      snprintf(obj_val, len, "%s", node->primitive.obj_str);
+    writer_put(writer, "{\"obj_val\":", 11);
+    if (obj_type == OBJ_TYPE_STRING) {
+      writer_put_json_string(writer, primitive->obj_str);
+    } else if (obj_type == OBJ_TYPE_FLOAT) {
+      // "%lf" prints every integer digit, so large floats need up to ~320 bytes
+      int len = snprintf(NULL, 0, "%lf", primitive->obj_float);
+      char *float_value = (char *)malloc(len + 1);
+      if (float_value == NULL) {
+        writer->out_of_memory = true;
+        return;
+      }
+      snprintf(float_value, len + 1, "%lf", primitive->obj_float);
+      writer_put_json_string(writer, float_value);
+      free(float_value);
     } else {
-      obj_val = "unknown";
+      if (obj_type == OBJ_TYPE_INT) {
+        snprintf(value, sizeof(value), "%lld", primitive->obj_int);
+      } else if (obj_type == OBJ_TYPE_BOOL) {
+        snprintf(value, sizeof(value), "%d", primitive->obj_bool);
+      } else if (obj_type == OBJ_TYPE_BUFFER) {
+        snprintf(value, sizeof(value), "%016llx",
+                 (unsigned long long)primitive->obj_int);
+      } else {
+        snprintf(value, sizeof(value), "unknown");
+      }
+      writer_put_json_string(writer, value);
     }
-    cJSON_AddStringToObject(node_json, "obj_val", obj_val);
-    free(obj_val);
-    obj_val = NULL;
   }
 
-  cJSON_AddStringToObject(node_json, "obj_type",
-                          getobjectTypeName(node->obj_type));
+  writer_put(writer, ",\"obj_type\":", 12);
+  writer_put_json_string(writer, getobjectTypeName(obj_type));
+  writer_put(writer, ",\"children\":[", 13);
+}
 
-  cJSON *children_array = cJSON_CreateArray();
-  cJSON_AddItemToObject(node_json, "children", children_array);
-  idGraphNodeList *child_node = node->children;
-  while (child_node != NULL) {
-    cJSON_AddItemToArray(children_array, get_json_rep(child_node->child));
-    child_node = child_node->next;
+/**
+ * Generates a JSON string of the ID Graph.
+ *
+ * Each node is an object with its obj_id (or obj_val for primitives),
+ *obj_type and children, listed most recently added first. The nodes are
+ *written in one pass with an explicit cursor per node instead of recursing, so
+ *any graph depth can be rendered, and only touches the graph, so it can run
+ *without the GIL.
+ *
+ * @param graph The ID graph.
+ *
+ * @return Returns the computed JSON string (to be freed with free), or NULL if
+ *out of memory.
+ **/
+char *get_json_str(const idGraph *graph) {
+  idGraphWriter writer = {NULL, 0, 0, false};
+  // Next child of each open node, walking child_index backwards
+  Py_ssize_t *cursor =
+      (Py_ssize_t *)malloc(graph->num_nodes * sizeof(Py_ssize_t));
+  if (cursor == NULL) {
+    return NULL;
+  }
+
+  Py_ssize_t node = 0;
+  writer_put_json_node(&writer, graph, node);
+  cursor[node] = graph->child_offset[node + 1];
+  while (node != NO_NODE && !writer.out_of_memory) {
+    if (cursor[node] == graph->child_offset[node]) {
+      writer_put(&writer, "]}", 2);
+      node = graph->parent[node];
+      continue;
+    }
+    if (cursor[node] != graph->child_offset[node + 1]) {
+      writer_put(&writer, ",", 1);
+    }
+    node = graph->child_index[--cursor[node]];
+    writer_put_json_node(&writer, graph, node);
+    cursor[node] = graph->child_offset[node + 1];
   }
-  return node_json;
+  writer_put(&writer, "", 1);
+  free(cursor);
+
+  if (writer.out_of_memory) {
+    free(writer.data);
+    return NULL;
+  }
+  return (char *)writer.data;
 }
 
 /**
- * Generates a JSON string of the ID Graph (idGraphNode *).
+ * Encodes an ID graph into a compact binary string.
+ *
+ * The encoding holds a header (magic, version, number of nodes and id of the
+ *root) followed by the nodes in preorder. Each node is a tag byte (type and
+ *primitive flag), a varint number of children, and either its id (zigzag
+ *varint) or its primitive value: zigzag varint for ints, 8 little-endian bytes
+ *for floats and buffer digests, one byte for bools, and a varint length
+ *followed by the UTF-8 bytes for strings. The preorder sequence and the
+ *numbers of children determine the tree, so no other structure is stored.
  *
- * Calls get_json_rep and converts the JSON object into string.
+ * Only touches the graph, so it can run without the GIL.
  *
- * @param node Head node of the ID graph.
+ * @param graph The ID graph.
+ * @param len Receives the length of the encoding.
  *
- * @return Returns the computed JSON string.
+ * @return Returns the encoding (to be freed with free), or NULL if out of
+ *memory.
  **/
-char *get_json_str(idGraphNode *node) {
-  cJSON *jsonRep = get_json_rep(node);
-  char *jsonString = cJSON_Print(jsonRep);
-  cJSON_Delete(jsonRep);
-  return jsonString;
+unsigned char *serialize_idGraph(const idGraph *graph, size_t *len) {
+  idGraphWriter writer = {NULL, 0, 0, false};
+  unsigned char version = IDGRAPH_BINARY_VERSION;
+  writer_put(&writer, IDGRAPH_BINARY_MAGIC, IDGRAPH_BINARY_MAGIC_LEN);
+  writer_put(&writer, &version, 1);
+  writer_put_varint(&writer, (unsigned long long)graph->num_nodes);
+  writer_put_signed(&writer, graph->obj_id[0]);
+
+  for (Py_ssize_t i = 0; i < graph->num_nodes; i++) {
+    enum IdGraphObjectType obj_type = graph->obj_type[i];
+    const idGraphPrimitiveValue *primitive = &graph->primitive[i];
+    unsigned char tag = (unsigned char)obj_type;
+    if (graph->is_primitive[i]) {
+      tag |= IDGRAPH_BINARY_PRIMITIVE;
+    }
+    writer_put(&writer, &tag, 1);
+    writer_put_varint(&writer, (unsigned long long)num_children(graph, i));
+
+    if (!graph->is_primitive[i]) {
+      writer_put_signed(&writer, graph->obj_id[i]);
+    } else if (obj_type == OBJ_TYPE_INT) {
+      writer_put_signed(&writer, primitive->obj_int);
+    } else if (obj_type == OBJ_TYPE_BUFFER) {
+      writer_put_fixed64(&writer, (unsigned long long)primitive->obj_int);
+    } else if (obj_type == OBJ_TYPE_FLOAT) {
+      unsigned long long bits;
+      memcpy(&bits, &primitive->obj_float, sizeof(bits));
+      writer_put_fixed64(&writer, bits);
+    } else if (obj_type == OBJ_TYPE_BOOL) {
+      unsigned char value = primitive->obj_bool ? 1 : 0;
+      writer_put(&writer, &value, 1);
+    } else if (obj_type == OBJ_TYPE_STRING) {
+      size_t str_len = strlen(primitive->obj_str);
+      writer_put_varint(&writer, (unsigned long long)str_len);
+      writer_put(&writer, primitive->obj_str, str_len);
+    }
+  }
+
+  if (writer.out_of_memory) {
+    free(writer.data);
+    return NULL;
+  }
+  *len = writer.len;
+  return writer.data;
 }
 
 /**
- * Adds a child idGraphNode to a parent idGraphNode.
+ * A cursor over a binary encoding being decoded.
  *
- * @param parent Parent node.
- * @param child Child node.
+ * @member "data" The encoding.
+ * @member "len" Length of the encoding.
+ * @member "pos" Offset of the next byte to read.
  **/
-void add_child(idGraphNode *parent, idGraphNode *child) {
-  idGraphNodeList *new_node =
-      (idGraphNodeList *)malloc(sizeof(idGraphNodeList));
-  new_node->child = child;
-  new_node->next = parent->children;
-  parent->children = new_node;
+typedef struct {
+  const unsigned char *data;
+  size_t len;
+  size_t pos;
+} idGraphReader;
+
+static int reader_get(idGraphReader *reader, void *out, size_t len) {
+  if (reader->len - reader->pos < len) {
+    return -1;
+  }
+  memcpy(out, reader->data + reader->pos, len);
+  reader->pos += len;
+  return 0;
+}
+
+static int reader_get_varint(idGraphReader *reader, unsigned long long *value) {
+  *value = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    unsigned char byte;
+    if (reader_get(reader, &byte, 1) == -1) {
+      return -1;
+    }
+    *value |= (unsigned long long)(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) {
+      return 0;
+    }
+  }
+  return -1;
+}
+
+static int reader_get_signed(idGraphReader *reader, long long *value) {
+  unsigned long long zigzag;
+  if (reader_get_varint(reader, &zigzag) == -1) {
+    return -1;
+  }
+  *value = (long long)(zigzag >> 1) ^ -(long long)(zigzag & 1);
+  return 0;
+}
+
+static int reader_get_fixed64(idGraphReader *reader, unsigned long long *value) {
+  unsigned char bytes[8];
+  if (reader_get(reader, bytes, 8) == -1) {
+    return -1;
+  }
+  *value = 0;
+  for (int i = 0; i < 8; i++) {
+    *value |= (unsigned long long)bytes[i] << (8 * i);
+  }
+  return 0;
 }
 
 /**
- * Searches for an ID graph node in a linkedlist.
+ * Decodes an ID graph encoded by serialize_idGraph.
  *
- * @param list The idGraphNodeList to search in.
- * @param id The id of the idGraphNode being serched.
+ * The parent of each node is the closest preceding node that still expects
+ *children, which is tracked with a stack of the remaining child counts.
  *
- * @return Returns the the ID graph node(idGraphNode *) if exists
- * else returns NULL
+ * @param data The encoding.
+ * @param len Length of the encoding.
+ *
+ * @return Returns the finalized graph, or NULL with an exception set if the
+ *encoding is malformed or out of memory.
  **/
-idGraphNode *find_idGraphNode_in_list(idGraphNodeList *list, long id) {
-  idGraphNodeList *current = list;
-  while (current != NULL) {
-    if (current->child->obj_id == id) {
-      return current->child;
+idGraph *deserialize_idGraph(const unsigned char *data, size_t len) {
+  idGraphReader reader = {data, len, 0};
+  char magic[IDGRAPH_BINARY_MAGIC_LEN];
+  unsigned char version;
+  unsigned long long num_nodes;
+  long long root_id;
+  if (reader_get(&reader, magic, IDGRAPH_BINARY_MAGIC_LEN) == -1 ||
+      memcmp(magic, IDGRAPH_BINARY_MAGIC, IDGRAPH_BINARY_MAGIC_LEN) != 0 ||
+      reader_get(&reader, &version, 1) == -1 ||
+      version != IDGRAPH_BINARY_VERSION ||
+      reader_get_varint(&reader, &num_nodes) == -1 ||
+      reader_get_signed(&reader, &root_id) == -1) {
+    PyErr_SetString(PyExc_ValueError, "Not an encoded ID graph.");
+    return NULL;
+  }
+  // Every node takes at least 2 bytes, which bounds the allocation below
+  if (num_nodes == 0 || num_nodes > (len - reader.pos) / 2) {
+    PyErr_SetString(PyExc_ValueError, "Malformed ID graph encoding.");
+    return NULL;
+  }
+
+  idGraph *graph = create_idGraph();
+  Py_ssize_t *parents = (Py_ssize_t *)malloc(num_nodes * sizeof(Py_ssize_t));
+  unsigned long long *remaining =
+      (unsigned long long *)malloc(num_nodes * sizeof(unsigned long long));
+  if (graph == NULL || parents == NULL || remaining == NULL) {
+    PyErr_NoMemory();
+    goto fail;
+  }
+  if (reserve_nodes(graph, (Py_ssize_t)num_nodes) == -1) {
+    goto fail;
+  }
+
+  Py_ssize_t depth = 0;
+  for (unsigned long long i = 0; i < num_nodes; i++) {
+    // Pop the nodes whose children are all decoded
+    while (depth > 0 && remaining[depth - 1] == 0) {
+      depth--;
+    }
+    if (i > 0 && depth == 0) {
+      goto malformed;
+    }
+    Py_ssize_t parent = depth > 0 ? parents[depth - 1] : NO_NODE;
+
+    unsigned char tag;
+    unsigned long long children;
+    if (reader_get(&reader, &tag, 1) == -1 ||
+        reader_get_varint(&reader, &children) == -1) {
+      goto malformed;
+    }
+    enum IdGraphObjectType obj_type =
+        (enum IdGraphObjectType)(tag & ~IDGRAPH_BINARY_PRIMITIVE);
+    bool primitive = (tag & IDGRAPH_BINARY_PRIMITIVE) != 0;
+    if (obj_type > OBJ_TYPE_BUFFER || children >= num_nodes) {
+      goto malformed;
+    }
+
+    long long value = 0;
+    unsigned long long bits = 0;
+    const char *str = NULL;
+    if (!primitive) {
+      if (reader_get_signed(&reader, &value) == -1) goto malformed;
+    } else if (obj_type == OBJ_TYPE_INT) {
+      if (reader_get_signed(&reader, &value) == -1) goto malformed;
+    } else if (obj_type == OBJ_TYPE_BUFFER || obj_type == OBJ_TYPE_FLOAT) {
+      if (reader_get_fixed64(&reader, &bits) == -1) goto malformed;
+    } else if (obj_type == OBJ_TYPE_BOOL) {
+      unsigned char byte;
+      if (reader_get(&reader, &byte, 1) == -1) goto malformed;
+      value = byte;
+    } else if (obj_type == OBJ_TYPE_STRING) {
+      unsigned long long str_len;
+      if (reader_get_varint(&reader, &str_len) == -1 ||
+          str_len > len - reader.pos) {
+        goto malformed;
+      }
+      char *copy = (char *)arena_alloc(&graph->arena, str_len + 1);
+      if (copy == NULL) {
+        PyErr_NoMemory();
+        goto fail;
+      }
+      reader_get(&reader, copy, str_len);
+      copy[str_len] = '\0';
+      str = copy;
+    }
+
+    long obj_id = (long)(primitive ? (i == 0 ? root_id : 0) : value);
+    Py_ssize_t node = add_node(graph, parent, obj_id, obj_type, primitive);
+    if (primitive) {
+      if (obj_type == OBJ_TYPE_INT) {
+        graph->primitive[node].obj_int = value;
+      } else if (obj_type == OBJ_TYPE_BUFFER) {
+        graph->primitive[node].obj_int = (long long)bits;
+      } else if (obj_type == OBJ_TYPE_FLOAT) {
+        memcpy(&graph->primitive[node].obj_float, &bits, sizeof(bits));
+      } else if (obj_type == OBJ_TYPE_BOOL) {
+        graph->primitive[node].obj_bool = value != 0;
+      } else if (obj_type == OBJ_TYPE_STRING) {
+        graph->primitive[node].obj_str = str;
+      }
+    }
+
+    if (depth > 0) {
+      remaining[depth - 1]--;
+    }
+    if (children > 0) {
+      parents[depth] = node;
+      remaining[depth] = children;
+      depth++;
     }
-    current = current->next;
   }
+  // Every node must have received all of its children
+  while (depth > 0 && remaining[depth - 1] == 0) {
+    depth--;
+  }
+  if (depth != 0 || reader.pos != len) {
+    goto malformed;
+  }
+
+  free(parents);
+  free(remaining);
+  if (finalize_idGraph(graph) == -1) {
+    free_idGraph(graph);
+    return NULL;
+  }
+  return graph;
+
+malformed:
+  PyErr_SetString(PyExc_ValueError, "Malformed ID graph encoding.");
+fail:
+  free(parents);
+  free(remaining);
+  free_idGraph(graph);
   return NULL;
 }
 
 /**
- * Adds an ID graph node to the visited list.
+ * Marks a container node as being on the current traversal path.
+ *
+ * @param graph The graph under construction.
+ * @param node The node to mark.
+ * @param previous Receives the path entry shadowed by node, if any.
  *
- * @param visited The idGraphNodeList.
- * @param node The node to be added to viited list.
+ * @return Returns 0 on success, -1 if out of memory.
  **/
-idGraphNodeList *mark_visited(idGraphNodeList *visited, idGraphNode *node) {
-  idGraphNodeList *new_node = malloc(sizeof(idGraphNodeList));
-  new_node->next = visited;
-  new_node->child = node;
-  return new_node;
+int mark_visited(idGraph *graph, Py_ssize_t node, int64_t *previous) {
+  STATS_INC(visited_probes);
+  if (idmap_put(&graph->visited, (uint64_t)node_obj_id(graph, node), node,
+                previous) == -1) {
+    PyErr_NoMemory();
+    return -1;
+  }
+  return 0;
 }
 
 /**
- * Initializes an idGraphNode
+ * Removes a container node from the current traversal path once all of its
+ * children are processed, restoring the entry it shadowed.
  *
- * @param obj_id The object id to be used as initial value.
- * @param obj_type The object type to be used as initial value.
+ * @param graph The graph under construction.
+ * @param node The node to unmark.
+ * @param previous The entry returned by mark_visited.
  **/
-idGraphNode *create_idGraphNode(long obj_id, enum IdGraphObjectType obj_type,
-                                bool primitive) {
-  idGraphNode *node = (idGraphNode *)malloc(sizeof(idGraphNode));
-  node->obj_id = obj_id;
-  node->obj_type = obj_type;
-  node->children = NULL;
-  node->is_primitive = primitive;
-  return node;
+void unmark_visited(idGraph *graph, Py_ssize_t node, int64_t previous) {
+  uint64_t key = (uint64_t)node_obj_id(graph, node);
+  STATS_INC(visited_probes);
+  if (previous == IDMAP_MISSING) {
+    idmap_remove(&graph->visited, key);
+  } else {
+    idmap_put(&graph->visited, key, previous, NULL);
+  }
 }
 
 const long get_builtin_id(PyObject *v) {
@@ -234,13 +993,18 @@ const long get_builtin_id(PyObject *v) {
   }
 
   PyObject *id = PyLong_FromVoidPtr(v);
+  if (id == NULL) {
+    return 0;
+  }
 
-  if (id && PySys_Audit("builtins.id", "O", id) < 0) {
+  if (PySys_Audit("builtins.id", "O", id) < 0) {
     Py_DECREF(id);
     return 0;
   }
 
-  return PyLong_AsLong(id);
+  long builtin_id = PyLong_AsLong(id);
+  Py_DECREF(id);
+  return builtin_id;
 }
 
 /**
@@ -268,307 +1032,1062 @@ bool isBuiltinObject(PyObject *obj) {
           PyAnySet_Check(obj) || isPrimitiveORString(obj));
 }
 
-idGraphNode *process_children(PyObject *item, idGraphNode *node,
-                              idGraphNodeList *visited) {
+#if defined(__GNUC__) || defined(__clang__)
+#define PREFETCH_OBJECT(obj) __builtin_prefetch(obj)
+#else
+#define PREFETCH_OBJECT(obj) ((void)0)
+#endif
+
+/**
+ * Adds item as a child of node.
+ *
+ * Objects already on the traversal path (cyclic references) are added as a
+ * childless node holding only their id and type. The children of containers
+ * are added later, from the frame pushed for them.
+ *
+ * @return Returns the index of the child, or NO_NODE if none was added.
+ **/
+Py_ssize_t process_children(PyObject *item, Py_ssize_t node, idGraph *graph) {
   long id = get_builtin_id(item);
-  idGraphNode *child = find_idGraphNode_in_list(visited, id);
-  if (child == NULL) {
-    child = create_id_graph(item, visited);
-  } else {
-    child = create_idGraphNode(child->obj_id, child->obj_type, 0);
+  STATS_INC(visited_probes);
+  int64_t visited = idmap_get(&graph->visited, (uint64_t)id);
+  if (visited == IDMAP_MISSING) {
+    return add_object_node(item, node, graph);
+  }
+  return add_node(graph, node, node_obj_id(graph, visited),
+                  node_obj_type(graph, visited), 0);
+}
+
+/**
+ * Pushes the frame of a container node, whose children are added next.
+ *
+ * The frame takes over the references to obj, items and values.
+ *
+ * @param graph The graph under construction.
+ * @param kind Kind of the container.
+ * @param obj The container.
+ * @param items Items to iterate (see idGraphFrame), or NULL.
+ * @param values Values of a dict, or NULL.
+ * @param node Index of the container node, marked as visited.
+ * @param previous The entry returned by mark_visited.
+ * @param size Number of items.
+ *
+ * @return Returns 0 on success, -1 if out of memory (the references are
+ *released).
+ **/
+int push_frame(idGraph *graph, enum IdGraphFrameKind kind, PyObject *obj,
+               PyObject *items, PyObject *values, Py_ssize_t node,
+               int64_t previous, Py_ssize_t size) {
+  if (graph->num_frames == graph->frame_capacity) {
+    Py_ssize_t capacity =
+        graph->frame_capacity == 0 ? 16 : graph->frame_capacity * 2;
+    idGraphFrame *frames =
+        (idGraphFrame *)realloc(graph->frames, capacity * sizeof(idGraphFrame));
+    if (frames == NULL) {
+      Py_DECREF(obj);
+      Py_XDECREF(items);
+      Py_XDECREF(values);
+      PyErr_NoMemory();
+      return -1;
+    }
+    STATS_INC(allocations);
+    graph->frames = frames;
+    graph->frame_capacity = capacity;
+  }
+  graph->frames[graph->num_frames++] =
+      (idGraphFrame){kind,     FRAME_STEP_ITEMS, obj, items, values, NULL,
+                     node,     previous,         0,   size,  NO_NODE};
+  return 0;
+}
+
+/**
+ * Pops the top frame once all children of its node are added, removing the
+ * node from the traversal path.
+ **/
+void pop_frame(idGraph *graph) {
+  idGraphFrame *frame = &graph->frames[--graph->num_frames];
+  unmark_visited(graph, frame->node, frame->previous);
+  Py_DECREF(frame->obj);
+  Py_XDECREF(frame->items);
+  Py_XDECREF(frame->values);
+  Py_XDECREF(frame->pending);
+}
+
+/**
+ * Produces the next item of a list or tuple.
+ *
+ * @return Returns true with a new reference in item, or false once all items
+ *are produced.
+ **/
+bool next_sequence_item(idGraphFrame *frame, PyObject **item) {
+  while (frame->index < frame->size) {
+    Py_ssize_t i = frame->index++;
+    // Prefetch the header (and thus ob_type) of the item after this one
+    if (PyList_CheckExact(frame->obj) &&
+        i + 1 < PyList_GET_SIZE(frame->obj)) {
+      PREFETCH_OBJECT(PyList_GET_ITEM(frame->obj, i + 1));
+    } else if (PyTuple_CheckExact(frame->obj) && i + 1 < frame->size) {
+      PREFETCH_OBJECT(PyTuple_GET_ITEM(frame->obj, i + 1));
+    }
+    *item = PySequence_GetItem(frame->obj, i);
+    if (*item != NULL) {
+      return true;
+    }
+    PyErr_Clear();
+  }
+  return false;
+}
+
+/**
+ * Produces the keys and values of a dictionary, alternately.
+ *
+ * @return Returns true with a new reference in item, or false once all items
+ *are produced.
+ **/
+bool next_dict_item(idGraphFrame *frame, PyObject **item) {
+  if (frame->index >= 2 * frame->size) {
+    return false;
+  }
+  Py_ssize_t i = frame->index++;
+  *item = PyList_GET_ITEM(i % 2 == 0 ? frame->items : frame->values, i / 2);
+  Py_INCREF(*item);
+  return true;
+}
+
+/**
+ * Produces the next item of a set.
+ *
+ * @return Returns true with a new reference in item, or false once all items
+ *are produced.
+ **/
+bool next_set_item(idGraphFrame *frame, PyObject **item) {
+  *item = PyIter_Next(frame->items);
+  return *item != NULL;
+}
+
+/**
+ * Hashes the raw data of a numpy array together with its dtype, shape and
+ *strides.
+ *
+ * The data is walked stride-aware in logical order, so no element is boxed
+ *into a Python object.
+ *
+ * @param arr_obj The array to hash. Must not hold Python objects.
+ * @param digest Receives the hash.
+ *
+ * @return Returns 0 on success, -1 with an exception set on failure.
+ **/
+int hash_numpy_buffer(PyArrayObject *arr_obj, unsigned long long *digest) {
+  PyArray_Descr *descr = PyArray_DESCR(arr_obj);
+  npy_intp itemsize = PyArray_ITEMSIZE(arr_obj);
+  int ndim = PyArray_NDIM(arr_obj);
+
+  XXH3_state_t *state = XXH3_createState();
+  if (state == NULL) {
+    PyErr_NoMemory();
+    return -1;
+  }
+  STATS_INC(allocations);
+  STATS_ADD(bytes_hashed, PyArray_NBYTES(arr_obj));
+  XXH3_64bits_reset(state);
+
+  // Hash dtype, shape and strides
+  XXH3_64bits_update(state, &descr->kind, sizeof(descr->kind));
+  XXH3_64bits_update(state, &descr->type, sizeof(descr->type));
+  XXH3_64bits_update(state, &descr->byteorder, sizeof(descr->byteorder));
+  XXH3_64bits_update(state, &itemsize, sizeof(itemsize));
+  XXH3_64bits_update(state, &ndim, sizeof(ndim));
+  XXH3_64bits_update(state, PyArray_SHAPE(arr_obj), ndim * sizeof(npy_intp));
+  XXH3_64bits_update(state, PyArray_STRIDES(arr_obj), ndim * sizeof(npy_intp));
+
+  // Hash data. The array is referenced by the caller, so its memory stays
+  // valid while the GIL is released.
+  bool release_gil = PyArray_NBYTES(arr_obj) >= BUFFER_HASH_NOGIL_THRESHOLD;
+  PyThreadState *thread_state = release_gil ? PyEval_SaveThread() : NULL;
+  int ret = hash_strided_buffer(state, PyArray_BYTES(arr_obj), ndim,
+                                PyArray_SHAPE(arr_obj),
+                                PyArray_STRIDES(arr_obj), itemsize);
+  if (release_gil) {
+    PyEval_RestoreThread(thread_state);
+  }
+  if (ret == -1) {
+    XXH3_freeState(state);
+    PyErr_SetString(PyExc_ValueError, "Too many dimensions for hashing array");
+    return -1;
+  }
+  *digest = XXH3_64bits_digest(state);
+  XXH3_freeState(state);
+  return 0;
+}
+
+/**
+ * Produces the children of a numpy array after its attributes.
+ *
+ * The shape is stored as int children. Arrays of raw data are stored as a
+ *single buffer child holding the hash of their data, which is added here;
+ *only arrays of Python objects are expanded element by element.
+ *
+ * @return Returns true with a new reference in item, or false once all
+ *children are produced.
+ **/
+bool next_numpy_item(idGraph *graph, idGraphFrame *frame, PyObject **item) {
+  PyArrayObject *arr_obj = (PyArrayObject *)frame->obj;
+
+  // Store shape of array
+  if (frame->step == FRAME_STEP_SHAPE) {
+    if (frame->index < frame->size) {
+      *item = PyLong_FromLong(PyArray_SHAPE(arr_obj)[frame->index++]);
+      return *item != NULL;
+    }
+
+    // Store hash of array data
+    if (!PyDataType_REFCHK(PyArray_DESCR(arr_obj))) {
+      unsigned long long digest;
+      if (hash_numpy_buffer(arr_obj, &digest) == -1) {
+        PyErr_Clear();
+        return false;
+      }
+      idGraphPrimitiveValue value = {.obj_int = (long long)digest};
+      if (add_primitive_node(graph, frame->node,
+                             get_builtin_id((PyObject *)arr_obj),
+                             OBJ_TYPE_BUFFER, value) == NO_NODE) {
+        graph->out_of_memory = true;
+      }
+      return false;
+    }
+    frame->step = FRAME_STEP_DATA;
+    frame->index = 0;
+    frame->size = PyArray_SIZE(arr_obj);
+  }
+
+  // Store array elements
+  while (frame->index < frame->size) {
+    npy_intp i = frame->index++;
+    *item = PyArray_GETITEM(
+        arr_obj, PyArray_DATA(arr_obj) + i * PyArray_ITEMSIZE(arr_obj));
+    if (*item != NULL) {
+      return true;
+    }
+    PyErr_Clear();
+  }
+  return false;
+}
+
+/**
+ * Checks if the type of an object has the given name.
+ *
+ * @param obj The object to check.
+ * @param name The expected type name (Type.__name__).
+ *
+ * @return Returns true if the type of obj is named name.
+ **/
+bool type_name_equals(PyObject *obj, const char *name) {
+  PyObject *type_name =
+      PyObject_GetAttrString((PyObject *)Py_TYPE(obj), "__name__");
+  if (type_name == NULL) {
+    PyErr_Clear();
+    return false;
+  }
+  const char *type_name_str = PyUnicode_AsUTF8(type_name);
+  bool equals = type_name_str != NULL && strcmp(type_name_str, name) == 0;
+  if (type_name_str == NULL) {
+    PyErr_Clear();
+  }
+  Py_DECREF(type_name);
+  return equals;
+}
+
+enum IdGraphTypeKind {
+  TYPE_KIND_OTHER,
+  TYPE_KIND_NDARRAY,
+  TYPE_KIND_SERIES,  // Any other type named Series
+  // Pandas types traversed through their internals, which must come last
+  TYPE_KIND_PANDAS_FRAME,
+  TYPE_KIND_PANDAS_SERIES,
+  TYPE_KIND_PANDAS_INDEX,  // Index and its subclasses but MultiIndex
+  TYPE_KIND_PANDAS_RANGE_INDEX,
+};
+
+// Number of cached types after which the cache is emptied
+#define TYPE_KINDS_MAX_ENTRIES 4096
+
+// Type address -> version tag << 8 | IdGraphTypeKind, for the types seen so far
+static IdMap type_kinds = {0};
+
+/**
+ * Classifies the type of an object as one of the pandas types with a
+ *dedicated traversal.
+ *
+ * Subclasses of DataFrame and Series are not classified, as they may hold
+ *state beyond their BlockManager.
+ *
+ * @param obj The object to classify.
+ *
+ * @return Returns the kind of the type of obj, or TYPE_KIND_OTHER if pandas
+ *is not imported.
+ **/
+enum IdGraphTypeKind get_pandas_type_kind(PyObject *obj) {
+  PyObject *name = PyUnicode_FromString("pandas");
+  if (name == NULL) {
+    PyErr_Clear();
+    return TYPE_KIND_OTHER;
+  }
+  PyObject *pandas = PyImport_GetModule(name);
+  Py_DECREF(name);
+  if (pandas == NULL) {
+    PyErr_Clear();
+    return TYPE_KIND_OTHER;
+  }
+
+  static const struct {
+    const char *name;
+    enum IdGraphTypeKind kind;
+    bool exact;
+  } pandas_types[] = {
+      {"DataFrame", TYPE_KIND_PANDAS_FRAME, true},
+      {"Series", TYPE_KIND_PANDAS_SERIES, true},
+      {"MultiIndex", TYPE_KIND_OTHER, false},
+      {"RangeIndex", TYPE_KIND_PANDAS_RANGE_INDEX, true},
+      {"Index", TYPE_KIND_PANDAS_INDEX, false},
+  };
+  enum IdGraphTypeKind kind = TYPE_KIND_OTHER;
+  for (size_t i = 0; i < sizeof(pandas_types) / sizeof(pandas_types[0]);
+       i++) {
+    PyObject *type = PyObject_GetAttrString(pandas, pandas_types[i].name);
+    if (type == NULL) {
+      PyErr_Clear();
+      continue;
+    }
+    int match = (PyObject *)Py_TYPE(obj) == type;
+    if (!match && !pandas_types[i].exact && PyType_Check(type)) {
+      match = PyType_IsSubtype(Py_TYPE(obj), (PyTypeObject *)type);
+    }
+    Py_DECREF(type);
+    if (match) {
+      kind = pandas_types[i].kind;
+      break;
+    }
+  }
+  Py_DECREF(pandas);
+  return kind;
+}
+
+/**
+ * Classifies the type of an object by its name.
+ *
+ * The name is only compared once per type: the kind is cached until the
+ *version tag of the type changes, i.e. until the type is modified or its
+ *address is reused by a new type.
+ *
+ * @param obj The object to classify.
+ *
+ * @return Returns the kind of the type of obj.
+ **/
+enum IdGraphTypeKind get_type_kind(PyObject *obj) {
+  PyTypeObject *type = Py_TYPE(obj);
+  uint64_t key = (uint64_t)(uintptr_t)type;
+  unsigned int version = type_version(type);
+  if (version != 0 && type_kinds.entries != NULL) {
+    int64_t value = idmap_get(&type_kinds, key);
+    if (value != IDMAP_MISSING && (unsigned int)(value >> 8) == version) {
+      return (enum IdGraphTypeKind)(value & 0xff);
+    }
+  }
+
+  enum IdGraphTypeKind kind = get_pandas_type_kind(obj);
+  if (kind == TYPE_KIND_OTHER && type_name_equals(obj, "ndarray")) {
+    kind = TYPE_KIND_NDARRAY;
+  } else if (kind == TYPE_KIND_OTHER && type_name_equals(obj, "Series")) {
+    kind = TYPE_KIND_SERIES;
+  }
+
+  // Looking up the name assigns a version tag to the type
+  version = type_version(type);
+  if (version == 0) {
+    return kind;
+  }
+  if (type_kinds.entries != NULL &&
+      type_kinds.count >= TYPE_KINDS_MAX_ENTRIES) {
+    idmap_free(&type_kinds);
+  }
+  // The kind is not cached if out of memory
+  if (type_kinds.entries != NULL || idmap_init(&type_kinds, 0) == 0) {
+    idmap_put(&type_kinds, key, ((int64_t)version << 8) | kind, NULL);
+  }
+  return kind;
+}
+
+/**
+ * Produces the attributes of a pandas object.
+ *
+ * Each included attribute is produced as its name, followed by its contents
+ *which are added below the node of the name.
+ *
+ * @param frame The frame of the object; items holds the result of dir().
+ * @param item Receives a new reference to the child.
+ * @param parent Receives the index of the node the child is added to.
+ *
+ * @return Returns true if a child was produced, false once all attributes
+ *are produced.
+ **/
+bool next_attribute(idGraphFrame *frame, PyObject **item, Py_ssize_t *parent) {
+  // insert attribute contents
+  if (frame->pending != NULL) {
+    PyObject *attr = frame->pending;
+    frame->pending = NULL;
+    if (frame->last_child != NO_NODE) {
+      *item = attr;
+      *parent = frame->last_child;
+      return true;
+    }
+    Py_DECREF(attr);
+  }
+
+  if (frame->items == NULL) {
+    return false;
+  }
+
+  // Attributes to exclude from idgraph
+  char exclude_dir1[] =
+      "T";  // This attribute, found in dataframe and series objects, are of
+            // the types dataframe and series, and thus iterating through them
+            // would result in an infinite loop
+  char exclude_dir2[] =
+      "__doc__";  // This attribute contains the documentation of the object
+  char exclude_dir3[] =
+      "__dict__";  // Code seems to go into complex and unnecessary classes
+  char exclude_dir4[] =
+      "_agg_summary_and_see_also_doc";        // another documentation
+  char exclude_dir5[] = "_agg_examples_doc";  // another documentation
+  char exclude_dir6[] =
+      "_item_cache";  // Stores data items as cache in case of pandas objects
+
+  while (frame->index < frame->size) {
+    PyObject *attr_title = PyList_GetItem(frame->items, frame->index++);
+    if (attr_title == NULL) continue;
+
+    const char *name = PyUnicode_AsUTF8(attr_title);
+    if (name == NULL) {
+      PyErr_Clear();
+      continue;
+    }
+
+    if ((strcmp(name, exclude_dir1) == 0) ||
+        (strcmp(name, exclude_dir2) == 0) ||
+        (strcmp(name, exclude_dir3) == 0) ||
+        (strcmp(name, exclude_dir4) == 0) ||
+        (strcmp(name, exclude_dir5) == 0) ||
+        (strcmp(name, exclude_dir6) == 0))
+      continue;
+
+    PyObject *attr = PyObject_GetAttr(frame->obj, attr_title);
+    if (attr == NULL) {
+      PyErr_Clear();
+      continue;
+    }
+
+    enum IdGraphTypeKind attr_kind = get_type_kind(attr);
+    bool is_ndarray = attr_kind == TYPE_KIND_NDARRAY;
+
+    // For attributes which start with '_', only include those which are
+    // built-in, numpy array of pandas series objects
+    bool include;
+    if (name[0] == '_') {
+      include = isBuiltinObject(attr) || is_ndarray ||
+                attr_kind == TYPE_KIND_SERIES ||
+                attr_kind == TYPE_KIND_PANDAS_SERIES;
+    }
+    // For attributes which don't start with '_', only include primitive
+    // objects
+    else {
+      include = isPrimitiveORString(attr);
+    }
+
+    // check if id remains constant if object is unchanged (excluding numpy
+    // array, primitive and char array objects)
+    if (include && !is_ndarray && !isPrimitiveORString(attr)) {
+      PyObject *attr1 = PyObject_GetAttr(frame->obj, attr_title);
+      PyObject *attr2 = PyObject_GetAttr(frame->obj, attr_title);
+      if (attr1 == NULL || attr2 == NULL) {
+        PyErr_Clear();
+      }
+      include = attr1 != NULL && attr1 == attr2;
+      Py_XDECREF(attr1);
+      Py_XDECREF(attr2);
+    }
+
+    if (include) {
+      // insert attribute name; the contents follow once it is added
+      frame->pending = attr;
+      Py_INCREF(attr_title);
+      *item = attr_title;
+      *parent = frame->node;
+      return true;
+    }
+    Py_DECREF(attr);
+  }
+  return false;
+}
+
+/**
+ * Appends an attribute of an object to a list.
+ *
+ * @return Returns 0 on success, -1 with an exception set on failure.
+ **/
+int append_attribute(PyObject *list, PyObject *obj, const char *name) {
+  PyObject *attr = PyObject_GetAttrString(obj, name);
+  if (attr == NULL) {
+    return -1;
+  }
+  int ret = PyList_Append(list, attr);
+  Py_DECREF(attr);
+  return ret;
+}
+
+/**
+ * Appends the axes and blocks of the BlockManager of a DataFrame or Series to
+ *a list.
+ *
+ * Each block is added as the column positions it holds, followed by its
+ *values: a numpy array (whose data is hashed as a single buffer) or an
+ *extension array. The positions are added as ints since BlockPlacement
+ *creates its arrays on demand.
+ *
+ * @return Returns 0 on success, -1 with an exception set on failure.
+ **/
+int append_block_manager(PyObject *list, PyObject *obj) {
+  PyObject *manager = PyObject_GetAttrString(obj, "_mgr");
+  if (manager == NULL) {
+    // Before pandas 1.1
+    PyErr_Clear();
+    manager = PyObject_GetAttrString(obj, "_data");
+    if (manager == NULL) {
+      return -1;
+    }
+  }
+
+  int ret = -1;
+  PyObject *axes = PyObject_GetAttrString(manager, "axes");
+  PyObject *blocks = PyObject_GetAttrString(manager, "blocks");
+  PyObject *block_list = NULL;
+  if (axes == NULL || blocks == NULL ||
+      (block_list = PySequence_List(blocks)) == NULL) {
+    goto done;
+  }
+  PyObject *axes_list = PySequence_List(axes);
+  if (axes_list == NULL) {
+    goto done;
+  }
+  Py_ssize_t num_axes = PyList_GET_SIZE(axes_list);
+  for (Py_ssize_t i = 0; i < num_axes; i++) {
+    if (PyList_Append(list, PyList_GET_ITEM(axes_list, i)) == -1) {
+      Py_DECREF(axes_list);
+      goto done;
+    }
   }
-  if (child != NULL) {
-    add_child(node, child);
+  Py_DECREF(axes_list);
+
+  Py_ssize_t num_blocks = PyList_GET_SIZE(block_list);
+  for (Py_ssize_t i = 0; i < num_blocks; i++) {
+    PyObject *block = PyList_GET_ITEM(block_list, i);
+    PyObject *placement = PyObject_GetAttrString(block, "mgr_locs");
+    if (placement == NULL) {
+      goto done;
+    }
+    PyObject *locs = PySequence_List(placement);
+    Py_DECREF(placement);
+    if (locs == NULL) {
+      goto done;
+    }
+    Py_ssize_t num_locs = PyList_GET_SIZE(locs);
+    for (Py_ssize_t j = 0; j < num_locs; j++) {
+      if (PyList_Append(list, PyList_GET_ITEM(locs, j)) == -1) {
+        Py_DECREF(locs);
+        goto done;
+      }
+    }
+    Py_DECREF(locs);
+    if (append_attribute(list, block, "values") == -1) {
+      goto done;
+    }
   }
-  return child;
+  ret = 0;
+
+done:
+  Py_XDECREF(block_list);
+  Py_XDECREF(blocks);
+  Py_XDECREF(axes);
+  Py_DECREF(manager);
+  return ret;
 }
 
 /**
- * Iterates over a list of tuple and adds children nodes to the ID graph.
+ * Collects the children of a pandas object from its internals instead of
+ *dir(), so their number grows with the number of blocks rather than with
+ *the API of the type.
+ *
+ * DataFrames and Series produce their name (Series only) and their
+ *BlockManager (see append_block_manager). Indexes produce their name and
+ *values, and RangeIndexes their name, start, stop and step.
+ *
+ * @param obj The pandas object.
+ * @param kind The kind of the type of obj.
+ *
+ * @return Returns a new reference to the list of children, or NULL with an
+ *exception set on failure, e.g. if the internals of this pandas version
+ *differ.
  **/
-void process_collection_items(PyObject *obj, idGraphNode *node,
-                              idGraphNodeList *visited) {
-  Py_ssize_t size = PySequence_Size(obj);
-  for (Py_ssize_t i = 0; i < size; i++) {
-    PyObject *item = PySequence_GetItem(obj, i);
-    process_children(item, node, visited);
+PyObject *get_pandas_children(PyObject *obj, enum IdGraphTypeKind kind) {
+  PyObject *children = PyList_New(0);
+  if (children == NULL) {
+    return NULL;
   }
-}
-
-/**
- * Iterates over a dictionary and adds children nodes to the ID graph.
- **/
-void process_dict_items(PyObject *obj, idGraphNode *node,
-                        idGraphNodeList *visited) {
-  PyObject *keys = PyDict_Keys(obj);
-  PyObject *values = PyDict_Values(obj);
-  Py_ssize_t size = PyList_Size(keys);
-  for (Py_ssize_t i = 0; i < size; i++) {
-    PyObject *key = PyList_GetItem(keys, i);
-    PyObject *value = PyList_GetItem(values, i);
-
-    // add key
-    process_children(key, node, visited);
 
-    // add value
-    process_children(value, node, visited);
+  int ret = 0;
+  if (kind != TYPE_KIND_PANDAS_FRAME) {
+    ret = append_attribute(children, obj, "name");
+  }
+  switch (kind) {
+    case TYPE_KIND_PANDAS_FRAME:
+    case TYPE_KIND_PANDAS_SERIES:
+      if (ret == 0) ret = append_block_manager(children, obj);
+      break;
+    case TYPE_KIND_PANDAS_INDEX:
+      if (ret == 0) ret = append_attribute(children, obj, "_values");
+      break;
+    case TYPE_KIND_PANDAS_RANGE_INDEX:
+      if (ret == 0) ret = append_attribute(children, obj, "start");
+      if (ret == 0) ret = append_attribute(children, obj, "stop");
+      if (ret == 0) ret = append_attribute(children, obj, "step");
+      break;
+    default:
+      break;
   }
+  if (ret == -1) {
+    Py_DECREF(children);
+    return NULL;
+  }
+  return children;
 }
 
 /**
- * Iterates over a set and adds children nodes to the ID graph.
+ * Produces the next child of a pandas object, collected by
+ *get_pandas_children.
+ *
+ * @return Returns true with a new reference in item, or false once all
+ *children are produced.
  **/
-void process_set_items(PyObject *obj, idGraphNode *node,
-                       idGraphNodeList *visited) {
-  PyObject *iter = PyObject_GetIter(obj);
-  PyObject *item;
-  while ((item = PyIter_Next(iter))) {
-    process_children(item, node, visited);
+bool next_pandas_item(idGraphFrame *frame, PyObject **item) {
+  if (frame->items == NULL || frame->index >= frame->size) {
+    return false;
   }
+  *item = PyList_GET_ITEM(frame->items, frame->index++);
+  Py_INCREF(*item);
+  return true;
 }
 
 /**
- * Iterates over a numpy array and adds children nodes to the ID graph.
+ * Produces the next child of the container of a frame.
+ *
+ * @param graph The graph under construction.
+ * @param frame The frame of the container.
+ * @param item Receives a new reference to the child.
+ * @param parent Receives the index of the node the child is added to.
+ *
+ * @return Returns true if a child was produced, false once all children are
+ *added.
  **/
-void process_numpy_items(PyArrayObject *arr_obj, idGraphNode *node,
-                         idGraphNodeList *visited) {
-  npy_intp arr_len = PyArray_SIZE(arr_obj);
-  npy_intp *shp = PyArray_SHAPE(arr_obj);
-  int ndim = PyArray_NDIM(arr_obj);
-
-  // Store shape of array
-  for (int i = 0; i < ndim; i++) {
-    process_children(PyLong_FromLong(shp[i]), node, visited);
-  }
-
-  // Store array elements
-  for (npy_intp i = 0; i < arr_len; ++i) {
-    PyObject *item = PyArray_GETITEM(
-        arr_obj, PyArray_DATA(arr_obj) + i * PyArray_ITEMSIZE(arr_obj));
-
-    process_children(item, node, visited);
-  }
-}
-
-/**
- * Iterates over a pandas object and adds children nodes to the ID graph.
- **/
-void process_pandas_items(PyObject *obj, idGraphNode *node,
-                          idGraphNodeList *visited) {
-  PyObject *dir = PyObject_Dir(obj);
-
-  if (dir != NULL && PyList_Check(dir)) {
-    // Attributes to exclude from idgraph
-    char exclude_dir1[] =
-        "T";  // This attribute, found in dataframe and series objects, are of
-              // the types dataframe and series, and thus iterating through them
-              // would result in an infinite loop
-    char exclude_dir2[] =
-        "__doc__";  // This attribute contains the documentation of the object
-    char exclude_dir3[] =
-        "__dict__";  // Code seems to go into complex and unnecessary classes
-    char exclude_dir4[] =
-        "_agg_summary_and_see_also_doc";        // another documentation
-    char exclude_dir5[] = "_agg_examples_doc";  // another documentation
-    char exclude_dir6[] =
-        "_item_cache";  // Stores data items as cache in case of pandas objects
-
-    Py_ssize_t dir_len = PyList_Size(dir);
-    for (Py_ssize_t i = 0; i < dir_len; i++) {
-      PyObject *attr_title = PyList_GetItem(dir, i);
-      if (attr_title == NULL) continue;
-
-      const char *name = PyUnicode_AsUTF8(attr_title);
-      if (name == NULL) continue;
-
-      if ((strcmp(name, exclude_dir1) == 0) ||
-          (strcmp(name, exclude_dir2) == 0) ||
-          (strcmp(name, exclude_dir3) == 0) ||
-          (strcmp(name, exclude_dir4) == 0) ||
-          (strcmp(name, exclude_dir5) == 0) ||
-          (strcmp(name, exclude_dir6) == 0))
-        continue;
-
-      PyObject *attr = PyObject_GetAttr(obj, attr_title);
-      if (attr == NULL) continue;
-
-      const char *name2 = PyUnicode_AsUTF8(
-          PyObject_GetAttrString(PyObject_Type(attr), "__name__"));
-      if (name2 == NULL) continue;
-
-      // For attributes which start with '_', only include those which are
-      // built-in, numpy array of pandas series objects
-      if (name[0] == '_') {
-        if (!(isBuiltinObject(attr) || (strcmp(name2, "ndarray") == 0) ||
-              (strcmp(name2, "Series") == 0)))
-          continue;
-      }
-      // For attributes which don't start with '_', only include primitive
-      // objects
-      if (name[0] != '_' && !isPrimitiveORString(attr)) continue;
-
-      // check if id remains constant if object is unchanged (excluding numpy
-      // array, primitive and char array objects)
-      if (strcmp(name2, "ndarray") != 0 && !isPrimitiveORString(attr)) {
-        if (get_builtin_id(PyObject_GetAttr(obj, attr_title)) !=
-            get_builtin_id(PyObject_GetAttr(obj, attr_title)))
-          continue;
+bool next_child(idGraph *graph, idGraphFrame *frame, PyObject **item,
+                Py_ssize_t *parent) {
+  *parent = frame->node;
+  switch (frame->kind) {
+    case FRAME_SEQUENCE:
+      return next_sequence_item(frame, item);
+    case FRAME_DICT:
+      return next_dict_item(frame, item);
+    case FRAME_SET:
+      return next_set_item(frame, item);
+    case FRAME_CLASS:
+      return next_attribute(frame, item, parent);
+    case FRAME_PANDAS:
+      return next_pandas_item(frame, item);
+    case FRAME_NDARRAY:
+      if (frame->step == FRAME_STEP_ITEMS) {
+        if (next_attribute(frame, item, parent)) {
+          return true;
+        }
+        frame->step = FRAME_STEP_SHAPE;
+        frame->index = 0;
+        frame->size = PyArray_NDIM((PyArrayObject *)frame->obj);
       }
-
-      // insert attribute name
-      idGraphNode *child = process_children(attr_title, node, visited);
-
-      // insert attribute contents
-      process_children(attr, child, visited);
-    }
+      return next_numpy_item(graph, frame, item);
   }
+  return false;
 }
 
 /**
- * Computes an ID graph(idGraphNode *) for any python object.
- *
- * Recursively iterates over the children of the given python object
- * and stores the objectId(memory address) and type of objects
- * that fall under one of these categories (list, set, tuple, dictionary, class
- *instance).
+ * Adds a node for an object that is not on the traversal path.
  *
- * We maintain a visited objects list to identify cyclic references.
- * For cyclically referenced objects, we only store the id of the visited object
- *to avoid infinite loop.
+ * Stores the objectId(memory address) and type of objects that fall under one
+ *of these categories (list, set, tuple, dictionary, class instance), and the
+ *value of primitives. Containers are marked as visited with a frame pushed to
+ *add their children.
  *
  * @param obj A python object.
- * @param visited A list of visited objects.
+ * @param parent Index of the parent node, or NO_NODE for the root.
+ * @param graph The graph the created node is appended to.
  *
- * @return Returns the head of the ID graph (idGraphNode *)
+ * @return Returns the index of the node of obj, or NO_NODE on failure.
  **/
-idGraphNode *create_id_graph(PyObject *obj, idGraphNodeList *visited) {
-  idGraphNode *node = NULL;
+Py_ssize_t add_object_node(PyObject *obj, Py_ssize_t parent, idGraph *graph) {
+  Py_ssize_t node = NO_NODE;
+  int64_t previous = IDMAP_MISSING;
+  enum IdGraphFrameKind kind;
+  PyObject *items = NULL;
+  PyObject *values = NULL;
+  Py_ssize_t size = 0;
   const long builtin_id = get_builtin_id(obj);
+  STATS_INC(objects_visited);
   // List
   if (PyList_Check(obj)) {
-    node = create_idGraphNode(builtin_id, OBJ_TYPE_LIST, 0);
-    visited = mark_visited(visited, node);
-    process_collection_items(obj, node, visited);
+    node = add_node(graph, parent, builtin_id, OBJ_TYPE_LIST, 0);
+    if (node == NO_NODE || mark_visited(graph, node, &previous) == -1)
+      goto oom;
+    kind = FRAME_SEQUENCE;
+    size = PySequence_Size(obj);
   }
 
   // Tuple
   else if (PyTuple_Check(obj)) {
-    node = create_idGraphNode(builtin_id, OBJ_TYPE_TUPLE, 0);
-    visited = mark_visited(visited, node);
-    process_collection_items(obj, node, visited);
+    node = add_node(graph, parent, builtin_id, OBJ_TYPE_TUPLE, 0);
+    if (node == NO_NODE || mark_visited(graph, node, &previous) == -1)
+      goto oom;
+    kind = FRAME_SEQUENCE;
+    size = PySequence_Size(obj);
   }
 
   // Dictionary
   else if (PyDict_Check(obj)) {
-    node = create_idGraphNode(builtin_id, OBJ_TYPE_DICT, 0);
-    visited = mark_visited(visited, node);
-    process_dict_items(obj, node, visited);
+    node = add_node(graph, parent, builtin_id, OBJ_TYPE_DICT, 0);
+    if (node == NO_NODE || mark_visited(graph, node, &previous) == -1)
+      goto oom;
+    kind = FRAME_DICT;
+    items = PyDict_Keys(obj);
+    values = PyDict_Values(obj);
+    if (items == NULL || values == NULL) {
+      Py_CLEAR(items);
+      Py_CLEAR(values);
+    } else {
+      size = PyList_GET_SIZE(items);
+    }
   }
 
   // Set
   else if (PyAnySet_Check(obj)) {
-    node = create_idGraphNode(builtin_id, OBJ_TYPE_SET, 0);
-    visited = mark_visited(visited, node);
-    process_set_items(obj, node, visited);
+    node = add_node(graph, parent, builtin_id, OBJ_TYPE_SET, 0);
+    if (node == NO_NODE || mark_visited(graph, node, &previous) == -1)
+      goto oom;
+    kind = FRAME_SET;
+    items = PyObject_GetIter(obj);
+    if (items == NULL) {
+      unmark_visited(graph, node, previous);
+      return node;
+    }
   }
 
   // Bool
   else if (PyBool_Check(obj)) {
-    int val = PyObject_IsTrue(obj);
-    node = create_idGraphNode(builtin_id, OBJ_TYPE_BOOL, true);
-    node->primitive.obj_int = val;
+    idGraphPrimitiveValue value = {.obj_int = PyObject_IsTrue(obj)};
+    node = add_primitive_node(graph, parent, builtin_id, OBJ_TYPE_BOOL, value);
+    if (node == NO_NODE) goto oom;
+    return node;
   }
 
   // Long(Integers)
   else if (PyLong_Check(obj)) {
-    long val = PyLong_AsLong(obj);
-    node = create_idGraphNode(builtin_id, OBJ_TYPE_INT, true);
-    node->primitive.obj_int = val;
+    idGraphPrimitiveValue value = {.obj_int = PyLong_AsLong(obj)};
+    node = add_primitive_node(graph, parent, builtin_id, OBJ_TYPE_INT, value);
+    if (node == NO_NODE) goto oom;
+    return node;
   }
 
   // Float(Floating point)
   else if (PyFloat_Check(obj)) {
-    double val = PyFloat_AsDouble(obj);
-    node = create_idGraphNode(builtin_id, OBJ_TYPE_FLOAT, true);
-    node->primitive.obj_float = val;
+    idGraphPrimitiveValue value = {.obj_float = PyFloat_AsDouble(obj)};
+    node = add_primitive_node(graph, parent, builtin_id, OBJ_TYPE_FLOAT, value);
+    if (node == NO_NODE) goto oom;
+    return node;
   }
 
   // String
   else if (PyUnicode_Check(obj)) {
-    const char *val = PyUnicode_AsUTF8(obj);
-    node = create_idGraphNode(builtin_id, OBJ_TYPE_STRING, true);
-    node->primitive.obj_str = val;
+    idGraphPrimitiveValue value = {.obj_str = PyUnicode_AsUTF8(obj)};
+    if (value.obj_str == NULL) return NO_NODE;
+    node =
+        add_primitive_node(graph, parent, builtin_id, OBJ_TYPE_STRING, value);
+    if (node == NO_NODE) goto oom;
+    return node;
   }
 
   // Numpy Arrays
-  else if (strcmp(PyUnicode_AsUTF8(
-                      PyObject_GetAttrString(PyObject_Type(obj), "__name__")),
-                  "ndarray") == 0) {
+  else if (get_type_kind(obj) == TYPE_KIND_NDARRAY) {
     import_array();
 
     PyArrayObject *arr_obj = (PyArrayObject *)obj;
     const long builtin_id_2 = (long)(PyArray_BASE(arr_obj));
 
-    if (builtin_id_2 == 0)
-      node = create_idGraphNode(builtin_id, OBJ_TYPE_CLASS, 0);
-    else
-      node = create_idGraphNode(builtin_id_2, OBJ_TYPE_CLASS, 0);
-
-    visited = mark_visited(visited, node);
-    process_pandas_items(obj, node, visited);
-    process_numpy_items(arr_obj, node, visited);
+    node = add_node(graph, parent, builtin_id_2 == 0 ? builtin_id : builtin_id_2,
+                    OBJ_TYPE_CLASS, 0);
+    if (node == NO_NODE || mark_visited(graph, node, &previous) == -1)
+      goto oom;
+    kind = FRAME_NDARRAY;
   }
 
   // Other Class object (Currently implemented only for pandas objects)
   else if (!PyModule_Check(obj) && !PyType_Check(obj) && obj != NULL) {
-    node = create_idGraphNode(builtin_id, OBJ_TYPE_CLASS, 0);
-    visited = mark_visited(visited, node);
-    process_pandas_items(obj, node, visited);
+    node = add_node(graph, parent, builtin_id, OBJ_TYPE_CLASS, 0);
+    if (node == NO_NODE || mark_visited(graph, node, &previous) == -1)
+      goto oom;
+    kind = FRAME_CLASS;
+
+    // DataFrames, Series and Indexes, unless their internals are unknown
+    enum IdGraphTypeKind type_kind = get_type_kind(obj);
+    if (type_kind >= TYPE_KIND_PANDAS_FRAME) {
+      items = get_pandas_children(obj, type_kind);
+      if (items == NULL) {
+        PyErr_Clear();
+      } else {
+        kind = FRAME_PANDAS;
+        size = PyList_GET_SIZE(items);
+      }
+    }
   }
 
   // Not implemented  objects
   else {
     PyErr_SetString(PyExc_NotImplementedError, "Unsupported type.");
-    return NULL;
+    return NO_NODE;
+  }
+
+  // Attributes of class instances and numpy arrays. The blocks of pandas
+  // objects only contribute their data.
+  bool in_pandas = graph->num_frames > 0 &&
+                   graph->frames[graph->num_frames - 1].kind == FRAME_PANDAS;
+  if (kind == FRAME_CLASS || (kind == FRAME_NDARRAY && !in_pandas)) {
+    items = PyObject_Dir(obj);
+    if (items == NULL) {
+      PyErr_Clear();
+    } else if (!PyList_Check(items)) {
+      Py_CLEAR(items);
+    } else {
+      size = PyList_GET_SIZE(items);
+    }
   }
 
+  Py_INCREF(obj);
+  if (push_frame(graph, kind, obj, items, values, node, previous, size) == -1)
+    goto oom;
   return node;
+
+oom:
+  graph->out_of_memory = true;
+  return NO_NODE;
 }
 
 /**
- * Returns the ID graph(idGraphNode *) as PyCapsule object.
+ * Computes an ID graph for any python object.
  *
- * This method is exposed to the Python caller class.
+ * Iterates over the children of the given python object in preorder, from an
+ *explicit stack of frames of the containers on the current traversal path
+ *rather than by recursion, so arbitrarily deep objects are supported.
  *
- * @param self Ref to this module object. (Unued. Included to follow Python C
- *extensions convention.)
- * @param args A tuple consisting of arguments passed to the function.
+ * We maintain the containers on the current traversal path to identify cyclic
+ *references. For cyclically referenced objects, we only store the id of the
+ *visited object to avoid infinite loop.
+ *
+ * @param obj A python object.
+ * @param parent Index of the parent node, or NO_NODE for the root.
+ * @param graph The graph the created nodes are appended to.
  *
- * @return Returns a Python capsule representing the pointer to ID graph head.
+ * @return Returns the index of the node of obj, or NO_NODE on failure.
  **/
-static PyObject *get_idgraph(PyObject *self, PyObject *args) {
-  PyObject *obj;
-  if (!PyArg_ParseTuple(args, "O", &obj)) {
+Py_ssize_t create_id_graph(PyObject *obj, Py_ssize_t parent, idGraph *graph) {
+  Py_ssize_t base = graph->num_frames;
+  Py_ssize_t node = add_object_node(obj, parent, graph);
+  while (graph->num_frames > base && !graph->out_of_memory) {
+    // Frames are accessed by index, as adding a child may grow the stack
+    Py_ssize_t top = graph->num_frames - 1;
+    PyObject *item;
+    Py_ssize_t item_parent;
+    if (!next_child(graph, &graph->frames[top], &item, &item_parent)) {
+      pop_frame(graph);
+      continue;
+    }
+    Py_ssize_t child = process_children(item, item_parent, graph);
+    Py_DECREF(item);
+    graph->frames[top].last_child = child;
+  }
+  while (graph->num_frames > base) {
+    pop_frame(graph);
+  }
+  return graph->out_of_memory ? NO_NODE : node;
+}
+
+// Graph of the comparisons against stored graphs, kept across calls so that
+// comparing an unchanged object allocates nothing once warmed up
+static idGraph *comparison_graph = NULL;
+static bool comparison_graph_in_use = false;
+
+/**
+ * Compares the ID graph of an object with a stored one while traversing the
+ *object.
+ *
+ * The object is traversed as by create_id_graph, but its nodes are checked
+ *against reference instead of being stored (see add_node), so the traversal
+ *stops at the first structural or value difference.
+ *
+ * @param obj A python object.
+ * @param reference A finalized ID graph.
+ *
+ * @return Returns 1 if the ID graph of obj equals reference, 0 if not, or -1
+ *with an exception set on failure.
+ **/
+int matches_id_graph(PyObject *obj, const idGraph *reference) {
+  // Traversals run Python code (e.g. dir()), which may compare again
+  bool shared = !comparison_graph_in_use;
+  if (shared && comparison_graph == NULL) {
+    comparison_graph = create_idGraph();
+  }
+  idGraph *graph = shared ? comparison_graph : create_idGraph();
+  if (graph == NULL) {
+    PyErr_NoMemory();
+    return -1;
+  }
+  comparison_graph_in_use = true;
+  graph->num_nodes = 0;
+  graph->reference = reference;
+  graph->diverged = false;
+  graph->out_of_memory = false;
+
+  uint64_t start_ns = stats_monotonic_ns();
+  Py_ssize_t head = create_id_graph(obj, NO_NODE, graph);
+  stats_timer_stop(STATS_TIMER_COMPARE, start_ns);
+  int ret;
+  if (graph->diverged) {
+    ret = 0;
+  } else if (graph->out_of_memory) {
+    PyErr_NoMemory();
+    ret = -1;
+  } else if (head == NO_NODE) {
+    PyErr_SetString(PyExc_Exception, "Could not generate ID Graph.");
+    ret = -1;
+  } else {
+    ret = graph->num_nodes == reference->num_nodes;
+  }
+
+  if (!shared) {
+    free_idGraph(graph);
+  } else {
+    comparison_graph_in_use = false;
+    // The traversal path may not have been unmarked after running out of
+    // memory
+    if (graph->out_of_memory && !graph->diverged) {
+      free_idGraph(graph);
+      comparison_graph = NULL;
+    }
+  }
+  return ret;
+}
+
+/**
+ * Releases the ID graph owned by a capsule.
+ *
+ * Called by Python when the capsule is garbage collected.
+ *
+ * @param capsule The capsule holding the graph.
+ **/
+static void idgraph_capsule_destructor(PyObject *capsule) {
+  free_idGraph((idGraph *)PyCapsule_GetPointer(capsule, "idgraph"));
+}
+
+/**
+ * Extracts the ID graph held by a capsule.
+ *
+ * @param capsule The capsule holding the graph.
+ *
+ * @return Returns the graph, or NULL with an exception set if capsule is not
+ *an ID graph.
+ **/
+idGraph *get_capsule_graph(PyObject *capsule) {
+  idGraph *graph = (idGraph *)PyCapsule_GetPointer(capsule, "idgraph");
+  if (graph == NULL || graph->num_nodes == 0) {
+    PyErr_SetString(PyExc_TypeError, "Invalid Capsule Object");
     return NULL;
   }
+  return graph;
+}
 
-  idGraphNodeList *visited = NULL;
-  idGraphNode *head = create_id_graph(obj, visited);
+/**
+ * Computes the ID graph of an object.
+ *
+ * @param obj A python object.
+ *
+ * @return Returns a new capsule owning the graph, or NULL with an exception
+ *set.
+ **/
+static PyObject *new_idgraph_capsule(PyObject *obj) {
+  idGraph *graph = create_idGraph();
+  if (graph == NULL) {
+    return PyErr_NoMemory();
+  }
 
-  // TODO: free visited
+  uint64_t start_ns = stats_monotonic_ns();
+  Py_ssize_t head = create_id_graph(obj, NO_NODE, graph);
+  stats_timer_stop(STATS_TIMER_TRAVERSE, start_ns);
 
-  if (head == NULL) {
+  if (graph->out_of_memory) {
+    free_idGraph(graph);
+    return PyErr_NoMemory();
+  }
+  if (head == NO_NODE) {
+    free_idGraph(graph);
     PyErr_SetString(PyExc_Exception, "Could not generate ID Graph.");
     return NULL;
   }
-  PyObject *id_graph_capsule = PyCapsule_New((void *)head, "idgraph", NULL);
+  if (finalize_idGraph(graph) == -1) {
+    free_idGraph(graph);
+    return NULL;
+  }
+  PyObject *id_graph_capsule =
+      PyCapsule_New((void *)graph, "idgraph", idgraph_capsule_destructor);
   if (id_graph_capsule == NULL) {
+    free_idGraph(graph);
     return NULL;
   }
 
   return id_graph_capsule;
 }
 
+/**
+ * Returns the ID graph as PyCapsule object.
+ *
+ * This method is exposed to the Python caller class.
+ *
+ * @param self Ref to this module object. (Unued. Included to follow Python C
+ *extensions convention.)
+ * @param args A tuple consisting of arguments passed to the function.
+ *
+ * @return Returns a Python capsule representing the pointer to ID graph.
+ *The capsule owns the graph and frees it when destroyed.
+ **/
+static PyObject *get_idgraph(PyObject *self, PyObject *args) {
+  PyObject *obj;
+  if (!PyArg_ParseTuple(args, "O", &obj)) {
+    return NULL;
+  }
+  return new_idgraph_capsule(obj);
+}
+
 /**
  * Returns the JSON representation of ID graph.
  *
@@ -590,82 +2109,165 @@ static PyObject *idgraph_json(PyObject *self, PyObject *args) {
   if (!PyArg_ParseTuple(args, "O", &obj)) {
     return NULL;
   }
-  idGraphNode *head = (idGraphNode *)PyCapsule_GetPointer(obj, "idgraph");
+  idGraph *graph = get_capsule_graph(obj);
+  if (graph == NULL) {
+    return NULL;
+  }
+
+  // Rendering only touches the graph, so other threads may run
+  char *jsonRep;
+  Py_BEGIN_ALLOW_THREADS
+  jsonRep = get_json_str(graph);
+  Py_END_ALLOW_THREADS
+  if (jsonRep == NULL) {
+    return PyErr_NoMemory();
+  }
+
+  PyObject *json = PyUnicode_FromString(jsonRep);
+  free(jsonRep);
+  return json;
+}
+
+/**
+ * Returns the binary encoding of ID graph (see serialize_idGraph).
+ *
+ * This method is exposed to the Python caller class.
+ *
+ * @param self Ref to this module object. (Unued. Included to follow Python C
+ *extensions convention.)
+ * @param args A tuple consisting of arguments passed to the function.
+ *
+ * @return Returns a Python bytes object holding the encoding.
+ **/
+static PyObject *idgraph_bytes(PyObject *self, PyObject *args) {
+  PyObject *obj;
+  if (!PyArg_ParseTuple(args, "O", &obj)) {
+    return NULL;
+  }
+  idGraph *graph = get_capsule_graph(obj);
+  if (graph == NULL) {
+    return NULL;
+  }
+
+  unsigned char *encoding;
+  size_t len = 0;
+  Py_BEGIN_ALLOW_THREADS
+  encoding = serialize_idGraph(graph, &len);
+  Py_END_ALLOW_THREADS
+  if (encoding == NULL) {
+    return PyErr_NoMemory();
+  }
+
+  PyObject *bytes = PyBytes_FromStringAndSize((const char *)encoding, len);
+  free(encoding);
+  return bytes;
+}
 
-  char *jsonRep = get_json_str(head);
+/**
+ * Rebuilds an ID graph from its binary encoding.
+ *
+ * This method is exposed to the Python caller class.
+ *
+ * @param self Ref to this module object. (Unued. Included to follow Python C
+ *extensions convention.)
+ * @param args A tuple holding a bytes-like object with the encoding.
+ *
+ * @return Returns a Python capsule representing the pointer to the ID graph,
+ *which can be compared with the capsules of get_idgraph.
+ **/
+static PyObject *idgraph_from_bytes(PyObject *self, PyObject *args) {
+  Py_buffer encoding;
+  if (!PyArg_ParseTuple(args, "y*", &encoding)) {
+    return NULL;
+  }
+  idGraph *graph =
+      deserialize_idGraph((const unsigned char *)encoding.buf, encoding.len);
+  PyBuffer_Release(&encoding);
+  if (graph == NULL) {
+    return NULL;
+  }
 
-  return PyUnicode_FromString(jsonRep);
+  PyObject *id_graph_capsule =
+      PyCapsule_New((void *)graph, "idgraph", idgraph_capsule_destructor);
+  if (id_graph_capsule == NULL) {
+    free_idGraph(graph);
+    return NULL;
+  }
+  return id_graph_capsule;
 }
 
 /**
- * Compares two idGraphNode pointers.
+ * Compares two nodes of (possibly different) ID graphs.
  *
- * Recursively compares the id and type of an object and it's children.
+ * Only the node itself and its number of children are compared, not the
+ *children.
  *
- * @param node1 idGraphNode pointer to be compared.
- * @param node2 idGraphNode pointer to be compared.
+ * @param graph1 ID graph of node1.
+ * @param node1 Node index to be compared.
+ * @param graph2 ID graph of node2.
+ * @param node2 Node index to be compared.
  *
  * @return Returns 1 if both the nodes are equivalent, else returns 0
  **/
-int compareNodes(idGraphNode *node1, idGraphNode *node2) {
+int compareNodes(const idGraph *graph1, Py_ssize_t node1,
+                 const idGraph *graph2, Py_ssize_t node2) {
+  enum IdGraphObjectType obj_type = graph1->obj_type[node1];
+  const idGraphPrimitiveValue *primitive1 = &graph1->primitive[node1];
+  const idGraphPrimitiveValue *primitive2 = &graph2->primitive[node2];
+
   // Compare object type
-  if (node1->obj_type != node2->obj_type) {
+  if (obj_type != graph2->obj_type[node2]) {
     return 0;
   }
 
   // Compare if primitive
-  if (node1->is_primitive != node2->is_primitive) {
+  if (graph1->is_primitive[node1] != graph2->is_primitive[node2]) {
     return 0;
   }
 
   // If primitive
-  if (node1->is_primitive) {
-    // Compare for ints
-    if (node1->obj_type == OBJ_TYPE_INT &&
-        node1->primitive.obj_int != node2->primitive.obj_int) {
-      return 0;
-    }
-    // Compare for floats
-    if (node1->obj_type == OBJ_TYPE_FLOAT &&
-        node1->primitive.obj_float != node2->primitive.obj_float) {
-      return 0;
-    }
-    // Compare for boolean
-    if (node1->obj_type == OBJ_TYPE_BOOL &&
-        node1->primitive.obj_bool != node2->primitive.obj_bool) {
-      return 0;
-    }
-    // Compare for string
-    if (node1->obj_type == OBJ_TYPE_STRING &&
-        strcmp(node1->primitive.obj_str, node2->primitive.obj_str) != 0) {
+  if (graph1->is_primitive[node1]) {
+    if (!primitive_equals(obj_type, primitive1, primitive2)) {
       return 0;
     }
   } else {
     // Compare object id
-    if (node1->obj_id != node2->obj_id) {
+    if (graph1->obj_id[node1] != graph2->obj_id[node2]) {
       return 0;
     }
   }
 
-  // Compare children
-  idGraphNodeList *curr1 = node1->children;
-  idGraphNodeList *curr2 = node2->children;
-  while (curr1 != NULL && curr2 != NULL) {
-    if (!compareNodes(curr1->child, curr2->child)) {
+  // If the number of children differ, they are not equal
+  return num_children(graph1, node1) == num_children(graph2, node2);
+}
+
+/**
+ * Compares two ID graphs.
+ *
+ * Nodes are stored in preorder, and a preorder sequence together with the
+ *number of children of every node determines the tree. The graphs are thus
+ *equal iff they have the same number of nodes and every pair of nodes at the
+ *same index is equal, which is checked with a single linear scan.
+ *
+ * @param graph1 ID graph to be compared.
+ * @param graph2 ID graph to be compared.
+ *
+ * @return Returns 1 if both the graphs are equivalent, else returns 0
+ **/
+int compareGraphs(const idGraph *graph1, const idGraph *graph2) {
+  if (graph1->num_nodes != graph2->num_nodes) {
+    return 0;
+  }
+  for (Py_ssize_t i = 0; i < graph1->num_nodes; i++) {
+    if (!compareNodes(graph1, i, graph2, i)) {
       return 0;
     }
-    curr1 = curr1->next;
-    curr2 = curr2->next;
-  }
-  // If one of the lists is not empty, they are not equal
-  if (curr1 != NULL || curr2 != NULL) {
-    return 0;
   }
   return 1;
 }
 
 /**
- * Compares the ID graphs(idGraphNode *) for any 2 python capsule objects.
+ * Compares the ID graphs for any 2 python capsule objects.
  *
  * This method is exposed to the Python caller class.
  *
@@ -683,26 +2285,163 @@ static PyObject *idgraph_compare_object(PyObject *self, PyObject *args) {
     return NULL;
   }
 
-  void *ptr1 = PyCapsule_GetPointer(capsule1, "idgraph");
-  void *ptr2 = PyCapsule_GetPointer(capsule2, "idgraph");
+  idGraph *graph1 = get_capsule_graph(capsule1);
+  idGraph *graph2 = get_capsule_graph(capsule2);
+  if (graph1 == NULL || graph2 == NULL) {
+    return NULL;
+  }
+  int result;
+  uint64_t start_ns = stats_monotonic_ns();
+  Py_BEGIN_ALLOW_THREADS
+  result = compareGraphs(graph1, graph2);
+  Py_END_ALLOW_THREADS
+  stats_timer_stop(STATS_TIMER_COMPARE, start_ns);
+  return PyBool_FromLong(result);
+}
 
-  if (ptr1 == NULL || ptr2 == NULL) {
-    PyErr_SetString(PyExc_TypeError, "Invalid Capsule Object");
+/**
+ * Compares many pairs of ID graphs in one call.
+ *
+ * The graphs are collected first, then all pairs are compared without
+ *holding the GIL.
+ *
+ * This method is exposed to the Python caller class.
+ *
+ * @param self Ref to this module object. (Unued. Included to follow Python C
+ *extensions convention.)
+ * @param args A tuple holding a sequence of (capsule, capsule) tuples.
+ *
+ * @return Returns a Python list of booleans, one per pair, which are True if
+ *the graphs of the pair are equal.
+ **/
+static PyObject *idgraph_compare_objects(PyObject *self, PyObject *args) {
+  PyObject *pairs;
+  if (!PyArg_ParseTuple(args, "O", &pairs)) {
     return NULL;
   }
-  idGraphNode *node1 = (idGraphNode *)ptr1;
-  idGraphNode *node2 = (idGraphNode *)ptr2;
-  if (node1 == NULL || node2 == NULL) {
-    PyErr_SetString(PyExc_TypeError, "Invalid Capsule Object");
+  // A list could be emptied by another thread while the GIL is released,
+  // freeing the graphs being compared, so the pairs are held by a tuple
+  PyObject *seq = PySequence_Tuple(pairs);
+  if (seq == NULL) {
+    return NULL;
+  }
+
+  Py_ssize_t num_pairs = PyTuple_GET_SIZE(seq);
+  Py_ssize_t num_allocated = num_pairs ? num_pairs : 1;
+  const idGraph **graphs =
+      (const idGraph **)malloc(num_allocated * 2 * sizeof(idGraph *));
+  int *results = (int *)malloc(num_allocated * sizeof(int));
+  if (graphs == NULL || results == NULL) {
+    free(graphs);
+    free(results);
+    Py_DECREF(seq);
+    return PyErr_NoMemory();
+  }
+
+  // The pairs are tuples, so the capsules stay referenced by seq
+  PyObject *result_list = NULL;
+  for (Py_ssize_t i = 0; i < num_pairs; i++) {
+    PyObject *pair = PyTuple_GET_ITEM(seq, i);
+    if (!PyTuple_Check(pair) || PyTuple_GET_SIZE(pair) != 2) {
+      PyErr_Format(PyExc_TypeError,
+                   "compare_graphs() expects (capsule, capsule) tuples, got "
+                   "%.200s at index %zd",
+                   Py_TYPE(pair)->tp_name, i);
+      goto done;
+    }
+    graphs[2 * i] = get_capsule_graph(PyTuple_GET_ITEM(pair, 0));
+    graphs[2 * i + 1] = get_capsule_graph(PyTuple_GET_ITEM(pair, 1));
+    if (graphs[2 * i] == NULL || graphs[2 * i + 1] == NULL) {
+      goto done;
+    }
+  }
+
+  uint64_t start_ns = stats_monotonic_ns();
+  Py_BEGIN_ALLOW_THREADS
+  for (Py_ssize_t i = 0; i < num_pairs; i++) {
+    results[i] = compareGraphs(graphs[2 * i], graphs[2 * i + 1]);
+  }
+  Py_END_ALLOW_THREADS
+  stats_timer_stop(STATS_TIMER_COMPARE, start_ns);
+
+  result_list = PyList_New(num_pairs);
+  if (result_list == NULL) {
+    goto done;
+  }
+  for (Py_ssize_t i = 0; i < num_pairs; i++) {
+    PyList_SET_ITEM(result_list, i, PyBool_FromLong(results[i]));
+  }
+
+done:
+  free(graphs);
+  free(results);
+  Py_DECREF(seq);
+  return result_list;
+}
+
+/**
+ * Compares the ID graph of a capsule with the current state of an object.
+ *
+ * This method is exposed to the Python caller class.
+ *
+ * @param self Ref to this module object. (Unued. Included to follow Python C
+ *extensions convention.)
+ * @param args A tuple holding the capsule and the object.
+ *
+ * @return Returns True if the ID graph of the object equals the graph of the
+ *capsule, False otherwise. No graph is built for the object.
+ **/
+static PyObject *idgraph_compare_graph_object(PyObject *self, PyObject *args) {
+  PyObject *capsule;
+  PyObject *obj;
+  if (!PyArg_ParseTuple(args, "OO", &capsule, &obj)) {
+    return NULL;
+  }
+  idGraph *reference = get_capsule_graph(capsule);
+  if (reference == NULL) {
     return NULL;
   }
-  int result = compareNodes(node1, node2);
+  int result = matches_id_graph(obj, reference);
   if (result == -1) {
     return NULL;
   }
   return PyBool_FromLong(result);
 }
 
+/**
+ * Returns the ID graph of an object, reusing the graph of a capsule if the
+ *object is unchanged.
+ *
+ * This method is exposed to the Python caller class.
+ *
+ * @param self Ref to this module object. (Unued. Included to follow Python C
+ *extensions convention.)
+ * @param args A tuple holding the capsule and the object.
+ *
+ * @return Returns the capsule itself if the ID graph of the object equals its
+ *graph, otherwise a new capsule holding the ID graph of the object.
+ **/
+static PyObject *idgraph_update(PyObject *self, PyObject *args) {
+  PyObject *capsule;
+  PyObject *obj;
+  if (!PyArg_ParseTuple(args, "OO", &capsule, &obj)) {
+    return NULL;
+  }
+  idGraph *reference = get_capsule_graph(capsule);
+  if (reference == NULL) {
+    return NULL;
+  }
+  int result = matches_id_graph(obj, reference);
+  if (result == -1) {
+    return NULL;
+  }
+  if (result) {
+    Py_INCREF(capsule);
+    return capsule;
+  }
+  return new_idgraph_capsule(obj);
+}
+
 /**
  * Compares 2 python strings (String representation of the ID graph)
  *
@@ -736,7 +2475,7 @@ static PyObject *idgraph_compare_string(PyObject *self, PyObject *args) {
  * @brief Get the obj id object
  *
  * @param self Unused.
- * @param args Python object for idGraphNode.
+ * @param args Python capsule object for the ID graph.
  * @return long The ID of the underlying object.
  */
 static PyObject *idgraph_obj_id(PyObject *self, PyObject *args) {
@@ -749,13 +2488,40 @@ static PyObject *idgraph_obj_id(PyObject *self, PyObject *args) {
     return NULL;
   }
 
-  idGraphNode *node = (idGraphNode *)PyCapsule_GetPointer(capsule, "idgraph");
-  if (node == NULL) {
-    PyErr_SetString(PyExc_TypeError, "Invalid Capsule Object");
+  idGraph *graph = get_capsule_graph(capsule);
+  if (graph == NULL) {
     return NULL;
   }
 
-  return PyLong_FromLong(node->obj_id);
+  return PyLong_FromLong(graph->obj_id[0]);
+}
+
+/**
+ * Returns the instrumentation counters and timers of the module.
+ *
+ * This method is exposed to the Python caller class.
+ *
+ * @param self Unused.
+ * @param args Unused.
+ *
+ * @return Returns a Python dict of the counters and timers (see stats_c.h)
+ *accumulated since the module was loaded or reset_stats was called.
+ **/
+static PyObject *idgraph_get_stats(PyObject *self, PyObject *args) {
+  return stats_as_dict();
+}
+
+/**
+ * Zeroes the instrumentation counters and timers of the module.
+ *
+ * @param self Unused.
+ * @param args Unused.
+ *
+ * @return Returns None.
+ **/
+static PyObject *idgraph_reset_stats(PyObject *self, PyObject *args) {
+  stats_reset();
+  Py_RETURN_NONE;
 }
 
 /**
@@ -767,12 +2533,28 @@ static PyMethodDef IdGraphMethods[] = {
      "Python interface for the idgraph C library function."},
     {"idgraph_json", idgraph_json, METH_VARARGS,
      "Get JSON representation of the ID graph object."},
+    {"idgraph_bytes", idgraph_bytes, METH_VARARGS,
+     "Get compact binary representation of the ID graph object."},
+    {"idgraph_from_bytes", idgraph_from_bytes, METH_VARARGS,
+     "Rebuild an ID graph object from its binary representation."},
     {"compare_graph", idgraph_compare_object, METH_VARARGS,
      "Compare two capsule objects and return True if they are equal."},
+    {"compare_graphs", idgraph_compare_objects, METH_VARARGS,
+     "Compare a sequence of capsule object pairs and return a list of "
+     "booleans."},
+    {"compare_graph_object", idgraph_compare_graph_object, METH_VARARGS,
+     "Compare the graph of a capsule object with the current state of an "
+     "object, stopping at the first difference."},
+    {"update_idgraph", idgraph_update, METH_VARARGS,
+     "Return the capsule object if an object is unchanged, else a new one."},
     {"compare_json", idgraph_compare_string, METH_VARARGS,
      "Compare two JSON strings and return True if they are equal."},
     {"idgraph_obj_id", idgraph_obj_id, METH_VARARGS,
-     "Get the object id of idGraphNode."},
+     "Get the object id of the ID graph root."},
+    {"get_stats", idgraph_get_stats, METH_NOARGS,
+     "Get the counters and monotonic timers of the native hot paths."},
+    {"reset_stats", idgraph_reset_stats, METH_NOARGS,
+     "Zero the counters and timers returned by get_stats."},
     {NULL, NULL, 0, NULL}};
 
 /**
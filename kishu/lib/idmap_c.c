@@ -0,0 +1,125 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include "idmap_c.h"
+
+#define IDMAP_MIN_CAPACITY 16
+
+static inline size_t idmap_hash(uint64_t key) {
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    return (size_t)key;
+}
+
+/*
+* Initializes an empty map sized for about expected entries
+* Return: 0 on success, -1 if out of memory
+*/
+int idmap_init(IdMap *map, size_t expected) {
+    size_t capacity = IDMAP_MIN_CAPACITY;
+    while (capacity * 7 < expected * 10)
+        capacity *= 2;
+    map->entries = (IdMapEntry*) calloc(capacity, sizeof(IdMapEntry));
+    if (!map->entries)
+        return -1;
+    map->capacity = capacity;
+    map->count = 0;
+    return 0;
+}
+
+// Returns the slot holding key, or the empty slot where it would be inserted
+static size_t idmap_find_slot(const IdMapEntry *entries, size_t capacity, uint64_t key) {
+    size_t mask = capacity - 1;
+    size_t i = idmap_hash(key) & mask;
+    while (entries[i].key != 0 && entries[i].key != key)
+        i = (i + 1) & mask;
+    return i;
+}
+
+static int idmap_grow(IdMap *map) {
+    size_t new_capacity = map->capacity * 2;
+    IdMapEntry *new_entries = (IdMapEntry*) calloc(new_capacity, sizeof(IdMapEntry));
+    if (!new_entries)
+        return -1;
+    for (size_t i = 0; i < map->capacity; i++) {
+        if (map->entries[i].key != 0)
+            new_entries[idmap_find_slot(new_entries, new_capacity, map->entries[i].key)] = map->entries[i];
+    }
+    free(map->entries);
+    map->entries = new_entries;
+    map->capacity = new_capacity;
+    return 0;
+}
+
+/*
+* Return: the value stored for key, or IDMAP_MISSING
+*/
+int64_t idmap_get(const IdMap *map, uint64_t key) {
+    if (key == 0)
+        return IDMAP_MISSING;
+    const IdMapEntry *entry = &(map->entries[idmap_find_slot(map->entries, map->capacity, key)]);
+    return entry->key == key ? entry->value : IDMAP_MISSING;
+}
+
+/*
+* Stores value for key, overwriting any existing value. If previous is not NULL
+* it receives the overwritten value (or IDMAP_MISSING).
+* Return: 0 on success, -1 if out of memory
+*/
+int idmap_put(IdMap *map, uint64_t key, int64_t value, int64_t *previous) {
+    if (previous)
+        *previous = IDMAP_MISSING;
+    if (key == 0)
+        return 0;
+
+    // Keep the load factor under 70% so probe sequences stay short
+    if ((map->count + 1) * 10 > map->capacity * 7) {
+        if (idmap_grow(map) == -1)
+            return -1;
+    }
+
+    IdMapEntry *entry = &(map->entries[idmap_find_slot(map->entries, map->capacity, key)]);
+    if (entry->key == key) {
+        if (previous)
+            *previous = entry->value;
+    } else {
+        entry->key = key;
+        map->count++;
+    }
+    entry->value = value;
+    return 0;
+}
+
+/*
+* Removes key using backward-shift deletion, so no tombstones are left behind
+*/
+void idmap_remove(IdMap *map, uint64_t key) {
+    if (key == 0)
+        return;
+    size_t mask = map->capacity - 1;
+    size_t hole = idmap_find_slot(map->entries, map->capacity, key);
+    if (map->entries[hole].key != key)
+        return;
+
+    size_t i = hole;
+    while (true) {
+        i = (i + 1) & mask;
+        if (map->entries[i].key == 0)
+            break;
+        // Move the entry back into the hole unless its home slot lies cyclically in (hole, i]
+        size_t home = idmap_hash(map->entries[i].key) & mask;
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            map->entries[hole] = map->entries[i];
+            hole = i;
+        }
+    }
+    map->entries[hole].key = 0;
+    map->count--;
+}
+
+void idmap_free(IdMap *map) {
+    free(map->entries);
+    map->entries = NULL;
+    map->capacity = 0;
+    map->count = 0;
+}
@@ -0,0 +1,31 @@
+#ifndef _IDMAP_C_H
+#define _IDMAP_C_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Value returned by idmap_get for missing keys
+#define IDMAP_MISSING (-1)
+
+typedef struct IdMapEntry {
+    uint64_t key;   // 0 marks an empty slot
+    int64_t value;
+} IdMapEntry;
+
+/*
+* Open-addressing (linear probing) hash map from object ids to indices.
+* The key 0 is reserved and can't be stored.
+*/
+typedef struct IdMap {
+    IdMapEntry *entries;
+    size_t capacity;  // Always a power of two
+    size_t count;
+} IdMap;
+
+int idmap_init(IdMap *map, size_t expected);
+int64_t idmap_get(const IdMap *map, uint64_t key);
+int idmap_put(IdMap *map, uint64_t key, int64_t value, int64_t *previous);
+void idmap_remove(IdMap *map, uint64_t key);
+void idmap_free(IdMap *map);
+
+#endif /* _IDMAP_C_H */
@@ -1,28 +1,71 @@
 import VisitorModule
+import enum
+import hashlib
 import pickle
 
+from typing import Any, Callable, Dict, FrozenSet, Iterable, List, Optional, Sequence, Tuple
+
+
+class PickleMode(str, enum.Enum):
+    """
+    How ObjectState records the pickled binaries of an object next to its hashed state.
+    FULL: store the pickled binaries
+    HASH: store a digest of the pickle stream, computed while pickling without materializing it
+    NONE: do not pickle; comparisons trust the hashed state alone
+    """
+    FULL = "full"
+    HASH = "hash"
+    NONE = "none"
+
+
+class _HashingWriter:
+    """
+    File-like sink hashing the pickle stream written to it.
+    """
+
+    def __init__(self):
+        self.hasher = hashlib.blake2b(digest_size=16)
+
+    def write(self, data):
+        self.hasher.update(data)
+
+
+def _pickle_state(obj, pickle_mode: PickleMode) -> Optional[bytes]:
+    if pickle_mode == PickleMode.FULL:
+        return pickle.dumps(obj)
+    if pickle_mode == PickleMode.HASH:
+        writer = _HashingWriter()
+        pickle.Pickler(writer).dump(obj)
+        return writer.hasher.digest()
+    return None
+
 
 class ObjectState:
     """
     Python interface for C implementation of visitor pattern for IdGraph and xxhash approach.
     obj: Object whose state needs to be hashed
-    pick: Pickeld binaries of object
+    pick: Pickeld binaries of object, their digest, or None depending on pickle_mode
     hashed_state: Hashed state of the object obj
     traversal: Items hashed during object travsersal
     """
 
-    def __init__(self, obj, include_traversal=False):
-        self.pick = pickle.dumps(obj)
+    def __init__(self, obj, include_traversal=False, pickle_mode: PickleMode = PickleMode.FULL):
+        self.pickle_mode = PickleMode(pickle_mode)
+        self.pick = _pickle_state(obj, self.pickle_mode)
 
         self.hashed_state, self.traversal = VisitorModule.get_object_hash_and_trav_wrapper(
             obj, include_traversal)
+        self.cached_id_set = None
 
     def compare_ObjectStates(self, other):
         """
         Input: other - ObjectState instance of another object (or same object with potentially
         different state)
-        Compares both pickled binaries and hashed states
+        Compares both pickled binaries (or their digests) and hashed states. If the states were
+        recorded without pickling or with different pickle modes, only the hashed states are compared.
         """
+        if self.pickle_mode != other.pickle_mode or self.pickle_mode == PickleMode.NONE:
+            return self.hashed_state == other.hashed_state
         return self.pick == other.pick and self.hashed_state == other.hashed_state
 
     def update_object_hash(self, obj, include_traversal=False):
@@ -30,9 +73,10 @@ class ObjectState:
         Inputs: obj - Object whose new state needs to be recorded
         Updates the hash and pickled bianries of the object state
         """
-        self.pick = pickle.dumps(obj)
+        self.pick = _pickle_state(obj, self.pickle_mode)
         self.hashed_state, self.traversal = VisitorModule.get_object_hash_and_trav_wrapper(
             obj, include_traversal)
+        self.cached_id_set = None
 
     def get_object_hash(self):
         """
@@ -49,9 +93,51 @@ class ObjectState:
         return self.traversal
 
     def id_set(self):
-        return set([i for i in self.traversal if isinstance(i, int)])
+        if self.cached_id_set is None:
+            self.cached_id_set = frozenset(i for i in self.traversal if isinstance(i, int))
+        return self.cached_id_set
 
     def is_overlap(self, other) -> bool:
         if self.id_set().intersection(other.id_set()):
             return True
         return False
+
+
+def hash_namespace(namespace: Dict[str, Any]) -> Tuple[Dict[str, int], Dict[str, FrozenSet[int]], List[Tuple[str, str]]]:
+    """
+    Input: namespace - Dict mapping variable names to objects
+    Hashes all variables in a single native call
+    Returns the hashed state of each variable, the ids of the non-primitive objects reachable from
+    each variable, and the pairs of variables that share objects
+    """
+    return VisitorModule.hash_namespace(namespace)
+
+
+def get_object_hash_and_size(obj) -> Tuple[int, int]:
+    """
+    Input: obj - Object whose state needs to be hashed
+    Hashes the object and computes its deep memory size in a single native traversal
+    Returns the hashed state (equal to ObjectState(obj).get_object_hash()) and the size in bytes
+    """
+    return VisitorModule.get_object_hash_and_size_wrapper(obj)
+
+
+def find_linked_pairs(id_sets: Dict[str, Iterable[int]]) -> List[Tuple[str, str]]:
+    """
+    Input: id_sets - Dict mapping variable names to the ids of the objects reachable from them
+    Finds linked variables with an inverted index from object id to the first variable holding it,
+    in time linear in the total size of the id sets
+    Returns pairs of variables sharing objects; they span the same connected components as all
+    overlapping pairs, but not every overlapping pair is listed
+    """
+    return VisitorModule.find_linked_pairs(id_sets)
+
+
+def register_type_handler(obj_type: type, handler: Optional[Callable[[Any], Sequence[Any]]]) -> None:
+    """
+    Input: obj_type - Type whose instances (including instances of subclasses) are handled
+           handler - Function returning the state to hash for an instance, or None to unregister
+    Instances are hashed as their id followed by the returned state, instead of their __reduce_ex__;
+    e.g. lambda model: tuple(model.state_dict().values())
+    """
+    VisitorModule.register_type_handler(obj_type, handler)
@@ -0,0 +1,286 @@
+#include <stdlib.h>
+#include <string.h>
+#include "sampled_hash_c.h"
+#include "stats_c.h"
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+/*
+* Return: true, and clears sample->complete, if the deadline of sample passed
+*/
+bool sample_deadline_passed(SampleState *sample) {
+    if (sample->deadline_ns == 0 || stats_monotonic_ns() < sample->deadline_ns)
+        return false;
+    sample->complete = false;
+    return true;
+}
+
+/*
+* Hashes the length of a contiguous buffer, its sample pages and the digest of
+* its dirty pages, or all of it if it is not larger than its sample pages. The
+* first and last sample pages are at the start and end of the buffer.
+* Return: true if the buffer was hashed, false if it was skipped because the
+* deadline passed
+*/
+bool sample_hash_buffer(XXH3_state_t *hashed_state, const char *data, size_t length, SampleState *sample) {
+    if (sample_deadline_passed(sample))
+        return false;
+
+    XXH3_64bits_update(hashed_state, &length, sizeof(length));
+    size_t page_size = sample->page_size;
+    size_t num_pages = sample->num_pages;
+    if (page_size == 0 || num_pages >= length / page_size) {
+        XXH3_64bits_update(hashed_state, data, length);
+        STATS_ADD(bytes_hashed, length);
+        return true;
+    }
+
+    for (size_t i = 0; i < num_pages; i++) {
+        uint64_t offset = num_pages > 1 ? (uint64_t)(length - page_size) * i / (num_pages - 1) : 0;
+        XXH3_64bits_update(hashed_state, data + offset, page_size);
+    }
+    STATS_ADD(bytes_hashed, page_size * num_pages);
+
+    uint64_t dirty_digest;
+    if (page_watcher_digest(data, length, &dirty_digest) == 0)
+        XXH3_64bits_update(hashed_state, &dirty_digest, sizeof(dirty_digest));
+    return true;
+}
+
+#ifdef __linux__
+
+// Bit of the soft-dirty flag in /proc/self/pagemap entries
+#define PAGEMAP_SOFT_DIRTY_BIT 55
+
+/*
+* A buffer whose dirty pages are tracked, keyed by its address and length
+*/
+typedef struct WatchedBuffer {
+    uintptr_t start;
+    size_t length;
+    uint64_t digest;     // Running digest of the pages written since the buffer is tracked
+    uint64_t last_pass;  // Pass in which the dirty pages were last hashed into digest
+    uint8_t *pending;    // Pages reported dirty since then, one bit per page
+} WatchedBuffer;
+
+static int watcher_state = -1;  // -1 until tested, then 1 if available or 0
+static int pagemap_fd = -1;
+static size_t os_page_size;
+static WatchedBuffer watched[PAGE_WATCHER_MAX_BUFFERS];
+static size_t num_watched = 0;
+static uint64_t current_pass = 1;
+static uint64_t num_registrations = 0;
+
+static int clear_soft_dirty() {
+    int fd = open("/proc/self/clear_refs", O_WRONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    ssize_t written = write(fd, "4", 1);
+    close(fd);
+    return written == 1 ? 0 : -1;
+}
+
+/*
+* ORs the soft-dirty bits of the pages of [start, start + length) into bits
+* Return: 0 on success, -1 if the page map could not be read
+*/
+static int read_dirty_pages(uintptr_t start, size_t length, uint8_t *bits) {
+    uint64_t entries[PAGE_WATCHER_READ_ENTRIES];
+    size_t first = start / os_page_size;
+    size_t num_pages = (start + length - 1) / os_page_size - first + 1;
+    for (size_t done = 0; done < num_pages;) {
+        size_t count = num_pages - done < PAGE_WATCHER_READ_ENTRIES ? num_pages - done : PAGE_WATCHER_READ_ENTRIES;
+        ssize_t bytes = pread(pagemap_fd, entries, count * sizeof(uint64_t), (off_t)((first + done) * sizeof(uint64_t)));
+        if (bytes != (ssize_t)(count * sizeof(uint64_t)))
+            return -1;
+        for (size_t i = 0; i < count; i++) {
+            if ((entries[i] >> PAGEMAP_SOFT_DIRTY_BIT) & 1)
+                bits[(done + i) / 8] |= (uint8_t)(1 << ((done + i) % 8));
+        }
+        done += count;
+    }
+    return 0;
+}
+
+/*
+* Checks that a page written after clearing the soft-dirty bits is reported
+* dirty, and only then
+*/
+static bool self_test() {
+    os_page_size = (size_t)sysconf(_SC_PAGESIZE);
+    pagemap_fd = open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+    if (pagemap_fd < 0)
+        return false;
+    volatile char *page = mmap(NULL, os_page_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (page == MAP_FAILED) {
+        close(pagemap_fd);
+        return false;
+    }
+
+    uint8_t before = 0, after = 0;
+    page[0] = 1;
+    bool ok = clear_soft_dirty() == 0 && read_dirty_pages((uintptr_t)page, 1, &before) == 0 && !before;
+    page[0] = 2;
+    ok = ok && read_dirty_pages((uintptr_t)page, 1, &after) == 0 && after;
+    munmap((void*)page, os_page_size);
+    if (!ok) {
+        close(pagemap_fd);
+        pagemap_fd = -1;
+    }
+    return ok;
+}
+
+bool page_watcher_available() {
+    if (watcher_state == -1)
+        watcher_state = self_test() ? 1 : 0;
+    return watcher_state == 1;
+}
+
+static size_t pending_bytes(const WatchedBuffer *buffer) {
+    size_t num_pages = (buffer->start + buffer->length - 1) / os_page_size - buffer->start / os_page_size + 1;
+    return (num_pages + 7) / 8;
+}
+
+static void stop_watching(size_t index) {
+    free(watched[index].pending);
+    watched[index] = watched[--num_watched];
+}
+
+/*
+* Return: the tracked buffer at [start, start + length), tracking it if needed
+* in place of the least recently hashed one, or NULL on memory error
+*/
+static WatchedBuffer* watch(uintptr_t start, size_t length) {
+    for (size_t i = 0; i < num_watched; i++) {
+        if (watched[i].start == start && watched[i].length == length)
+            return &watched[i];
+    }
+    if (num_watched == PAGE_WATCHER_MAX_BUFFERS) {
+        size_t oldest = 0;
+        for (size_t i = 1; i < num_watched; i++) {
+            if (watched[i].last_pass < watched[oldest].last_pass)
+                oldest = i;
+        }
+        stop_watching(oldest);
+    }
+
+    WatchedBuffer *buffer = &watched[num_watched];
+    buffer->start = start;
+    buffer->length = length;
+    buffer->pending = calloc(pending_bytes(buffer), 1);
+    if (!buffer->pending)
+        return NULL;
+    STATS_INC(allocations);
+    /*
+    * Writes before the buffer was (re)tracked are unknown: start from a digest
+    * no earlier pass produced, so the buffer is reported modified once
+    */
+    num_registrations++;
+    buffer->digest = XXH3_64bits(&num_registrations, sizeof(num_registrations));
+    buffer->last_pass = 0;
+    num_watched++;
+    return buffer;
+}
+
+/*
+* Hashes the runs of pending pages of buffer into its digest, and clears them
+*/
+static void fold_pending(WatchedBuffer *buffer) {
+    size_t first = buffer->start / os_page_size;
+    size_t num_pages = (buffer->start + buffer->length - 1) / os_page_size - first + 1;
+    uintptr_t end = buffer->start + buffer->length;
+    for (size_t page = 0; page < num_pages;) {
+        if (!(buffer->pending[page / 8] & (1 << (page % 8)))) {
+            page++;
+            continue;
+        }
+        size_t run_end = page;
+        while (run_end < num_pages && (buffer->pending[run_end / 8] & (1 << (run_end % 8))))
+            run_end++;
+
+        // Only hash the bytes of the run which belong to the buffer
+        uintptr_t low = (first + page) * os_page_size;
+        uintptr_t high = (first + run_end) * os_page_size;
+        low = low < buffer->start ? buffer->start : low;
+        high = high > end ? end : high;
+        uint64_t seed = buffer->digest ^ ((uint64_t)page * 0x9E3779B97F4A7C15ULL);
+        buffer->digest = XXH3_64bits_withSeed((const void*)low, high - low, seed);
+        STATS_ADD(bytes_hashed, high - low);
+        page = run_end;
+    }
+    memset(buffer->pending, 0, pending_bytes(buffer));
+}
+
+/*
+* Gets the running digest of the pages of [data, data + length) written since
+* the buffer is tracked. A buffer hashed several times in a pass has the same
+* digest each time.
+* Return: 0 on success, -1 if the watcher is not available or failed
+*/
+int page_watcher_digest(const char *data, size_t length, uint64_t *digest) {
+    if (length == 0 || !page_watcher_available())
+        return -1;
+
+    WatchedBuffer *buffer = watch((uintptr_t)data, length);
+    if (!buffer)
+        return -1;
+    if (buffer->last_pass != current_pass) {
+        if (read_dirty_pages(buffer->start, buffer->length, buffer->pending) == -1) {
+            stop_watching((size_t)(buffer - watched));
+            return -1;
+        }
+        fold_pending(buffer);
+        buffer->last_pass = current_pass;
+    }
+    *digest = buffer->digest;
+    return 0;
+}
+
+/*
+* Ends a hashing pass: records the dirty pages of the buffers which were not
+* hashed in the pass, then clears the soft-dirty bits of the process, so the
+* next pass sees the pages written from now on. Buffers which were freed may be
+* read from the page map, which is harmless.
+* Return: 0 on success, -1 if the watcher failed, in which case it is disabled
+*/
+int page_watcher_end_pass() {
+    if (watcher_state != 1)
+        return 0;
+    for (size_t i = 0; i < num_watched;) {
+        if (watched[i].last_pass != current_pass &&
+            read_dirty_pages(watched[i].start, watched[i].length, watched[i].pending) == -1) {
+            stop_watching(i);
+            continue;
+        }
+        i++;
+    }
+    current_pass++;
+    if (clear_soft_dirty() == -1) {
+        // Dirty pages would go unnoticed from now on
+        while (num_watched > 0)
+            stop_watching(num_watched - 1);
+        watcher_state = 0;
+        return -1;
+    }
+    return 0;
+}
+
+#else
+
+bool page_watcher_available() {
+    return false;
+}
+
+int page_watcher_digest(const char *data, size_t length, uint64_t *digest) {
+    return -1;
+}
+
+int page_watcher_end_pass() {
+    return 0;
+}
+
+#endif
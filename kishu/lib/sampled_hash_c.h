@@ -0,0 +1,55 @@
+#ifndef _SAMPLED_HASH_C_H
+#define _SAMPLED_HASH_C_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "xxh_x86dispatch.h"
+
+// Defaults of the sampled hashing mode (see SampleState)
+#define DEFAULT_SAMPLE_THRESHOLD (64 * 1024 * 1024)
+#define DEFAULT_SAMPLE_PAGE_SIZE (64 * 1024)
+#define DEFAULT_SAMPLE_PAGES 64
+
+// Largest number of buffers whose dirty pages are tracked at once
+#define PAGE_WATCHER_MAX_BUFFERS 4096
+
+// Number of page map entries read at once
+#define PAGE_WATCHER_READ_ENTRIES 4096
+
+/*
+* Probabilistic hashing mode for large mutable buffers (bytearrays and
+* contiguous buffers, e.g. numpy arrays): instead of all of their memory, only
+* their length, num_pages pages of page_size bytes spread evenly over them and
+* the pages written since the last pass (see page_watcher_digest) are hashed.
+* Writes between sample pages go unnoticed when the page watcher is not
+* available.
+*
+* Once the monotonic clock (see stats_monotonic_ns) reaches deadline_ns, large
+* buffers are skipped and complete is cleared: the digest must not be compared
+* then, and the object should be hashed again, e.g. without a deadline.
+*/
+typedef struct SampleState {
+    size_t threshold;      // Smallest buffer hashed from samples
+    size_t page_size;
+    size_t num_pages;
+    uint64_t deadline_ns;  // 0 for no deadline
+    bool complete;         // False once a buffer was skipped
+} SampleState;
+
+bool sample_hash_buffer(XXH3_state_t *hashed_state, const char *data, size_t length, SampleState *sample);
+bool sample_deadline_passed(SampleState *sample);
+
+/*
+* Dirty page watcher over the soft-dirty bits of the Linux page tables (see
+* Documentation/admin-guide/mm/soft-dirty.rst): the bits of the pages written
+* since the last page_watcher_end_pass are read from /proc/self/pagemap. Each
+* watched buffer keeps a running digest of its dirty pages, which changes
+* whenever the buffer is written. Not available on other systems, or if the
+* kernel does not track soft-dirty bits.
+*/
+bool page_watcher_available();
+int page_watcher_digest(const char *data, size_t length, uint64_t *digest);
+int page_watcher_end_pass();
+
+#endif /* _SAMPLED_HASH_C_H */
@@ -0,0 +1,269 @@
+#include <Python.h>
+#include <stdbool.h>
+#include "size_visitor_c.h"
+#include "stats_c.h"
+
+/*
+* The size visitor computes the deep memory size of an object in the same
+* traversal as another visitor (e.g. the hash visitor): every call adds the size
+* of the visited object to the total, once per object, and is then forwarded to
+* the inner visitor. Sizes are the ones of sys.getsizeof, except that buffers
+* (e.g. numpy arrays) include the memory they expose. Pandas objects are
+* measured through their __reduce_ex__ state, i.e. the arrays of their blocks.
+*/
+
+/*
+* Return: sys.getsizeof(obj), or -1 with an exception set on error
+*/
+static Py_ssize_t get_sizeof(PyObject *obj) {
+    static PyObject *getsizeof_func = NULL;
+
+    // Get sys.getsizeof only once
+    if (getsizeof_func == NULL) {
+        PyObject *sys_module = PyImport_ImportModule("sys");
+        if (!sys_module)
+            return -1;
+        getsizeof_func = PyObject_GetAttrString(sys_module, "getsizeof");
+        Py_DECREF(sys_module);
+        if (!getsizeof_func)
+            return -1;
+    }
+
+    PyObject *result = PyObject_CallOneArg(getsizeof_func, obj);
+    if (!result) {
+        // __sizeof__ is broken; fall back to the size of the object header
+        PyErr_Clear();
+        return Py_TYPE(obj)->tp_basicsize;
+    }
+    Py_ssize_t bytes = PyLong_AsSsize_t(result);
+    Py_DECREF(result);
+    return bytes;
+}
+
+/*
+* Adds bytes to the total as the size of obj, unless obj was added before
+* Return: 1 if added, 0 if already included, -1 on error
+*/
+static int size_add_bytes(SizeState *size, PyObject *obj, Py_ssize_t bytes) {
+    int added = visited_add(size->sized, obj);
+    if (added == 1)
+        size->total += (size_t)bytes;
+    return added;
+}
+
+/*
+* Adds the size of obj to the total, unless obj was added before
+* Return: 1 if added, 0 if already included, -1 on error
+*/
+static int size_add(SizeState *size, PyObject *obj) {
+    int added = visited_add(size->sized, obj);
+    if (added != 1)
+        return added;
+    Py_ssize_t bytes = get_sizeof(obj);
+    if (bytes == -1)
+        return -1;
+    size->total += (size_t)bytes;
+    return 1;
+}
+
+/*
+* Adds the sizes of the objects in an immutable subtree (primitives, bytes and
+* tuples) that the inner visitor handled without traversing it. Tuples are
+* walked from the traversal stack of the visitor, and only the first time they
+* are added.
+* Return: 0 on success, -1 on error
+*/
+static int size_add_subtree(SizeState *size, PyObject *obj, TraversalStack *stack) {
+    size_t base = stack->count;
+    int ret = 0;
+    while (true) {
+        int added = size_add(size, obj);
+        if (added == -1) {
+            ret = -1;
+            break;
+        }
+        if (added && PyTuple_Check(obj)) {
+            Py_INCREF(obj);
+            if (traversal_push(stack, FRAME_TUPLE, obj, NULL, 0, PyTuple_GET_SIZE(obj), false, NULL) == -1) {
+                ret = -1;
+                break;
+            }
+        }
+        // Next item of the innermost tuple with items left
+        while (stack->count > base && stack->frames[stack->count - 1].index == stack->frames[stack->count - 1].size)
+            traversal_pop(stack);
+        if (stack->count == base)
+            break;
+        TraversalFrame *frame = &(stack->frames[stack->count - 1]);
+        obj = PyTuple_GET_ITEM(frame->items, frame->index++);
+    }
+    while (stack->count > base)
+        traversal_pop(stack);
+    return ret;
+}
+
+VisitorReturnType* size_has_visited(PyObject *obj, Visited *visited, const bool include_id, VisitorReturnType* state) {
+    return state->size->inner->has_visited(obj, visited, include_id, state);
+}
+
+VisitorReturnType* size_handle_visited(PyObject *obj, const bool include_id, VisitorReturnType* state, PyObject* list_included, const bool include_trav) {
+    return state->size->inner->handle_visited(obj, include_id, state, list_included, include_trav);
+}
+
+VisitorReturnType* size_visit_primitive(PyObject *obj, VisitorReturnType* state, PyObject* list_included, const bool include_trav) {
+    if (size_add(state->size, obj) == -1)
+        return NULL;
+    return state->size->inner->visit_primitive(obj, state, list_included, include_trav);
+}
+
+VisitorReturnType* size_visit_tuple(PyObject *obj, Visited **visited, const bool include_id, VisitorReturnType* state, PyObject* list_included, const bool include_trav) {
+    if (size_add(state->size, obj) == -1)
+        return NULL;
+    return state->size->inner->visit_tuple(obj, visited, include_id, state, list_included, include_trav);
+}
+
+VisitorReturnType* size_visit_list(PyObject *obj, Visited **visited, const bool include_id, VisitorReturnType* state, PyObject* list_included, const bool include_trav) {
+    if (size_add(state->size, obj) == -1)
+        return NULL;
+    return state->size->inner->visit_list(obj, visited, include_id, state, list_included, include_trav);
+}
+
+VisitorReturnType* size_visit_set(PyObject *obj, Visited **visited, const bool include_id, VisitorReturnType* state, PyObject* list_included, const bool include_trav) {
+    if (size_add(state->size, obj) == -1)
+        return NULL;
+    return state->size->inner->visit_set(obj, visited, include_id, state, list_included, include_trav);
+}
+
+VisitorReturnType* size_visit_dict(PyObject *obj, Visited **visited, const bool include_id, VisitorReturnType* state, PyObject* list_included, const bool include_trav) {
+    if (size_add(state->size, obj) == -1)
+        return NULL;
+    return state->size->inner->visit_dict(obj, visited, include_id, state, list_included, include_trav);
+}
+
+VisitorReturnType* size_visit_byte(PyObject *obj, Visited **visited, const bool include_id, VisitorReturnType* state, PyObject* list_included, const bool include_trav) {
+    if (size_add(state->size, obj) == -1)
+        return NULL;
+    return state->size->inner->visit_byte(obj, visited, include_id, state, list_included, include_trav);
+}
+
+VisitorReturnType* size_visit_type(PyObject *obj, Visited **visited, const bool include_id, VisitorReturnType* state, PyObject* list_included, const bool include_trav) {
+    if (size_add(state->size, obj) == -1)
+        return NULL;
+    return state->size->inner->visit_type(obj, visited, include_id, state, list_included, include_trav);
+}
+
+/*
+* sys.getsizeof of a numpy array includes its data only if the array owns it. A
+* size smaller than the exposed memory means the data is borrowed (e.g. a view),
+* so the memory is added on top of the object itself, as numpy nbytes.
+*/
+VisitorReturnType* size_visit_buffer(PyObject *obj, Py_buffer *view, Visited **visited, const bool include_id, VisitorReturnType* state, PyObject* list_included, const bool include_trav) {
+    if (!visited_contains(state->size->sized, obj)) {
+        Py_ssize_t bytes = get_sizeof(obj);
+        if (bytes == -1)
+            return NULL;
+        if (size_add_bytes(state->size, obj, bytes < view->len ? bytes + view->len : bytes) == -1)
+            return NULL;
+    }
+    return state->size->inner->visit_buffer(obj, view, visited, include_id, state, list_included, include_trav);
+}
+
+VisitorReturnType* size_visit_callable(PyObject *obj, Visited **visited, const bool include_id, VisitorReturnType* state, PyObject* list_included, const bool include_trav) {
+    if (size_add(state->size, obj) == -1)
+        return NULL;
+    return state->size->inner->visit_callable(obj, visited, include_id, state, list_included, include_trav);
+}
+
+VisitorReturnType* size_visit_custom_obj(PyObject *obj, Visited **visited, const bool include_id, VisitorReturnType* state, PyObject* list_included, const bool include_trav) {
+    if (size_add(state->size, obj) == -1)
+        return NULL;
+    return state->size->inner->visit_custom_obj(obj, visited, include_id, state, list_included, include_trav);
+}
+
+/*
+* The inner visitor is called with the size visitor, so subtrees it traverses
+* itself are measured as usual; subtrees it skips (e.g. cached digests) are
+* measured here.
+*/
+int size_visit_immutable(PyObject *obj, Visitor *visitor, const bool include_id, VisitorReturnType* state, const bool include_trav) {
+    int ret = state->size->inner->visit_immutable(obj, visitor, include_id, state, include_trav);
+    if (ret == 1 && size_add_subtree(state->size, obj, &(visitor->stack)) == -1)
+        return -1;
+    return ret;
+}
+
+void size_update_state_id(PyObject *obj, VisitorReturnType* state, PyObject* list_included, const bool include_trav) {
+    state->size->inner->update_state_id(obj, state, list_included, include_trav);
+}
+
+/*
+* Frees the size state and the inner visitor. Runs without the GIL like the
+* free_contents of the inner visitor.
+*/
+void size_free_contents(Visited *visited, VisitorReturnType* state) {
+    SizeState *size = state->size;
+    Visitor *inner = size->inner;
+    state->size = NULL;
+    visited_free(size->sized);
+    free(size);
+    inner->free_contents(visited, state);
+    free(inner);
+}
+
+/*
+* Wraps inner (e.g. a new hash visitor) to also compute deep sizes. The size
+* visitor shares the visited set, state and lists of inner, and owns inner.
+* Return: the size visitor, or NULL on memory error (inner is not freed)
+*/
+Visitor* create_size_visitor(Visitor *inner) {
+    Visitor* visitor = (Visitor*) (malloc(sizeof(Visitor)));
+    SizeState* size = (SizeState*) (malloc(sizeof(SizeState)));
+    Visited* sized = visited_create();
+    if (!visitor || !size || !sized) {
+        free(visitor);
+        free(size);
+        visited_free(sized);
+        return NULL;
+    }
+    STATS_ADD(allocations, 2);
+    /* Initialize size visitor functions */
+    visitor->has_visited = size_has_visited;
+    visitor->handle_visited = size_handle_visited;
+
+    visitor->visit_primitive = size_visit_primitive;
+    visitor->visit_tuple = size_visit_tuple;
+    visitor->visit_list = size_visit_list;
+    visitor->visit_set = size_visit_set;
+    visitor->visit_dict = size_visit_dict;
+    visitor->visit_byte = size_visit_byte;
+    visitor->visit_type = size_visit_type;
+    visitor->visit_buffer = size_visit_buffer;
+    visitor->visit_callable = size_visit_callable;
+    visitor->visit_custom_obj = size_visit_custom_obj;
+
+    visitor->visit_immutable = size_visit_immutable;
+    visitor->update_state_id = size_update_state_id;
+    visitor->free_contents = size_free_contents;
+
+    size->sized = sized;
+    size->total = 0;
+    size->inner = inner;
+    inner->state->size = size;
+
+    /* Share the contents of inner */
+    visitor->visited = inner->visited;
+    visitor->state = inner->state;
+    visitor->list_included = inner->list_included;
+    visitor->keep_alive = inner->keep_alive;
+    inner->keep_alive = NULL;
+    visitor->stack = (TraversalStack){NULL, 0, 0};
+
+    return visitor;
+}
+
+/*
+* Return: deep size in bytes of the objects visited by the size visitor
+*/
+size_t size_visitor_total(const Visitor *visitor) {
+    return visitor->state->size->total;
+}
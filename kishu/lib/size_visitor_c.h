@@ -0,0 +1,38 @@
+#ifndef _SIZE_VISITOR_C_H
+#define _SIZE_VISITOR_C_H
+
+#include "visitor_c.h"
+
+/*
+* State of a size visitor, shared by all copies of the VisitorReturnType it is
+* attached to (e.g. the fresh states of hashed subtrees).
+* sized: objects whose size is already included in total
+* total: deep size in bytes of the objects visited so far
+* inner: visitor every call is forwarded to, owned by the size visitor
+*/
+typedef struct SizeState {
+    Visited *sized;
+    size_t total;
+    Visitor *inner;
+} SizeState;
+
+Visitor* create_size_visitor(Visitor *inner);
+size_t size_visitor_total(const Visitor *visitor);
+
+VisitorReturnType* size_has_visited(PyObject *obj, Visited *visited, const bool include_id, VisitorReturnType* state);
+VisitorReturnType* size_handle_visited(PyObject *obj, const bool include_id, VisitorReturnType* state, PyObject* list_included, const bool include_trav);
+VisitorReturnType* size_visit_primitive(PyObject *obj, VisitorReturnType* state, PyObject* list_included, const bool include_trav);
+VisitorReturnType* size_visit_tuple(PyObject *obj, Visited **visited, const bool include_id, VisitorReturnType* state, PyObject* list_included, const bool include_trav);
+VisitorReturnType* size_visit_list(PyObject *obj, Visited **visited, const bool include_id, VisitorReturnType* state, PyObject* list_included, const bool include_trav);
+VisitorReturnType* size_visit_set(PyObject *obj, Visited **visited, const bool include_id, VisitorReturnType* state, PyObject* list_included, const bool include_trav);
+VisitorReturnType* size_visit_dict(PyObject *obj, Visited **visited, const bool include_id, VisitorReturnType* state, PyObject* list_included, const bool include_trav);
+VisitorReturnType* size_visit_byte(PyObject *obj, Visited **visited, const bool include_id, VisitorReturnType* state, PyObject* list_included, const bool include_trav);
+VisitorReturnType* size_visit_type(PyObject *obj, Visited **visited, const bool include_id, VisitorReturnType* state, PyObject* list_included, const bool include_trav);
+VisitorReturnType* size_visit_buffer(PyObject *obj, Py_buffer *view, Visited **visited, const bool include_id, VisitorReturnType* state, PyObject* list_included, const bool include_trav);
+VisitorReturnType* size_visit_callable(PyObject *obj, Visited **visited, const bool include_id, VisitorReturnType* state, PyObject* list_included, const bool include_trav);
+VisitorReturnType* size_visit_custom_obj(PyObject *obj, Visited **visited, const bool include_id, VisitorReturnType* state, PyObject* list_included, const bool include_trav);
+int size_visit_immutable(PyObject *obj, Visitor *visitor, const bool include_id, VisitorReturnType* state, const bool include_trav);
+void size_update_state_id(PyObject *obj, VisitorReturnType* state, PyObject* list_included, const bool include_trav);
+void size_free_contents(Visited *visited, VisitorReturnType* state);
+
+#endif /* _SIZE_VISITOR_C_H */
@@ -0,0 +1,81 @@
+#include <Python.h>
+#include <string.h>
+#include "stats_c.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+KishuStats kishu_stats = {0};
+
+// Dict keys of the timers, in StatsTimerKind order
+static const char *timer_names[STATS_NUM_TIMERS] = {"traverse", "compare", "linked_vars"};
+
+/*
+* Return: the current time of a monotonic clock in ns, unrelated to wall time
+*/
+uint64_t stats_monotonic_ns() {
+#ifdef _WIN32
+    static LARGE_INTEGER frequency = {0};
+    LARGE_INTEGER counter;
+    if (frequency.QuadPart == 0)
+        QueryPerformanceFrequency(&frequency);
+    QueryPerformanceCounter(&counter);
+    return (uint64_t)(counter.QuadPart / frequency.QuadPart) * 1000000000ULL +
+           (uint64_t)(counter.QuadPart % frequency.QuadPart) * 1000000000ULL / (uint64_t)frequency.QuadPart;
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+#endif
+}
+
+/*
+* Accounts for a call timed from start_ns (see stats_monotonic_ns)
+*/
+void stats_timer_stop(StatsTimerKind kind, uint64_t start_ns) {
+    kishu_stats.timers[kind].calls++;
+    kishu_stats.timers[kind].ns += stats_monotonic_ns() - start_ns;
+}
+
+void stats_reset() {
+    memset(&kishu_stats, 0, sizeof(kishu_stats));
+}
+
+static int set_counter(PyObject *dict, const char *key, uint64_t value) {
+    PyObject *item = PyLong_FromUnsignedLongLong(value);
+    if (!item)
+        return -1;
+    int ret = PyDict_SetItemString(dict, key, item);
+    Py_DECREF(item);
+    return ret;
+}
+
+PyObject* stats_as_dict() {
+    PyObject *dict = PyDict_New();
+    if (!dict)
+        return NULL;
+    if (set_counter(dict, "objects_visited", kishu_stats.objects_visited) == -1 ||
+        set_counter(dict, "bytes_hashed", kishu_stats.bytes_hashed) == -1 ||
+        set_counter(dict, "visited_probes", kishu_stats.visited_probes) == -1 ||
+        set_counter(dict, "pickles", kishu_stats.pickles) == -1 ||
+        set_counter(dict, "allocations", kishu_stats.allocations) == -1)
+        goto error;
+
+    char key[64];
+    for (int i = 0; i < STATS_NUM_TIMERS; i++) {
+        PyOS_snprintf(key, sizeof(key), "%s_calls", timer_names[i]);
+        if (set_counter(dict, key, kishu_stats.timers[i].calls) == -1)
+            goto error;
+        PyOS_snprintf(key, sizeof(key), "%s_ns", timer_names[i]);
+        if (set_counter(dict, key, kishu_stats.timers[i].ns) == -1)
+            goto error;
+    }
+    return dict;
+
+error:
+    Py_DECREF(dict);
+    return NULL;
+}
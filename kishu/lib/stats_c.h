@@ -0,0 +1,51 @@
+#ifndef _STATS_C_H
+#define _STATS_C_H
+
+#include <stdint.h>
+
+// Native code timed by the timers of KishuStats
+typedef enum {
+    STATS_TIMER_TRAVERSE,     // Hashing objects and building ID graphs
+    STATS_TIMER_COMPARE,      // Comparing ID graphs, with each other or with objects
+    STATS_TIMER_LINKED_VARS,  // Finding variables sharing objects
+    STATS_NUM_TIMERS,
+} StatsTimerKind;
+
+typedef struct StatsTimer {
+    uint64_t calls;
+    uint64_t ns;  // Total monotonic time of the calls
+} StatsTimer;
+
+/*
+* Counters of the hot paths of an extension, since it was loaded or the last
+* stats_reset. Each extension linking stats_c.c has its own counters. They are
+* only updated with the GIL held: code running without the GIL (e.g. hashing
+* threads) is accounted for by its caller.
+*/
+typedef struct KishuStats {
+    uint64_t objects_visited;  // Objects traversed, excluding revisits
+    uint64_t bytes_hashed;     // Payload bytes of strings, bytes and buffers
+    uint64_t visited_probes;   // Lookups into visited tables
+    uint64_t pickles;          // Objects pickled to check picklability
+    uint64_t allocations;      // Heap allocations (arena blocks, tables, states)
+    StatsTimer timers[STATS_NUM_TIMERS];
+} KishuStats;
+
+extern KishuStats kishu_stats;
+
+#define STATS_ADD(counter, n) (kishu_stats.counter += (uint64_t)(n))
+#define STATS_INC(counter) STATS_ADD(counter, 1)
+
+uint64_t stats_monotonic_ns();
+void stats_timer_stop(StatsTimerKind kind, uint64_t start_ns);
+void stats_reset();
+
+#ifdef Py_PYTHON_H
+/*
+* Return: new reference to a dict of the counters, and of the calls and time
+* (in ns) of each timer, or NULL with an exception set
+*/
+PyObject* stats_as_dict();
+#endif
+
+#endif /* _STATS_C_H */
@@ -0,0 +1,485 @@
+#include "type_dispatch_c.h"
+#include "visitor_c.h"
+
+// Number of entries allocated when the first entry is added
+#define TYPE_DISPATCH_INITIAL_CAPACITY 64
+
+// Dispatch of each type seen so far
+static TypeDispatchCache type_dispatch_cache = {0};
+
+// Handlers registered with type_dispatch_register: type -> callable
+static PyObject *type_handlers = NULL;
+
+/*
+* Builds a state tuple: the type of obj followed by n items, which are stolen.
+* Return: the tuple, or NULL if an item is NULL or on memory error
+*/
+static PyObject* typed_state(PyObject *obj, Py_ssize_t n, PyObject **items) {
+    PyObject *state = NULL;
+    for (Py_ssize_t i = 0; i < n; i++) {
+        if (!items[i])
+            goto error;
+    }
+    state = PyTuple_New(n + 1);
+    if (!state)
+        goto error;
+    Py_INCREF(Py_TYPE(obj));
+    PyTuple_SET_ITEM(state, 0, (PyObject*) Py_TYPE(obj));
+    for (Py_ssize_t i = 0; i < n; i++)
+        PyTuple_SET_ITEM(state, i + 1, items[i]);
+    return state;
+
+error:
+    for (Py_ssize_t i = 0; i < n; i++)
+        Py_XDECREF(items[i]);
+    return NULL;
+}
+
+/*
+* Attributes of obj set outside of its dataclass fields, whose names are in
+* payload, e.g. in __post_init__, as a tuple of (name, value) pairs
+* Return: the tuple, which is empty if obj has no such attributes or no
+* __dict__, or NULL on error
+*/
+static PyObject* dataclass_extra_attributes(PyObject *obj, PyObject *payload) {
+    PyObject *dict = PyObject_GetAttrString(obj, "__dict__");
+    if (!dict || !PyDict_Check(dict)) {
+        // Instances with __slots__ only have their fields
+        Py_XDECREF(dict);
+        PyErr_Clear();
+        return PyTuple_New(0);
+    }
+    PyObject *extras = PyList_New(0);
+    PyObject *key, *value;
+    Py_ssize_t pos = 0;
+    while (extras && PyDict_Next(dict, &pos, &key, &value)) {
+        int is_field = PySequence_Contains(payload, key);
+        if (is_field == 1)
+            continue;
+        PyObject *pair = is_field == 0 ? PyTuple_Pack(2, key, value) : NULL;
+        if (!pair || PyList_Append(extras, pair) == -1)
+            Py_CLEAR(extras);
+        Py_XDECREF(pair);
+    }
+    Py_DECREF(dict);
+    if (!extras)
+        return NULL;
+    PyObject *result = PyList_AsTuple(extras);
+    Py_DECREF(extras);
+    return result;
+}
+
+/*
+* Dataclass instances: their fields, whose names are in payload, followed by
+* the tuple of their other attributes if they have any
+*/
+static PyObject* dataclass_state(PyObject *obj, PyObject *payload) {
+    Py_ssize_t n = PyTuple_GET_SIZE(payload);
+    PyObject *extras = dataclass_extra_attributes(obj, payload);
+    if (!extras)
+        return NULL;
+    bool has_extras = PyTuple_GET_SIZE(extras) > 0;
+    PyObject *state = PyTuple_New(n + 1 + has_extras);
+    if (!state) {
+        Py_DECREF(extras);
+        return NULL;
+    }
+    Py_INCREF(Py_TYPE(obj));
+    PyTuple_SET_ITEM(state, 0, (PyObject*) Py_TYPE(obj));
+    for (Py_ssize_t i = 0; i < n; i++) {
+        PyObject *value = PyObject_GetAttr(obj, PyTuple_GET_ITEM(payload, i));
+        if (!value) {
+            Py_DECREF(extras);
+            Py_DECREF(state);
+            return NULL;
+        }
+        PyTuple_SET_ITEM(state, i + 1, value);
+    }
+    if (has_extras)
+        PyTuple_SET_ITEM(state, n + 1, extras);
+    else
+        Py_DECREF(extras);
+    return state;
+}
+
+/*
+* Blocks of the BlockManager of a pandas DataFrame or Series, as a tuple of
+* (positions of the columns in the block, values of the block) pairs
+*/
+static PyObject* pandas_blocks(PyObject *mgr) {
+    PyObject *blocks = PyObject_GetAttrString(mgr, "blocks");
+    PyObject *seq = blocks ? PySequence_Fast(blocks, "blocks must be a sequence") : NULL;
+    Py_XDECREF(blocks);
+    if (!seq)
+        return NULL;
+    Py_ssize_t n = PySequence_Fast_GET_SIZE(seq);
+    PyObject *state = PyTuple_New(n);
+    for (Py_ssize_t i = 0; state && i < n; i++) {
+        PyObject *block = PySequence_Fast_GET_ITEM(seq, i);
+        PyObject *locs = PyObject_GetAttrString(block, "mgr_locs");
+        PyObject *indexer = locs ? PyObject_GetAttrString(locs, "indexer") : NULL;
+        Py_XDECREF(locs);
+        PyObject *values = indexer ? PyObject_GetAttrString(block, "values") : NULL;
+        PyObject *pair = values ? PyTuple_Pack(2, indexer, values) : NULL;
+        Py_XDECREF(indexer);
+        Py_XDECREF(values);
+        if (!pair)
+            Py_CLEAR(state);
+        else
+            PyTuple_SET_ITEM(state, i, pair);
+    }
+    Py_DECREF(seq);
+    return state;
+}
+
+/*
+* pandas DataFrames: the axes and blocks of their BlockManager, instead of
+* pickling it
+*/
+static PyObject* pandas_frame_state(PyObject *obj, PyObject *payload) {
+    PyObject *mgr = PyObject_GetAttrString(obj, "_mgr");
+    if (!mgr)
+        return NULL;
+    PyObject *items[] = {PyObject_GetAttrString(mgr, "axes"), pandas_blocks(mgr)};
+    Py_DECREF(mgr);
+    return typed_state(obj, 2, items);
+}
+
+/*
+* pandas Series: their name, and the axes and blocks of their manager
+*/
+static PyObject* pandas_series_state(PyObject *obj, PyObject *payload) {
+    PyObject *mgr = PyObject_GetAttrString(obj, "_mgr");
+    if (!mgr)
+        return NULL;
+    PyObject *items[] = {PyObject_GetAttrString(obj, "name"), PyObject_GetAttrString(mgr, "axes"), pandas_blocks(mgr)};
+    Py_DECREF(mgr);
+    return typed_state(obj, 3, items);
+}
+
+/*
+* pandas Index: their name and values
+*/
+static PyObject* pandas_index_state(PyObject *obj, PyObject *payload) {
+    PyObject *items[] = {PyObject_GetAttrString(obj, "name"), PyObject_GetAttrString(obj, "_values")};
+    return typed_state(obj, 2, items);
+}
+
+/*
+* pandas RangeIndex: their name and range, without materializing their values
+*/
+static PyObject* pandas_range_index_state(PyObject *obj, PyObject *payload) {
+    PyObject *items[] = {PyObject_GetAttrString(obj, "name"), PyObject_GetAttrString(obj, "start"),
+                         PyObject_GetAttrString(obj, "stop"), PyObject_GetAttrString(obj, "step")};
+    return typed_state(obj, 4, items);
+}
+
+/*
+* torch tensors: their dtype, shape, whether they require gradients, and their
+* data as a numpy array sharing the memory of CPU tensors
+*/
+static PyObject* torch_tensor_state(PyObject *obj, PyObject *payload) {
+    PyObject *detached = PyObject_CallMethod(obj, "detach", NULL);
+    PyObject *cpu = detached ? PyObject_CallMethod(detached, "cpu", NULL) : NULL;
+    Py_XDECREF(detached);
+    PyObject *data = cpu ? PyObject_CallMethod(cpu, "numpy", NULL) : NULL;
+    Py_XDECREF(cpu);
+    PyObject *dtype = PyObject_GetAttrString(obj, "dtype");
+    PyObject *shape = PyObject_GetAttrString(obj, "shape");
+    PyObject *items[] = {dtype ? PyObject_Str(dtype) : NULL, shape ? PySequence_Tuple(shape) : NULL,
+                         PyObject_GetAttrString(obj, "requires_grad"), data};
+    Py_XDECREF(dtype);
+    Py_XDECREF(shape);
+    return typed_state(obj, 4, items);
+}
+
+/*
+* Handlers registered from Python: the sequence returned by calling payload on obj
+*/
+static PyObject* plugin_state(PyObject *obj, PyObject *payload) {
+    PyObject *result = PyObject_CallFunctionObjArgs(payload, obj, NULL);
+    if (!result || PyTuple_Check(result))
+        return result;
+    PyObject *state = PySequence_Tuple(result);
+    Py_DECREF(result);
+    return state;
+}
+
+/*
+* Looks up a registered handler for type or one of its bases
+* Return: 1 and the handler in dispatch, 0 if none is registered, -1 on error
+*/
+static int find_plugin(PyTypeObject *type, TypeDispatch *dispatch) {
+    if (!type_handlers || PyDict_GET_SIZE(type_handlers) == 0 || !type->tp_mro)
+        return 0;
+    for (Py_ssize_t i = 0; i < PyTuple_GET_SIZE(type->tp_mro); i++) {
+        PyObject *handler = PyDict_GetItemWithError(type_handlers, PyTuple_GET_ITEM(type->tp_mro, i));
+        if (handler) {
+            Py_INCREF(handler);
+            dispatch->kind = DISPATCH_HANDLER;
+            dispatch->handler = plugin_state;
+            dispatch->payload = handler;
+            dispatch->plugin = true;
+            return 1;
+        }
+        if (PyErr_Occurred())
+            return -1;
+    }
+    return 0;
+}
+
+/*
+* Return: 1 if type is module.name, 0 if not or if the module is not imported, -1 on error
+*/
+static int is_module_type(PyTypeObject *type, const char *module, const char *name, bool subclasses) {
+    PyObject *module_name = PyUnicode_FromString(module);
+    if (!module_name)
+        return -1;
+    PyObject *loaded = PyImport_GetModule(module_name);
+    Py_DECREF(module_name);
+    if (!loaded)
+        return PyErr_Occurred() ? -1 : 0;
+    PyObject *expected = PyObject_GetAttrString(loaded, name);
+    Py_DECREF(loaded);
+    if (!expected) {
+        PyErr_Clear();
+        return 0;
+    }
+    int ret = (PyObject*) type == expected;
+    if (!ret && subclasses && PyType_Check(expected))
+        ret = PyType_IsSubtype(type, (PyTypeObject*) expected);
+    Py_DECREF(expected);
+    return ret;
+}
+
+/*
+* Names of the fields of the dataclass type, from dataclasses.fields
+* Return: a new tuple, or NULL with an exception set
+*/
+static PyObject* dataclass_field_names(PyTypeObject *type) {
+    PyObject *dataclasses = PyImport_ImportModule("dataclasses");
+    PyObject *fields = dataclasses ? PyObject_CallMethod(dataclasses, "fields", "(O)", (PyObject*) type) : NULL;
+    Py_XDECREF(dataclasses);
+    PyObject *seq = fields ? PySequence_Fast(fields, "fields must be a sequence") : NULL;
+    Py_XDECREF(fields);
+    if (!seq)
+        return NULL;
+    Py_ssize_t n = PySequence_Fast_GET_SIZE(seq);
+    PyObject *names = PyTuple_New(n);
+    for (Py_ssize_t i = 0; names && i < n; i++) {
+        PyObject *name = PyObject_GetAttrString(PySequence_Fast_GET_ITEM(seq, i), "name");
+        if (!name)
+            Py_CLEAR(names);
+        else
+            PyTuple_SET_ITEM(names, i, name);
+    }
+    Py_DECREF(seq);
+    return names;
+}
+
+/*
+* Looks up a built-in handler for types otherwise visited through __reduce_ex__
+* Return: 1 and the handler in dispatch, 0 if there is none, -1 on error
+*/
+static int find_builtin_handler(PyTypeObject *type, TypeDispatch *dispatch) {
+    static const struct {
+        const char *module;
+        const char *name;
+        bool subclasses;
+        StateHandler handler;  // NULL: visited through __reduce_ex__
+        bool include_id;
+    } handlers[] = {
+        {"pandas", "MultiIndex", false, NULL, true},
+        {"pandas", "RangeIndex", false, pandas_range_index_state, false},
+        {"pandas", "Index", false, pandas_index_state, true},
+        {"pandas", "Series", false, pandas_series_state, true},
+        {"pandas", "DataFrame", false, pandas_frame_state, true},
+        {"torch", "Tensor", true, torch_tensor_state, true},
+    };
+
+    for (size_t i = 0; i < sizeof(handlers) / sizeof(handlers[0]); i++) {
+        int match = is_module_type(type, handlers[i].module, handlers[i].name, handlers[i].subclasses);
+        if (match == -1)
+            return -1;
+        if (match) {
+            if (!handlers[i].handler)
+                return 0;
+            dispatch->kind = DISPATCH_HANDLER;
+            dispatch->handler = handlers[i].handler;
+            dispatch->include_id = handlers[i].include_id;
+            return 1;
+        }
+    }
+
+    int is_dataclass = PyObject_HasAttrString((PyObject*) type, "__dataclass_fields__");
+    if (is_dataclass && PyType_Check((PyObject*) type)) {
+        PyObject *names = dataclass_field_names(type);
+        if (!names) {
+            // Not a dataclass after all, e.g. a class with a __dataclass_fields__ attribute
+            PyErr_Clear();
+            return 0;
+        }
+        dispatch->kind = DISPATCH_HANDLER;
+        dispatch->handler = dataclass_state;
+        dispatch->payload = names;
+        return 1;
+    }
+    return 0;
+}
+
+/*
+* Resolves how obj is visited, checking its type in the order of DispatchKind
+* Return: 0 on success, -1 on error
+*/
+static int resolve_dispatch(PyObject *obj, TypeDispatch *dispatch) {
+    PyTypeObject *type = Py_TYPE(obj);
+    *dispatch = (TypeDispatch){type, 0, DISPATCH_UNSUPPORTED, false, NULL, NULL, false, true};
+
+    if (is_primitive(obj))
+        dispatch->kind = DISPATCH_PRIMITIVE;
+    else if (PyTuple_Check(obj))
+        dispatch->kind = DISPATCH_TUPLE;
+    else if (PyList_Check(obj))
+        dispatch->kind = DISPATCH_LIST;
+    else if (PyAnySet_Check(obj))
+        dispatch->kind = DISPATCH_SET;
+    else if (PyDict_Check(obj))
+        dispatch->kind = DISPATCH_DICT;
+    else if (PyBytes_Check(obj) || PyByteArray_Check(obj))
+        dispatch->kind = DISPATCH_BYTE;
+    else if (PyType_Check(obj))
+        dispatch->kind = DISPATCH_TYPE;
+    else {
+        // Registered handlers also take precedence over callables, e.g. for models
+        int found = find_plugin(type, dispatch);
+        if (found)
+            return found == -1 ? -1 : 0;
+
+        dispatch->reducible = PyObject_HasAttrString(obj, "__reduce_ex__");
+        if (PyCallable_Check(obj))
+            dispatch->kind = DISPATCH_CALLABLE;
+        else if (PyObject_CheckBuffer(obj))
+            dispatch->kind = DISPATCH_BUFFER;
+        else if ((found = find_builtin_handler(type, dispatch)))
+            return found == -1 ? -1 : 0;
+        else if (dispatch->reducible)
+            dispatch->kind = DISPATCH_CUSTOM;
+    }
+    return 0;
+}
+
+/*
+* Stores dispatch in the cache, replacing a stale entry of its type
+* Return: 0 on success, -1 if out of memory
+*/
+static int type_dispatch_put(TypeDispatchCache *cache, const TypeDispatch *dispatch) {
+    int64_t i = cache->entries ? idmap_get(&(cache->index), (uint64_t)(uintptr_t)dispatch->type) : IDMAP_MISSING;
+    if (i != IDMAP_MISSING) {
+        Py_XDECREF(cache->entries[i].payload);
+        cache->entries[i] = *dispatch;
+        Py_XINCREF(dispatch->payload);
+        return 0;
+    }
+
+    if (cache->count >= TYPE_DISPATCH_MAX_ENTRIES)
+        type_dispatch_clear();
+    if (!cache->entries) {
+        if (idmap_init(&(cache->index), TYPE_DISPATCH_INITIAL_CAPACITY) == -1)
+            return -1;
+        cache->entries = (TypeDispatch*) malloc(TYPE_DISPATCH_INITIAL_CAPACITY * sizeof(TypeDispatch));
+        if (!cache->entries) {
+            idmap_free(&(cache->index));
+            return -1;
+        }
+        cache->capacity = TYPE_DISPATCH_INITIAL_CAPACITY;
+    }
+    if (cache->count == cache->capacity) {
+        TypeDispatch *entries = (TypeDispatch*) realloc(cache->entries, 2 * cache->capacity * sizeof(TypeDispatch));
+        if (!entries)
+            return -1;
+        cache->entries = entries;
+        cache->capacity *= 2;
+    }
+
+    if (idmap_put(&(cache->index), (uint64_t)(uintptr_t)dispatch->type, (int64_t)cache->count, NULL) == -1)
+        return -1;
+    cache->entries[cache->count++] = *dispatch;
+    Py_XINCREF(dispatch->payload);
+    return 0;
+}
+
+/*
+* Looks up how obj is visited, resolving its type on first sight and again
+* after the type was modified
+* dispatch: receives the dispatch, with a new reference to its payload
+* Return: 0 on success, -1 on error
+*/
+int type_dispatch_get(PyObject *obj, TypeDispatch *dispatch) {
+    TypeDispatchCache *cache = &type_dispatch_cache;
+    PyTypeObject *type = Py_TYPE(obj);
+    unsigned int version = type_version(type);
+    if (version != 0 && cache->count != 0) {
+        int64_t i = idmap_get(&(cache->index), (uint64_t)(uintptr_t)type);
+        if (i != IDMAP_MISSING && cache->entries[i].version == version) {
+            *dispatch = cache->entries[i];
+            Py_XINCREF(dispatch->payload);
+            return 0;
+        }
+    }
+
+    if (resolve_dispatch(obj, dispatch) == -1)
+        return -1;
+    // Resolving looks up attributes of the type, which assigns it a version tag
+    dispatch->version = type_version(type);
+    if (dispatch->version != 0 && type_dispatch_put(cache, dispatch) == -1) {
+        Py_CLEAR(dispatch->payload);
+        PyErr_NoMemory();
+        return -1;
+    }
+    return 0;
+}
+
+/*
+* Registers handler to return the state of the instances of type (and of its
+* subclasses), or unregisters it if handler is None
+* Return: 0 on success, -1 with an exception set on error
+*/
+int type_dispatch_register(PyObject *type, PyObject *handler) {
+    if (!PyType_Check(type)) {
+        PyErr_SetString(PyExc_TypeError, "type must be a type");
+        return -1;
+    }
+    if (handler != Py_None && !PyCallable_Check(handler)) {
+        PyErr_SetString(PyExc_TypeError, "handler must be callable or None");
+        return -1;
+    }
+    if (!type_handlers && !(type_handlers = PyDict_New()))
+        return -1;
+
+    if (handler == Py_None) {
+        if (PyDict_DelItem(type_handlers, type) == -1) {
+            if (!PyErr_ExceptionMatches(PyExc_KeyError))
+                return -1;
+            PyErr_Clear();
+        }
+    } else if (PyDict_SetItem(type_handlers, type, handler) == -1) {
+        return -1;
+    }
+    // Subclasses resolved before may now use the handler
+    type_dispatch_clear();
+    return 0;
+}
+
+/*
+* Forgets the dispatch of all types (registered handlers are kept)
+*/
+void type_dispatch_clear() {
+    TypeDispatchCache *cache = &type_dispatch_cache;
+    for (size_t i = 0; i < cache->count; i++)
+        Py_XDECREF(cache->entries[i].payload);
+    free(cache->entries);
+    idmap_free(&(cache->index));
+    cache->entries = NULL;
+    cache->count = 0;
+    cache->capacity = 0;
+}
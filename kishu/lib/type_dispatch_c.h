@@ -0,0 +1,76 @@
+#ifndef _TYPE_DISPATCH_C_H
+#define _TYPE_DISPATCH_C_H
+
+#include <Python.h>
+#include <stdbool.h>
+#include "idmap_c.h"
+
+// How get_object_state visits the instances of a type, in the order types are checked
+typedef enum {
+    DISPATCH_PRIMITIVE,
+    DISPATCH_TUPLE,
+    DISPATCH_LIST,
+    DISPATCH_SET,
+    DISPATCH_DICT,
+    DISPATCH_BYTE,
+    DISPATCH_TYPE,
+    DISPATCH_CALLABLE,
+    DISPATCH_BUFFER,       // Buffer (e.g. numpy array), else like DISPATCH_CUSTOM
+    DISPATCH_HANDLER,      // State returned by a type handler
+    DISPATCH_CUSTOM,       // State returned by __reduce_ex__
+    DISPATCH_UNSUPPORTED,
+} DispatchKind;
+
+/*
+* Returns the state of obj to traverse instead of its __reduce_ex__, as a new
+* reference to a tuple, or NULL with an exception set
+*/
+typedef PyObject* (*StateHandler)(PyObject *obj, PyObject *payload);
+
+/*
+* How the instances of a type are visited. Entries hold no reference to their
+* type: an entry is only valid while the version tag of the type is unchanged,
+* and CPython assigns a new tag when a type is modified or allocated.
+*/
+typedef struct TypeDispatch {
+    PyTypeObject *type;
+    unsigned int version;
+    DispatchKind kind;
+    bool reducible;        // Whether the type has __reduce_ex__, for DISPATCH_BUFFER
+    StateHandler handler;  // For DISPATCH_HANDLER
+    PyObject *payload;     // Passed to handler (owned, or NULL)
+    bool plugin;           // Errors of plugin handlers are raised instead of falling back to __reduce_ex__
+    bool include_id;       // Whether the id of instances is hashed, for DISPATCH_HANDLER
+} TypeDispatch;
+
+/*
+* Return: the version tag of type, or 0 if it has none, in which case nothing
+* may be cached about the type
+*/
+static inline unsigned int type_version(PyTypeObject *type) {
+#ifdef Py_TPFLAGS_VALID_VERSION_TAG
+    return PyType_HasFeature(type, Py_TPFLAGS_VALID_VERSION_TAG) ? type->tp_version_tag : 0;
+#else
+    return 0;
+#endif
+}
+
+// Number of cached types after which the cache is emptied
+#define TYPE_DISPATCH_MAX_ENTRIES 4096
+
+/*
+* Persistent cache of the dispatch of each type seen so far, keyed by type
+* address. Entries are stored densely; index maps addresses to entry positions.
+*/
+typedef struct TypeDispatchCache {
+    IdMap index;
+    TypeDispatch *entries;
+    size_t count;
+    size_t capacity;
+} TypeDispatchCache;
+
+int type_dispatch_get(PyObject *obj, TypeDispatch *dispatch);
+int type_dispatch_register(PyObject *type, PyObject *handler);
+void type_dispatch_clear();
+
+#endif /* _TYPE_DISPATCH_C_H */
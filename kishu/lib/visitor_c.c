@@ -1,6 +1,13 @@
 #include <Python.h>
 #include "visitor_c.h"
+#include "buffer_hash_c.h"
+#include "chunker_c.h"
 #include "hash_visitor_c.h"
+#include "idmap_c.h"
+#include "sampled_hash_c.h"
+#include "size_visitor_c.h"
+#include "stats_c.h"
+#include "type_dispatch_c.h"
 #include <stdbool.h>
 
 // Definitions of global type identifiers
@@ -13,164 +20,488 @@ const int TYPE_BOOL = 5;
 const int TYPE_STR = 6;
 const int TYPE_BYTE = 7;
 const int TYPE_BYTEARR = 8;
+const int TYPE_BUFFER = 9;
+const int TYPE_SUBTREE = 10;
+
+/*
+* Mixes the bits of an object address so that consecutive (aligned) addresses
+* spread over the whole table
+*/
+static inline size_t visited_hash(PyObject *obj) {
+    uint64_t h = (uint64_t)(uintptr_t)obj;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return (size_t)h;
+}
+
+Visited* visited_create() {
+    Visited *visited = (Visited*) (malloc(sizeof(Visited)));
+    if (!visited)
+        return NULL;
+    STATS_INC(allocations);
+    arena_init(&(visited->arena));
+    visited->capacity = VISITED_INITIAL_CAPACITY;
+    visited->count = 0;
+    visited->slots = (PyObject**) arena_calloc(&(visited->arena), visited->capacity, sizeof(PyObject*));
+    if (!visited->slots) {
+        free(visited);
+        return NULL;
+    }
+    return visited;
+}
+
+bool visited_contains(const Visited *visited, PyObject *obj) {
+    STATS_INC(visited_probes);
+    size_t mask = visited->capacity - 1;
+    size_t i = visited_hash(obj) & mask;
+    while (visited->slots[i] != NULL) {
+        if (visited->slots[i] == obj)
+            return true;
+        i = (i + 1) & mask;
+    }
+    return false;
+}
+
+/*
+* Inserts obj without checking the load factor. The table must have a free slot.
+*/
+static void visited_insert_slot(PyObject **slots, size_t capacity, PyObject *obj) {
+    size_t mask = capacity - 1;
+    size_t i = visited_hash(obj) & mask;
+    while (slots[i] != NULL && slots[i] != obj)
+        i = (i + 1) & mask;
+    slots[i] = obj;
+}
+
+/*
+* Doubles the table. The old table stays in the arena until the visitor is freed;
+* since the table grows geometrically this at most doubles the memory in use.
+*/
+static int visited_grow(Visited *visited) {
+    size_t new_capacity = visited->capacity * 2;
+    PyObject **new_slots = (PyObject**) arena_calloc(&(visited->arena), new_capacity, sizeof(PyObject*));
+    if (!new_slots) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    for (size_t i = 0; i < visited->capacity; i++) {
+        if (visited->slots[i] != NULL)
+            visited_insert_slot(new_slots, new_capacity, visited->slots[i]);
+    }
+    visited->slots = new_slots;
+    visited->capacity = new_capacity;
+    return 0;
+}
+
+/*
+* Adds obj to the visited set
+* Return: 1 if obj was added, 0 if it was already present, -1 on memory error
+*/
+int visited_add(Visited *visited, PyObject *obj) {
+    if (visited_contains(visited, obj))
+        return 0;
+
+    // Keep the load factor under 70% so probe sequences stay short
+    if ((visited->count + 1) * 10 > visited->capacity * 7) {
+        if (visited_grow(visited) == -1)
+            return -1;
+    }
+    visited_insert_slot(visited->slots, visited->capacity, obj);
+    visited->count++;
+    return 1;
+}
+
+/*
+* Empties the visited set, shrinking it back to its initial capacity
+* Return: 0 on success, -1 on memory error
+*/
+int visited_clear(Visited *visited) {
+    visited->count = 0;
+    if (visited->capacity == VISITED_INITIAL_CAPACITY) {
+        memset(visited->slots, 0, visited->capacity * sizeof(PyObject*));
+        return 0;
+    }
+    arena_free(&(visited->arena));
+    arena_init(&(visited->arena));
+    visited->capacity = VISITED_INITIAL_CAPACITY;
+    visited->slots = (PyObject**) arena_calloc(&(visited->arena), visited->capacity, sizeof(PyObject*));
+    if (!visited->slots) {
+        visited->capacity = 0;
+        PyErr_NoMemory();
+        return -1;
+    }
+    return 0;
+}
+
+void visited_free(Visited *visited) {
+    if (!visited)
+        return;
+    arena_free(&(visited->arena));
+    free(visited);
+}
 
 // VisitorReturnType* get_object_hash(PyObject *obj) {
 //     Visitor* hash_visitor = create_hash_visitor();
 //     return get_object_state(obj, hash_visitor, 1, hash_visitor -> state);
 // }
 
-Visitor* get_object_hash(PyObject *obj, const bool include_trav) {
+/*
+* Hashes obj with a new hash visitor
+* include_size: also compute the deep size of obj in the same traversal, with a
+* size visitor wrapping the hash visitor (see size_visitor_total)
+* chunk_size: chunk size for hashing large buffers in chunked mode, 0 to disable it
+* num_threads: threads used in chunked mode, 0 to use all CPUs
+* sample: sampled hashing mode for large buffers, NULL to hash all of their memory
+* Return: the visitor, or NULL with an exception set on error
+*/
+Visitor* get_object_hash(PyObject *obj, const bool include_trav, const bool include_size, size_t chunk_size, int num_threads, SampleState* sample) {
+    uint64_t start_ns = stats_monotonic_ns();
+    hash_cache_begin_pass();
     Visitor* hash_visitor = create_hash_visitor();
-    get_object_state(obj, hash_visitor, true, hash_visitor->state, include_trav);
+    if (!hash_visitor)
+        return NULL;
+    if (include_size) {
+        Visitor* size_visitor = create_size_visitor(hash_visitor);
+        if (!size_visitor) {
+            Py_DECREF(hash_visitor->list_included);
+            release_visitor_objects(hash_visitor);
+            free_visitor(hash_visitor);
+            PyErr_NoMemory();
+            return NULL;
+        }
+        hash_visitor = size_visitor;
+    }
+    hash_visitor->state->hash_chunk_size = chunk_size;
+    hash_visitor->state->hash_num_threads = num_threads > 0 ? num_threads : buffer_hash_default_threads();
+    hash_visitor->state->sample = sample;
+    if (!get_object_state(obj, hash_visitor, true, hash_visitor->state, include_trav)) {
+        if (!PyErr_Occurred())
+            PyErr_SetString(PyExc_RuntimeError, "Could not hash object");
+        Py_DECREF(hash_visitor->list_included);
+        release_visitor_objects(hash_visitor);
+        free_visitor(hash_visitor);
+        stats_timer_stop(STATS_TIMER_TRAVERSE, start_ns);
+        return NULL;
+    }
+    stats_timer_stop(STATS_TIMER_TRAVERSE, start_ns);
     return hash_visitor;
 }
 
-VisitorReturnType* get_object_state(PyObject *obj, Visitor *visitor, const bool include_id, VisitorReturnType* state, const bool include_trav) {
-    VisitorReturnType* ret_state;
-    if (NULL != (ret_state = (visitor->has_visited(obj, visitor->visited, include_id, state))))
-        return visitor->handle_visited(obj, include_id, state, visitor->list_included, include_trav);
-    else {
-        /* Not been visited yet */
-        if (is_primitive(obj))
-            return visitor->visit_primitive(obj, state, visitor->list_included, include_trav);
-        else if (PyTuple_Check(obj)) {
-            /* Tuple */
-            visitor->visit_tuple(obj, &(visitor->visited), include_id, state, visitor->list_included, include_trav);
-            Py_ssize_t size = PyTuple_Size(obj);
-            for (Py_ssize_t i = 0; i < size; i++) {
-                PyObject *item = PyTuple_GetItem(obj, i);
-                if (!get_object_state(item, visitor, include_id, state, include_trav)) {
-                    // Error
-                    return NULL;
-                }
-            }
-            return state;
-        }
-        else if (PyList_Check(obj)) {
-            /* List */
-            visitor->visit_list(obj, &(visitor->visited), include_id, state, visitor->list_included, include_trav);
-            Py_ssize_t size = PyList_Size(obj);
-            for (Py_ssize_t i = 0; i < size; i++) {
-                PyObject *item = PyList_GetItem(obj, i);
-                if (!get_object_state(item, visitor, include_id, state, include_trav)) {
-                    // Error
-                    return NULL;
-                }
-            } 
-            return state;            
-        }
-        else if (PyAnySet_Check(obj)) {
-            /* Set */
-            visitor->visit_set(obj, &(visitor->visited), include_id, state, visitor->list_included, include_trav);
-            PyObject *iter = PyObject_GetIter(obj);
-            PyObject *item;
-            while ((item = PyIter_Next(iter))) {
-                if (!get_object_state(item, visitor, include_id, state, include_trav)) {
-                    // Error
-                    return NULL;
-                }
-            }
-            return state;     
-        }
-        else if (PyDict_Check(obj)) {
-            /* Dictionary */
-            visitor->visit_dict(obj, &(visitor->visited), include_id, state, visitor->list_included, include_trav);
-            PyObject *keys = PyDict_Keys(obj);
-            PyObject *values = PyDict_Values(obj);
-            Py_ssize_t size = PyList_Size(keys);
-            for (Py_ssize_t i = 0; i < size; i++) {
-                PyObject *key = PyList_GetItem(keys, i);
-                PyObject *value = PyList_GetItem(values, i);
-
-                // process key
-                if (!get_object_state(key, visitor, include_id, state, include_trav)) {
-                    return NULL;
-                }
-
-                // process values
-                if (!get_object_state(value, visitor, include_id, state, include_trav)) {
-                    // Error
-                    return NULL;
-                }
-            }
-            return state;        
+/*
+* Visits a custom object through the state returned by its __reduce_ex__
+* Return: 0 on success, -1 on error
+*/
+static int visit_reduced(PyObject *obj, Visitor *visitor, VisitorReturnType* state, const bool include_trav) {
+    int picklable = is_picklable(obj);
+    if (picklable == -1)
+        return -1;
+
+    if (picklable) {
+        // Prepare the argument for __reduce_ex__
+        PyObject *arg = PyLong_FromLong(4);
+        if (!arg) {
+            // Handle error in creating the argument
+            return -1;
         }
-        else if (PyBytes_Check(obj) || PyByteArray_Check(obj)) {
-            /* Byte or Bytearray */
-            return visitor->visit_byte(obj, &(visitor->visited), include_id, state, visitor->list_included, include_trav);
+
+        // Call __reduce_ex__(4)
+        PyObject *reduced = PyObject_CallMethod(obj, "__reduce_ex__", "(O)", arg);
+        Py_DECREF(arg); // Decrement the reference count for arg
+
+        if (!reduced) {
+            // The type is cached as picklable, but this instance may still fail to reduce;
+            // like an unpicklable object, it is then only hashed by its id
+            PyErr_Clear();
+            return 0;
         }
-        else if(PyType_Check(obj)) {
-            /* type */
-            return visitor->visit_type(obj, &(visitor->visited), include_id, state, visitor->list_included, include_trav);
+
+        // Keep the reduced state alive until the visitor is freed, so the addresses of its
+        // objects in the visited set are not reused by other temporaries during the pass
+        int kept = PyList_Append(visitor->keep_alive, reduced);
+        Py_DECREF(reduced);
+        if (kept == -1)
+            return -1;
+
+        int range_index_instance = is_pandas_RangeIndex_instance(obj);
+        if (range_index_instance == -1)
+            return -1;
+
+        if (!range_index_instance)
+            visitor->update_state_id(obj, state, visitor->list_included, include_trav);
+        
+        if (PyUnicode_Check(reduced))
+            return visitor->visit_primitive(reduced, state, visitor->list_included, include_trav) ? 0 : -1;
+
+        // Uncomment the below code if pickle check is removed in python file
+        // int plt_callback_instance = is_plt_Callback_instance(obj);
+        // if (plt_callback_instance == -1)
+        //     return -1;
+        
+        // if (plt_callback_instance) 
+        //     return 0;
+
+        // Items after the callable, without their ids (reduced is kept alive by keep_alive)
+        Py_ssize_t size = PyTuple_Size(reduced);
+        if (size == -1)
+            return -1;
+        Py_INCREF(reduced);
+        return traversal_push(&(visitor->stack), FRAME_TUPLE, reduced, NULL, 1, size, false, state);
+    }
+    return 0;
+}
+
+/*
+* Visits a custom object through the state returned by its type handler (see
+* type_dispatch_c.h). Built-in handlers that fail fall back to __reduce_ex__.
+* Return: 0 on success, -1 on error
+*/
+static int visit_handled(PyObject *obj, const TypeDispatch *dispatch, Visitor *visitor, VisitorReturnType* state, const bool include_trav) {
+    PyObject *obj_state = dispatch->handler(obj, dispatch->payload);
+    if (!obj_state) {
+        if (dispatch->plugin || !dispatch->reducible)
+            return -1;
+        PyErr_Clear();
+        return visit_reduced(obj, visitor, state, include_trav);
+    }
+
+    // Keep the state alive until the visitor is freed, like reduced states
+    int kept = PyList_Append(visitor->keep_alive, obj_state);
+    if (kept == -1) {
+        Py_DECREF(obj_state);
+        return -1;
+    }
+    if (dispatch->include_id)
+        visitor->update_state_id(obj, state, visitor->list_included, include_trav);
+    return traversal_push(&(visitor->stack), FRAME_TUPLE, obj_state, NULL, 0, PyTuple_GET_SIZE(obj_state), false, state);
+}
+
+/*
+* Visits obj, and pushes a frame to visit its items next if it is a container.
+* The type checks are resolved once per type (see type_dispatch_get).
+* Return: 0 on success, -1 on error
+*/
+static int visit_object(PyObject *obj, Visitor *visitor, const bool include_id, VisitorReturnType* state, const bool include_trav) {
+    VisitorReturnType* ret_state;
+    Py_buffer view;
+    if (NULL != (ret_state = (visitor->has_visited(obj, visitor->visited, include_id, state))))
+        return visitor->handle_visited(obj, include_id, state, visitor->list_included, include_trav) ? 0 : -1;
+
+    /* Not been visited yet */
+    STATS_INC(objects_visited);
+    int immutable = visitor->visit_immutable(obj, visitor, include_id, state, include_trav);
+    if (immutable == -1)
+        return -1;
+    if (immutable)
+        return 0;
+
+    TypeDispatch dispatch;
+    if (type_dispatch_get(obj, &dispatch) == -1)
+        return -1;
+    int ret = 0;
+    switch (dispatch.kind) {
+    case DISPATCH_PRIMITIVE:
+        ret = visitor->visit_primitive(obj, state, visitor->list_included, include_trav) ? 0 : -1;
+        break;
+    case DISPATCH_TUPLE:
+        if (!visitor->visit_tuple(obj, &(visitor->visited), include_id, state, visitor->list_included, include_trav))
+            return -1;
+        Py_INCREF(obj);
+        return traversal_push(&(visitor->stack), FRAME_TUPLE, obj, NULL, 0, PyTuple_GET_SIZE(obj), include_id, state);
+    case DISPATCH_LIST:
+        if (!visitor->visit_list(obj, &(visitor->visited), include_id, state, visitor->list_included, include_trav))
+            return -1;
+        Py_INCREF(obj);
+        return traversal_push(&(visitor->stack), FRAME_LIST, obj, NULL, 0, 0, include_id, state);
+    case DISPATCH_SET: {
+        if (!visitor->visit_set(obj, &(visitor->visited), include_id, state, visitor->list_included, include_trav))
+            return -1;
+        PyObject *iter = PyObject_GetIter(obj);
+        if (!iter)
+            return -1;
+        return traversal_push(&(visitor->stack), FRAME_SET, iter, NULL, 0, 0, include_id, state);
+    }
+    case DISPATCH_DICT: {
+        if (!visitor->visit_dict(obj, &(visitor->visited), include_id, state, visitor->list_included, include_trav))
+            return -1;
+        PyObject *keys = PyDict_Keys(obj);
+        PyObject *values = PyDict_Values(obj);
+        if (!keys || !values) {
+            Py_XDECREF(keys);
+            Py_XDECREF(values);
+            return -1;
         }
-        else if (PyCallable_Check(obj)) {
-            /* Callable object */
-            return visitor->visit_callable(obj, &(visitor->visited), include_id, state, visitor->list_included, include_trav);
+        // Keys and values are visited alternately from the frame
+        return traversal_push(&(visitor->stack), FRAME_DICT, keys, values, 0, PyList_GET_SIZE(keys), include_id, state);
+    }
+    case DISPATCH_BYTE:
+        /* Byte or Bytearray */
+        ret = visitor->visit_byte(obj, &(visitor->visited), include_id, state, visitor->list_included, include_trav) ? 0 : -1;
+        break;
+    case DISPATCH_TYPE:
+        ret = visitor->visit_type(obj, &(visitor->visited), include_id, state, visitor->list_included, include_trav) ? 0 : -1;
+        break;
+    case DISPATCH_CALLABLE:
+        ret = visitor->visit_callable(obj, &(visitor->visited), include_id, state, visitor->list_included, include_trav) ? 0 : -1;
+        break;
+    case DISPATCH_BUFFER:
+        /* Buffer (e.g. numpy array) */
+        if (get_hashable_buffer(obj, &view)) {
+            ret = visitor->visit_buffer(obj, &view, &(visitor->visited), include_id, state, visitor->list_included, include_trav) ? 0 : -1;
+            PyBuffer_Release(&view);
+            break;
         }
-        else if (PyObject_HasAttrString(obj, "__reduce_ex__")) {
-            /* Custom object */
-            visitor->visit_custom_obj(obj, &(visitor->visited), include_id, state, visitor->list_included, include_trav);
-            int picklable = is_picklable(obj);
-            if (picklable == -1)
-                return NULL;
-
-            if (picklable) {
-                // Prepare the argument for __reduce_ex__
-                PyObject *arg = PyLong_FromLong(4);
-                if (!arg) {
-                    // Handle error in creating the argument
-                    return NULL;
-                }
-
-                // Call __reduce_ex__(4)
-                PyObject *reduced = PyObject_CallMethod(obj, "__reduce_ex__", "(O)", arg);
-                Py_DECREF(arg); // Decrement the reference count for arg
-
-                if (!reduced)
-                    return state;
-
-                int range_index_instance = is_pandas_RangeIndex_instance(obj);
-                if (range_index_instance == -1)
-                    return NULL;
-
-                if (!range_index_instance)
-                    visitor->update_state_id(obj, state, visitor->list_included, include_trav);
-                
-                if (PyUnicode_Check(reduced))
-                    return visitor->visit_primitive(reduced, state, visitor->list_included, include_trav);
-
-                // Uncomment the below code if pickle check is removed in python file
-                // int plt_callback_instance = is_plt_Callback_instance(obj);
-                // if (plt_callback_instance == -1)
-                //     return NULL;
-                
-                // if (plt_callback_instance) 
-                //     return state;
-
-                Py_ssize_t size = PyTuple_Size(reduced);
-                for (Py_ssize_t i = 1; i < size; i++) {
-                    PyObject *item = PyTuple_GetItem(reduced, i);
-                    if (!get_object_state(item, visitor, false, state, include_trav)) {
-                        // Error
-                        return NULL;
-                    }
-                }
-            }
-            return state;
+        if (!dispatch.reducible)
+            goto unsupported;
+        // Arrays of Python objects are custom objects
+        /* fall through */
+    case DISPATCH_CUSTOM:
+        if (!visitor->visit_custom_obj(obj, &(visitor->visited), include_id, state, visitor->list_included, include_trav))
+            return -1;
+        ret = visit_reduced(obj, visitor, state, include_trav);
+        break;
+    case DISPATCH_HANDLER:
+        if (!visitor->visit_custom_obj(obj, &(visitor->visited), include_id, state, visitor->list_included, include_trav))
+            ret = -1;
+        else
+            ret = visit_handled(obj, &dispatch, visitor, state, include_trav);
+        Py_XDECREF(dispatch.payload);
+        break;
+    default:
+    unsupported:
+        /* Not supported yet */
+        PyErr_SetString(PyExc_TypeError, "Unsupported object type for ObjectStare");
+        return -1;
+    }
+    return ret;
+}
+
+/*
+* Pushes a frame to traverse items, taking over the references to items and
+* values (NULL for frames other than dicts). The frame starts at index.
+* Return: 0 on success, -1 on memory error (the references are released)
+*/
+int traversal_push(TraversalStack *stack, TraversalFrameKind kind, PyObject *items, PyObject *values, Py_ssize_t index, Py_ssize_t size, const bool include_id, VisitorReturnType* state) {
+    if (stack->count == stack->capacity) {
+        size_t capacity = stack->capacity ? 2 * stack->capacity : TRAVERSAL_STACK_INITIAL_CAPACITY;
+        TraversalFrame *frames = (TraversalFrame*) realloc(stack->frames, capacity * sizeof(TraversalFrame));
+        if (!frames) {
+            Py_DECREF(items);
+            Py_XDECREF(values);
+            PyErr_NoMemory();
+            return -1;
         }
-        else {
-            /* Not supported yet */
-            PyErr_SetString(PyExc_TypeError, "Unsupported object type for ObjectStare");
-            return NULL;
+        STATS_INC(allocations);
+        stack->frames = frames;
+        stack->capacity = capacity;
+    }
+    stack->frames[stack->count++] = (TraversalFrame){kind, items, values, index, size, include_id, state};
+    return 0;
+}
+
+void traversal_pop(TraversalStack *stack) {
+    TraversalFrame *frame = &(stack->frames[--stack->count]);
+    Py_DECREF(frame->items);
+    Py_XDECREF(frame->values);
+}
+
+#if defined(__GNUC__) || defined(__clang__)
+#define PREFETCH_OBJECT(obj) __builtin_prefetch(obj)
+#else
+#define PREFETCH_OBJECT(obj) ((void)0)
+#endif
+
+/*
+* Takes the next item of frame, prefetching the header (and thus ob_type) of
+* the item after it in tuples and lists
+* Return: 1 and a new reference in item, 0 if the frame is exhausted, -1 on error
+*/
+static int traversal_next(TraversalFrame *frame, PyObject **item) {
+    switch (frame->kind) {
+    case FRAME_TUPLE:
+        if (frame->index >= frame->size)
+            return 0;
+        if (frame->index + 1 < frame->size)
+            PREFETCH_OBJECT(PyTuple_GET_ITEM(frame->items, frame->index + 1));
+        *item = PyTuple_GET_ITEM(frame->items, frame->index++);
+        break;
+    case FRAME_LIST:
+        // The size is read again since visiting items may run Python code
+        if (frame->index >= PyList_GET_SIZE(frame->items))
+            return 0;
+        if (frame->index + 1 < PyList_GET_SIZE(frame->items))
+            PREFETCH_OBJECT(PyList_GET_ITEM(frame->items, frame->index + 1));
+        *item = PyList_GET_ITEM(frame->items, frame->index++);
+        break;
+    case FRAME_SET:
+        *item = PyIter_Next(frame->items);
+        if (!*item)
+            return PyErr_Occurred() ? -1 : 0;
+        return 1;
+    case FRAME_DICT:
+        if (frame->index >= 2 * frame->size)
+            return 0;
+        *item = PyList_GET_ITEM(frame->index % 2 ? frame->values : frame->items, frame->index / 2);
+        frame->index++;
+        break;
+    default:
+        return 0;
+    }
+    Py_INCREF(*item);
+    return 1;
+}
+
+/*
+* Visits obj and its items in preorder. Items of containers are traversed from
+* the visitor's explicit stack, so deep objects don't exhaust the C stack.
+* Reentrant: nested calls (e.g. to hash subtrees) only use the frames they push.
+* Return: state on success, NULL on error
+*/
+VisitorReturnType* get_object_state(PyObject *obj, Visitor *visitor, const bool include_id, VisitorReturnType* state, const bool include_trav) {
+    TraversalStack *stack = &(visitor->stack);
+    size_t base = stack->count;
+    if (visit_object(obj, visitor, include_id, state, include_trav) == -1)
+        goto error;
+    while (stack->count > base) {
+        // Frames are accessed by index, visiting an item may grow the stack
+        TraversalFrame *frame = &(stack->frames[stack->count - 1]);
+        PyObject *item;
+        int next = traversal_next(frame, &item);
+        if (next == -1)
+            goto error;
+        if (next == 0) {
+            traversal_pop(stack);
+            continue;
         }
-    } 
+        int ret = visit_object(item, visitor, frame->include_id, frame->state, include_trav);
+        Py_DECREF(item);
+        if (ret == -1)
+            goto error;
+    }
+    return state;
+
+error:
+    while (stack->count > base)
+        traversal_pop(stack);
+    return NULL;
 }
 
+/*
+* Frees the visitor. Can run without the GIL once release_visitor_objects was called.
+*/
 void free_visitor(Visitor* visitor) {
     visitor->free_contents(visitor->visited, visitor->state);
+    free(visitor->stack.frames);
     free(visitor);
 }
 
+/*
+* Releases the Python objects kept alive by the visitor during the traversal
+*/
+void release_visitor_objects(Visitor* visitor) {
+    Py_CLEAR(visitor->keep_alive);
+}
+
 int is_primitive(PyObject *obj) {
     if ( (obj == Py_None) || (obj == Py_NotImplemented) || (obj == Py_Ellipsis) || PyLong_Check(obj) || PyFloat_Check(obj) || PyBool_Check(obj) || PyUnicode_Check(obj))
         return 1;
@@ -178,11 +509,27 @@ int is_primitive(PyObject *obj) {
         return 0;
 }
 
-int is_picklable(PyObject *obj) {
-    static PyObject *dumps_func = NULL;
+/*
+* Types seen to be picklable so far: type -> True. Instances are checked by
+* pickling the first instance of their type only, so hashing a large model does
+* not serialize it again on every pass. An instance of a picklable type holding
+* an unpicklable attribute is still traversed through __reduce_ex__. Negative
+* results are not cached: other instances of a type may be picklable, and must
+* be hashed from their state; the cache is emptied by clear_picklable_types.
+*/
+static PyObject *picklable_types = NULL;
+
+/*
+* Pickles obj into a sink discarding the stream, so the pickle is never
+* materialized in memory.
+* Return: 1 if obj can be pickled, 0 if not, -1 on error
+*/
+static int try_pickle(PyObject *obj) {
+    static PyObject *pickler_type = NULL;
+    static PyObject *sink = NULL;
 
-    // Import pickle and get dumps function only once
-    if (dumps_func == NULL) {
+    // Import pickle and create the sink only once
+    if (pickler_type == NULL) {
         PyObject *pickle_module = PyImport_ImportModule("pickle");
         if (!pickle_module) {
             // Handle error: unable to import pickle
@@ -190,25 +537,36 @@ int is_picklable(PyObject *obj) {
             return -1; // Considered not picklable
         }
 
-        dumps_func = PyObject_GetAttrString(pickle_module, "dumps");
+        pickler_type = PyObject_GetAttrString(pickle_module, "Pickler");
         Py_DECREF(pickle_module); // Done with pickle module
-        if (!dumps_func) {
-            // Handle error: dumps function not found
+        if (!pickler_type) {
+            // Handle error: Pickler not found
             PyErr_Print();
             return -1; // Considered not picklable
         }
     }
+    if (sink == NULL) {
+        // Any object with a write method is a valid file; len ignores the data written
+        PyObject *types_module = PyImport_ImportModule("types");
+        if (!types_module)
+            return -1;
+        PyObject *write = PyDict_GetItemString(PyEval_GetBuiltins(), "len");
+        sink = write ? PyObject_CallMethod(types_module, "SimpleNamespace", NULL) : NULL;
+        Py_DECREF(types_module);
+        if (!sink || PyObject_SetAttrString(sink, "write", write) == -1) {
+            Py_CLEAR(sink);
+            return -1;
+        }
+    }
 
-    // Prepare args
-    PyObject *args = PyTuple_Pack(1, obj);
-    if(!args) {
-        // Failed to create tuple
+    PyObject *pickler = PyObject_CallFunction(pickler_type, "(Oi)", sink, 4);
+    if (!pickler)
         return -1;
-    }
 
     // Try to pickle the object
-    PyObject *result = PyObject_CallObject(dumps_func, args);
-    Py_DECREF(args); // Decrement reference count for args
+    STATS_INC(pickles);
+    PyObject *result = PyObject_CallMethod(pickler, "dump", "(O)", obj);
+    Py_DECREF(pickler);
 
     if (!result) {
         // An exception occurred, clear it and consider the object not picklable
@@ -221,6 +579,35 @@ int is_picklable(PyObject *obj) {
     return 1; // True
 }
 
+int is_picklable(PyObject *obj) {
+    if (picklable_types == NULL) {
+        picklable_types = PyDict_New();
+        if (!picklable_types)
+            return -1;
+    }
+
+    PyObject *type = (PyObject*) Py_TYPE(obj);
+    PyObject *cached = PyDict_GetItemWithError(picklable_types, type);
+    if (cached)
+        return 1;
+    if (PyErr_Occurred())
+        return -1;
+
+    int picklable = try_pickle(obj);
+    if (picklable != 1)
+        return picklable;
+    if (PyDict_SetItem(picklable_types, type, Py_True) == -1)
+        return -1;
+    return 1;
+}
+
+/*
+* Forgets the picklability of all types
+*/
+void clear_picklable_types() {
+    Py_CLEAR(picklable_types);
+}
+
 /* Uncomment below code if pickle check is removed in python file*/
 // int is_plt_Callback_instance(PyObject *obj) {
 //     static PyObject *CallbackRegistry = NULL;
@@ -248,18 +635,44 @@ int is_picklable(PyObject *obj) {
 //         return 0;
 // }
 
+/*
+* Requests a strided, read-only buffer over the memory of obj, for objects
+* whose state is fully described by that memory (e.g. numpy arrays).
+* Buffers holding Python objects (format 'O') are not raw data and are rejected.
+* Return: 1 if view was filled (release it with PyBuffer_Release), 0 otherwise
+*/
+int get_hashable_buffer(PyObject *obj, Py_buffer *view) {
+    if (!PyObject_CheckBuffer(obj))
+        return 0;
+
+    if (PyObject_GetBuffer(obj, view, PyBUF_RECORDS_RO) == -1) {
+        // e.g. numpy datetime arrays can't be exported; hash them like other objects
+        PyErr_Clear();
+        return 0;
+    }
+
+    if (view->format && strchr(view->format, 'O')) {
+        PyBuffer_Release(view);
+        return 0;
+    }
+    return 1;
+}
+
 int is_pandas_RangeIndex_instance(PyObject *obj) {
     static PyObject *RangeIndex = NULL;
+    static bool pandas_missing = false;
 
-
+    if (pandas_missing)
+        return 0;
 
     if (RangeIndex == NULL) {
         // Import the pandas.core.indexes.range module and get RangeIndex
         PyObject *pandas_module = PyImport_ImportModule("pandas.core.indexes.range");
         if (!pandas_module) {
-            // Handle error
-            PyErr_Print();
-            return -1;
+            // Without pandas, no object can be a RangeIndex
+            PyErr_Clear();
+            pandas_missing = true;
+            return 0;
         }
 
         RangeIndex = PyObject_GetAttrString(pandas_module, "RangeIndex");
@@ -277,27 +690,65 @@ int is_pandas_RangeIndex_instance(PyObject *obj) {
         return 0;
 }
 
+/*
+* Computes the digest of a hash visitor and frees it. Neither step touches
+* Python objects (the caller takes over list_included), so both run with the
+* GIL released; freeing the visited table of a large object graph takes a while.
+* Return: the digest
+*/
+static unsigned long digest_and_free_visitor(Visitor* hash_visitor) {
+    unsigned long digest_hash;
+    release_visitor_objects(hash_visitor);
+    Py_BEGIN_ALLOW_THREADS
+    digest_hash = XXH3_64bits_digest(hash_visitor->state->hashed_state);
+    free_visitor(hash_visitor);
+    Py_END_ALLOW_THREADS
+    return digest_hash;
+}
+
+/*
+* Parses the arguments shared by the Python interface functions:
+* (obj, include_trav=False, chunk_size=0, num_threads=0)
+* chunk_size enables chunked hashing of buffers larger than chunk_size bytes,
+* with num_threads threads (0 for all CPUs).
+*/
+static int parse_hash_args(PyObject *args, PyObject *kwargs, PyObject **obj, bool *include_trav, size_t *chunk_size, int *num_threads) {
+    static char *kwlist[] = {"obj", "include_trav", "chunk_size", "num_threads", NULL};
+    int temp_include_trav = 0;
+    Py_ssize_t temp_chunk_size = 0;
+    *num_threads = 0;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|pni", kwlist, obj, &temp_include_trav, &temp_chunk_size, num_threads))
+        return -1;
+    if (temp_chunk_size < 0 || *num_threads < 0) {
+        PyErr_SetString(PyExc_ValueError, "chunk_size and num_threads must be non-negative");
+        return -1;
+    }
+
+    *include_trav = temp_include_trav ? true : false;
+    *chunk_size = (size_t)temp_chunk_size;
+    return 0;
+}
+
 /*
 * Python interface funtion to get hashed state of object
-* args: object whose state needs to be hashed
+* args: object whose state needs to be hashed, see parse_hash_args for options
 * Return: long(hashed value)
 */
-static PyObject *get_object_hash_wrapper(PyObject *self, PyObject *args) {
+static PyObject *get_object_hash_wrapper(PyObject *self, PyObject *args, PyObject *kwargs) {
     // Parse arguments from Python to C
     PyObject *obj;
-    int temp_include_trav;
     bool include_trav;
-    if (!PyArg_ParseTuple(args, "O", &obj, &temp_include_trav)) {
+    size_t chunk_size;
+    int num_threads;
+    if (parse_hash_args(args, kwargs, &obj, &include_trav, &chunk_size, &num_threads) == -1)
         return NULL;
-    }
 
-    include_trav = temp_include_trav ? true : false;
-
-    // Calling get_object_hash
-    // VisitorReturnType* result = get_object_hash(obj); 
-    Visitor* hash_visitor = get_object_hash(obj, include_trav);    
-    unsigned long digest_hash = XXH3_64bits_digest(hash_visitor->state->hashed_state);
-    free_visitor(hash_visitor);
+    Visitor* hash_visitor = get_object_hash(obj, include_trav, false, chunk_size, num_threads, NULL);
+    if (!hash_visitor)
+        return NULL;
+    Py_DECREF(hash_visitor->list_included);
+    unsigned long digest_hash = digest_and_free_visitor(hash_visitor);
 
     return PyLong_FromUnsignedLong(digest_hash);
 }
@@ -305,34 +756,485 @@ static PyObject *get_object_hash_wrapper(PyObject *self, PyObject *args) {
 /*
 * Python interface funtion to get hashed state of object as well as
 * items hashed during traversing
-* args: object whose state needs to be hashed
+* args: object whose state needs to be hashed, see parse_hash_args for options
 * Return: Tuple(hashed state, traversed items)
 */
-static PyObject *get_object_hash_and_trav_wrapper(PyObject *self, PyObject *args) {
+static PyObject *get_object_hash_and_trav_wrapper(PyObject *self, PyObject *args, PyObject *kwargs) {
+    // Parse arguments from Python to C
+    PyObject *obj;
+    bool include_trav;
+    size_t chunk_size;
+    int num_threads;
+    if (parse_hash_args(args, kwargs, &obj, &include_trav, &chunk_size, &num_threads) == -1)
+        return NULL;
+
+    Visitor* hash_visitor = get_object_hash(obj, include_trav, false, chunk_size, num_threads, NULL);
+    if (!hash_visitor)
+        return NULL;
+    PyObject* list_included = hash_visitor->list_included;
+    unsigned long digest_hash = digest_and_free_visitor(hash_visitor);
+
+    PyObject* result = Py_BuildValue("(kN)", digest_hash, list_included);
+    return result;
+}
+
+/*
+* Python interface funtion to get hashed state and deep size of object in a
+* single traversal
+* args: object whose state needs to be hashed, see parse_hash_args for options
+* Return: Tuple(hashed state, deep size in bytes)
+*/
+static PyObject *get_object_hash_and_size_wrapper(PyObject *self, PyObject *args, PyObject *kwargs) {
     // Parse arguments from Python to C
     PyObject *obj;
-    int temp_include_trav;
     bool include_trav;
+    size_t chunk_size;
+    int num_threads;
+    if (parse_hash_args(args, kwargs, &obj, &include_trav, &chunk_size, &num_threads) == -1)
+        return NULL;
 
-    if (!PyArg_ParseTuple(args, "Op", &obj, &temp_include_trav)) {
+    Visitor* size_visitor = get_object_hash(obj, include_trav, true, chunk_size, num_threads, NULL);
+    if (!size_visitor)
+        return NULL;
+    Py_DECREF(size_visitor->list_included);
+    size_t size = size_visitor_total(size_visitor);
+    unsigned long digest_hash = digest_and_free_visitor(size_visitor);
+
+    return Py_BuildValue("(kn)", digest_hash, (Py_ssize_t)size);
+}
+
+/*
+* Python interface funtion to get the hashed state of an object in sampled mode
+* (see sampled_hash_c.h), within a time budget
+* args: object whose state needs to be hashed; budget_ns, the time left to hash
+* large buffers, negative for no budget; threshold, page_size and sample_pages
+* of the sampled mode
+* Return: Tuple(hashed state, False if a large buffer was skipped because the
+* budget ran out, in which case the hashed state must not be compared)
+*/
+static PyObject *get_object_sampled_hash_wrapper(PyObject *self, PyObject *args, PyObject *kwargs) {
+    static char *kwlist[] = {"obj", "budget_ns", "threshold", "page_size", "sample_pages", NULL};
+    PyObject *obj;
+    long long budget_ns = -1;
+    Py_ssize_t threshold = DEFAULT_SAMPLE_THRESHOLD;
+    Py_ssize_t page_size = DEFAULT_SAMPLE_PAGE_SIZE;
+    Py_ssize_t sample_pages = DEFAULT_SAMPLE_PAGES;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|Lnnn", kwlist, &obj, &budget_ns, &threshold, &page_size, &sample_pages))
+        return NULL;
+    if (threshold < 0 || page_size <= 0 || sample_pages <= 0) {
+        PyErr_SetString(PyExc_ValueError, "threshold must be non-negative, page_size and sample_pages positive");
         return NULL;
     }
 
-    include_trav = temp_include_trav ? true : false;
+    SampleState sample = {(size_t)threshold, (size_t)page_size, (size_t)sample_pages, 0, true};
+    if (budget_ns >= 0)
+        sample.deadline_ns = stats_monotonic_ns() + (uint64_t)budget_ns;
+    Visitor* hash_visitor = get_object_hash(obj, false, false, 0, 1, &sample);
+    if (!hash_visitor)
+        return NULL;
+    Py_DECREF(hash_visitor->list_included);
+    unsigned long digest_hash = digest_and_free_visitor(hash_visitor);
 
-    Visitor* hash_visitor = get_object_hash(obj, include_trav);    
-    unsigned long digest_hash = XXH3_64bits_digest(hash_visitor->state->hashed_state);
+    return Py_BuildValue("(kN)", digest_hash, PyBool_FromLong(sample.complete));
+}
 
-    free_visitor(hash_visitor);
+/*
+* Python interface funtion to end a pass of sampled hashing: the dirty page
+* watcher reports the pages written from now on in the next pass. Until then,
+* the buffers hashed again keep the same digest.
+* Return: True if the dirty page watcher is available, False if only sample
+* pages are hashed
+*/
+static PyObject *end_sampled_pass_wrapper(PyObject *self, PyObject *args) {
+    page_watcher_end_pass();
+    return PyBool_FromLong(page_watcher_available());
+}
 
-    return PyTuple_Pack(2, PyLong_FromUnsignedLong(digest_hash), hash_visitor->list_included);
+/*
+* Python interface funtion to check for the dirty page watcher of the sampled
+* mode (see sampled_hash_c.h), which self-tests on first use
+* Return: True if it is available, False if only sample pages are hashed
+*/
+static PyObject *page_watcher_available_wrapper(PyObject *self, PyObject *args) {
+    return PyBool_FromLong(page_watcher_available());
+}
+
+/*
+* Records var_index as an owner of the object with address key. The first
+* variable that records an object keeps owning it, and every later variable
+* holding the object is linked to that owner. Linking each variable to the first
+* owner only yields the same connected components as checking all pairs, in
+* time linear in the number of recorded objects.
+* owners: object address -> index of the first variable that recorded it
+* pairs: (first variable * num_vars + second variable + 1) -> 1, for reported links
+* Return: 0 on success, -1 on error
+*/
+static int record_owner(uint64_t key, Py_ssize_t var_index, Py_ssize_t num_vars, PyObject *names, IdMap *owners, IdMap *pairs, PyObject *overlaps) {
+    int64_t previous;
+    if (idmap_put(owners, key, var_index, &previous) == -1) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    if (previous == IDMAP_MISSING || previous == var_index)
+        return 0;
+
+    // Keep the first variable as the owner, and report the pair once
+    idmap_put(owners, key, previous, NULL);
+    int64_t seen;
+    if (idmap_put(pairs, (uint64_t)(previous * num_vars + var_index + 1), 1, &seen) == -1) {
+        PyErr_NoMemory();
+        return -1;
+    }
+    if (seen != IDMAP_MISSING)
+        return 0;
+
+    PyObject *pair = PyTuple_Pack(2, PyList_GET_ITEM(names, previous), PyList_GET_ITEM(names, var_index));
+    if (!pair || PyList_Append(overlaps, pair) == -1) {
+        Py_XDECREF(pair);
+        return -1;
+    }
+    Py_DECREF(pair);
+    return 0;
+}
+
+/*
+* Records the objects in the visited set of variable var_index in its id set, and
+* the variables it shares objects with (see record_owner).
+* Return: the id set (a new frozenset), or NULL on error
+*/
+static PyObject* collect_namespace_ids(Visited *visited, Py_ssize_t var_index, Py_ssize_t num_vars, PyObject *names, IdMap *owners, IdMap *pairs, PyObject *overlaps) {
+    PyObject *ids = PyFrozenSet_New(NULL);
+    if (!ids)
+        return NULL;
+
+    for (size_t i = 0; i < visited->capacity; i++) {
+        PyObject *obj = visited->slots[i];
+        if (!obj)
+            continue;
+
+        PyObject *id = PyLong_FromVoidPtr(obj);
+        if (!id || PySet_Add(ids, id) == -1) {
+            Py_XDECREF(id);
+            Py_DECREF(ids);
+            return NULL;
+        }
+        Py_DECREF(id);
+
+        if (record_owner((uint64_t)(uintptr_t)obj, var_index, num_vars, names, owners, pairs, overlaps) == -1) {
+            Py_DECREF(ids);
+            return NULL;
+        }
+    }
+    return ids;
+}
+
+/*
+* Python interface funtion to find the linked variables of precomputed id sets,
+* e.g. the ones returned by hash_namespace or ObjectState.id_set.
+* args: dict mapping variable names to iterables of object ids
+* Return: list of (name, name) pairs of variables sharing objects. Every variable
+* sharing an object is paired with the first variable holding it, so the pairs
+* span the same connected components as all overlapping pairs.
+*/
+static PyObject *find_linked_pairs_wrapper(PyObject *self, PyObject *args) {
+    PyObject *id_sets;
+    if (!PyArg_ParseTuple(args, "O!", &PyDict_Type, &id_sets))
+        return NULL;
+
+    uint64_t start_ns = stats_monotonic_ns();
+    PyObject *names = PyDict_Keys(id_sets);
+    PyObject *overlaps = PyList_New(0);
+    PyObject *result = NULL;
+    IdMap owners = {0};
+    IdMap pairs = {0};
+    if (!names || !overlaps)
+        goto done;
+    if (idmap_init(&owners, 0) == -1 || idmap_init(&pairs, 0) == -1) {
+        PyErr_NoMemory();
+        goto done;
+    }
+
+    Py_ssize_t num_vars = PyList_GET_SIZE(names);
+    for (Py_ssize_t i = 0; i < num_vars; i++) {
+        PyObject *ids = PyDict_GetItemWithError(id_sets, PyList_GET_ITEM(names, i));
+        if (!ids) {
+            if (!PyErr_Occurred())
+                PyErr_SetString(PyExc_RuntimeError, "id_sets changed size during iteration");
+            goto done;
+        }
+        PyObject *iter = PyObject_GetIter(ids);
+        if (!iter)
+            goto done;
+        PyObject *id;
+        while ((id = PyIter_Next(iter))) {
+            void *address = PyLong_AsVoidPtr(id);
+            Py_DECREF(id);
+            if (!address) {
+                if (!PyErr_Occurred())
+                    PyErr_SetString(PyExc_ValueError, "object ids must be non-zero");
+                Py_DECREF(iter);
+                goto done;
+            }
+            if (record_owner((uint64_t)(uintptr_t)address, i, num_vars, names, &owners, &pairs, overlaps) == -1) {
+                Py_DECREF(iter);
+                goto done;
+            }
+        }
+        Py_DECREF(iter);
+        if (PyErr_Occurred())
+            goto done;
+    }
+    result = overlaps;
+    Py_INCREF(result);
+
+done:
+    idmap_free(&owners);
+    idmap_free(&pairs);
+    Py_XDECREF(names);
+    Py_XDECREF(overlaps);
+    stats_timer_stop(STATS_TIMER_LINKED_VARS, start_ns);
+    return result;
+}
+
+/*
+* Python interface funtion to hash all variables of a namespace in one call.
+* One visitor, XXH3 state and visited table are reused for all variables. The
+* visited table is emptied between variables, so every digest equals the one of
+* get_object_hash_wrapper for the variable alone.
+* args: dict mapping variable names to objects; chunk_size and num_threads as
+* for get_object_hash_wrapper
+* Return: Tuple(dict name -> hashed state, dict name -> frozenset of the ids of the
+* non-primitive objects visited from the variable, list of (name, name) pairs of
+* variables sharing objects, as returned by find_linked_pairs_wrapper)
+*/
+static PyObject *hash_namespace_wrapper(PyObject *self, PyObject *args, PyObject *kwargs) {
+    static char *kwlist[] = {"namespace", "chunk_size", "num_threads", NULL};
+    PyObject *namespace;
+    Py_ssize_t chunk_size = 0;
+    int num_threads = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O!|ni", kwlist, &PyDict_Type, &namespace, &chunk_size, &num_threads))
+        return NULL;
+    if (chunk_size < 0 || num_threads < 0) {
+        PyErr_SetString(PyExc_ValueError, "chunk_size and num_threads must be non-negative");
+        return NULL;
+    }
+
+    // Fix the order of the variables; names also keeps them alive during the traversal
+    uint64_t start_ns = stats_monotonic_ns();
+    PyObject *names = PyDict_Keys(namespace);
+    PyObject *values = PyDict_Values(namespace);
+    PyObject *digests = PyDict_New();
+    PyObject *id_sets = PyDict_New();
+    PyObject *overlaps = PyList_New(0);
+    PyObject *result = NULL;
+    IdMap owners = {0};
+    IdMap pairs = {0};
+    Visitor *hash_visitor = NULL;
+    if (!names || !values || !digests || !id_sets || !overlaps)
+        goto done;
+    if (idmap_init(&owners, 0) == -1 || idmap_init(&pairs, 0) == -1) {
+        PyErr_NoMemory();
+        goto done;
+    }
+
+    hash_cache_begin_pass();
+    hash_visitor = create_hash_visitor();
+    if (!hash_visitor)
+        goto done;
+    hash_visitor->state->hash_chunk_size = (size_t)chunk_size;
+    hash_visitor->state->hash_num_threads = num_threads > 0 ? num_threads : buffer_hash_default_threads();
+
+    Py_ssize_t num_vars = PyList_GET_SIZE(names);
+    for (Py_ssize_t i = 0; i < num_vars; i++) {
+        PyObject *name = PyList_GET_ITEM(names, i);
+        if (i > 0 && visited_clear(hash_visitor->visited) == -1)
+            goto done;
+        XXH3_64bits_reset(hash_visitor->state->hashed_state);
+
+        if (!get_object_state(PyList_GET_ITEM(values, i), hash_visitor, true, hash_visitor->state, false)) {
+            if (!PyErr_Occurred())
+                PyErr_SetString(PyExc_RuntimeError, "Could not hash object");
+            goto done;
+        }
+
+        PyObject *digest = PyLong_FromUnsignedLong(XXH3_64bits_digest(hash_visitor->state->hashed_state));
+        if (!digest || PyDict_SetItem(digests, name, digest) == -1) {
+            Py_XDECREF(digest);
+            goto done;
+        }
+        Py_DECREF(digest);
+
+        PyObject *ids = collect_namespace_ids(hash_visitor->visited, i, num_vars, names, &owners, &pairs, overlaps);
+        if (!ids || PyDict_SetItem(id_sets, name, ids) == -1) {
+            Py_XDECREF(ids);
+            goto done;
+        }
+        Py_DECREF(ids);
+    }
+    result = PyTuple_Pack(3, digests, id_sets, overlaps);
+
+done:
+    if (hash_visitor) {
+        Py_DECREF(hash_visitor->list_included);
+        release_visitor_objects(hash_visitor);
+        free_visitor(hash_visitor);
+    }
+    idmap_free(&owners);
+    idmap_free(&pairs);
+    Py_XDECREF(names);
+    Py_XDECREF(values);
+    Py_XDECREF(digests);
+    Py_XDECREF(id_sets);
+    Py_XDECREF(overlaps);
+    stats_timer_stop(STATS_TIMER_TRAVERSE, start_ns);
+    return result;
+}
+
+/*
+* Python interface funtion to split data into content-defined chunks and compute
+* their XXH3 128-bit digests (see find_chunk_ends). Runs without the GIL.
+* args: bytes-like data; final=True, False if the data continues in a later
+* call; min_size, avg_size and max_size of the chunks
+* Return: list of (end offset, 16-byte canonical digest) per chunk
+*/
+static PyObject *content_defined_chunks_wrapper(PyObject *self, PyObject *args, PyObject *kwargs) {
+    static char *kwlist[] = {"data", "final", "min_size", "avg_size", "max_size", NULL};
+    Py_buffer data;
+    int final = 1;
+    Py_ssize_t min_size = CHUNKER_MIN_SIZE;
+    Py_ssize_t avg_size = CHUNKER_AVG_SIZE;
+    Py_ssize_t max_size = CHUNKER_MAX_SIZE;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "y*|pnnn", kwlist, &data, &final, &min_size, &avg_size, &max_size))
+        return NULL;
+    if (min_size <= 0 || min_size > avg_size || avg_size > max_size) {
+        PyBuffer_Release(&data);
+        PyErr_SetString(PyExc_ValueError, "chunk sizes must satisfy 0 < min_size <= avg_size <= max_size");
+        return NULL;
+    }
+
+    size_t length = (size_t)data.len;
+    size_t *ends = (size_t*) malloc((length / (size_t)min_size + 1) * sizeof(size_t));
+    XXH128_canonical_t *digests = (XXH128_canonical_t*) malloc((length / (size_t)min_size + 1) * sizeof(XXH128_canonical_t));
+    if (!ends || !digests) {
+        free(ends);
+        free(digests);
+        PyBuffer_Release(&data);
+        return PyErr_NoMemory();
+    }
+
+    size_t count;
+    Py_BEGIN_ALLOW_THREADS
+    const unsigned char *bytes = (const unsigned char*) data.buf;
+    count = find_chunk_ends(bytes, length, (size_t)min_size, (size_t)avg_size, (size_t)max_size, final != 0, ends);
+    for (size_t i = 0; i < count; i++) {
+        size_t start = i == 0 ? 0 : ends[i - 1];
+        XXH128_canonicalFromHash(&digests[i], XXH3_128bits(bytes + start, ends[i] - start));
+    }
+    Py_END_ALLOW_THREADS
+    PyBuffer_Release(&data);
+
+    PyObject *chunks = PyList_New((Py_ssize_t)count);
+    for (size_t i = 0; chunks && i < count; i++) {
+        PyObject *digest = PyBytes_FromStringAndSize((const char*) digests[i].digest, sizeof(digests[i].digest));
+        PyObject *chunk = digest ? Py_BuildValue("(nN)", (Py_ssize_t)ends[i], digest) : NULL;
+        if (!chunk) {
+            Py_CLEAR(chunks);
+            break;
+        }
+        PyList_SET_ITEM(chunks, (Py_ssize_t)i, chunk);
+    }
+    free(ends);
+    free(digests);
+    return chunks;
+}
+
+/*
+* Python interface funtion to drop all cached subtree digests, type picklability
+* and type dispatch
+* Return: None
+*/
+static PyObject *clear_hash_cache_wrapper(PyObject *self, PyObject *args) {
+    hash_cache_reset();
+    clear_picklable_types();
+    type_dispatch_clear();
+    Py_RETURN_NONE;
+}
+
+/*
+* Python interface funtion to register a handler returning the state to hash for
+* the instances of a type, instead of their __reduce_ex__: (type, handler) where
+* handler(obj) returns a sequence, or is None to unregister
+* Return: None
+*/
+static PyObject *register_type_handler_wrapper(PyObject *self, PyObject *args) {
+    PyObject *type, *handler;
+    if (!PyArg_ParseTuple(args, "OO", &type, &handler))
+        return NULL;
+    if (type_dispatch_register(type, handler) == -1)
+        return NULL;
+    Py_RETURN_NONE;
+}
+
+#ifndef KISHU_BUILD_VARIANT
+#define KISHU_BUILD_VARIANT "unknown"
+#endif
+
+/*
+* Python interface funtion to describe how the module was built, e.g. to label
+* benchmark runs
+* Return: dict of the build variant of setup.py and the XXH3 SIMD variant
+*/
+static PyObject *build_info_wrapper(PyObject *self, PyObject *args) {
+    return Py_BuildValue("{ssss}", "variant", KISHU_BUILD_VARIANT, "xxh3", xxh3_dispatch_variant());
+}
+
+/*
+* Python interface funtion to get the instrumentation counters and timers of the
+* module (see stats_c.h), accumulated since it was loaded or reset_stats
+* Return: dict of counter and timer names to values (times in ns)
+*/
+static PyObject *get_stats_wrapper(PyObject *self, PyObject *args) {
+    return stats_as_dict();
+}
+
+/*
+* Python interface funtion to zero the instrumentation counters and timers
+* Return: None
+*/
+static PyObject *reset_stats_wrapper(PyObject *self, PyObject *args) {
+    stats_reset();
+    Py_RETURN_NONE;
 }
 
 static PyMethodDef VisitorMethods[] = {
-    {"get_object_hash_and_trav_wrapper", get_object_hash_and_trav_wrapper, METH_VARARGS,
+    {"get_object_hash_and_trav_wrapper", (PyCFunction)(void(*)(void))get_object_hash_and_trav_wrapper, METH_VARARGS | METH_KEYWORDS,
      "Python interface to get hashed state and traversal as a tuple"},
-    {"get_object_hash_wrapper", get_object_hash_wrapper, METH_VARARGS,
-     "Python interface for getting hashed object state of object"},     
+    {"get_object_hash_wrapper", (PyCFunction)(void(*)(void))get_object_hash_wrapper, METH_VARARGS | METH_KEYWORDS,
+     "Python interface for getting hashed object state of object"},
+    {"get_object_hash_and_size_wrapper", (PyCFunction)(void(*)(void))get_object_hash_and_size_wrapper, METH_VARARGS | METH_KEYWORDS,
+     "Python interface to get hashed state and deep size of object in one traversal"},
+    {"get_object_sampled_hash", (PyCFunction)(void(*)(void))get_object_sampled_hash_wrapper, METH_VARARGS | METH_KEYWORDS,
+     "Python interface to get hashed object state with large buffers sampled, within a time budget"},
+    {"end_sampled_pass", end_sampled_pass_wrapper, METH_NOARGS,
+     "End a pass of sampled hashing, so the next one sees the pages written from now on"},
+    {"page_watcher_available", page_watcher_available_wrapper, METH_NOARGS,
+     "Whether the writes between sample pages are detected by the dirty page watcher"},
+    {"hash_namespace", (PyCFunction)(void(*)(void))hash_namespace_wrapper, METH_VARARGS | METH_KEYWORDS,
+     "Python interface to hash all variables of a namespace dict in one call"},
+    {"find_linked_pairs", find_linked_pairs_wrapper, METH_VARARGS,
+     "Python interface to find pairs of variables sharing objects from their id sets"},
+    {"content_defined_chunks", (PyCFunction)(void(*)(void))content_defined_chunks_wrapper, METH_VARARGS | METH_KEYWORDS,
+     "Split data into content-defined chunks with their XXH3 128-bit digests"},
+    {"clear_hash_cache", clear_hash_cache_wrapper, METH_NOARGS,
+     "Drop the subtree digests, type picklability and type dispatch cached across calls"},     
+    {"register_type_handler", register_type_handler_wrapper, METH_VARARGS,
+     "Register a handler returning the state to hash for the instances of a type"},
+    {"build_info", build_info_wrapper, METH_NOARGS,
+     "Describe the build variant and the selected XXH3 SIMD variant"},
+    {"get_stats", get_stats_wrapper, METH_NOARGS,
+     "Get the counters and monotonic timers of the native hot paths"},
+    {"reset_stats", reset_stats_wrapper, METH_NOARGS,
+     "Zero the counters and timers returned by get_stats"},
     {NULL, NULL, 0, NULL}};
 
 static struct PyModuleDef VisitorModule = {
@@ -344,5 +1246,16 @@ static struct PyModuleDef VisitorModule = {
 };
 
 PyMODINIT_FUNC PyInit_VisitorModule(void) {
-    return PyModule_Create(&VisitorModule);
+    PyObject *module = PyModule_Create(&VisitorModule);
+    if (!module)
+        return NULL;
+    chunker_init();
+    if (PyModule_AddIntConstant(module, "DEFAULT_HASH_CHUNK_SIZE", DEFAULT_HASH_CHUNK_SIZE) == -1 ||
+        PyModule_AddIntConstant(module, "DEFAULT_SAMPLE_THRESHOLD", DEFAULT_SAMPLE_THRESHOLD) == -1 ||
+        PyModule_AddIntConstant(module, "DEFAULT_SAMPLE_PAGE_SIZE", DEFAULT_SAMPLE_PAGE_SIZE) == -1 ||
+        PyModule_AddIntConstant(module, "DEFAULT_SAMPLE_PAGES", DEFAULT_SAMPLE_PAGES) == -1) {
+        Py_DECREF(module);
+        return NULL;
+    }
+    return module;
 }
\ No newline at end of file
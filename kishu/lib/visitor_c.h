@@ -3,7 +3,8 @@
 
 #include <Python.h>
 #include <stdbool.h>
-#include "xxhash.h"
+#include "xxh_x86dispatch.h"
+#include "arena_c.h"
 
 // Global type identifiers
 extern const int TYPE_NONE;
@@ -15,22 +16,87 @@ extern const int TYPE_BOOL;
 extern const int TYPE_STR;
 extern const int TYPE_BYTE;
 extern const int TYPE_BYTEARR;
+extern const int TYPE_BUFFER;
+extern const int TYPE_SUBTREE;
 
 
-typedef union {
-    PyObject* py_object;
-    XXH3_state_t* hashed_state;
-    // GraphNode* node;
-    // other possible return types
+// Default chunk size of the chunked (tree) hashing mode for large buffers
+#define DEFAULT_HASH_CHUNK_SIZE (4 * 1024 * 1024)
+
+struct SizeState;
+struct SampleState;
+
+typedef struct {
+    union {
+        PyObject* py_object;
+        XXH3_state_t* hashed_state;
+        // GraphNode* node;
+        // other possible return types
+    };
+    /*
+    * Chunked hashing mode for bytes, bytearray and contiguous buffers larger than
+    * hash_chunk_size: chunks are hashed by hash_num_threads threads with the GIL
+    * released. hash_chunk_size 0 hashes every buffer with a single update.
+    */
+    size_t hash_chunk_size;
+    int hash_num_threads;
+    // Deep size accounting of the size visitor, NULL without one (see size_visitor_c.h)
+    struct SizeState* size;
+    // Sampled hashing mode for large mutable buffers, NULL to hash all of their memory (see sampled_hash_c.h)
+    struct SampleState* sample;
 } VisitorReturnType;
 
+// Initial number of slots in the visited table. Must be a power of two.
+#define VISITED_INITIAL_CAPACITY 64
+
+/*
+* Open-addressing hash set of visited objects, keyed by object address.
+* Empty slots hold NULL. Slot tables are carved out of the arena, so the
+* whole set is released at once when the visitor is freed.
+*/
 typedef struct Visited {
-    PyObject *pyObject;
-    // PyObject *id;
-    struct Visited *next;
-    // maybe have a pointer here to the VisitorReturnType as well
+    PyObject **slots;
+    size_t capacity;  // Always a power of two
+    size_t count;
+    Arena arena;
 } Visited;
 
+// Initial number of frames in the traversal stack
+#define TRAVERSAL_STACK_INITIAL_CAPACITY 64
+
+typedef enum {
+    FRAME_TUPLE,  // Items of a tuple, or of the reduced state of a custom object
+    FRAME_LIST,
+    FRAME_SET,    // Items of an iterator over a set
+    FRAME_DICT,   // Keys and values, alternately
+} TraversalFrameKind;
+
+/*
+* A container whose items remain to be traversed. The frame owns references
+* to the objects it iterates.
+*/
+typedef struct TraversalFrame {
+    TraversalFrameKind kind;
+    PyObject *items;    // Tuple, list, set iterator or list of dict keys
+    PyObject *values;   // List of dict values, NULL for other kinds
+    Py_ssize_t index;   // Next item; for dicts, 2 * entry (key) or 2 * entry + 1 (value)
+    Py_ssize_t size;    // Number of items of tuples and dicts
+    bool include_id;    // Passed on to the items (false below custom objects)
+    VisitorReturnType* state;
+} TraversalFrame;
+
+/*
+* Explicit stack of the containers on the current traversal path, innermost
+* last. get_object_state visits the items of the top frame instead of
+* recursing, so the depth of an object is only bounded by memory. The stack
+* belongs to the visitor and is reused by all traversals of a pass.
+*/
+typedef struct TraversalStack {
+    TraversalFrame *frames;
+    size_t count;
+    size_t capacity;
+} TraversalStack;
+
 // function pointer for visitor pattern
 
 typedef struct Visitor {
@@ -43,26 +109,42 @@ typedef struct Visitor {
     VisitorReturnType* (*visit_dict)(PyObject *obj, Visited **visited, const bool include_id, VisitorReturnType* state, PyObject* list_included, const bool include_trav);
     VisitorReturnType* (*visit_byte)(PyObject *obj, Visited **visited, const bool include_id, VisitorReturnType* state, PyObject* list_included, const bool include_trav);
     VisitorReturnType* (*visit_type)(PyObject *obj, Visited **visited, const bool include_id, VisitorReturnType* state, PyObject* list_included, const bool include_trav);
+    VisitorReturnType* (*visit_buffer)(PyObject *obj, Py_buffer *view, Visited **visited, const bool include_id, VisitorReturnType* state, PyObject* list_included, const bool include_trav);
     VisitorReturnType* (*visit_callable)(PyObject *obj, Visited **visited, const bool include_id, VisitorReturnType* state, PyObject* list_included, const bool include_trav);
     VisitorReturnType* (*visit_custom_obj)(PyObject *obj, Visited **visited, const bool include_id, VisitorReturnType* state, PyObject* list_included, const bool include_trav);
+    int (*visit_immutable)(PyObject *obj, struct Visitor *visitor, const bool include_id, VisitorReturnType* state, const bool include_trav);
     void (*update_state_id)(PyObject *obj, VisitorReturnType* state, PyObject* list_included, const bool include_trav);
     void (*free_contents)(Visited *visited, VisitorReturnType* state);
     Visited* visited;
     PyObject* list_included; // for debugging purposes
+    PyObject* keep_alive; // temporaries referenced by the visited set
     VisitorReturnType* state;
+    TraversalStack stack;
 } Visitor;
 
+Visited* visited_create();
+bool visited_contains(const Visited *visited, PyObject *obj);
+int visited_add(Visited *visited, PyObject *obj);
+int visited_clear(Visited *visited);
+void visited_free(Visited *visited);
+
 // static PyObject* get_object_hash_wrapper(PyObject* self, PyObject* args);
 
+int traversal_push(TraversalStack *stack, TraversalFrameKind kind, PyObject *items, PyObject *values, Py_ssize_t index, Py_ssize_t size, const bool include_id, VisitorReturnType* state);
+void traversal_pop(TraversalStack *stack);
+
 VisitorReturnType* get_object_state(PyObject *obj, Visitor *visitor, const bool include_id, VisitorReturnType* state, const bool include_trav);
 // VisitorReturnType* get_object_hash(PyObject *obj);
-Visitor* get_object_hash(PyObject *obj, const bool include_trav);
+Visitor* get_object_hash(PyObject *obj, const bool include_trav, const bool include_size, size_t chunk_size, int num_threads, struct SampleState* sample);
 
 Visitor* get_hash_visitor();
 
 void free_visitor(Visitor* visitor);
+void release_visitor_objects(Visitor* visitor);
 int is_primitive(PyObject *obj);
 int is_picklable(PyObject *obj);
+void clear_picklable_types();
+int get_hashable_buffer(PyObject *obj, Py_buffer *view);
 int is_pandas_RangeIndex_instance(PyObject *obj);
 int is_plt_Callback_instance(PyObject *obj);
 int is_pickable_using_Python(PyObject *obj);
@@ -0,0 +1,85 @@
+/*
+* Runtime dispatch of XXH3 on x86-64, after xxHash's xxh_x86dispatch.c: the
+* long-input loops are compiled once per instruction set with target
+* attributes, and the best one supported by the CPU is selected when the
+* extension is loaded.
+*/
+#define XXH_DISPATCH_IMPLEMENTATION
+#include "xxh_x86dispatch.h"
+
+#if XXH_DISPATCH_ENABLED
+
+typedef XXH_errorcode (*XXH3_update_f)(XXH3_state_t *state, const void *input, size_t len);
+
+/*
+* Defines the long-input functions of one variant, inlining its accumulate and
+* scramble steps into loops compiled for the variant's instruction set.
+*/
+#define XXH_DEFINE_DISPATCH_VARIANT(variant, target)                                                          \
+    target static XXH64_hash_t XXH3_hashLong_64b_##variant(const void *XXH_RESTRICT input, size_t len,      \
+                                                            XXH64_hash_t seed64,                              \
+                                                            const xxh_u8 *XXH_RESTRICT secret,                \
+                                                            size_t secretLen) {                               \
+        (void)seed64; (void)secret; (void)secretLen;                                                          \
+        return XXH3_hashLong_64b_internal(input, len, XXH3_kSecret, sizeof(XXH3_kSecret),                     \
+                                          XXH3_accumulate_##variant, XXH3_scrambleAcc_##variant);             \
+    }                                                                                                         \
+    target static XXH128_hash_t XXH3_hashLong_128b_##variant(const void *XXH_RESTRICT input, size_t len,    \
+                                                              XXH64_hash_t seed64,                            \
+                                                              const void *XXH_RESTRICT secret,                \
+                                                              size_t secretLen) {                             \
+        (void)seed64; (void)secret; (void)secretLen;                                                          \
+        return XXH3_hashLong_128b_internal(input, len, XXH3_kSecret, sizeof(XXH3_kSecret),                    \
+                                           XXH3_accumulate_##variant, XXH3_scrambleAcc_##variant);            \
+    }                                                                                                         \
+    target static XXH_errorcode XXH3_update_##variant(XXH3_state_t *state, const void *input, size_t len) {  \
+        return XXH3_update(state, (const xxh_u8 *)input, len,                                                 \
+                           XXH3_accumulate_##variant, XXH3_scrambleAcc_##variant);                            \
+    }
+
+XXH_DEFINE_DISPATCH_VARIANT(sse2, XXH_TARGET_SSE2)
+XXH_DEFINE_DISPATCH_VARIANT(avx2, XXH_TARGET_AVX2)
+XXH_DEFINE_DISPATCH_VARIANT(avx512, XXH_TARGET_AVX512)
+
+typedef struct {
+    const char *name;
+    XXH3_hashLong64_f hash_long_64;
+    XXH3_hashLong128_f hash_long_128;
+    XXH3_update_f update;
+} XXH3Dispatch;
+
+/* SSE2 is part of x86-64, so it is safe to use before the CPU is inspected. */
+static XXH3Dispatch xxh3_dispatch = {"sse2", XXH3_hashLong_64b_sse2, XXH3_hashLong_128b_sse2, XXH3_update_sse2};
+
+__attribute__((constructor)) static void xxh3_dispatch_init(void) {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        xxh3_dispatch = (XXH3Dispatch){"avx512", XXH3_hashLong_64b_avx512, XXH3_hashLong_128b_avx512, XXH3_update_avx512};
+    } else if (__builtin_cpu_supports("avx2")) {
+        xxh3_dispatch = (XXH3Dispatch){"avx2", XXH3_hashLong_64b_avx2, XXH3_hashLong_128b_avx2, XXH3_update_avx2};
+    }
+}
+
+XXH64_hash_t XXH3_64bits_dispatch(const void *input, size_t len) {
+    return XXH3_64bits_internal(input, len, 0, XXH3_kSecret, sizeof(XXH3_kSecret), xxh3_dispatch.hash_long_64);
+}
+
+XXH_errorcode XXH3_64bits_update_dispatch(XXH3_state_t *state, const void *input, size_t len) {
+    return xxh3_dispatch.update(state, input, len);
+}
+
+XXH128_hash_t XXH3_128bits_dispatch(const void *input, size_t len) {
+    return XXH3_128bits_internal(input, len, 0, XXH3_kSecret, sizeof(XXH3_kSecret), xxh3_dispatch.hash_long_128);
+}
+
+const char *xxh3_dispatch_variant(void) {
+    return xxh3_dispatch.name;
+}
+
+#else
+
+const char *xxh3_dispatch_variant(void) {
+    return "scalar";
+}
+
+#endif // XXH_DISPATCH_ENABLED
@@ -0,0 +1,52 @@
+#ifndef XXH_X86DISPATCH_H
+#define XXH_X86DISPATCH_H
+
+/*
+* With XXH_DISPATCH defined on x86-64 (see setup.py), the XXH3 functions used by
+* the extensions pick the SIMD variant of their long-input loop (SSE2, AVX2 or
+* AVX-512) at load time from the features of the CPU. Digests are the same for
+* all variants. Otherwise, this header only includes xxhash.h.
+*/
+#if defined(XXH_DISPATCH) && (defined(__x86_64__) || defined(_M_X64)) && (defined(__GNUC__) || defined(__clang__))
+#define XXH_DISPATCH_ENABLED 1
+#else
+#define XXH_DISPATCH_ENABLED 0
+#endif
+
+#if XXH_DISPATCH_ENABLED && defined(XXH_DISPATCH_IMPLEMENTATION)
+/* xxh_x86dispatch.c compiles xxHash inline, with the vector variants enabled. */
+#include <immintrin.h>
+#define XXH_INLINE_ALL
+#define XXH_X86DISPATCH
+#define XXH_DISPATCH_AVX2 1
+#define XXH_DISPATCH_AVX512 1
+#define XXH_TARGET_SSE2 __attribute__((__target__("sse2")))
+#define XXH_TARGET_AVX2 __attribute__((__target__("avx2")))
+#define XXH_TARGET_AVX512 __attribute__((__target__("avx512f")))
+#endif
+
+#include "xxhash.h"
+
+#if XXH_DISPATCH_ENABLED
+XXH64_hash_t XXH3_64bits_dispatch(const void *input, size_t len);
+XXH_errorcode XXH3_64bits_update_dispatch(XXH3_state_t *state, const void *input, size_t len);
+XXH128_hash_t XXH3_128bits_dispatch(const void *input, size_t len);
+
+#ifndef XXH_DISPATCH_IMPLEMENTATION
+#undef XXH3_64bits
+#undef XXH3_64bits_update
+#undef XXH3_128bits
+#define XXH3_64bits XXH3_64bits_dispatch
+#define XXH3_64bits_update XXH3_64bits_update_dispatch
+#define XXH3_128bits XXH3_128bits_dispatch
+#endif
+#endif
+
+/*
+* Name of the variant used for long inputs: "scalar" without dispatch (the
+* vector extensions enabled at compile time may still be used), or "sse2",
+* "avx2" or "avx512".
+*/
+const char *xxh3_dispatch_variant(void);
+
+#endif // XXH_X86DISPATCH_H
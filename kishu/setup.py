@@ -2,8 +2,45 @@
 
 # Learn more: https://github.com/kennethreitz/setup.py
 
+import os
+import sys
+
 from setuptools import setup, Extension
 
+# Build variant of the native extensions, chosen with the KISHU_BUILD environment variable:
+#   release (default): -O3 with link-time optimization across each extension's sources, and runtime selection of
+#       the SIMD variant of XXH3 (see lib/xxh_x86dispatch.h).
+#   debug: unoptimized, with debug symbols.
+#   pgo-generate, pgo-use: release build with profile-guided optimization (GCC). Build with pgo-generate, run the
+#       training workloads (see benchmark.sh) to write profiles into build/pgo, then rebuild with pgo-use.
+BUILD_VARIANT = os.environ.get('KISHU_BUILD', 'release')
+PGO_DIRECTORY = os.path.abspath(os.path.join('build', 'pgo'))
+
+
+def build_flags(variant):
+    """Returns the compile arguments, link arguments and macros of a build variant."""
+    macros = [('KISHU_BUILD_VARIANT', '"%s"' % variant)]
+    if variant == 'debug':
+        return ['-g', '-O0'], [], macros
+    if variant not in ('release', 'pgo-generate', 'pgo-use'):
+        raise ValueError('unknown KISHU_BUILD variant %s' % variant)
+
+    macros.append(('XXH_DISPATCH', '1'))
+    if sys.platform == 'win32':
+        return ['/O2', '/GL'], ['/LTCG'], macros
+    compile_args, link_args = ['-O3', '-flto'], ['-O3', '-flto']
+    if variant == 'pgo-generate':
+        compile_args.append('-fprofile-generate=' + PGO_DIRECTORY)
+        link_args.append('-fprofile-generate=' + PGO_DIRECTORY)
+    elif variant == 'pgo-use':
+        # Functions not run by the training workloads have no profile, which is expected.
+        compile_args += ['-fprofile-use=' + PGO_DIRECTORY, '-fprofile-correction', '-Wno-missing-profile']
+        link_args.append('-fprofile-use=' + PGO_DIRECTORY)
+    return compile_args, link_args, macros
+
+
+compile_args, link_args, macros = build_flags(BUILD_VARIANT)
+
 
 class get_numpy_include(object):
     """Defer numpy.get_include() until after numpy is installed."""
@@ -15,8 +52,30 @@ class get_numpy_include(object):
 
 c_idgraph_extension = Extension(
     "c_idgraph",
-    sources=["lib/idgraphmodule.c", "lib/cJSON.c"],
+    sources=[
+        "lib/idgraphmodule.c",
+        "lib/arena_c.c",
+        "lib/idmap_c.c",
+        "lib/buffer_hash_c.c",
+        "lib/stats_c.c",
+        "lib/xxhash.c",
+        "lib/xxh_x86dispatch.c",
+    ],
     include_dirs=[get_numpy_include()],
+    extra_compile_args=compile_args,
+    extra_link_args=link_args,
+    define_macros=macros,
+)
+
+dirty_tracker_extension = Extension(
+    "c_dirty_tracker",
+    sources=[
+        "lib/dirtytrackermodule.c",
+        "lib/idmap_c.c",
+    ],
+    extra_compile_args=compile_args,
+    extra_link_args=link_args,
+    define_macros=macros,
 )
 
 visitor_module_extension = Extension(
@@ -24,14 +83,26 @@ visitor_module_extension = Extension(
     sources=[
         'lib/visitor_c.c',
         'lib/hash_visitor_c.c',
-        'lib/xxhash.c'
+        'lib/size_visitor_c.c',
+        'lib/xxhash.c',
+        'lib/arena_c.c',
+        'lib/buffer_hash_c.c',
+        'lib/chunker_c.c',
+        'lib/hash_cache_c.c',
+        'lib/idmap_c.c',
+        'lib/type_dispatch_c.c',
+        'lib/sampled_hash_c.c',
+        'lib/stats_c.c',
+        'lib/xxh_x86dispatch.c'
     ],
     include_dirs=['/lib/'],
-    extra_compile_args=['-g', '-O0']
+    extra_compile_args=compile_args,
+    extra_link_args=link_args,
+    define_macros=macros,
 )
 
 
 setup_args = dict(
-    ext_modules=[c_idgraph_extension, visitor_module_extension],
+    ext_modules=[c_idgraph_extension, dirty_tracker_extension, visitor_module_extension],
 )
 setup(**setup_args)
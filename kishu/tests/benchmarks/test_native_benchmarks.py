@@ -0,0 +1,139 @@
+"""
+Throughput benchmarks of the native extensions on scaling workloads. Run with --run-benchmark (see benchmark.sh);
+besides pytest-benchmark's timings, each benchmark records objects/sec, bytes/sec and the peak RSS in extra_info.
+"""
+import c_idgraph
+import gc
+import numpy as np
+import pandas as pd
+import pytest
+import resource
+import sys
+import VisitorModule
+
+from typing import Any, Callable, Dict, Tuple
+
+
+class Node:
+    def __init__(self, value: int):
+        self.value = value
+        self.neighbors: list = []
+
+
+def nested_list(n: int) -> Any:
+    return [[i, str(i), [float(i)]] for i in range(n)]
+
+
+def wide_dict(n: int) -> Any:
+    return {f"key{i}": i for i in range(n)}
+
+
+def ndarray(n: int) -> Any:
+    return np.arange(n * 128, dtype=np.float64)
+
+
+def object_dataframe(n: int) -> Any:
+    return pd.DataFrame({"name": [f"row{i}" for i in range(n)], "pair": [(i, str(i)) for i in range(n)]},
+                        dtype=object)
+
+
+def cyclic_graph(n: int) -> Any:
+    """
+        A ring of nodes, each also linked to the node halfway around the ring.
+    """
+    nodes = [Node(i) for i in range(n)]
+    for i, node in enumerate(nodes):
+        node.neighbors.extend([nodes[(i + 1) % n], nodes[(i + n // 2) % n]])
+    return nodes
+
+
+WORKLOADS: Dict[str, Callable[[int], Any]] = {
+    "nested_list": nested_list,
+    "wide_dict": wide_dict,
+    "ndarray": ndarray,
+    "object_dataframe": object_dataframe,
+    "cyclic_graph": cyclic_graph,
+}
+SCALES = [1_000, 100_000]
+
+
+def measure(obj: Any) -> Tuple[int, int]:
+    """
+        Number and total size in bytes of the distinct objects reachable from obj, as seen by the garbage
+        collector. Types are not counted.
+    """
+    seen = {id(obj)}
+    stack = [obj]
+    num_bytes = 0
+    while stack:
+        current = stack.pop()
+        num_bytes += sys.getsizeof(current)
+        for referent in gc.get_referents(current):
+            if id(referent) not in seen and not isinstance(referent, type):
+                seen.add(id(referent))
+                stack.append(referent)
+    return len(seen), num_bytes
+
+
+@pytest.fixture(params=[(name, scale) for name in WORKLOADS for scale in SCALES],
+                ids=lambda param: f"{param[0]}-{param[1]}")
+def workload(request) -> Tuple[Any, int, int]:
+    """
+        A workload object, with its number of objects and its size in bytes.
+    """
+    name, scale = request.param
+    obj = WORKLOADS[name](scale)
+    return (obj, ) + measure(obj)
+
+
+def record_throughput(benchmark, num_objects: int, num_bytes: int) -> None:
+    benchmark.extra_info["objects"] = num_objects
+    benchmark.extra_info["bytes"] = num_bytes
+    benchmark.extra_info.update(VisitorModule.build_info())
+    # ru_maxrss is in KiB on Linux. It is the peak of the whole process, so earlier benchmarks may dominate it.
+    benchmark.extra_info["peak_rss_mib"] = resource.getrusage(resource.RUSAGE_SELF).ru_maxrss / 1024
+    if benchmark.stats is not None:
+        mean = benchmark.stats.stats.mean
+        benchmark.extra_info["objects_per_s"] = num_objects / mean
+        benchmark.extra_info["bytes_per_s"] = num_bytes / mean
+
+
+@pytest.mark.benchmark(group="get_object_hash_wrapper")
+def test_benchmark_object_hash(benchmark, workload):
+    obj, num_objects, num_bytes = workload
+    # Disable the digests cached across calls, which would hide the cost of the traversal.
+    benchmark.pedantic(VisitorModule.get_object_hash_wrapper, args=(obj, ), setup=VisitorModule.clear_hash_cache,
+                       rounds=5)
+    record_throughput(benchmark, num_objects, num_bytes)
+
+
+@pytest.mark.benchmark(group="get_idgraph")
+def test_benchmark_get_idgraph(benchmark, workload):
+    obj, num_objects, num_bytes = workload
+    benchmark(c_idgraph.get_idgraph, obj)
+    record_throughput(benchmark, num_objects, num_bytes)
+
+
+@pytest.mark.benchmark(group="compare_graph")
+def test_benchmark_compare_graph(benchmark, workload):
+    obj, num_objects, num_bytes = workload
+    graph1 = c_idgraph.get_idgraph(obj)
+    graph2 = c_idgraph.get_idgraph(obj)
+    assert benchmark(c_idgraph.compare_graph, graph1, graph2)
+    record_throughput(benchmark, num_objects, num_bytes)
+
+
+@pytest.mark.benchmark(group="compare_graph_object")
+def test_benchmark_compare_graph_object(benchmark, workload):
+    obj, num_objects, num_bytes = workload
+    graph = c_idgraph.get_idgraph(obj)
+    assert benchmark(c_idgraph.compare_graph_object, graph, obj)
+    record_throughput(benchmark, num_objects, num_bytes)
+
+
+@pytest.mark.benchmark(group="idgraph_json")
+def test_benchmark_idgraph_json(benchmark, workload):
+    obj, num_objects, num_bytes = workload
+    graph = c_idgraph.get_idgraph(obj)
+    benchmark(c_idgraph.idgraph_json, graph)
+    record_throughput(benchmark, num_objects, num_bytes)
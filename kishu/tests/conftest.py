@@ -131,6 +131,13 @@ def enable_incremental_store(tmp_kishu_path) -> Generator[type, None, None]:
     Config.set('PLANNER', 'incremental_cr', False)
 
 
+@pytest.fixture()
+def enable_lazy_load(tmp_kishu_path) -> Generator[type, None, None]:
+    Config.set('PLANNER', 'lazy_load', True)
+    yield Config
+    Config.set('PLANNER', 'lazy_load', False)
+
+
 @pytest.fixture()
 def matplotlib_plot() -> Generator[Tuple[Any, List[matplotlib.lines.Line2D]], None, None]:
     # Setup code
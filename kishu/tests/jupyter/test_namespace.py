@@ -2,7 +2,7 @@ import pytest
 
 from IPython.core.interactiveshell import InteractiveShell
 
-from kishu.jupyter.namespace import Namespace
+from kishu.jupyter.namespace import LazyVariable, Namespace
 
 
 @pytest.fixture()
@@ -95,3 +95,45 @@ def test_special_inputs_not_magic(namespace, patched_shell):
     patched_shell.run_cell("who_ls = 3")
     patched_shell.run_cell("a = b%who_ls")
     assert namespace.accessed_vars() == {"b", "who_ls"}
+
+
+def test_lazy_variable(namespace, patched_shell):
+    loads = []
+
+    def load_snapshot():
+        loads.append(1)
+        return {"x": [1, 2]}
+
+    namespace.get_tracked_namespace().setitem_proxy("x", LazyVariable("x", load_snapshot))
+    assert loads == []
+
+    # The variable is loaded on first access, once.
+    patched_shell.run_cell("y = len(x)")
+    assert namespace["y"] == 2
+    assert namespace["x"] == [1, 2]
+    assert loads == [1]
+    assert namespace.accessed_vars() == {"x"}
+
+
+def test_lazy_variable_accessors():
+    loads = []
+
+    def load_snapshot():
+        loads.append(1)
+        return {"x": [1, 2]}
+
+    namespace = Namespace({"y": 1})
+    tracked = namespace.get_tracked_namespace()
+    tracked.setitem_proxy("x", LazyVariable("x", load_snapshot))
+    assert namespace.keyset() == {"x", "y"}
+    assert namespace.is_lazy("x")
+    assert loads == []
+
+    # Placeholders are not handed out.
+    assert tracked.get("x") == [1, 2]
+    assert tracked.get("w", 3) == 3
+    assert not namespace.is_lazy("x")
+    tracked.setitem_proxy("x", LazyVariable("x", load_snapshot))
+    assert sorted(tracked.values(), key=str) == [1, [1, 2]]
+    tracked.setitem_proxy("x", LazyVariable("x", load_snapshot))
+    assert dict(tracked.items()) == {"x": [1, 2], "y": 1}
@@ -44,6 +44,15 @@ def test_update_graph():
     assert len(cell_executions[1].dst_vss) == 3
 
 
+def test_update_graph_deleted_variable_names():
+    ahg = AHG()
+    ahg.update_graph("", 1, 1, {}, {"df", "xs"}, [], {}, {})
+    ahg.update_graph("", 2, 1, {}, {"xs"}, [], {}, {"df"})
+
+    # The snapshot of a deleted variable is named after the variable.
+    assert {vs.name for vs in ahg.get_cell_executions()[1].dst_vss} == {frozenset({"df"})}
+
+
 def test_update_graph_with_connected_components():
     """
         Connected components:
@@ -169,3 +178,30 @@ def test_create_vs_modify_connected_component():
 
     # 2 connected components
     assert set(vs.name for vs in active_variable_snapshots) == {frozenset({"c", "b"}), frozenset("a")}
+
+
+def test_add_modified_variables():
+    """
+        Variables found modified after the last cell execution was added are recorded as modified by it.
+    """
+    ahg = AHG()
+    ahg.update_graph("x = 1", 1, 1, set(), {"x", "y"}, [], set(), set())
+    ahg.update_graph("print(x)", 2, 1, {"x"}, {"x", "y"}, [], set(), set())
+    x_vs = ahg.get_active_variable_snapshots_dict()[frozenset("x")]
+
+    ahg.add_modified_variables(3, {"x"})
+
+    new_x_vs = ahg.get_active_variable_snapshots_dict()[frozenset("x")]
+    assert new_x_vs.version == 3
+    assert ahg.get_active_variable_snapshots_dict()[frozenset("y")].version == 1
+
+    # The last cell execution accesses the old VS once and outputs the new one.
+    ce = ahg.get_cell_executions()[-1]
+    assert new_x_vs.output_ce is ce
+    assert [vs for vs in ce.src_vss if vs is x_vs] == [x_vs]
+    assert ce.dst_vss == [new_x_vs]
+    assert len(ahg.get_variable_snapshots()) == 3
+
+    # VSes already output by the last cell execution are up to date.
+    ahg.add_modified_variables(4, {"x"})
+    assert ahg.get_active_variable_snapshots_dict()[frozenset("x")] is new_x_vs
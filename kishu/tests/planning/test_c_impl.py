@@ -1,11 +1,17 @@
+import dataclasses
 import matplotlib.pyplot as plt
 import numpy as np
 import pandas as pd
 import pickle
+import random
 import seaborn as sns
+import sys
+import threading
 import pytest
+import VisitorModule
 
-from lib.object_state_c import ObjectState
+from lib.object_state_c import ObjectState, PickleMode, find_linked_pairs, get_object_hash_and_size, hash_namespace, \
+    register_type_handler
 
 
 def benchmark_hash_creation(obj):
@@ -110,6 +116,415 @@ def test_idgraph_nested_overlap():
     objs2 = ObjectState(nested_list, True)
 
     assert objs1.is_overlap(objs2)
+
+
+def test_hash_many_containers():
+    """
+        Test hashing past the initial capacity of the visited table, with shared and cyclic references.
+    """
+    shared = [0]
+    a = {i: [i, shared] for i in range(10000)}
+    a["self"] = a
+
+    objs1 = ObjectState(a)
+    objs2 = ObjectState(a)
+    assert objs1.compare_ObjectStates(objs2)
+
+    a[5000][0] = -1
+    objs2.update_object_hash(a)
+    assert not objs1.compare_ObjectStates(objs2)
+
+
+def test_hash_deeply_nested():
+    """
+        Test hashing objects nested deeper than the C stack allows to recurse, including a deep immutable subtree.
+    """
+    a = []
+    inner = a
+    for _ in range(200000):
+        inner.append([])
+        inner = inner[0]
+    subtree = ()
+    for i in range(200000):
+        subtree = (subtree, i)
+    a.append(tuple([subtree] * 100))
+
+    # pickle itself recurses, so only the hashed states are compared
+    objs1 = ObjectState(a, pickle_mode=PickleMode.NONE)
+    objs2 = ObjectState(a, pickle_mode=PickleMode.NONE)
+    assert objs1.compare_ObjectStates(objs2)
+
+    inner.append(0)
+    objs2.update_object_hash(a)
+    assert not objs1.compare_ObjectStates(objs2)
+
+
+def test_hash_chunked_bytes():
+    """
+        Test if chunked hashing of large buffers is independent of the number of threads
+    """
+    a = bytearray(range(256)) * 40000
+    chunk_size = 1 << 16
+
+    digest1 = VisitorModule.get_object_hash_wrapper(a, chunk_size=chunk_size, num_threads=1)
+    digest2 = VisitorModule.get_object_hash_wrapper(a, chunk_size=chunk_size, num_threads=4)
+    assert digest1 == digest2
+
+    # Assert that the hash changes when a single chunk changes
+    a[-1] = 0
+    assert digest1 != VisitorModule.get_object_hash_wrapper(a, chunk_size=chunk_size, num_threads=4)
+
+
+def test_hash_cached_subtrees():
+    """
+        Test if hashes of large immutable subtrees are reused across calls and changes are still detected
+    """
+    text = "DAIS" * 10000
+    record = tuple(range(1000))
+    mixed = tuple([[0]] * 100)
+    a = {"text": text, "record": record, "mixed": mixed}
+
+    objs1 = ObjectState(a)
+    objs2 = ObjectState(a)
+    assert objs1.compare_ObjectStates(objs2)
+
+    # Assert that the cache does not change the hash
+    VisitorModule.clear_hash_cache()
+    objs2.update_object_hash(a)
+    assert objs1.compare_ObjectStates(objs2)
+    assert objs1.get_object_hash() == ObjectState(a, True).get_object_hash()
+
+    # Assert that the hash changes when a list in a large tuple changes
+    mixed[0].append(1)
+    objs2.update_object_hash(a)
+    assert not objs1.compare_ObjectStates(objs2)
+
+
+def test_hash_nested_cached_subtrees():
+    """
+        Test if large tuples nested in a large immutable subtree are hashed once and cached with the same digests
+    """
+    tail = tuple(range(63))
+    nested = ()
+    for _ in range(8000):
+        nested = (nested,) + tail
+    mixed = (([0],) + tail,) + tail
+
+    VisitorModule.clear_hash_cache()
+    digests = [VisitorModule.get_object_hash_wrapper((obj,)) for obj in [nested, nested[0], mixed, mixed[0]]]
+    VisitorModule.clear_hash_cache()
+    assert digests[1] == VisitorModule.get_object_hash_wrapper((nested[0],))
+    assert digests[3] == VisitorModule.get_object_hash_wrapper((mixed[0],))
+    assert digests == [VisitorModule.get_object_hash_wrapper((obj,)) for obj in [nested, nested[0], mixed, mixed[0]]]
+
+    # Assert that the hash changes when the list below the remembered mutable tuples changes
+    mixed[0][0].append(1)
+    assert digests[2] != VisitorModule.get_object_hash_wrapper((mixed,))
+
+
+def test_hash_cached_subtrees_chunked():
+    """
+        Test if cached hashes of large immutable subtrees depend on the chunk size only, not on earlier calls
+    """
+    chunk_size = 1 << 16
+
+    def plain(obj):
+        return VisitorModule.get_object_hash_wrapper(obj)
+
+    def chunked(obj):
+        return VisitorModule.get_object_hash_wrapper(obj, chunk_size=chunk_size, num_threads=4)
+
+    expected = {}
+    for mode in [plain, chunked]:
+        VisitorModule.clear_hash_cache()
+        expected[mode] = mode(bytes(range(256)) * 100000)
+    assert expected[plain] != expected[chunked]
+
+    for order in [[plain, chunked], [chunked, plain]]:
+        VisitorModule.clear_hash_cache()
+        big = bytes(range(256)) * 100000
+        for mode in order + order:
+            assert mode(big) == expected[mode]
+
+
+def test_hash_namespace():
+    """
+        Test if hashing a namespace in one call matches hashing each variable and finds shared objects
+    """
+    shared = [1, 2]
+    namespace = {"a": [shared, {"k": 3}], "b": {"s": shared}, "c": 5, "d": [3, 4]}
+
+    digests, id_sets, overlaps = hash_namespace(namespace)
+
+    for name, obj in namespace.items():
+        assert digests[name] == ObjectState(obj).get_object_hash()
+    assert id(shared) in id_sets["a"]
+    assert id(shared) in id_sets["b"]
+    assert overlaps == [("a", "b")]
+
+
+def test_find_linked_pairs():
+    """
+        Test if linked variables are found from their id sets, connecting variables sharing objects
+        through other variables
+    """
+    shared_1, shared_2 = [1], [2]
+    objs = {"a": [shared_1], "b": [shared_1, shared_2], "c": [shared_2], "d": [3]}
+    id_sets = {name: ObjectState(obj, include_traversal=True).id_set() for name, obj in objs.items()}
+
+    assert find_linked_pairs(id_sets) == [("a", "b"), ("b", "c")]
+    assert find_linked_pairs({"a": [1, 2], "b": [2, 1], "c": [2]}) == [("a", "b"), ("a", "c")]
+    assert find_linked_pairs({}) == []
+
+
+def test_native_stats():
+    """
+        Test if the hot paths are counted and timed, and if the counters are zeroed on reset
+    """
+    VisitorModule.clear_hash_cache()
+    VisitorModule.reset_stats()
+    shared = [1]
+    VisitorModule.get_object_hash_wrapper([shared, shared, "abc", b"12345"])
+    find_linked_pairs({"a": [1, 2], "b": [2]})
+
+    stats = VisitorModule.get_stats()
+    assert stats["objects_visited"] == 5  # shared is visited once
+    assert stats["bytes_hashed"] == 8
+    assert stats["visited_probes"] >= stats["objects_visited"]
+    assert stats["allocations"] > 0
+    assert stats["traverse_calls"] == 1 and stats["traverse_ns"] > 0
+    assert stats["linked_vars_calls"] == 1
+    assert stats["compare_calls"] == 0
+
+    VisitorModule.reset_stats()
+    assert set(VisitorModule.get_stats().values()) == {0}
+
+
+def test_sampled_hash():
+    """
+        Test if large buffers are hashed from their sample pages, and skipped once the budget runs out
+    """
+    options = {"threshold": 64 * 1024, "page_size": 4096, "sample_pages": 4}
+    data = bytearray(1024 * 1024)
+    digest, complete = VisitorModule.get_object_sampled_hash(data, **options)
+    VisitorModule.end_sampled_pass()
+    assert complete
+    assert VisitorModule.get_object_sampled_hash(data, **options) == (digest, True)
+
+    # The last byte is on the last sample page
+    data[-1] = 1
+    assert VisitorModule.get_object_sampled_hash(data, **options)[0] != digest
+
+    # Small objects are hashed in full, and are hashed even if the budget ran out
+    small = [1, "abc", bytearray(b"12345")]
+    assert VisitorModule.get_object_sampled_hash(small, budget_ns=0, **options) == \
+        (VisitorModule.get_object_hash_wrapper(small), True)
+    assert not VisitorModule.get_object_sampled_hash([small, data], budget_ns=0, **options)[1]
+    assert VisitorModule.get_object_sampled_hash([small, data], budget_ns=10 ** 12, **options)[1]
+
+    with pytest.raises(ValueError):
+        VisitorModule.get_object_sampled_hash(data, page_size=0)
+
+
+@pytest.mark.parametrize("pickle_mode", [PickleMode.FULL, PickleMode.HASH, PickleMode.NONE])
+def test_pickle_modes(pickle_mode):
+    """
+        Test if changes are detected whether the pickled binaries are stored, hashed or skipped
+    """
+    a = {"x": [1, 2], "y": "text"}
+
+    objs1 = ObjectState(a, pickle_mode=pickle_mode)
+    objs2 = ObjectState(a, pickle_mode=pickle_mode)
+    assert objs1.compare_ObjectStates(objs2)
+    assert (objs1.pick is None) == (pickle_mode == PickleMode.NONE)
+
+    a["x"].append(3)
+    objs2.update_object_hash(a)
+    assert not objs1.compare_ObjectStates(objs2)
+
+
+def test_picklable_type_cached():
+    """
+        Test if unpicklable custom objects are still skipped once their type's picklability is cached
+    """
+    class Unpicklable:
+        def __init__(self, value):
+            self.value = value
+
+        def __reduce_ex__(self, protocol):
+            raise TypeError("cannot pickle")
+
+    VisitorModule.clear_hash_cache()
+    a = Unpicklable(1)
+    b = Unpicklable(2)
+
+    assert ObjectState(a, pickle_mode=PickleMode.NONE).compare_ObjectStates(ObjectState(b, pickle_mode=PickleMode.NONE))
+
+
+class Holder:
+    def __init__(self, value):
+        self.value = value
+
+
+def test_unpicklable_instance_not_cached():
+    """
+        Test if instances of a type are still hashed from their state after an unpicklable instance of the type
+    """
+    VisitorModule.clear_hash_cache()
+    ObjectState(Holder(threading.Lock()), pickle_mode=PickleMode.NONE)
+
+    a = Holder([1])
+    objs1 = ObjectState(a, pickle_mode=PickleMode.NONE)
+    a.value.append(2)
+    objs2 = ObjectState(a, pickle_mode=PickleMode.NONE)
+    assert not objs1.compare_ObjectStates(objs2)
+
+
+class FlakyReduce:
+    def __init__(self, fail):
+        self.fail = fail
+
+    def __reduce_ex__(self, protocol):
+        if self.fail:
+            raise TypeError("cannot pickle")
+        return super().__reduce_ex__(protocol)
+
+
+def test_unpicklable_instance_of_picklable_type():
+    """
+        Test if an instance failing to reduce is hashed by its id once its type is cached as picklable
+    """
+    VisitorModule.clear_hash_cache()
+    VisitorModule.get_object_hash_wrapper(FlakyReduce(False))
+
+    a = FlakyReduce(True)
+    assert VisitorModule.get_object_hash_wrapper(a) == VisitorModule.get_object_hash_wrapper(a)
+
+
+def test_hash_dataclass():
+    """
+        Test if dataclass instances are hashed from their fields, and if a type is resolved again once it is modified
+    """
+    @dataclasses.dataclass
+    class Point:
+        x: int
+        tags: list
+
+    a = Point(1, ["a"])
+    objs1 = ObjectState(a, pickle_mode=PickleMode.NONE)
+    a.tags.append("b")
+    objs2 = ObjectState(a, pickle_mode=PickleMode.NONE)
+    assert not objs1.compare_ObjectStates(objs2)
+
+    # Callable objects are only hashed by their id
+    Point.__call__ = lambda self: None
+    objs1.update_object_hash(a)
+    a.x = 2
+    objs2.update_object_hash(a)
+    assert objs1.compare_ObjectStates(objs2)
+
+
+def test_hash_dataclass_extra_attributes():
+    """
+        Test if attributes of dataclass instances set outside of their fields are hashed
+    """
+    @dataclasses.dataclass
+    class Point:
+        x: int
+
+        def __post_init__(self):
+            self.history = [self.x]
+
+    a = Point(1)
+    a.extra = [1]
+    objs1 = ObjectState(a, pickle_mode=PickleMode.NONE)
+    a.extra.append(2)
+    objs2 = ObjectState(a, pickle_mode=PickleMode.NONE)
+    assert not objs1.compare_ObjectStates(objs2)
+
+    a.history.append(2)
+    objs3 = ObjectState(a, pickle_mode=PickleMode.NONE)
+    assert not objs2.compare_ObjectStates(objs3)
+
+
+def test_register_type_handler():
+    """
+        Test if registered handlers replace __reduce_ex__ for a type and its subclasses, and if they can be unregistered
+    """
+    class Model:
+        def __init__(self):
+            self.weights = [1.0, 2.0]
+            self.cache = {}
+
+    class SubModel(Model):
+        pass
+
+    register_type_handler(Model, lambda model: [model.weights])
+    try:
+        for a in [Model(), SubModel()]:
+            objs1 = ObjectState(a, pickle_mode=PickleMode.NONE)
+            a.cache["key"] = 1
+            objs2 = ObjectState(a, pickle_mode=PickleMode.NONE)
+            assert objs1.compare_ObjectStates(objs2)
+
+            a.weights[0] = 3.0
+            objs2.update_object_hash(a)
+            assert not objs1.compare_ObjectStates(objs2)
+    finally:
+        register_type_handler(Model, None)
+
+    # Without the handler, the unpicklable local class is only hashed by its id
+    a = Model()
+    objs1 = ObjectState(a, pickle_mode=PickleMode.NONE)
+    a.weights[0] = 3.0
+    objs2 = ObjectState(a, pickle_mode=PickleMode.NONE)
+    assert objs1.compare_ObjectStates(objs2)
+
+
+def test_hash_and_size():
+    """
+        Test if the deep size is computed in the hashing pass, counting shared objects once
+    """
+    payload = b"x" * 100000
+    shared = [payload]
+    a = {"k": shared, "l": [shared, (payload, "text")]}
+
+    digest, size = get_object_hash_and_size(a)
+
+    assert digest == ObjectState(a).get_object_hash()
+    assert size >= sys.getsizeof(payload) + sys.getsizeof(a)
+    assert size < 2 * sys.getsizeof(payload)
+
+    # Cached immutable subtrees are measured without being traversed
+    b = (tuple(range(1000)),)
+    assert get_object_hash_and_size(b)[1] == get_object_hash_and_size(b)[1]
+    assert get_object_hash_and_size(b)[1] > sys.getsizeof(b[0])
+
+    # Deep cached subtrees are measured without recursing
+    deep = ()
+    for i in range(200000):
+        deep = (deep, i)
+    c = (tuple([deep] * 100),)
+    assert get_object_hash_and_size(c)[1] == get_object_hash_and_size(c)[1]
+    assert get_object_hash_and_size(c)[1] > 200000 * sys.getsizeof(deep)
+
+
+def test_content_defined_chunks():
+    """
+        Test if chunk boundaries depend on the content only, so an insertion keeps the chunks away from it
+    """
+    data = random.Random(0).randbytes(8 * 1024 * 1024)
+    chunks = VisitorModule.content_defined_chunks(data)
+    assert chunks[-1][0] == len(data)
+    assert all(end > start for (start, _), (end, _) in zip([(0, None)] + chunks, chunks))
+
+    edited = VisitorModule.content_defined_chunks(b"12345" + data)
+    assert len(set(d for _, d in chunks) & set(d for _, d in edited)) >= len(chunks) - 2
+
+    # A non-final call leaves the tail after the last boundary to the next call
+    partial = VisitorModule.content_defined_chunks(data[:len(data) // 2], False)
+    assert partial == chunks[:len(partial)]
+
 # --------------------------------------- Numpy tests -----------------------
 
 
@@ -138,6 +553,28 @@ def test_hash_numpy():
     assert objs1.compare_ObjectStates(objs2)
 
 
+def test_hash_numpy_strided():
+    """
+        Test if hash is accurately generated for non-contiguous numpy arrays
+    """
+    a = np.arange(24).reshape(4, 6)
+    view = a[:, ::2]
+
+    objs1 = ObjectState(view)
+    objs2 = ObjectState(view)
+    assert objs1.compare_ObjectStates(objs2)
+
+    # Assert that the hash does not change when memory outside of the view changes
+    a[0, 1] = 100
+    objs2.update_object_hash(view)
+    assert objs1.compare_ObjectStates(objs2)
+
+    # Assert that the hash changes when an element of the view changes
+    a[0, 2] = 100
+    objs2.update_object_hash(view)
+    assert not objs1.compare_ObjectStates(objs2)
+
+
 @pytest.mark.benchmark(group="hash creation")
 def test_hash_creation_numpy(benchmark):
     a = np.arange(6)
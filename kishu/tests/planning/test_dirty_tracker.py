@@ -0,0 +1,96 @@
+import pytest
+import sys
+
+from kishu.planning.dirty_tracker import DirtyTracker
+
+
+requires_watchers = pytest.mark.skipif(sys.version_info < (3, 12), reason="dict watchers require Python 3.12")
+
+
+def test_disabled_tracker_reports_all_variables():
+    """
+        Without watchers, every variable is possibly modified.
+    """
+    user_ns = {"x": {"a": 1}}
+    tracker = DirtyTracker(user_ns, enabled=False)
+    assert not tracker.is_enabled()
+    assert not tracker.track("x", user_ns["x"])
+    assert tracker.possibly_modified({"x", "y"}) == {"x", "y"}
+
+
+@requires_watchers
+def test_nested_dict_modification():
+    inner = {"b": 1}
+    user_ns = {"x": {"a": inner, "c": (1, frozenset({"s"}))}, "y": {"b": 2}}
+    tracker = DirtyTracker(user_ns)
+    assert tracker.track("x", user_ns["x"])
+    assert tracker.track("y", user_ns["y"])
+    assert tracker.possibly_modified({"x", "y"}) == set()
+
+    # Writes to a dict reachable from a variable or to its namespace entry make it dirty.
+    inner["b"] = 3
+    assert tracker.possibly_modified({"x", "y"}) == {"x"}
+    user_ns["y"] = {}
+    assert tracker.possibly_modified({"x", "y"}) == {"y"}
+
+    # The dirty set is reset once taken.
+    assert tracker.possibly_modified({"x", "y"}) == set()
+
+    # Clearing the namespace makes every variable dirty.
+    user_ns.clear()
+    assert tracker.possibly_modified({"x", "y"}) == {"x", "y"}
+
+
+@requires_watchers
+def test_untracked_variables():
+    class Foo:
+        pass
+
+    user_ns = {"x": [1], "y": {"a": Foo()}, "z": {"a": 1}}
+    tracker = DirtyTracker(user_ns)
+
+    # Lists and class instances can be modified without dict writes, so variables holding them are not tracked.
+    assert not tracker.track("x", user_ns["x"])
+    assert not tracker.track("y", user_ns["y"])
+    assert tracker.track("z", user_ns["z"])
+    assert tracker.possibly_modified({"x", "y", "z"}) == {"x", "y"}
+
+    tracker.untrack("z")
+    assert tracker.possibly_modified({"z"}) == {"z"}
+
+
+@requires_watchers
+def test_type_modification():
+    class Foo:
+        pass
+
+    user_ns = {"cls": Foo}
+    tracker = DirtyTracker(user_ns)
+    assert tracker.track("cls", Foo)
+    assert tracker.possibly_modified({"cls"}) == set()
+
+    Foo.__qualname__ = "Bar"
+    assert tracker.possibly_modified({"cls"}) == {"cls"}
+
+
+@requires_watchers
+def test_functions_are_not_tracked():
+    def make_acc():
+        items = []
+
+        def acc(x):
+            items.append(x)
+        return acc
+
+    def plain(x, y=[]):
+        return x
+
+    user_ns = {"acc": make_acc(), "plain": plain, "z": {"f": plain}}
+    tracker = DirtyTracker(user_ns)
+
+    # Closure cells, defaults and attributes of functions change without dict writes.
+    assert not tracker.track("acc", user_ns["acc"])
+    assert not tracker.track("plain", user_ns["plain"])
+    assert not tracker.track("z", user_ns["z"])
+    user_ns["acc"](5)
+    assert tracker.possibly_modified({"acc", "plain", "z"}) == {"acc", "plain", "z"}
@@ -0,0 +1,47 @@
+import time
+
+from kishu.planning.metrics import CHECKPOINT_WRITE, HASH, PHASES, PRE_RUN, PlannerMetrics
+
+
+def test_nested_phases_are_exclusive():
+    """
+        The time of a nested phase only counts for the inner phase, so the phases add up to the total.
+    """
+    metrics = PlannerMetrics()
+    metrics.begin_cell()
+    start = time.monotonic_ns()
+    with metrics.phase(PRE_RUN):
+        with metrics.phase(HASH):
+            time.sleep(0.02)
+    elapsed = time.monotonic_ns() - start
+    cell = metrics.end_cell(3)
+
+    assert cell is not None
+    assert cell.execution_count == 3
+    assert set(cell.phase_ns) == set(PHASES)
+    assert cell.phase_ns[HASH] >= 20_000_000
+    assert cell.phase_ns[PRE_RUN] < cell.phase_ns[HASH]
+    assert cell.total_ns() <= elapsed
+    assert metrics.cells() == [cell]
+
+
+def test_phase_outside_of_cell():
+    """
+        Phases outside of cells, e.g., of manual commits, start a cell without execution count.
+    """
+    metrics = PlannerMetrics()
+    assert metrics.end_cell() is None
+    with metrics.phase(CHECKPOINT_WRITE):
+        pass
+    cell = metrics.end_cell()
+    assert cell is not None
+    assert cell.execution_count is None
+    assert cell.phase_ns[CHECKPOINT_WRITE] > 0
+
+
+def test_history_is_bounded():
+    metrics = PlannerMetrics(history=2)
+    for execution_count in range(3):
+        metrics.begin_cell()
+        metrics.end_cell(execution_count)
+    assert [cell.execution_count for cell in metrics.cells()] == [1, 2]
@@ -0,0 +1,74 @@
+import random
+
+from itertools import chain, combinations
+
+from kishu.planning.mincut import FlowNetwork, MinCutCache
+
+
+def brute_force_source_side(source_capacities, sink_capacities, edges):
+    """
+        Minimal source side of the minimum cut, by enumerating all cuts: the intersection of the minimum ones.
+    """
+    nodes = list(source_capacities) + sorted({target for targets in edges.values() for target in targets})
+    best_value, best_sides = float('inf'), []
+    for side in chain.from_iterable(combinations(nodes, size) for size in range(len(nodes) + 1)):
+        side = set(side)
+        value = sum(capacity for node, capacity in source_capacities.items() if node not in side)
+        value += sum(sink_capacities.get(node, 0) for node in side if node not in source_capacities)
+        if any(target not in side for node in side if node in edges for target in edges[node]):
+            value = float('inf')
+        if value < best_value:
+            best_value, best_sides = value, [side]
+        elif value == best_value:
+            best_sides.append(side)
+    return set.intersection(*best_sides)
+
+
+def test_flow_network_min_cut():
+    """
+        source -3-> 2 -1-> sink, source -2-> 3 -5-> sink, 2 -1-> 3: the source side is {source, 2}, cutting
+        edges of capacity 1 + 1 + 2.
+    """
+    network = FlowNetwork(4, [(0, 2, 3), (2, 1, 1), (0, 3, 2), (3, 1, 5), (2, 3, 1)])
+    assert network.min_cut(0, 1) == [True, False, True, False]
+
+
+def test_min_cut_matches_brute_force():
+    rng = random.Random(0)
+    for _ in range(200):
+        source_capacities = {f"v{i}": rng.randint(0, 5) for i in range(rng.randint(1, 4))}
+        sink_capacities = {i: rng.randint(0, 5) for i in range(rng.randint(1, 5))}
+        edges = {node: set(rng.sample(range(len(sink_capacities) + 1), rng.randint(1, 2)))
+                 for node in source_capacities}
+        assert MinCutCache().solve(source_capacities, sink_capacities, edges) == \
+            brute_force_source_side(source_capacities, sink_capacities, edges)
+
+
+def test_min_cut_cache_reuses_unchanged_components():
+    cache = MinCutCache()
+    source_capacities = {"x": 1, "y": 5}
+    sink_capacities = {0: 2, 1: 2}
+    edges = {"x": {0}, "y": {1}}
+    assert cache.solve(source_capacities, sink_capacities, edges) == {"y", 1}
+
+    solved = []
+    solve_component = MinCutCache._solve_component
+
+    def counting_solve_component(left, *args):
+        solved.append(set(left))
+        return solve_component(left, *args)
+
+    cache._solve_component = counting_solve_component
+
+    # Only the component of the new variable is solved.
+    source_capacities["z"] = 1
+    sink_capacities[2] = 3
+    edges["z"] = {2}
+    assert cache.solve(source_capacities, sink_capacities, edges) == {"y", 1}
+    assert solved == [{"z"}]
+
+    # A changed capacity invalidates the component.
+    source_capacities["x"] = 3
+    solved.clear()
+    assert cache.solve(source_capacities, sink_capacities, edges) == {"x", 0, "y", 1}
+    assert solved == [{"x"}]
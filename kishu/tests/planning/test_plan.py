@@ -1,11 +1,15 @@
 import pytest
+import time
 
 from IPython.core.interactiveshell import InteractiveShell
+from unittest.mock import patch
 
 from kishu.exceptions import CommitIdNotExistError
-from kishu.jupyter.namespace import Namespace
+from kishu.jupyter.namespace import LazyVariable, Namespace
 from kishu.planning.ahg import VariableSnapshot, VersionedName, VersionedNameContext
-from kishu.planning.plan import CheckpointPlan, IncrementalCheckpointPlan, RestorePlan
+from kishu.planning.plan import PREFETCHED_ACTIONS, CheckpointPlan, IncrementalCheckpointPlan, \
+    LoadVariableRestoreAction, RerunCellRestoreAction, RestoreActionOrder, RestorePlan, StepOrder, \
+    VarNamesToObjects, restore_dependencies
 from kishu.storage.checkpoint import KishuCheckpoint
 from kishu.storage.path import KishuPath
 
@@ -114,6 +118,90 @@ def test_mix_reload_recompute_restore_plan():
     assert result_ns.to_dict() == user_ns.to_dict()
 
 
+def test_restore_dependencies():
+    load_a = LoadVariableRestoreAction(StepOrder(1, RestoreActionOrder.LOAD_VARIABLE), ["a"])
+    rerun_b = RerunCellRestoreAction(StepOrder(2, RestoreActionOrder.RERUN_CELL), "b = 2", set(), {"b"})
+    load_c = LoadVariableRestoreAction(StepOrder(3, RestoreActionOrder.LOAD_VARIABLE), ["c"])
+    rerun_a = RerunCellRestoreAction(StepOrder(4, RestoreActionOrder.RERUN_CELL), "a += c", {"a", "c"}, {"a"})
+    load_b = LoadVariableRestoreAction(StepOrder(5, RestoreActionOrder.LOAD_VARIABLE), ["b"])
+    rerun_unknown = RerunCellRestoreAction(StepOrder(6, RestoreActionOrder.RERUN_CELL), "print(a)")
+    load_d = LoadVariableRestoreAction(StepOrder(7, RestoreActionOrder.LOAD_VARIABLE), ["d"])
+
+    assert restore_dependencies([load_a, rerun_b, load_c, rerun_a, load_b, rerun_unknown, load_d]) == [
+        set(),
+        set(),
+        set(),
+        {0, 1, 2},  # Reads a and c, and reruns after rerun_b.
+        {1},        # Overwrites b.
+        {0, 1, 2, 3, 4},
+        {5},
+    ]
+
+
+def test_overlapped_restore_plan():
+    """
+        Variables are loaded in the background, but set in the order of the cells which access or modify them too.
+    """
+    user_ns = Namespace({'a': 1, 'b': 2, 'c': 3, 'd': 4})
+    filename = KishuPath.database_path("test")
+    KishuCheckpoint(filename).init_database()
+
+    # save
+    exec_id = 1
+    checkpoint = CheckpointPlan.create(user_ns, filename, exec_id, var_names=["b", "c"])
+    checkpoint.run(user_ns)
+
+    # restore
+    restore_plan = RestorePlan()
+    restore_plan.add_rerun_cell_restore_action(1, "a = 1\nc = 0", set(), {"a", "c"})
+    restore_plan.add_load_variable_restore_action(2, ["b"], [(2, "b = 2")])
+    restore_plan.add_load_variable_restore_action(3, ["c"], [(3, "c = 3")])
+    restore_plan.add_rerun_cell_restore_action(4, "d = b + 2", {"b"}, {"d"})
+    result_ns = restore_plan.run(filename, exec_id)
+
+    assert result_ns.to_dict() == user_ns.to_dict()
+
+
+def test_prefetched_restore_plan():
+    """
+        Load actions are fetched in order, at most PREFETCHED_ACTIONS ahead of those whose variables were set.
+    """
+    names = [f"v{i}" for i in range(2 * PREFETCHED_ACTIONS + 1)]
+    user_ns = Namespace({name: i for i, name in enumerate(names)})
+    filename = KishuPath.database_path("test")
+    KishuCheckpoint(filename).init_database()
+
+    # save
+    exec_id = 1
+    checkpoint = CheckpointPlan.create(user_ns, filename, exec_id)
+    checkpoint.run(user_ns)
+
+    # restore
+    restore_plan = RestorePlan()
+    for i, name in enumerate(names):
+        restore_plan.add_load_variable_restore_action(i + 1, [name], [(i + 1, f"{name} = {i}")])
+
+    fetch = LoadVariableRestoreAction.fetch
+    fetched = []
+    ahead = []
+
+    def recording_fetch(action, ctx):
+        fetched.extend(action.variable_names)
+        ahead.append(len(fetched) - len(set(names) & ctx.shell.user_ns.keys()))
+        if len(fetched) == 1:
+            # Leave time for fetching later actions meanwhile.
+            time.sleep(0.1)
+        return fetch(action, ctx)
+
+    with patch.object(LoadVariableRestoreAction, "fetch", recording_fetch):
+        result_ns = restore_plan.run(filename, exec_id)
+
+    assert result_ns.to_dict() == user_ns.to_dict()
+    assert restore_plan.fallbacked_actions == []
+    assert fetched == names
+    assert max(ahead) <= PREFETCHED_ACTIONS
+
+
 def test_fallback_recomputation():
     shell = InteractiveShell()
     shell.run_cell(UNDESERIALIZABLE_CLASS)
@@ -205,3 +293,69 @@ def test_mix_reload_recompute_incremental_restore_plan(enable_incremental_store)
     result_ns = restore_plan.run(filename, exec_id)
 
     assert result_ns.to_dict() == user_ns.to_dict()
+
+
+def test_lazy_incremental_restore_plan(enable_incremental_store):
+    shared = [1, 2]
+    user_ns = Namespace({'a': shared, 'b': [shared], 'c': 3})
+    filename = KishuPath.database_path("test")
+    KishuCheckpoint(filename).init_database()
+
+    # save
+    exec_id = 1
+    vses_to_store = [VariableSnapshot(frozenset({'a', 'b'}), 1), VariableSnapshot(frozenset('c'), 1)]
+    checkpoint = IncrementalCheckpointPlan.create(user_ns, filename, exec_id, vses_to_store)
+    checkpoint.run(user_ns)
+
+    # restore
+    restore_plan = RestorePlan()
+    restore_plan.add_incremental_load_restore_action(
+        1,
+        [(VersionedName(frozenset({'a', 'b'}), 1), VersionedNameContext(1, exec_id)),
+         (VersionedName(frozenset('c'), 1), VersionedNameContext(1, exec_id))],
+        [(1, "a=[1, 2]\nb=[a]\nc=3")]
+    )
+    result_ns = restore_plan.run(filename, exec_id, lazy_load=True)
+
+    # Variables are only loaded when accessed, together with the variables of their snapshot.
+    tracked_ns = result_ns.get_tracked_namespace()
+    assert all(isinstance(dict.__getitem__(tracked_ns, k), LazyVariable) for k in ['a', 'b', 'c'])
+    assert result_ns["b"] == [[1, 2]]
+    assert isinstance(dict.__getitem__(tracked_ns, "c"), LazyVariable)
+    assert result_ns["b"][0] is result_ns["a"]
+    assert result_ns.to_dict() == user_ns.to_dict()
+
+
+def test_lazy_restore_plan(enable_lazy_load):
+    shared = [1, 2]
+    user_ns = Namespace({'a': shared, 'b': [shared], 'c': 3})
+    filename = KishuPath.database_path("test")
+    KishuCheckpoint(filename).init_database()
+
+    # save
+    exec_id = 1
+    checkpoint = CheckpointPlan.create(user_ns, filename, exec_id)
+    checkpoint.run(user_ns)
+
+    # restore, lazily as set in the config
+    restore_plan = RestorePlan()
+    restore_plan.add_load_variable_restore_action(1, ['a', 'b'], [(1, "a=[1, 2]\nb=[a]")])
+    restore_plan.add_load_variable_restore_action(2, ['c'], [(2, "c=3")])
+    with patch("kishu.planning.plan.VarNamesToObjects.loads", wraps=VarNamesToObjects.loads) as loads:
+        result_ns = restore_plan.run(filename, exec_id)
+
+        # The checkpoint is only loaded when a variable is accessed, once for all load actions.
+        tracked_ns = result_ns.get_tracked_namespace()
+        assert all(isinstance(dict.__getitem__(tracked_ns, k), LazyVariable) for k in ['a', 'b', 'c'])
+        assert loads.call_count == 0
+        assert result_ns["b"] == [[1, 2]]
+        assert not any(isinstance(dict.__getitem__(tracked_ns, k), LazyVariable) for k in ['a', 'b', 'c'])
+        assert result_ns["b"][0] is result_ns["a"]
+        assert result_ns.to_dict() == user_ns.to_dict()
+        assert loads.call_count == 1
+
+    # Restoring eagerly is still possible.
+    result_ns = restore_plan.run(filename, exec_id, lazy_load=False)
+    assert not any(isinstance(dict.__getitem__(result_ns.get_tracked_namespace(), k), LazyVariable)
+                   for k in ['a', 'b', 'c'])
+    assert result_ns.to_dict() == user_ns.to_dict()
@@ -1,9 +1,13 @@
 import copy
+import functools
+import numpy
 import pytest
 
 from typing import Any, Dict, Generator, List, Optional, Set, Tuple
+from unittest.mock import patch
 
-from kishu.jupyter.namespace import Namespace
+from kishu.jupyter.namespace import LazyVariable, Namespace
+from kishu.planning.metrics import COMPARE, HASH, LINKED_VAR, PRE_RUN
 from kishu.planning.planner import CheckpointRestorePlanner, ChangedVariables
 from kishu.planning.plan import CheckpointPlan, RestoreActionOrder, RestorePlan, StepOrder
 from kishu.storage.checkpoint import KishuCheckpoint
@@ -30,6 +34,32 @@ def enable_always_migrate(tmp_kishu_path) -> Generator[type, None, None]:
     Config.set('OPTIMIZER', 'always_migrate', False)
 
 
+@pytest.fixture()
+def enable_dirty_tracking(tmp_kishu_path) -> Generator[type, None, None]:
+    Config.set('PLANNER', 'dirty_tracking', True)
+    yield Config
+    Config.set('PLANNER', 'dirty_tracking', False)
+
+
+@pytest.fixture()
+def enable_sampled_hashing_without_budget(tmp_kishu_path) -> Generator[type, None, None]:
+    Config.set('OPTIMIZER', 'sampled_hashing', True)
+    Config.set('OPTIMIZER', 'sampled_hash_budget_ms', 0)
+    Config.set('OPTIMIZER', 'sampled_hash_threshold', 4096)
+    yield Config
+    Config.set('OPTIMIZER', 'sampled_hashing', False)
+
+
+@pytest.fixture()
+def enable_sampled_hashing_with_small_pages(tmp_kishu_path) -> Generator[type, None, None]:
+    Config.set('OPTIMIZER', 'sampled_hashing', True)
+    Config.set('OPTIMIZER', 'sampled_hash_threshold', 4096)
+    Config.set('OPTIMIZER', 'sampled_hash_page_size', 4096)
+    Config.set('OPTIMIZER', 'sampled_hash_pages', 4)
+    yield Config
+    Config.set('OPTIMIZER', 'sampled_hashing', False)
+
+
 class PlannerManager:
     """
         Class for automating pre and post-run-cell function calls in Planner.
@@ -140,6 +170,132 @@ def test_post_run_cell_update_return(enable_always_migrate):
     )
 
 
+def test_post_run_cell_update_linked_variables(enable_always_migrate):
+    planner_manager = PlannerManager(CheckpointRestorePlanner(Namespace({})))
+
+    # a and c share a list only through b; d is not linked to any other variable.
+    shared_1, shared_2 = [1], [2]
+    planner_manager.run_cell(
+        {"a": [shared_1], "b": [shared_1, shared_2], "c": [shared_2], "d": [3]},
+        "a, b, c, d = ..."
+    )
+
+    active_names = {vs.name for vs in planner_manager.planner.get_ahg().get_active_variable_snapshots()}
+    assert active_names == {frozenset({"a", "b", "c"}), frozenset({"d"})}
+
+
+def test_post_run_cell_update_in_place_modification(enable_dirty_tracking, enable_always_migrate):
+    """
+        In-place modifications are detected both for variables tracked by dict watchers and for other variables.
+    """
+    planner = CheckpointRestorePlanner(Namespace({}))
+    planner_manager = PlannerManager(planner)
+    inner = {"b": 1}
+    planner_manager.run_cell({"x": {"a": inner}, "y": [1], "z": (1, "s")}, "x, y, z = ...")
+
+    planner.pre_run_cell_update()
+    inner["b"] = 2
+    changed_vars = planner.post_run_cell_update("x['a']['b'] = 2", 1.0)
+    assert changed_vars.modified_vars_value == {"x"}
+
+    planner.pre_run_cell_update()
+    planner._user_ns["y"].append(2)
+    changed_vars = planner.post_run_cell_update("y.append(2)", 1.0)
+    assert changed_vars.modified_vars_value == {"y"}
+
+    changed_vars = planner_manager.run_cell({}, "print(x)")
+    assert changed_vars.modified_vars_structure == set()
+
+
+def test_post_run_cell_update_metrics(enable_always_migrate):
+    """
+        The time spent in each phase of a cell is recorded once the cell is finished.
+    """
+    planner = CheckpointRestorePlanner(Namespace({}))
+    planner_manager = PlannerManager(planner)
+    planner_manager.run_cell({"x": [1, 2]}, "x = [1, 2]")
+    planner_manager.run_cell({}, "x.append(3)")
+    cell = planner.get_metrics().end_cell(2)
+
+    assert cell is not None
+    assert cell.execution_count == 2
+    for phase in [PRE_RUN, HASH, COMPARE, LINKED_VAR]:
+        assert cell.phase_ns[phase] > 0
+    assert [cell.execution_count for cell in planner.get_metrics().cells()] == [None, 2]
+
+
+def test_lazy_variables_are_tracked_once_loaded(enable_always_migrate):
+    """
+        Lazily restored variables are not loaded to compute their ID graphs. Once a cell loads them, they have no ID
+        graph to compare against, so they are considered modified.
+    """
+    loads = []
+
+    @functools.lru_cache(maxsize=None)
+    def load_snapshot():
+        loads.append(1)
+        return {"x": [1], "y": [2]}
+
+    user_ns = Namespace({"x": LazyVariable("x", load_snapshot), "y": LazyVariable("y", load_snapshot), "z": [3],
+                         "In": ["x, y, z = ..."]})
+    planner = CheckpointRestorePlanner.from_existing(user_ns)
+    planner.pre_run_cell_update()
+    assert loads == []
+    assert set(planner.get_id_graph_map().keys()) == {"z"}
+
+    # Loading x also loads y, from the same snapshot.
+    assert user_ns.get_tracked_namespace()["x"] == [1]
+    changed_vars = planner.post_run_cell_update("print(x)", 1.0)
+    assert loads == [1]
+    assert changed_vars.modified_vars_structure == {"x", "y"}
+    assert set(planner.get_id_graph_map().keys()) == {"x", "y", "z"}
+
+    assert PlannerManager(planner).run_cell({}, "print(x)").modified_vars_structure == set()
+
+
+def test_unhashed_arrays_are_hashed_at_checkpoint(enable_sampled_hashing_without_budget):
+    """
+        Arrays left unhashed because the budget ran out are considered modified until they are hashed at checkpoint time.
+    """
+    planner = CheckpointRestorePlanner(Namespace({}))
+    planner_manager = PlannerManager(planner)
+    planner_manager.run_cell({"x": numpy.zeros(1024 * 1024)}, "x = np.zeros(1024 * 1024)")
+    assert planner_manager.run_cell({}, "print(x)").modified_vars_structure == {"x"}
+
+    # Done first when generating checkpoint plans.
+    planner._hash_unhashed_vars()
+    assert isinstance(planner.get_id_graph_map()["x"].children[0], int)
+
+
+def test_unwatched_arrays_are_hashed_in_full_at_checkpoint(enable_sampled_hashing_with_small_pages):
+    """
+        Without the dirty page watcher, writes between the sample pages of arrays are found by hashing them in full at
+        checkpoint time, and recorded as modified by the last cell.
+    """
+    with patch("kishu.planning.sampled_hash.VisitorModule.page_watcher_available", return_value=False):
+        planner = CheckpointRestorePlanner(Namespace({}))
+        planner_manager = PlannerManager(planner)
+        x = numpy.zeros(1024 * 1024)
+        planner_manager.run_cell({"x": x}, "x = np.zeros(1024 * 1024)")
+
+        # Done first when generating checkpoint plans.
+        planner._hash_unwatched_vars_in_full()
+        version = planner.get_ahg().get_active_variable_snapshots_dict()[frozenset("x")].version
+
+        planner_manager.run_cell({}, "print(x)")
+        planner._hash_unwatched_vars_in_full()
+        assert planner.get_ahg().get_active_variable_snapshots_dict()[frozenset("x")].version == version
+
+        # The 11th page is between the first two of the 4 sample pages.
+        planner.pre_run_cell_update()
+        x[4096 // x.itemsize * 10] = 1
+        planner.post_run_cell_update("x[5120] = 1", 1.0)
+        planner._hash_unwatched_vars_in_full()
+        x_vs = planner.get_ahg().get_active_variable_snapshots_dict()[frozenset("x")]
+        assert x_vs.version != version
+        assert x_vs.output_ce is planner.get_ahg().get_cell_executions()[-1]
+
+
 def test_checkpoint_restore_planner_incremental_store_simple(enable_incremental_store, enable_always_migrate):
     """
         Test incremental store.
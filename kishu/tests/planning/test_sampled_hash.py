@@ -0,0 +1,86 @@
+import numpy
+import scipy.sparse
+import xxhash
+
+from unittest.mock import patch
+
+from kishu.planning.idgraph import get_object_state
+from kishu.planning.sampled_hash import ArrayHasher
+
+
+def full_hash(array: numpy.ndarray) -> int:
+    h = xxhash.xxh3_128()
+    h.update(numpy.ascontiguousarray(array.data))
+    return h.intdigest()
+
+
+def test_arrays_are_hashed_in_full_by_default():
+    array = numpy.arange(1024 * 1024)
+    assert ArrayHasher().hash_array(array) == full_hash(array)
+
+    # Arrays smaller than the threshold are hashed in full in sampled mode too.
+    hasher = ArrayHasher(sampled=True, threshold=array.nbytes + 1)
+    assert hasher.hash_array(array) == full_hash(array)
+
+
+def test_sampled_hash():
+    hasher = ArrayHasher(sampled=True, threshold=4096, page_size=4096, sample_pages=4)
+    array = numpy.zeros(1024 * 1024)
+    hasher.begin_cell()
+    digest = hasher.hash_array(array)
+    hasher.end_pass()
+
+    hasher.begin_cell()
+    assert digest is not None
+    assert hasher.hash_array(array) == digest
+    assert not hasher.take_incomplete()
+
+    # The first element is on the first sample page.
+    array[0] = 1
+    assert hasher.hash_array(array) != digest
+
+
+def test_budget_runs_out():
+    """
+        Large arrays are left unhashed once the budget of the cell ran out, unless hashing without a budget.
+    """
+    hasher = ArrayHasher(sampled=True, budget_ms=0, threshold=4096)
+    array = numpy.zeros(1024 * 1024)
+    hasher.begin_cell()
+    assert hasher.hash_array(array) is None
+    assert hasher.take_incomplete()
+    assert not hasher.take_incomplete()
+
+    with hasher.unbounded():
+        assert hasher.hash_array(array) is not None
+    assert not hasher.take_incomplete()
+    assert hasher.hash_array(array) is None
+
+
+def test_unwatched_arrays():
+    """
+        Arrays sampled without the dirty page watcher are reported, to be hashed in full at checkpoint time.
+    """
+    hasher = ArrayHasher(sampled=True, threshold=4096, page_size=4096, sample_pages=4)
+    array = numpy.zeros(1024 * 1024)
+    with patch("kishu.planning.sampled_hash.VisitorModule.page_watcher_available", return_value=False):
+        hasher.begin_cell()
+        digest = hasher.hash_array(array)
+        assert hasher.take_unwatched()
+        assert not hasher.take_unwatched()
+
+        with hasher.full():
+            assert hasher.hash_array(array) == full_hash(array)
+        assert not hasher.take_unwatched()
+        assert hasher.hash_array(array) == digest
+
+
+def test_sampled_hash_csr_matrix():
+    """
+        Sparse matrices are hashed from their data in sampled mode too, instead of being traversed as objects.
+    """
+    matrix = scipy.sparse.csr_matrix(numpy.ones((1024, 1024)))
+    hasher = ArrayHasher(sampled=True, threshold=4096)
+    node = get_object_state(matrix, {}, array_hasher=hasher)
+    assert node.obj_type == scipy.sparse.csr_matrix
+    assert node.children == [hasher.hash_array(matrix.data), "/EOC"]
@@ -1,6 +1,19 @@
+import pickle
+import os
+import pytest
+import random
 import sqlite3
+import threading
 
-from kishu.storage.checkpoint import CHECKPOINT_TABLE, KishuCheckpoint, VARIABLE_SNAPSHOT_TABLE
+from unittest.mock import patch
+
+from kishu.jupyter.namespace import Namespace
+from kishu.planning.ahg import VariableSnapshot, VersionedName
+from kishu.storage.checkpoint import BLOB_CHUNK_SIZE, CHECKPOINT_TABLE, CheckpointWriter, ConnectionPool, \
+    KishuCheckpoint, VARIABLE_SNAPSHOT_TABLE
+from kishu.storage.chunk_store import CHUNK_TABLE
+from kishu.storage.config import Config
+from kishu.storage.segment import OUT_OF_BAND_MIN_SIZE
 from kishu.storage.path import KishuPath
 
 
@@ -18,3 +31,219 @@ def test_create_table():
     # The namespace table should exist.
     cur.execute(f"SELECT count(*) FROM sqlite_master WHERE type='table' AND name='{VARIABLE_SNAPSHOT_TABLE}';")
     assert cur.fetchone()[0] == 1
+
+
+def test_store_variable_snapshots():
+    filename = KishuPath.database_path("test")
+    kishu_checkpoint = KishuCheckpoint(filename)
+    kishu_checkpoint.init_database()
+
+    user_ns = Namespace({"a": b"x" * (3 * BLOB_CHUNK_SIZE // 2), "b": [1, 2], "lock": threading.Lock()})
+    vses = [VariableSnapshot(frozenset({name}), 1, False) for name in ["a", "b", "lock"]]
+    kishu_checkpoint.store_variable_snapshots("1:1", vses, user_ns)
+
+    # The unpicklable lock is skipped; the others are written across blob chunks.
+    stored = kishu_checkpoint.get_stored_versioned_names(["1:1"])
+    assert set(stored.keys()) == {VersionedName(frozenset({"a"}), 1), VersionedName(frozenset({"b"}), 1)}
+
+    data = kishu_checkpoint.get_variable_snapshots(list(stored.items()))
+    assert sorted((pickle.loads(i) for i in data), key=list) == [{"a": user_ns["a"]}, {"b": [1, 2]}]
+
+    # At the default bandwidth, snapshots are stored uncompressed, in chunks with 2-byte codec frame headers.
+    for size, pickled in zip(sorted(context.size for context in stored.values()), sorted(len(i) for i in data)):
+        assert 0 <= size - pickled <= 2 * (pickled // (128 * 1024) + 1)
+
+    # Snapshots are written with a persistent connection in WAL mode.
+    con = sqlite3.connect(filename)
+    assert con.execute("pragma journal_mode").fetchone()[0] == "wal"
+
+
+def test_chunked_store_deduplicates():
+    filename = KishuPath.database_path("test")
+    kishu_checkpoint = KishuCheckpoint(filename)
+    kishu_checkpoint.init_database()
+    con = sqlite3.connect(filename)
+
+    # Two versions of a large variable, differing in a few bytes at the end.
+    payload = random.Random(0).randbytes(4 * 1024 * 1024)
+    vs1 = VariableSnapshot(frozenset({"a"}), 1, False)
+    kishu_checkpoint.store_variable_snapshots("1:1", [vs1], Namespace({"a": payload}))
+    chunks_after_first = con.execute(f"select count(*) from {CHUNK_TABLE}").fetchone()[0]
+    assert chunks_after_first > 1
+
+    vs2 = VariableSnapshot(frozenset({"a"}), 2, False)
+    kishu_checkpoint.store_variable_snapshots("1:2", [vs2], Namespace({"a": payload + b"edit"}))
+    chunks_after_second = con.execute(f"select count(*) from {CHUNK_TABLE}").fetchone()[0]
+
+    # Only the chunks around the edit are stored again.
+    assert chunks_after_second < 2 * chunks_after_first
+    stored = kishu_checkpoint.get_stored_versioned_names(["1:2"])
+    assert pickle.loads(kishu_checkpoint.get_variable_snapshots(list(stored.items()))[0]) == {"a": payload + b"edit"}
+
+    # Deleting the first commit only reclaims the chunks the second doesn't share.
+    kishu_checkpoint.delete_variable_snapshots(["1:1"])
+    assert 0 < kishu_checkpoint.collect_garbage() < chunks_after_first
+    assert pickle.loads(kishu_checkpoint.get_variable_snapshots(list(stored.items()))[0]) == {"a": payload + b"edit"}
+
+    kishu_checkpoint.delete_variable_snapshots(["1:2"])
+    kishu_checkpoint.collect_garbage()
+    assert con.execute(f"select count(*) from {CHUNK_TABLE}").fetchone()[0] == 0
+
+
+def test_snapshots_written_in_one_transaction():
+    filename = KishuPath.database_path("test")
+    kishu_checkpoint = KishuCheckpoint(filename)
+    kishu_checkpoint.init_database()
+
+    user_ns = Namespace({"a": [1, 2], "b": {"x": 1}})
+    vses = [VariableSnapshot(frozenset({name}), 1, False) for name in ["a", "b"]]
+    captured = kishu_checkpoint.capture_variable_snapshots("1:1", vses, user_ns)
+
+    # Failing to write the commit rolls back the snapshots already written.
+    captured[1][1].close()
+    with pytest.raises(ValueError):
+        kishu_checkpoint.write_variable_snapshots("1:1", captured)
+    assert kishu_checkpoint.get_stored_versioned_names(["1:1"]) == {}
+
+
+def test_pooled_connection_left_in_transaction():
+    filename = KishuPath.database_path("test")
+    kishu_checkpoint = KishuCheckpoint(filename)
+    kishu_checkpoint.init_database()
+
+    # A caller failing before its commit leaves a transaction open on the pooled connection.
+    con = ConnectionPool.get(filename)
+    con.execute(f"insert into {CHECKPOINT_TABLE} values (?, ?)", ("0:0", b""))
+    assert con.in_transaction
+
+    # It is rolled back instead of being joined, or failing, by the next caller.
+    kishu_checkpoint.store_variable_snapshots("1:1", [VariableSnapshot(frozenset({"a"}), 1, False)],
+                                              Namespace({"a": [1, 2]}))
+    stored = kishu_checkpoint.get_stored_versioned_names(["1:1"])
+    assert list(stored) == [VersionedName(frozenset({"a"}), 1)]
+    assert sqlite3.connect(filename).execute(f"select count(*) from {CHECKPOINT_TABLE}").fetchone()[0] == 0
+
+
+def test_connections_of_finished_threads_closed():
+    filename = KishuPath.database_path("test")
+    connections = []
+    thread = threading.Thread(target=lambda: connections.append(ConnectionPool.get(filename)))
+    thread.start()
+    thread.join()
+
+    # Opening a connection closes the one of the finished thread.
+    ConnectionPool.get(filename)
+    with pytest.raises(sqlite3.ProgrammingError, match="closed database"):
+        connections[0].execute("select 1")
+
+
+def test_unchunked_store():
+    Config.set('PLANNER', 'chunked_store', False)
+    filename = KishuPath.database_path("test")
+    kishu_checkpoint = KishuCheckpoint(filename)
+    kishu_checkpoint.init_database()
+
+    kishu_checkpoint.store_variable_snapshots("1:1", [VariableSnapshot(frozenset({"b"}), 1, False)],
+                                              Namespace({"b": [1, 2]}))
+
+    # The pickle is stored in the snapshot row itself.
+    con = sqlite3.connect(filename)
+    assert con.execute(f"select count(*) from {CHUNK_TABLE}").fetchone()[0] == 0
+    assert pickle.loads(con.execute(f"select data from {VARIABLE_SNAPSHOT_TABLE}").fetchone()[0]) == {"b": [1, 2]}
+
+
+def test_checkpoint_writer():
+    filename = KishuPath.database_path("test")
+    kishu_checkpoint = KishuCheckpoint(filename)
+    kishu_checkpoint.init_database()
+    written = CheckpointWriter.metrics().written
+
+    user_ns = Namespace({"a": [1, 2], "b": {"x": 1}})
+    vses = [VariableSnapshot(frozenset({name}), 1, False) for name in ["a", "b"]]
+    CheckpointWriter.submit(filename, "1:1", kishu_checkpoint.capture_variable_snapshots("1:1", vses, user_ns))
+
+    # Modifying a variable after submitting doesn't change its captured snapshot.
+    user_ns["a"].append(3)
+
+    # Reads wait for the submitted commit to be written.
+    stored = kishu_checkpoint.get_stored_versioned_names(["1:1"])
+    data = kishu_checkpoint.get_variable_snapshots(list(stored.items()))
+    assert sorted((pickle.loads(i) for i in data), key=list) == [{"a": [1, 2]}, {"b": {"x": 1}}]
+
+    metrics = CheckpointWriter.metrics()
+    assert metrics.queue_depth == 0
+    assert metrics.written == written + 1
+
+
+def test_checkpoint_writer_failure():
+    filename = KishuPath.database_path("test")
+    kishu_checkpoint = KishuCheckpoint(filename)
+    kishu_checkpoint.init_database()
+    failed = CheckpointWriter.metrics().failed
+
+    user_ns = Namespace({"a": pickle.PickleBuffer(bytearray(2 * OUT_OF_BAND_MIN_SIZE))})
+    captured = kishu_checkpoint.capture_variable_snapshots("1:1", [VariableSnapshot(frozenset({"a"}), 1, False)],
+                                                           user_ns)
+    segment = captured[0][2]
+    assert segment is not None and os.path.exists(segment)
+
+    # The failure of the transaction is reported once by flush, and kept in the metrics.
+    with patch("kishu.storage.checkpoint.os.path.getsize", side_effect=OSError("disk failure")):
+        CheckpointWriter.submit(filename, "1:1", captured)
+        assert isinstance(CheckpointWriter.flush(), OSError)
+    assert CheckpointWriter.flush() is None
+    metrics = CheckpointWriter.metrics()
+    assert metrics.failed == failed + 1
+    assert "disk failure" in metrics.last_error
+
+    # Nothing of the commit is left behind.
+    assert kishu_checkpoint.get_stored_versioned_names(["1:1"]) == {}
+    assert not os.path.exists(segment)
+
+
+def test_out_of_band_buffers():
+    filename = KishuPath.database_path("test")
+    kishu_checkpoint = KishuCheckpoint(filename)
+    kishu_checkpoint.init_database()
+
+    # Large buffers (e.g., of numpy arrays) are pickled out-of-band into a segment file.
+    payload = bytearray(random.Random(0).randbytes(2 * OUT_OF_BAND_MIN_SIZE))
+    user_ns = Namespace({"a": pickle.PickleBuffer(payload), "b": [1, 2]})
+    vs = VariableSnapshot(frozenset({"a", "b"}), 1, False)
+    kishu_checkpoint.store_variable_snapshots("1:1", [vs], user_ns)
+
+    stored = kishu_checkpoint.get_stored_versioned_names(["1:1"])
+    data = kishu_checkpoint.get_variable_snapshots(list(stored.items()))[0]
+    assert len(data) < OUT_OF_BAND_MIN_SIZE
+
+    # They are restored as copy-on-write views of the mapped segment file.
+    restored = kishu_checkpoint.loads_variable_snapshot(data)
+    assert restored["b"] == [1, 2]
+    assert isinstance(restored["a"], memoryview) and restored["a"] == payload
+    restored["a"][0] ^= 0xFF
+    assert kishu_checkpoint.loads_variable_snapshot(data)["a"] == payload
+
+    # Segment files are deleted with their commits.
+    kishu_checkpoint.delete_variable_snapshots(["1:1"])
+    assert os.listdir(kishu_checkpoint.segment_directory()) == []
+
+
+def test_compressed_snapshots():
+    # Compression pays off at a low bandwidth.
+    Config.set('OPTIMIZER', 'network_bandwidth', 1_000_000)
+    filename = KishuPath.database_path("test")
+    kishu_checkpoint = KishuCheckpoint(filename)
+    kishu_checkpoint.init_database()
+
+    user_ns = Namespace({"a": list(range(1000)) * 100})
+    vs = VariableSnapshot(frozenset({"a"}), 1, False)
+    assert kishu_checkpoint.compression_ratio(vs.name) == 1.0
+    kishu_checkpoint.store_variable_snapshots("1:1", [vs], user_ns)
+
+    stored = kishu_checkpoint.get_stored_versioned_names(["1:1"])
+    data = kishu_checkpoint.get_variable_snapshots(list(stored.items()))
+    assert pickle.loads(data[0]) == {"a": list(range(1000)) * 100}
+
+    # The stored size is the compressed size, which the optimizer uses through the compression ratio.
+    assert stored[VersionedName(vs.name, 1)].size < len(data[0]) / 2
+    assert kishu_checkpoint.compression_ratio(vs.name) == stored[VersionedName(vs.name, 1)].size / len(data[0])
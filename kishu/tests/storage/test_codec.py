@@ -0,0 +1,36 @@
+import pytest
+import random
+import struct
+
+from kishu.storage.codec import NO_COMPRESSION, CodecChoice, codec_by_name, decode, select_codec, shuffle, unshuffle
+
+
+@pytest.mark.parametrize("itemsize", [1, 4, 8])
+def test_shuffle_round_trip(itemsize):
+    data = random.Random(0).randbytes(1001)
+    assert unshuffle(shuffle(data, itemsize), itemsize) == data
+
+
+def test_frame_round_trip():
+    data = b"kishu" * 1000
+    for choice in [NO_COMPRESSION, CodecChoice(codec_by_name("zlib"), 1), CodecChoice(codec_by_name("zlib"), 1, 8)]:
+        frame = choice.encode(data)
+        assert decode(frame) == data
+
+
+def test_select_codec():
+    # Slowly increasing 8-byte integers, which the shuffle filter makes more compressible.
+    numbers = struct.pack("<100000q", *range(0, 300000, 3))
+
+    # Compression doesn't pay off at a high bandwidth, nor for incompressible data.
+    assert select_codec(numbers, 10_000_000_000) == NO_COMPRESSION
+    assert select_codec(random.Random(0).randbytes(100000), 1_000_000) == NO_COMPRESSION
+
+    choice = select_codec(numbers, 1_000_000)
+    assert choice != NO_COMPRESSION
+    assert len(choice.encode(numbers)) < len(numbers) / 4
+
+    # A configured codec is used regardless of the bandwidth.
+    assert select_codec(numbers, 10_000_000_000, "zlib").codec == codec_by_name("zlib")
+    with pytest.raises(ValueError):
+        select_codec(numbers, 1_000_000, "unknown")
@@ -0,0 +1,113 @@
+import pytest
+
+from unittest.mock import patch
+
+from kishu.storage.commit_graph import (
+    CommitGraphBlockTail,
+    CommitGraphStore,
+    CommitNode,
+    CommitNodeInfo,
+    KishuCommitGraph,
+)
+from kishu.storage.commit_index import INITIAL_TABLE_CAPACITY, NO_NODE, CommitIndex
+
+
+def test_find_and_ancestry(tmp_path):
+    index = CommitIndex(str(tmp_path))
+    assert not index.exists()
+    assert index.find("1") == NO_NODE
+
+    assert index.insert("1", "") == 0
+    assert index.insert("2", "1") == 1
+    assert index.insert("3", "missing") == 2
+    assert index.find("2") == 1
+    assert index.node(1) == ("2", "1", 0)
+    assert index.node(2) == ("3", "missing", NO_NODE)
+    assert list(index.iter_ancestry(1)) == [1, 0]
+
+    # IDs are interned: the parent ID of "2" is the ID of "1".
+    assert (tmp_path / "commit_index.ids").read_bytes() == b"123missing"
+
+
+def test_table_grows(tmp_path):
+    index = CommitIndex(str(tmp_path))
+    num_commits = 2 * INITIAL_TABLE_CAPACITY
+    parent_id = ""
+    for idx in range(num_commits):
+        index.insert(str(idx), parent_id)
+        parent_id = str(idx)
+    index.close()
+
+    index = CommitIndex(str(tmp_path))
+    assert all(index.find(str(idx)) == idx for idx in range(num_commits))
+    assert len(list(index.iter_ancestry(index.find(str(num_commits - 1))))) == num_commits
+
+
+def test_readers_see_new_commits(tmp_path):
+    writer = CommitIndex(str(tmp_path))
+    reader = CommitIndex(str(tmp_path))
+    writer.insert("1", "")
+    assert reader.find("1") == 0
+    writer.insert("2", "1")
+    assert reader.find("2") == 1
+    assert reader.node(1) == ("2", "1", 0)
+
+
+def test_unindexed_nodes(tmp_path):
+    """
+        Nodes appended without their table slot, e.g., by an interrupted writer, are found and indexed later.
+    """
+    index = CommitIndex(str(tmp_path))
+    index.insert("1", "")
+    index._index = lambda index, encoded: None  # type: ignore
+    index.insert("2", "1")
+
+    index = CommitIndex(str(tmp_path))
+    assert index.find("2") == 1
+    index.insert("3", "2")
+    assert index._table_header()[2] == 3
+    assert list(index.iter_ancestry(index.find("3"))) == [2, 1, 0]
+
+
+def _write_blocks(tmp_path):
+    # Graph stored in a tail block by earlier versions, children before their parents.
+    tail = CommitGraphBlockTail(str(tmp_path))
+    for info in [CommitNodeInfo("3", "2"), CommitNodeInfo("2", "1"), CommitNodeInfo("1", "")]:
+        tail.insert(CommitNode(info))
+    store = CommitGraphStore(str(tmp_path))
+    store._tail_block = tail
+    store._sorted_blocks = []
+    with open(store._meta_path(), "w") as f:
+        f.write('{"sorted_blocks": [], "tail_block": {"size": 3}}')
+    for name in ["commit_index.ids", "commit_index.nodes", "commit_index.table"]:
+        (tmp_path / name).unlink(missing_ok=True)
+
+
+def test_import_blocks(tmp_path):
+    _write_blocks(tmp_path)
+
+    graph = KishuCommitGraph.new_on_file(str(tmp_path))
+    assert graph.list_history("3") == [
+        CommitNodeInfo("3", "2"),
+        CommitNodeInfo("2", "1"),
+        CommitNodeInfo("1", "")
+    ]
+
+
+def test_interrupted_import(tmp_path):
+    _write_blocks(tmp_path)
+
+    # The first open is interrupted after importing a node.
+    insert = CommitIndex.insert
+
+    def interrupted_insert(index, commit_id, parent_id):
+        if index.size() > 0:
+            raise KeyboardInterrupt()
+        return insert(index, commit_id, parent_id)
+
+    with patch.object(CommitIndex, "insert", interrupted_insert), pytest.raises(KeyboardInterrupt):
+        KishuCommitGraph.new_on_file(str(tmp_path))
+
+    # The partial index is not used, the blocks are imported again.
+    graph = KishuCommitGraph.new_on_file(str(tmp_path))
+    assert [info.commit_id for info in graph.list_history("3")] == ["3", "2", "1"]
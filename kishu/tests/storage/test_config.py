@@ -34,6 +34,11 @@ def test_set_and_get_new_fields(tmp_path_config):
     Config.set('PLANNER', 'int_field', 42)
     assert Config.get('PLANNER', 'int_field', 0) == 42
 
+    # Test with bool.
+    assert 'bool_field' not in Config.config['PLANNER']
+    Config.set('PLANNER', 'bool_field', False)
+    assert Config.get('PLANNER', 'bool_field', True) is False
+
 
 def test_set_and_get_update_fields(tmp_path_config):
     assert 'PROFILER' in Config.config
@@ -1,4 +1,7 @@
+import c_idgraph
 import json
+import pandas as pd
+import pytest
 
 from lib.idgraph import IDGraph
 
@@ -84,6 +87,22 @@ def test_IDGraph_list():
     assert not idGraph1.compare(idGraph3)
 
 
+def test_IDGraph_snapshot_outlives_elements():
+    """
+        Test if the id graph keeps its values after the referenced elements are released
+    """
+    list1 = ["".join(["DA", "IS"]), "".join(["ELAS", "TIC"])]
+    idGraph1 = IDGraph(list1)
+    expected_json = idGraph1.get_json()
+
+    # Drop the only references to the original strings
+    list1[0] = "UIUC"
+    list1[1] = "UIUC"
+
+    assert expected_json == idGraph1.get_json()
+    assert not idGraph1.compare(IDGraph(list1))
+
+
 def test_compare_lists():
     """
         Test if two lists (different objects) are accurately compared
@@ -109,6 +128,118 @@ def test_compare_lists():
     assert not idgraph1.compare(idgraph3)
 
 
+def test_compare_many():
+    """
+        Test if pairs of IDGraphs are accurately compared in one batch
+    """
+    list1 = [1, 2, 3]
+    list2 = [1, 2, 3]
+
+    idgraph1 = IDGraph(list1)
+    idgraph2 = IDGraph(list1)
+    idgraph3 = IDGraph(list2)
+
+    assert IDGraph.compare_many([(idgraph1, idgraph2), (idgraph1, idgraph3)]) == [True, False]
+    assert IDGraph.compare_many([]) == []
+
+    # Pairs which are not 2-tuples of capsules are rejected.
+    capsule1 = c_idgraph.get_idgraph(list1)
+    capsule2 = c_idgraph.get_idgraph(list2)
+    with pytest.raises(TypeError):
+        c_idgraph.compare_graphs([[capsule1, capsule2]])
+    with pytest.raises(TypeError):
+        c_idgraph.compare_graphs([(capsule1,)])
+
+
+def test_compare_object():
+    """
+        Test if an IDGraph is accurately compared with the current state of an object
+    """
+    list1 = [1, "UIUC", {"a": [2.5, True]}]
+    list1.append(list1)
+    idgraph1 = IDGraph(list1)
+    idgraph2 = IDGraph.from_bytes(idgraph1.to_bytes())
+
+    assert idgraph1.compare_object(list1)
+    assert idgraph2.compare_object(list1)
+
+    list1[2]["a"][0] = 3.5
+    assert not idgraph1.compare_object(list1)
+    assert not idgraph2.compare_object(list1)
+
+    list1[2]["a"][0] = 2.5
+    assert idgraph1.compare_object(list1)
+    list1.append(4)
+    assert not idgraph1.compare_object(list1)
+    assert not idgraph1.compare_object([1, "UIUC", {"a": [2.5, True]}])
+
+
+def test_update_reuses_unchanged_graph():
+    """
+        Test if updating an IDGraph keeps the snapshot of an unchanged object
+    """
+    list1 = [1, 2, [3]]
+    idgraph1 = IDGraph(list1)
+    data = idgraph1.to_bytes()
+
+    assert not idgraph1.update(list1)
+    assert idgraph1.to_bytes() == data
+
+    list1[2].append(4)
+    assert idgraph1.update(list1)
+    assert idgraph1.compare(IDGraph(list1))
+    assert not idgraph1.update(list1)
+
+
+def test_native_stats():
+    """
+        Test if building and comparing IDGraphs is counted and timed
+    """
+    c_idgraph.reset_stats()
+    obj = [1, [2, 3], {"a": 4}]
+    graph = IDGraph(obj)
+    assert graph.compare(IDGraph(obj))
+    assert graph.compare_object(obj)
+
+    stats = c_idgraph.get_stats()
+    assert stats["objects_visited"] == 3 * 8  # 8 nodes per traversal
+    assert stats["visited_probes"] > 0
+    assert stats["allocations"] > 0
+    assert stats["traverse_calls"] == 2
+    assert stats["compare_calls"] == 2 and stats["compare_ns"] > 0
+    assert stats["pickles"] == 0
+
+    c_idgraph.reset_stats()
+    assert set(c_idgraph.get_stats().values()) == {0}
+
+
+def test_binary_round_trip():
+    """
+        Test if an IDGraph rebuilt from its binary encoding compares equal and renders the same JSON
+    """
+    list1 = [1, -2, 3.5, True, "UIUC", ("DAIS", -(2**40))]
+    dict1 = {"a": list1, "b": {4, 5}}
+    list1.append(dict1)
+
+    idgraph1 = IDGraph(dict1)
+    data = idgraph1.to_bytes()
+    idgraph2 = IDGraph.from_bytes(data)
+
+    assert len(data) < len(idgraph1.get_json())
+    assert idgraph1.compare(idgraph2)
+    assert idgraph2.compare(idgraph1)
+    assert idgraph2.get_obj_id() == idgraph1.get_obj_id()
+    assert json.loads(idgraph2.get_json()) == json.loads(idgraph1.get_json())
+    assert idgraph2.to_bytes() == data
+
+    list1[0] = 10
+    assert not IDGraph(dict1).compare(idgraph2)
+
+    for malformed in [b"", b"KIDG", data[:-1], data + b"\x00"]:
+        with pytest.raises(ValueError):
+            IDGraph.from_bytes(malformed)
+
+
 def test_IDGraph_tuple():
     """
         Test if idgraph (json rep) is accurately generated for a Tuple
@@ -146,6 +277,16 @@ def test_IDGraph_tuple():
     assert idGraph1.compare(idGraph2)
 
 
+def test_IDGraph_large_float():
+    """
+        Test if the json rep of large floats holds all of their digits
+    """
+    tuple1 = (1e300, -1.7976931348623157e308)
+
+    idGraph1_json = json.loads(IDGraph(tuple1).get_json())
+    assert [child["obj_val"] for child in idGraph1_json["children"]] == ["%f" % -1.7976931348623157e308, "%f" % 1e300]
+
+
 def test_IDGraph_set():
     """
         Test if idgraph (json rep) is accurately generated for a set
@@ -282,6 +423,47 @@ def test_IDGraph_class_instance():
     assert idGraph1.compare(idGraph2)
 
 
+def test_IDGraph_pandas_dataframe():
+    """
+        Test if idgraph detects changes to the blocks, index and columns of a dataframe
+    """
+    df = pd.DataFrame({"a": [1, 2, 3], "b": [1.5, 2.5, 3.5], "c": ["x", "y", "z"]})
+    idGraph1 = IDGraph(df)
+    # Assert that the id graph does not change when the object remains unchanged
+    assert idGraph1.compare(IDGraph(df))
+
+    df.at[1, "b"] = 0.0
+    assert not idGraph1.compare(IDGraph(df))
+
+    idGraph2 = IDGraph(df)
+    df.at[1, "c"] = "w"
+    assert not idGraph2.compare(IDGraph(df))
+
+    idGraph3 = IDGraph(df)
+    df.columns = ["d", "e", "f"]
+    assert not idGraph3.compare(IDGraph(df))
+
+    idGraph4 = IDGraph(df)
+    df.index = [4, 5, 6]
+    assert not idGraph4.compare(IDGraph(df))
+
+
+def test_IDGraph_pandas_series():
+    """
+        Test if idgraph detects changes to the data and name of a series
+    """
+    series = pd.Series([1, 2, 3], name="foo")
+    idGraph1 = IDGraph(series)
+    assert idGraph1.compare(IDGraph(series))
+
+    series.iloc[0] = 4
+    assert not idGraph1.compare(IDGraph(series))
+
+    idGraph2 = IDGraph(series)
+    series.name = "bar"
+    assert not idGraph2.compare(IDGraph(series))
+
+
 # (2) These tests verify id graph generation for NESTED objects.
 
 
@@ -352,6 +534,50 @@ def test_create_idgraph_change_in_nested_dictionary():
     assert idGraph1.compare(idGraph2)
 
 
+def test_compare_nested_list_moved_element():
+    """
+        Test if moving an element between nested lists is detected, although
+        the graphs contain the same objects
+    """
+    set1 = {"UIUC"}
+    list1 = [set1]
+    list2 = []
+    list3 = [list1, list2]
+
+    idGraph1 = IDGraph(list3)
+
+    list2.append(list1.pop())
+    idGraph2 = IDGraph(list3)
+
+    assert not idGraph1.compare(idGraph2)
+    assert idGraph2.compare(IDGraph(list3))
+
+
+def test_create_idgraph_deeply_nested_list():
+    """
+        Test if idgraph is generated for objects nested deeper than the C stack allows to recurse
+    """
+    list1 = []
+    inner = list1
+    for _ in range(200000):
+        inner.append([])
+        inner = inner[0]
+    inner.append({"a": (1, 2)})
+
+    idGraph1 = IDGraph(list1)
+    assert idGraph1.get_obj_id() == id(list1)
+    assert idGraph1.compare(IDGraph(list1))
+
+    # Too deep for json.loads, but rendered in full
+    json_rep = idGraph1.get_json()
+    assert json_rep.startswith('{"obj_id":%d,' % id(list1))
+    assert json_rep.count('"obj_type":"list"') == 200001
+    assert json_rep.endswith("]}" * 200001)
+
+    inner.append(3)
+    assert not idGraph1.compare(IDGraph(list1))
+
+
 # (3) These tests verify id graph generation for CYCLIC objects.
 
 